@@ -30,8 +30,11 @@
 #define NTA_ARRAY_ALGO_HPP
 
 #include <algorithm>
+#include <cstring>
 #include <iterator>
+#include <limits>
 #include <math.h>
+#include <vector>
 
 #if defined(NTA_OS_WINDOWS) && defined(NTA_COMPILER_MSVC)
 #include <array>
@@ -5624,6 +5627,183 @@ inline void partial_argsort(size_t k, InIter begin, InIter end, OutIter sorted,
         sorted[i] = buff[i].first;
 }
 
+//--------------------------------------------------------------------------------
+/**
+ * Top-k selection by radix select, an O(n) alternative to partial_argsort
+ * when k is not tiny.
+ *
+ * The values are converted to Real32 and mapped to unsigned keys that sort
+ * in the same order as the floats. The key of the k-th largest value is then
+ * found one radix digit at a time (11, 11 and 10 bits), with one histogram
+ * pass over the keys per digit. A last pass collects the winners, which are
+ * finally sorted, so the cost is O(n + k log k) instead of O(n log k).
+ *
+ * The result is the same as a stable selection with the following order:
+ * larger values first, and among equal values the smaller index first, or
+ * the larger index first if higherIndexFirst is true. Values below
+ * 'minimum' are never selected, so fewer than k indices are returned when
+ * there are not enough eligible values.
+ *
+ * The selector owns its scratch memory, which is reused from one call to the
+ * next. Unlike partial_argsort, it does not use a static buffer, so separate
+ * instances can be used concurrently.
+ *
+ * Usage:
+ *   TopKSelector selector;
+ *   std::vector<UInt32> winners(k);
+ *   size_t n = selector.select(k, scores.begin(), scores.end(),
+ *                              winners.begin());
+ */
+class TopKSelector
+{
+public:
+    typedef crucian::UInt32 size_type;
+
+    /**
+     * Allocates the scratch memory for selections among up to n values, so
+     * that select does not allocate afterwards.
+     */
+    inline void reserve(size_t n)
+    {
+        keys_.reserve(n);
+        histogram_.reserve(1u << 11);
+        selected_.reserve(n);
+    }
+
+    /**
+     * Writes to out the indices of the (at most) k largest values of
+     * [begin, end) that are >= minimum, ordered as described above.
+     * Returns the number of indices written.
+     */
+    template <typename InIter, typename OutIter>
+    inline size_t select(size_t k, InIter begin, InIter end, OutIter out,
+                         crucian::Real32 minimum =
+                             -std::numeric_limits<crucian::Real32>::max(),
+                         bool higherIndexFirst = false)
+    {
+        const size_type n = static_cast<size_type>(end - begin);
+        const crucian::UInt32 minKey = key_(minimum);
+
+        keys_.resize(n);
+        size_type numEligible = 0;
+        InIter it = begin;
+        for (size_type i = 0; i != n; ++i, ++it)
+        {
+            keys_[i] = key_(static_cast<crucian::Real32>(*it));
+            numEligible += keys_[i] >= minKey;
+        }
+
+        selected_.clear();
+        if (numEligible <= k)
+        {
+            for (size_type i = 0; i != n; ++i)
+                if (keys_[i] >= minKey)
+                    selected_.push_back(i);
+        }
+        else if (k > 0)
+        {
+            collect_(k, findPivot_(k, minKey), higherIndexFirst);
+        }
+
+        if (higherIndexFirst)
+        {
+            std::sort(selected_.begin(), selected_.end(),
+                      [this](size_type a, size_type b) {
+                          return keys_[a] > keys_[b] ||
+                                 (keys_[a] == keys_[b] && a > b);
+                      });
+        }
+        else
+        {
+            std::sort(selected_.begin(), selected_.end(),
+                      [this](size_type a, size_type b) {
+                          return keys_[a] > keys_[b] ||
+                                 (keys_[a] == keys_[b] && a < b);
+                      });
+        }
+
+        std::copy(selected_.begin(), selected_.end(), out);
+        return selected_.size();
+    }
+
+private:
+    // Maps a float to an unsigned key with the same order. -0 and +0 map to
+    // the same key since they compare equal.
+    static inline crucian::UInt32 key_(crucian::Real32 value)
+    {
+        if (value == 0)
+            value = 0;
+
+        crucian::UInt32 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+
+    // Returns the key of the k-th largest eligible key, 0 < k < numEligible.
+    inline crucian::UInt32 findPivot_(size_t k, crucian::UInt32 minKey)
+    {
+        static const int shifts[3] = {21, 10, 0};
+        static const crucian::UInt32 widths[3] = {11, 11, 10};
+
+        crucian::UInt32 prefix = 0, mask = 0;
+        size_t remaining = k;
+
+        for (int pass = 0; pass != 3; ++pass)
+        {
+            const crucian::UInt32 digitMask = (1u << widths[pass]) - 1;
+            histogram_.assign(digitMask + 1, 0);
+
+            for (size_type i = 0; i != keys_.size(); ++i)
+                if (keys_[i] >= minKey && (keys_[i] & mask) == prefix)
+                    ++histogram_[(keys_[i] >> shifts[pass]) & digitMask];
+
+            crucian::UInt32 digit = digitMask;
+            while (histogram_[digit] < remaining)
+                remaining -= histogram_[digit--];
+
+            prefix |= digit << shifts[pass];
+            mask |= digitMask << shifts[pass];
+        }
+
+        return prefix;
+    }
+
+    // Collects the keys above the pivot and as many keys equal to the pivot
+    // as needed to get k winners, taken in tie-breaking order.
+    inline void collect_(size_t k, crucian::UInt32 pivot,
+                         bool higherIndexFirst)
+    {
+        const size_type n = static_cast<size_type>(keys_.size());
+        for (size_type i = 0; i != n; ++i)
+            if (keys_[i] > pivot)
+                selected_.push_back(i);
+
+        size_t ties = k - selected_.size();
+        if (higherIndexFirst)
+        {
+            for (size_type i = n; ties != 0 && i != 0; --i)
+                if (keys_[i - 1] == pivot)
+                {
+                    selected_.push_back(i - 1);
+                    --ties;
+                }
+        }
+        else
+        {
+            for (size_type i = 0; ties != 0 && i != n; ++i)
+                if (keys_[i] == pivot)
+                {
+                    selected_.push_back(i);
+                    --ties;
+                }
+        }
+    }
+
+    std::vector<crucian::UInt32> keys_;
+    std::vector<size_t> histogram_;
+    std::vector<size_type> selected_;
+};
+
 //--------------------------------------------------------------------------------
 /**
  * Specialized partial argsort with selective random noise for breaking ties, to
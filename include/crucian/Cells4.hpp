@@ -25,12 +25,17 @@
 
 #include <cstring>
 #include <fstream>
+#include <memory>
 #include <ostream>
 #include <queue>
 #include <sstream>
+#include <vector>
 
+#include <crucian/Log.hpp>
 #include <crucian/OutSynapse.hpp>
+#include <crucian/OutSynapseStore.hpp>
 #include <crucian/Segment.hpp>
+#include <crucian/ThreadPool.hpp>
 #include <crucian/Types.hpp>
 
 //-----------------------------------------------------------------------
@@ -56,7 +61,9 @@
  *
  * Cells4 also maintains additional data structures for optimization
  * purposes. The OutSynapses maintain forward propagation data about
- * which Cell's project to which Cell's and Segments.
+ * which Cell's project to which Cell's and Segments, in an
+ * OutSynapseStore: one arena for all source cells, with a reverse index
+ * so that synapses are added and erased in constant time.
  *
  * The Cells4 class is used extensively by Python code. Most of the
  * methods are wrapped automatically by SWIG. Some additional methods
@@ -118,47 +125,38 @@ class SegmentUpdate;
  * If an array is not so sparse, this selective zeroing may be
  * slower than a full memset().  We arbitrarily choose a threshold
  * of 6.25%, past which we use memset() instead of selective
- * zeroing.
+ * zeroing.  Only that many nonzero elements are ever tracked: once
+ * past the threshold the list is useless, so it never takes more
+ * than a sixteenth of the counters.
+ *
+ * The tables are sized from the number of cells and the number of
+ * segments per cell, rounded up to a power of 2 for efficient
+ * indexing.  The segment stride grows, keeping the counts, when a
+ * cell gets more segments than it, see reserveSegments.
+ *
+ * Threads may increment disjoint cell ranges at once with the
+ * untracked variants, which collect the counters that become
+ * nonzero in per-thread lists, handed to track afterwards.
  */
-const UInt _MAX_CELLS = 1u << 18u; // power of 2 allows efficient array indexing
-const UInt _MAX_SEGS = 1u << 7u;   // power of 2 allows efficient array indexing
 typedef unsigned char UChar;     // custom type, since NTA_Byte = Byte is signed
 
 template <typename It> class CBasicActivity
 {
 public:
-    CBasicActivity()
-    {
-        _counter = nullptr;
-        _nonzero = nullptr;
-        _size = 0;
-        _dimension = 0;
-    }
-    ~CBasicActivity()
-    {
-        if (_counter != nullptr)
-            delete[] _counter;
-        if (_nonzero != nullptr)
-            delete[] _nonzero;
-    }
+    CBasicActivity() : _size(0), _dimension(0) {}
     void initialize(UInt n)
     {
-        if (_counter != nullptr)
-            delete[] _counter;
-        if (_nonzero != nullptr)
-            delete[] _nonzero;
-        _counter = new It[n]; // use typename here
-        memset(_counter, 0, n * sizeof(_counter[0]));
-        _nonzero = new UInt[n];
+        _counter.assign(n, 0);
+        _nonzero.resize(n / 16);
         _size = 0;
         _dimension = n;
     }
-    UInt get(UInt cellIdx) { return _counter[cellIdx]; }
+    UInt get(UInt cellIdx) const { return _counter[cellIdx]; }
     void add(UInt cellIdx, UInt incr)
     {
         // currently unused, but may need to resurrect
         if (_counter[cellIdx] == 0)
-            _nonzero[_size++] = cellIdx;
+            addNonZero(cellIdx);
         _counter[cellIdx] += incr;
     }
     It increment(UInt cellIdx) // use typename here
@@ -170,7 +168,7 @@ public:
         _counter[cellIdx] =
             1; // without this, the inefficient compiler reloads the value from
                // memory, increments it and stores it back
-        _nonzero[_size++] = cellIdx;
+        addNonZero(cellIdx);
         return 1;
     }
     void max(UInt cellIdx, It val) // use typename here
@@ -180,9 +178,57 @@ public:
         {
             _counter[cellIdx] = val;
             if (curr == 0)
-                _nonzero[_size++] = cellIdx;
+                addNonZero(cellIdx);
+        }
+    }
+    It incrementUntracked(UInt cellIdx, std::vector<UInt> &nonzero)
+    {
+        if (_counter[cellIdx] != 0)
+            return ++_counter[cellIdx];
+        _counter[cellIdx] = 1;
+        nonzero.push_back(cellIdx);
+        return 1;
+    }
+    void maxUntracked(UInt cellIdx, It val, std::vector<UInt> &nonzero)
+    {
+        const It curr = _counter[cellIdx];
+        if (val > curr)
+        {
+            _counter[cellIdx] = val;
+            if (curr == 0)
+                nonzero.push_back(cellIdx);
         }
     }
+    /**
+     * Records counters made nonzero by the untracked variants.
+     */
+    void track(const std::vector<UInt> &nonzero)
+    {
+        for (UInt cellIdx : nonzero)
+            addNonZero(cellIdx);
+    }
+    /**
+     * Calls f(index, count) for every nonzero counter.
+     */
+    template <typename Function> void forEachNonZero(const Function &f) const
+    {
+        if (_size <= _nonzero.size())
+        {
+            for (UInt ndx = 0; ndx < _size; ndx++)
+                f(_nonzero[ndx], _counter[_nonzero[ndx]]);
+        }
+        else
+        {
+            for (UInt ndx = 0; ndx < _dimension; ndx++)
+                if (_counter[ndx] != 0)
+                    f(ndx, _counter[ndx]);
+        }
+    }
+    size_t getNumBytes() const
+    {
+        return _counter.capacity() * sizeof(It) +
+               _nonzero.capacity() * sizeof(UInt);
+    }
     void reset()
     {
 #define REPORT_ACTIVITY_STATISTICS 0
@@ -200,9 +246,8 @@ public:
         {
             static std::vector<It> vectStat;
             vectStat.clear();
-            UInt ndxStat;
-            for (ndxStat = 0; ndxStat < _size; ndxStat++)
-                vectStat.push_back(_counter[_nonzero[ndxStat]]);
+            forEachNonZero(
+                [&](UInt, It count) { vectStat.push_back(count); });
             std::sort(vectStat.begin(), vectStat.end());
             std::cout << "Reset width=" << sizeof(It) << " size=" << _dimension
                       << " nonzero=" << _size
@@ -212,15 +257,15 @@ public:
         }
 #endif
         // zero all the nonzero slots
-        if (_size < _dimension / 16)
-        {             // if fewer than 6.25% are nonzero
+        if (_size <= _nonzero.size())
+        {             // if at most 6.25% are nonzero
             UInt ndx; // zero selectively
             for (ndx = 0; ndx < _size; ndx++)
                 _counter[_nonzero[ndx]] = 0;
         }
         else
         {
-            memset(_counter, 0, _dimension * sizeof(_counter[0]));
+            memset(_counter.data(), 0, _dimension * sizeof(_counter[0]));
         }
 
         // no more nonzero slots
@@ -228,8 +273,15 @@ public:
     }
 
 private:
-    It *_counter; // use typename here
-    UInt *_nonzero;
+    void addNonZero(UInt cellIdx)
+    {
+        if (_size < _nonzero.size())
+            _nonzero[_size] = cellIdx;
+        ++_size;
+    }
+
+    std::vector<It> _counter; // use typename here
+    std::vector<UInt> _nonzero;
     UInt _size;
     UInt _dimension;
 };
@@ -237,19 +289,74 @@ private:
 template <typename It> class CCellSegActivity
 {
 public:
-    CCellSegActivity()
+    CCellSegActivity() : _nCells(0), _segShift(0) {}
+    /**
+     * Sizes the tables for nCells cells with nSegs segments each, and
+     * zeroes them.
+     */
+    void initialize(UInt nCells, UInt nSegs)
+    {
+        _nCells = nCells;
+        _segShift = getSegShift(nSegs);
+        _cell.initialize(nCells);
+        _seg.initialize(nCells << _segShift);
+    }
+    /**
+     * Makes room for nSegs segments per cell, keeping the counts.
+     */
+    void reserveSegments(UInt nSegs)
     {
-        _cell.initialize(_MAX_CELLS);
-        _seg.initialize(_MAX_CELLS * _MAX_SEGS);
+        const UInt segShift = getSegShift(nSegs);
+        if (segShift <= _segShift)
+            return;
+        CBasicActivity<It> seg;
+        seg.initialize(_nCells << segShift);
+        const UInt mask = (1u << _segShift) - 1;
+        _seg.forEachNonZero([&](UInt ndx, It count) {
+            const UInt dst = ((ndx >> _segShift) << segShift) + (ndx & mask);
+            for (It i = 0; i < count; i++)
+                seg.increment(dst);
+        });
+        std::swap(_seg, seg);
+        _segShift = segShift;
     }
-    UInt get(UInt cellIdx) { return _cell.get(cellIdx); }
-    UInt get(UInt cellIdx, UInt segIdx)
+    UInt getNumSegments() const { return 1u << _segShift; }
+    size_t getNumBytes() const
     {
-        return _seg.get(cellIdx * _MAX_SEGS + segIdx);
+        return _cell.getNumBytes() + _seg.getNumBytes();
+    }
+    UInt get(UInt cellIdx) const { return _cell.get(cellIdx); }
+    UInt get(UInt cellIdx, UInt segIdx) const
+    {
+        NTA_ASSERT(segIdx < getNumSegments());
+        return _seg.get((cellIdx << _segShift) + segIdx);
     }
     void increment(UInt cellIdx, UInt segIdx)
     {
-        _cell.max(cellIdx, _seg.increment(cellIdx * _MAX_SEGS + segIdx));
+        NTA_ASSERT(segIdx < getNumSegments());
+        _cell.max(cellIdx, _seg.increment((cellIdx << _segShift) + segIdx));
+    }
+    /**
+     * The index of the counter of segment segIdx of cell cellIdx, for
+     * incrementUntracked.
+     */
+    UInt getSegmentKey(UInt cellIdx, UInt segIdx) const
+    {
+        NTA_ASSERT(segIdx < getNumSegments());
+        return (cellIdx << _segShift) + segIdx;
+    }
+    void incrementUntracked(UInt segKey, std::vector<UInt> &nonzeroCells,
+                            std::vector<UInt> &nonzeroSegs)
+    {
+        _cell.maxUntracked(segKey >> _segShift,
+                           _seg.incrementUntracked(segKey, nonzeroSegs),
+                           nonzeroCells);
+    }
+    void track(const std::vector<UInt> &nonzeroCells,
+               const std::vector<UInt> &nonzeroSegs)
+    {
+        _cell.track(nonzeroCells);
+        _seg.track(nonzeroSegs);
     }
     void reset()
     {
@@ -258,6 +365,18 @@ public:
     }
 
 private:
+    UInt getSegShift(UInt nSegs) const
+    {
+        UInt segShift = 0;
+        while ((1u << segShift) < nSegs)
+            segShift++;
+        NTA_CHECK(segShift < 32 && ((UInt64)_nCells << segShift) <= 0xffffffffu)
+            << "Too many segments per cell: " << nSegs;
+        return segShift;
+    }
+
+    UInt _nCells;
+    UInt _segShift; // the tables hold 2^_segShift segments per cell
     CBasicActivity<It> _cell;
     CBasicActivity<It> _seg;
 };
@@ -269,7 +388,6 @@ class CRU_API Cells4
 {
 public:
     typedef Segment::InSynapses InSynapses;
-    typedef std::vector<OutSynapse> OutSynapses;
     typedef std::vector<SegmentUpdate> SegmentUpdates;
     static const UInt VERSION = 2;
 
@@ -383,12 +501,56 @@ private:
     /**
      * Internal data structures used for speed optimization.
      */
-    std::vector<OutSynapses> _outSynapses;
+    OutSynapseStore _outSynapses;
     CCellSegActivity<UChar> _learnActivity;
 // _inferActivity and _learnActivity use identical data
 // structures, and their use does not overlap
 #define _inferActivity _learnActivity
 
+    //-----------------------------------------------------------------------
+    /**
+     * Scratch buffers of the compute and learning methods.  They keep
+     * their capacity between calls, and are members rather than
+     * function statics so that independent instances can compute on
+     * different threads.
+     */
+    std::vector<UInt> _newSynapses;       // computeUpdate
+    std::vector<UInt> _badPatterns;       // inferBacktrack, learnBacktrack
+    std::vector<UInt> _candidateCellIdxs; // getCellForNewSegment
+    std::vector<UInt> _delUpdates;        // processSegmentUpdates
+    std::vector<UInt> _cleanUpdates;      // cleanUpdatesList
+    std::vector<UInt> _removedSynapses;   // decay and trimming
+    std::vector<UInt> _extSynapses;       // addNewSegment, updateSegment
+
+    // adaptSegment
+    std::vector<UInt> _removed;
+    std::vector<UInt> _synToDec;
+    std::vector<UInt> _synToInc;
+    std::vector<UInt> _inactiveSegmentIndices;
+    std::vector<UInt> _activeSegmentIndices;
+
+    // chooseCellsToLearnFrom, and computeForwardPropagation for _cellBuffer
+    std::vector<UInt> _cellBuffer;
+    std::vector<UInt> _prunedCells;
+    std::vector<UInt> _alreadyHave;
+
+    // The counters made nonzero by each thread in propagateForward
+    std::vector<std::vector<UInt>> _nonzeroCells;
+    std::vector<std::vector<UInt>> _nonzeroSegs;
+
+    // The segment keys that thread t of propagateForward found, by
+    // destination range: range d of _forwardKeys[t] spans the offsets d and
+    // d + 1 of thread t, at t * (_numThreads + 16) in _forwardOffsets.
+    std::vector<std::vector<UInt>> _forwardKeys;
+    std::vector<UInt> _forwardOffsets;
+    // The ends of the ranges of thread t, while it fills them, at
+    // t * (_numThreads + 8).  The rows of both are a cache line apart from
+    // those of the other threads.
+    std::vector<UInt *> _forwardEnds;
+
+    UInt _numThreads;
+    std::shared_ptr<ThreadPool> _threadPool;
+
 public:
     //-----------------------------------------------------------------------
     /**
@@ -451,6 +613,15 @@ public:
     Int getMaxSynapsesPerSegment() const { return _maxSynapsesPerSegment; }
     bool getCheckSynapseConsistency() const { return _checkSynapseConsistency; }
 
+    /**
+     * The activity tables, sized from the number of cells and the
+     * number of segments per cell.
+     */
+    const CCellSegActivity<UChar> &getActivity() const
+    {
+        return _learnActivity;
+    }
+
     //----------------------------------------------------------------------
     /**
      * Accessors for setting various member variables
@@ -474,6 +645,10 @@ public:
             NTA_CHECK(_maxAge == 0);
         }
         _maxSegmentsPerCell = maxSegs;
+        if (maxSegs > 0)
+        {
+            _learnActivity.reserveSegments((UInt)maxSegs);
+        }
     }
 
     void setMaxSynapsesPerCell(int maxSyns)
@@ -612,6 +787,17 @@ public:
     void computeForwardPropagation(CState &state);
 #endif
 
+    //----------------------------------------------------------------------
+    /**
+     * Adds the activity that the given active cells propagate forward,
+     * on the thread pool, in two passes.  First every thread follows the
+     * out synapses of its share of srcCells and files their segments by
+     * destination range, then every thread increments the segments of its
+     * own destination range.  Every out synapse is read once, and the
+     * counts are the same as those of the serial loop.
+     */
+    void propagateForward(const std::vector<UInt> &srcCells);
+
     //----------------------------------------------------------------------
     //----------------------------------------------------------------------
     //
@@ -1039,6 +1225,17 @@ public:
     // Set the Cell class segment order
     static void setCellSegmentOrder(bool matchPythonOrder);
 
+    //----------------------------------------------------------------------
+    /**
+     * The number of threads of forward propagation, 1 by default.  With
+     * more than one, the destination cells are split in ranges over a
+     * thread pool, see propagateForward.  The activities, and so the
+     * results, do not depend on it.  0 means one thread per hardware
+     * thread.  The setting is not saved.
+     */
+    UInt getNumThreads() const { return _numThreads; }
+    void setNumThreads(UInt numThreads);
+
     //----------------------------------------------------------------------
     /**
      * Used in unit tests and debugging.
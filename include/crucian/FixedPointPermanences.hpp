@@ -0,0 +1,180 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Definition of FixedPointPermanences
+ */
+
+#ifndef NTA_FIXED_POINT_PERMANENCES_HPP
+#define NTA_FIXED_POINT_PERMANENCES_HPP
+
+#include <cstring>
+#include <vector>
+
+#include <crucian/Log.hpp>
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * Permanences stored as an array of 8 or 16-bit fixed-point codes.
+ *
+ * Code q stands for minimum + q * step, where the step splits
+ * [minimum, maximum] into 2^bits - 1 intervals. Values are rounded to the
+ * nearest code, halves away from the minimum, and clamped to the range, so
+ * encoding a decoded value gives the same code back. quantizeDelta rounds
+ * increments and decrements to a whole, non zero number of steps, so that
+ * learning moves the codes by fixed amounts whatever their values.
+ *
+ * With 0 bits the codes are disabled: there are no codes and quantizeDelta
+ * returns its argument.
+ */
+class FixedPointPermanences
+{
+public:
+    FixedPointPermanences()
+        : bits_(0), bytes_(0), maxCode_(0), minimum_(0), maximum_(0), step_(0)
+    {
+    }
+
+    /**
+     * Chooses the number of bits, 0, 8 or 16, and the range of the codes.
+     * Removes all codes.
+     */
+    void setFormat(UInt bits, Real minimum, Real maximum)
+    {
+        NTA_CHECK(bits == 0 || bits == 8 || bits == 16)
+            << "Permanences can have 0 (floating point), 8 or 16 bits, not "
+            << bits;
+        NTA_CHECK(bits == 0 || maximum > minimum)
+            << "Invalid permanence range [" << minimum << ", " << maximum
+            << "]";
+        bits_ = bits;
+        bytes_ = bits / 8;
+        maxCode_ = bits == 0 ? 0 : (1u << bits) - 1;
+        minimum_ = minimum;
+        maximum_ = maximum;
+        step_ = bits == 0 ? 0 : (maximum - minimum) / maxCode_;
+        codes_.clear();
+        codes_.shrink_to_fit();
+    }
+
+    bool enabled() const { return bits_ != 0; }
+
+    UInt getBits() const { return bits_; }
+
+    UInt getBytesPerCode() const { return bytes_; }
+
+    Real getMinimum() const { return minimum_; }
+
+    Real getMaximum() const { return maximum_; }
+
+    /**
+     * Changes the number of codes. New codes are 0.
+     */
+    void resize(size_t size) { codes_.resize(size * bytes_, 0); }
+
+    size_t size() const { return bytes_ == 0 ? 0 : codes_.size() / bytes_; }
+
+    /**
+     * The codes, getBytesPerCode() bytes each in host byte order.
+     */
+    const char *data() const
+    {
+        return reinterpret_cast<const char *>(codes_.data());
+    }
+
+    char *data() { return reinterpret_cast<char *>(codes_.data()); }
+
+    Real get(size_t i) const { return decode(getCode(i)); }
+
+    void set(size_t i, Real value) { setCode(i, encode(value)); }
+
+    UInt getCode(size_t i) const
+    {
+        if (bytes_ == 1)
+        {
+            return codes_[i];
+        }
+        UInt16 code;
+        std::memcpy(&code, &codes_[2 * i], sizeof(code));
+        return code;
+    }
+
+    void setCode(size_t i, UInt code)
+    {
+        if (bytes_ == 1)
+        {
+            codes_[i] = (unsigned char)code;
+            return;
+        }
+        const UInt16 code16 = (UInt16)code;
+        std::memcpy(&codes_[2 * i], &code16, sizeof(code16));
+    }
+
+    UInt encode(Real value) const
+    {
+        const Real64 scaled = ((Real64)value - minimum_) / step_;
+        if (scaled <= 0)
+        {
+            return 0;
+        }
+        if (scaled >= maxCode_)
+        {
+            return maxCode_;
+        }
+        return (UInt)(scaled + 0.5);
+    }
+
+    Real decode(UInt code) const { return minimum_ + code * step_; }
+
+    /**
+     * Rounds a change of permanence to a whole number of steps, at least
+     * one unless delta is 0.
+     */
+    Real quantizeDelta(Real delta) const
+    {
+        if (bits_ == 0 || delta == 0)
+        {
+            return delta;
+        }
+        const Real magnitude = delta < 0 ? -delta : delta;
+        UInt steps = (UInt)((Real64)magnitude / step_ + 0.5);
+        steps = steps == 0 ? 1 : steps;
+        return delta < 0 ? -(Real)(steps * step_) : (Real)(steps * step_);
+    }
+
+private:
+    UInt bits_;
+    UInt bytes_;
+    UInt maxCode_;
+    Real minimum_;
+    Real maximum_;
+    Real step_;
+
+    std::vector<unsigned char> codes_;
+};
+
+} // namespace crucian
+
+#endif // NTA_FIXED_POINT_PERMANENCES_HPP
@@ -0,0 +1,132 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Definition of FrozenSpatialPooler
+ */
+
+#ifndef NTA_FROZEN_SPATIAL_POOLER_HPP
+#define NTA_FROZEN_SPATIAL_POOLER_HPP
+
+#include <vector>
+
+#include <crucian/Inhibition.hpp>
+#include <crucian/SpatialPooler.hpp>
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * An inference-only spatial pooler, made by SpatialPooler::freeze from a
+ * trained one. It gives the same active columns as the spatial pooler's
+ * compute with learning off, but only keeps what inference needs: the
+ * connected synapses, as an inverted index from every input to the
+ * columns connected to it, and the inhibition parameters. There are no
+ * permanences, potential pools or duty cycles.
+ *
+ * The column ids of the index take 16 bits when there are at most 65536
+ * columns, 32 bits otherwise. The overlaps are accumulated from the
+ * active inputs only, so the cost grows with the number of active inputs
+ * rather than with the number of connected synapses.
+ *
+ * A frozen spatial pooler never changes: any number of threads can run
+ * compute on it at once, each with its own context.
+ *
+ *     FrozenSpatialPooler frozen = sp.freeze();
+ *     SpatialPooler::InferenceContext context;
+ *     frozen.compute(inputVector, activeVector, context);
+ */
+class CRU_API FrozenSpatialPooler
+{
+public:
+    FrozenSpatialPooler();
+
+    UInt getNumInputs() const { return numInputs_; }
+
+    UInt getNumColumns() const { return numColumns_; }
+
+    /**
+     * The number of connected synapses.
+     */
+    size_t getNumSynapses() const { return offsets_.back(); }
+
+    /**
+     * The number of bits of the column ids of the index, 16 or 32.
+     */
+    UInt getColumnIdBits() const { return columns16_.empty() ? 32 : 16; }
+
+    /**
+     * The number of bytes of the index.
+     */
+    size_t getIndexSize() const;
+
+    /**
+     * Same as the const SpatialPooler::compute of the frozen spatial
+     * pooler.
+     *
+     * @param inputVector An array of getNumInputs() integer 0's and 1's.
+     *
+     * @param activeVector An array of getNumColumns() integers receiving
+     *       the dense active columns.
+     *
+     * @param context The state of the calling thread.
+     */
+    void compute(const UInt inputVector[], UInt activeVector[],
+                 SpatialPooler::InferenceContext &context) const;
+
+    /**
+     * Sparse variant of compute, with the input and output as sorted lists
+     * of indices.
+     */
+    void compute(const std::vector<UInt> &activeInputs,
+                 std::vector<UInt> &activeColumns,
+                 SpatialPooler::InferenceContext &context) const;
+
+private:
+    friend class SpatialPooler;
+
+    template <typename ColumnId>
+    void addOverlaps_(const ColumnId columns[], UInt input,
+                      std::vector<UInt> &overlaps) const;
+
+    void addOverlaps_(UInt input, std::vector<UInt> &overlaps) const;
+
+    void inhibit_(SpatialPooler::InferenceContext &context) const;
+
+    UInt numInputs_;
+    UInt numColumns_;
+
+    // The columns connected to input i are columns[offsets_[i]] to
+    // columns[offsets_[i + 1] - 1], in increasing order, in columns16_ or
+    // columns32_.
+    std::vector<size_t> offsets_;
+    std::vector<UInt16> columns16_;
+    std::vector<UInt32> columns32_;
+
+    // The parameters of the spatial pooler's inhibition.
+    InhibitionParameters inhibition_;
+};
+
+} // namespace crucian
+
+#endif // NTA_FROZEN_SPATIAL_POOLER_HPP
@@ -0,0 +1,155 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Inhibition of the spatial pooler's columns
+ */
+
+#ifndef NTA_INHIBITION_HPP
+#define NTA_INHIBITION_HPP
+
+#include <vector>
+
+#include <crucian/ArrayAlgo.hpp>
+#include <crucian/ThreadPool.hpp>
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * Everything the inhibition reads from a spatial pooler. SpatialPooler
+ * builds it from its own parameters and FrozenSpatialPooler keeps a copy.
+ */
+struct InhibitionParameters
+{
+    InhibitionParameters()
+        : numColumns(0), globalInhibition(true),
+          numActiveColumnsPerInhArea(0), localAreaDensity(0),
+          stimulusThreshold(0), inhibitionRadius(0), wrapAround(true)
+    {
+    }
+
+    UInt numColumns;
+    std::vector<UInt> columnDimensions;
+    bool globalInhibition;
+    Int numActiveColumnsPerInhArea;
+    Real localAreaDensity;
+    UInt stimulusThreshold;
+    UInt inhibitionRadius;
+    bool wrapAround;
+};
+
+/**
+ * The buffers of the inhibition, reused from one call to the next. Separate
+ * threads must use separate scratches.
+ */
+struct InhibitionScratch
+{
+    /**
+     * Reserves the buffers for numColumns columns, so that the inhibition
+     * does not allocate when its engine changes.
+     */
+    void reserve(UInt numColumns);
+
+    // Per-column state of the window and sweep local inhibitions.
+    std::vector<UInt> state;
+
+    // Scratch for the parallel local inhibition.
+    std::vector<UInt> numBigger;
+    std::vector<UInt> numActive;
+
+    // Scratch for the sweep local inhibition.
+    std::vector<UInt> sweepOrder;
+    std::vector<Int> sweepBigger;
+    std::vector<Int> sweepEqualWinners;
+
+    // Top-k selection for the global inhibition.
+    TopKSelector topK;
+};
+
+/**
+ * Returns the target density of active columns used by the inhibition and
+ * the global boosting.
+ */
+Real inhibitionDensity(const InhibitionParameters &parameters);
+
+/**
+ * Performs inhibition: picks the active columns among overlaps with the
+ * density given by the parameters, globally or locally.
+ *
+ * @param overlaps        the overlap score for each column.
+ * @param activeColumns   receives the indices of the active columns.
+ * @param threadPool      runs the window local inhibition in parallel, if
+ *                        not null.
+ */
+void inhibitColumns(const InhibitionParameters &parameters,
+                    const std::vector<Real> &overlaps,
+                    std::vector<UInt> &activeColumns,
+                    InhibitionScratch &scratch,
+                    ThreadPool *threadPool = nullptr);
+
+/**
+ * Global inhibition: picks the density * numColumns columns with the highest
+ * overlaps. Ties go to the column with the highest index, and columns with
+ * an overlap below the stimulus threshold are always inhibited.
+ */
+void inhibitColumnsGlobal(const InhibitionParameters &parameters,
+                          const std::vector<Real> &overlaps, Real density,
+                          std::vector<UInt> &activeColumns,
+                          InhibitionScratch &scratch);
+
+/**
+ * Local inhibition: a column is active if its overlap is within the top
+ * density of its neighborhood. Uses inhibitColumnsLocalSweep for large
+ * neighborhoods in 1D and 2D, inhibitColumnsLocalWindow otherwise.
+ */
+void inhibitColumnsLocal(const InhibitionParameters &parameters,
+                         const std::vector<Real> &overlaps, Real density,
+                         std::vector<UInt> &activeColumns,
+                         InhibitionScratch &scratch,
+                         ThreadPool *threadPool = nullptr);
+
+/**
+ * Local inhibition that visits the neighborhood of every column. Works with
+ * any number of dimensions, in parallel when a thread pool is given.
+ */
+void inhibitColumnsLocalWindow(const InhibitionParameters &parameters,
+                               const std::vector<Real> &overlaps, Real density,
+                               std::vector<UInt> &activeColumns,
+                               InhibitionScratch &scratch,
+                               ThreadPool *threadPool = nullptr);
+
+/**
+ * Local inhibition with the same result as inhibitColumnsLocalWindow, for 1D
+ * and 2D topologies. It visits the columns by decreasing overlap and counts
+ * the bigger neighbors with 2D Fenwick trees, so the cost per column grows
+ * with log(numColumns) instead of with the size of the neighborhood.
+ */
+void inhibitColumnsLocalSweep(const InhibitionParameters &parameters,
+                              const std::vector<Real> &overlaps, Real density,
+                              std::vector<UInt> &activeColumns,
+                              InhibitionScratch &scratch);
+
+} // end namespace crucian
+
+#endif // NTA_INHIBITION_HPP
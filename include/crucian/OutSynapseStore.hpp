@@ -0,0 +1,185 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Definition of OutSynapseStore
+ */
+
+#ifndef NTA_OUT_SYNAPSE_STORE_HPP
+#define NTA_OUT_SYNAPSE_STORE_HPP
+
+#include <vector>
+
+#include <crucian/Log.hpp>
+#include <crucian/OutSynapse.hpp>
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * The out synapses of Cells4: for every source cell (row), the
+ * destination cells and segments it projects to.
+ *
+ * The rows share one arena. A row is a contiguous slice of it, with
+ * some slack after its synapses so that it can grow in place. A row
+ * that outgrows its capacity moves to the end of the arena with twice
+ * the capacity. When more than half of the arena is left unused by
+ * moved rows, it is compacted, and every row keeps its capacity.
+ * Forward propagation reads a row as a plain array, and can prefetch
+ * the next one.
+ *
+ * A reverse index, an open addressing hash table from (row, destination
+ * cell, destination segment) to the position of the synapse in the
+ * arena, makes add and erase O(1) on average, whatever the size of the
+ * row. A slot only holds the row and the position, the destination is
+ * read from the arena, so the index costs 8 bytes per slot, and 32/3 to
+ * 64/3 bytes per synapse as the table is 3/8 to 3/4 full. erase moves
+ * the last synapse of the row into the hole, so the order of a row is
+ * the order of insertion until the first erase.
+ *
+ *   OutSynapseStore store;
+ *   store.resize(nCells);
+ *   store.add(srcCellIdx, OutSynapse(dstCellIdx, dstSegIdx));
+ *   const OutSynapse *row = store.getRow(srcCellIdx);
+ *   for (UInt j = 0; j != store.getRowSize(srcCellIdx); ++j)
+ *       activity.increment(row[j].dstCellIdx(), row[j].dstSegIdx());
+ *   store.erase(srcCellIdx, dstCellIdx, dstSegIdx);
+ */
+class CRU_API OutSynapseStore
+{
+public:
+    OutSynapseStore();
+
+    /**
+     * Removes all synapses and sets the number of rows.
+     */
+    void resize(UInt numRows);
+
+    /**
+     * Removes all synapses and lays out the rows contiguously, with the
+     * given capacities, as many as rows, and sizes the reverse index for
+     * numSynapses synapses.
+     */
+    void reserve(const std::vector<UInt> &capacities, size_t numSynapses);
+
+    UInt getNumRows() const { return (UInt)rows_.size(); }
+
+    /**
+     * The number of synapses of all rows.
+     */
+    size_t getNumSynapses() const { return numIndexed_; }
+
+    UInt getRowSize(UInt row) const { return rows_[row].size; }
+
+    UInt getRowCapacity(UInt row) const { return rows_[row].capacity; }
+
+    /**
+     * The synapses of a row, getRowSize of them. The pointer is valid
+     * until the next add, erase, resize or reserve.
+     */
+    const OutSynapse *getRow(UInt row) const
+    {
+        return synapses_.data() + rows_[row].begin;
+    }
+
+    /**
+     * Hints that the synapses of a row are about to be read.
+     */
+    void prefetch(UInt row) const
+    {
+#if defined(__GNUC__)
+        __builtin_prefetch(getRow(row));
+#endif
+    }
+
+    /**
+     * The number of bytes of the arena, the rows and the reverse index.
+     */
+    size_t getNumBytes() const;
+
+    /**
+     * The number of arena slots left by rows that moved, reclaimed by
+     * the next compaction.
+     */
+    size_t getNumUnused() const { return unused_; }
+
+    bool contains(UInt row, UInt dstCellIdx, UInt dstSegIdx) const
+    {
+        return find_(row, dstCellIdx, dstSegIdx) != NOT_FOUND;
+    }
+
+    /**
+     * Appends a synapse to a row. The row must not have a synapse to the
+     * same destination.
+     */
+    void add(UInt row, const OutSynapse &synapse);
+
+    /**
+     * Removes the synapse of a row to a destination, if any, and returns
+     * whether there was one.
+     */
+    bool erase(UInt row, UInt dstCellIdx, UInt dstSegIdx);
+
+    /**
+     * Checks that the reverse index matches the arena.
+     */
+    bool invariants() const;
+
+private:
+    struct Row
+    {
+        size_t begin;
+        UInt size;
+        UInt capacity;
+    };
+
+    struct Slot
+    {
+        UInt row; // EMPTY for an empty slot
+        UInt position;
+    };
+
+    static const UInt EMPTY = (UInt)-1;
+    static const size_t NOT_FOUND = (size_t)-1;
+
+    size_t hash_(UInt row, UInt dstCellIdx, UInt dstSegIdx) const;
+    size_t hash_(const Slot &slot) const;
+    size_t find_(UInt row, UInt dstCellIdx, UInt dstSegIdx) const;
+    void insert_(UInt row, const OutSynapse &synapse, size_t position);
+    void remove_(size_t slot);
+    void rehash_(size_t numSlots);
+    void reserveRow_(UInt row, UInt size);
+    void compact_();
+
+    std::vector<Row> rows_;
+    std::vector<OutSynapse> synapses_;
+    size_t unused_;
+
+    // The reverse index, with a power of 2 number of slots.
+    std::vector<Slot> slots_;
+    size_t numIndexed_;
+};
+
+} // namespace crucian
+
+#endif // NTA_OUT_SYNAPSE_STORE_HPP
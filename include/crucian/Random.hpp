@@ -91,6 +91,11 @@ public:
 
     explicit Random(UInt64 seed = 0);
 
+    // an independent stream of the generator seeded with seed, stream 0
+    // being Random(seed). Consecutive streams give unrelated sequences, for
+    // deterministic parallel work split in many pieces.
+    Random(UInt64 seed, UInt64 stream);
+
     // support copy constructor and operator= -- these require non-default
     // implementations because of the impl_ pointer.
     // They do a deep copy of impl_ so that an RNG and its copy generate the
@@ -165,6 +170,14 @@ public:
     // normally used for debugging only
     UInt64 getSeed() { return seed_; }
 
+    // binary serialization of the seed and the generator state, in host
+    // byte order, to exactly BINARY_SIZE bytes
+    static const size_t BINARY_SIZE;
+
+    void saveBinary(char *out) const;
+
+    void loadBinary(const char *in);
+
     // for STL
     typedef UInt32 argument_type;
     typedef UInt32 result_type;
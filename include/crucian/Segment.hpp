@@ -313,30 +313,20 @@ public:
      */
     inline bool invariants() const
     {
-        static std::vector<UInt> indices;
-        static UInt highWaterSize = 0;
-        if (highWaterSize < static_cast<UInt> (_synapses.size()))
-        {
-            highWaterSize = static_cast<UInt> (_synapses.size());
-            indices.reserve(highWaterSize);
-        }
-        indices.clear(); // purge residual data
-
-        for (UInt i = 0; i != _synapses.size(); ++i)
-            indices.push_back(_synapses[i].srcCellIdx());
+        bool sorted = true;
+        for (UInt i = 1; i < _synapses.size(); ++i)
+            sorted = sorted &&
+                     _synapses[i - 1].srcCellIdx() < _synapses[i].srcCellIdx();
 
 #ifndef NDEBUG
-        if (indices.size() != _synapses.size())
-            std::cout << "Indices are not unique" << std::endl;
-
-        if (!is_sorted(indices, true, true))
+        if (!sorted)
             std::cout << "Indices are not sorted" << std::endl;
 
         if (_frequency < 0)
             std::cout << "Frequency is less than zero" << std::endl;
 #endif
 
-        return _frequency >= 0 && is_sorted(indices, true, true);
+        return _frequency >= 0 && sorted;
     }
 
     //-----------------------------------------------------------------------
@@ -0,0 +1,86 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Definition of SerialWorker
+ */
+
+#ifndef NTA_SERIAL_WORKER_HPP
+#define NTA_SERIAL_WORKER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * A background thread that runs the tasks posted to it one at a time, in
+ * the order they were posted.
+ */
+class CRU_API SerialWorker
+{
+public:
+    SerialWorker();
+
+    /**
+     * Waits for the posted tasks, then stops the thread.
+     */
+    ~SerialWorker();
+
+    SerialWorker(const SerialWorker &) = delete;
+    SerialWorker &operator=(const SerialWorker &) = delete;
+
+    /**
+     * Runs task on the worker thread after the tasks posted before it.
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * Waits until all the posted tasks have run. If one of them threw since
+     * the last wait, rethrows the first exception.
+     */
+    void wait();
+
+private:
+    void loop_();
+
+    std::mutex mutex_; // protects the fields below
+    std::condition_variable start_;
+    std::condition_variable done_;
+    std::deque<std::function<void()>> tasks_;
+    bool busy_;
+    bool stop_;
+    std::exception_ptr error_;
+
+    std::thread thread_;
+};
+
+} // namespace crucian
+
+#endif // NTA_SERIAL_WORKER_HPP
@@ -51,36 +51,43 @@ public:
     typedef UI1 size_type;
     typedef UI2 nz_index_type;
     typedef std::vector<nz_index_type> Row;
+    typedef std::vector<size_type> Col;
 
 private:
     nz_index_type ncols_;
     std::vector<Row> ind_; // indices of the non-zeros
     Row buffer_;
+    bool dual_;             // true if tind_ is maintained
+    std::vector<Col> tind_; // row indices of the non-zeros of each column
 
 public:
-    inline SparseBinaryMatrix() : ncols_(0), ind_(), buffer_() {}
+    inline SparseBinaryMatrix()
+        : ncols_(0), ind_(), buffer_(), dual_(false), tind_()
+    {
+    }
 
     template <typename InputIterator>
     inline SparseBinaryMatrix(size_type nrows, size_type ncols,
                               InputIterator begin, InputIterator end)
-        : ncols_(0), ind_(), buffer_()
+        : ncols_(0), ind_(), buffer_(), dual_(false), tind_()
     {
         fromDense(nrows, ncols, begin, end);
     }
 
-    inline explicit SparseBinaryMatrix(size_type ncols) : ncols_(0), ind_(), buffer_()
+    inline explicit SparseBinaryMatrix(size_type ncols)
+        : ncols_(0), ind_(), buffer_(), dual_(false), tind_()
     {
         nCols(ncols);
         buffer_.resize(nCols());
     }
 
     inline SparseBinaryMatrix(size_type nrows, size_type ncols)
-        : ncols_(ncols), ind_(nrows), buffer_(ncols)
+        : ncols_(ncols), ind_(nrows), buffer_(ncols), dual_(false), tind_()
     {
     }
 
     inline SparseBinaryMatrix(const SparseBinaryMatrix &o)
-        : ncols_(0), ind_(), buffer_()
+        : ncols_(0), ind_(), buffer_(), dual_(false), tind_()
     {
         copy(o);
     }
@@ -101,6 +108,8 @@ public:
             ind_[r].insert(ind_[r].end(), o.ind_[r].begin(), o.ind_[r].end());
         nCols(o.nCols());
         buffer_.resize(nCols());
+        dual_ = o.dual_;
+        tind_ = o.tind_;
     }
 
     inline ~SparseBinaryMatrix()
@@ -108,6 +117,57 @@ public:
         ind_.clear();
         ncols_ = 0;
         buffer_.clear();
+        tind_.clear();
+    }
+
+    /**
+     * Turns on the column index: from now on, this matrix also stores, for
+     * each column, the sorted indices of the rows that have a non-zero in
+     * that column, and keeps them in sync with the rows.
+     *
+     * Row-level mutators (set, replaceSparseRow, rowFromDense,
+     * setRangeToZero, appendSparseRow, appendDenseRow...) patch only the columns whose bit
+     * actually changed, so the cost of keeping the index is proportional to
+     * the number of changed non-zeros. Whole-matrix operations (transpose,
+     * logical operations, fromDense, resize...) rebuild it in O(nnz).
+     */
+    inline void enableColumnIndex()
+    {
+        if (dual_)
+            return;
+
+        dual_ = true;
+        rebuildColumnIndex_();
+    }
+
+    /**
+     * Turns off the column index and releases its memory.
+     */
+    inline void disableColumnIndex()
+    {
+        dual_ = false;
+        std::vector<Col> empty;
+        tind_.swap(empty);
+    }
+
+    inline bool hasColumnIndex() const { return dual_; }
+
+    /**
+     * Returns the sorted indices of the rows that have a non-zero on column
+     * col. Requires the column index to be enabled.
+     */
+    inline const Col &getSparseCol(nz_index_type col) const
+    {
+        { // Pre-conditions
+            NTA_ASSERT(dual_)
+                << "SparseBinaryMatrix::getSparseCol: Column index disabled";
+
+            NTA_ASSERT(col < nCols())
+                << "SparseBinaryMatrix::getSparseCol: Invalid col index: "
+                << col << " - Should be < number of columns: " << nCols();
+        } // End pre-conditions
+
+        return tind_[col];
     }
 
     /**
@@ -133,6 +193,8 @@ public:
             std::copy(buffer_.begin(), buffer_.begin() + nnz, ind_[i].begin());
         }
 
+        rebuildColumnIndex_();
+
         NTA_ASSERT(nRows());
         NTA_ASSERT(nCols());
         NTA_ASSERT(buffer_.size() == nCols());
@@ -170,6 +232,9 @@ public:
         for (size_type i = 0; i != nRows(); ++i)
             n += ind_[i].capacity() * sizeof(nz_index_type);
         n += buffer_.capacity() * sizeof(nz_index_type);
+        n += tind_.capacity() * sizeof(Col);
+        for (size_type j = 0; j != tind_.size(); ++j)
+            n += tind_[j].capacity() * sizeof(size_type);
         return n;
     }
 
@@ -201,7 +266,8 @@ public:
 
     /**
      * Deallocates memory used by this instance. Doesn't change the number of
-     * rows or columns.
+     * rows or columns. The column index stays enabled, if it was, and is
+     * emptied too.
      */
     inline void clear()
     {
@@ -209,7 +275,10 @@ public:
         ind_.swap(empty);
         Row empty2;
         buffer_.swap(empty2);
+        std::vector<Col> empty3;
+        tind_.swap(empty3);
         ncols_ = 0;
+        rebuildColumnIndex_();
 
         NTA_ASSERT(nBytes() == sizeof(SparseBinaryMatrix));
     }
@@ -251,6 +320,8 @@ public:
 
             ind_.resize(new_nrows);
         }
+
+        rebuildColumnIndex_();
     }
 
     /**
@@ -622,6 +693,8 @@ public:
                 for (size_type k = 0; k != nnzr[i]; ++k, ++it)
                     ind_[i].push_back(it->second);
         }
+
+        rebuildColumnIndex_();
     }
 
     template <typename value_type>
@@ -644,15 +717,21 @@ public:
         {
 
             if (it != ind_[row].end() && *it == col)
+            {
                 ind_[row].erase(it);
+                if (dual_)
+                    eraseFromCol_(col, row);
+            }
         }
         else
         {
 
-            if (it == ind_[row].end())
-                ind_[row].push_back(col);
-            else if (*it != col)
+            if (it == ind_[row].end() || *it != col)
+            {
                 ind_[row].insert(it, col);
+                if (dual_)
+                    insertIntoCol_(col, row);
+            }
         }
     }
 
@@ -713,6 +792,10 @@ public:
         ind_.resize(nRows() + 1);
         Row &row = ind_[ind_.size() - 1];
         row.insert(row.end(), begin, end);
+
+        if (dual_)
+            for (nz_index_type k = 0; k != row.size(); ++k)
+                tind_[row[k]].push_back(nRows() - 1);
     }
 
     template <typename InputIterator>
@@ -731,12 +814,18 @@ public:
         for (nz_index_type j = 0; j != nCols(); ++j, ++begin)
             if (!crucian::nearlyZero(*begin))
                 row.push_back(j);
+
+        if (dual_)
+            for (nz_index_type k = 0; k != row.size(); ++k)
+                tind_[row[k]].push_back(nRows() - 1);
     }
 
     inline void appendEmptyCols(size_type n)
     {
         ncols_ += n;
         buffer_.resize(ncols_);
+        if (dual_)
+            tind_.resize(ncols_);
     }
 
     template <typename InputIterator>
@@ -750,6 +839,12 @@ public:
                 << " - Should be less than number of rows: " << nRows();
         } // End pre-conditions
 
+        if (dual_)
+        {
+            tind_.push_back(Col(ind, ind_end));
+            std::sort(tind_.back().begin(), tind_.back().end());
+        }
+
         for (; ind != ind_end; ++ind)
             ind_[*ind].push_back(ncols_);
 
@@ -768,6 +863,10 @@ public:
             sparse_row_invariants_(begin, end, "replaceSparseRow");
         } // End pre-conditions
 
+        if (dual_)
+            updateColumnIndex_(row, ind_[row].begin(), ind_[row].end(), begin,
+                               end);
+
         auto n = static_cast<size_type>(end - begin);
         ind_[row].resize(n);
 
@@ -953,6 +1052,9 @@ public:
         typename Row::iterator it1, it2;
         it1 = std::lower_bound(the_row.begin(), the_row.end(), begin);
         it2 = std::lower_bound(it1, the_row.end(), end);
+        if (dual_)
+            for (typename Row::iterator it = it1; it != it2; ++it)
+                eraseFromCol_(*it, row);
         the_row.erase(it1, it2);
     }
 
@@ -983,6 +1085,8 @@ public:
 
         ncols_ = nRows();
         ind_.swap(tind);
+
+        rebuildColumnIndex_();
     }
 
     inline void logicalNot()
@@ -1007,6 +1111,8 @@ public:
 
             ind_[row].swap(new_row);
         }
+
+        rebuildColumnIndex_();
     }
 
     inline void logicalOr(const SparseBinaryMatrix &o)
@@ -1052,6 +1158,8 @@ public:
             ind_[row].resize(k);
             // replaceSparseRow(row, buffer_.begin(), buffer_.begin() + k);
         }
+
+        rebuildColumnIndex_();
     }
 
     inline void inside()
@@ -1277,6 +1385,8 @@ public:
             inStream.ignore(1);
             crucian::binary_load(inStream, ind_[row].begin(), ind_[row].end());
         }
+
+        rebuildColumnIndex_();
     }
 
     inline void toBinary(std::ostream &outStream) const
@@ -1342,6 +1452,8 @@ public:
             size_type col = idx % ncols;
             ind_[row].push_back(col);
         }
+
+        rebuildColumnIndex_();
     }
 
     template <typename OutputIterator>
@@ -1377,6 +1489,18 @@ public:
                 << " vs. " << nCols();
         } // End pre-conditions
 
+        if (dual_)
+        {
+            Row old_row;
+            old_row.swap(ind_[row]);
+            for (InputIterator it = begin; it != end; ++it)
+                if (!nearlyZero(*it))
+                    ind_[row].push_back(static_cast<size_type>(it - begin));
+            updateColumnIndex_(row, old_row.begin(), old_row.end(),
+                               ind_[row].begin(), ind_[row].end());
+            return;
+        }
+
         ind_[row].clear();
         for (InputIterator it = begin; it != end; ++it)
             if (!nearlyZero(*it))
@@ -1492,6 +1616,8 @@ public:
             for (nz_index_type col = 0; col != nCols(); ++col)
                 if (*begin++ != 0)
                     ind_[row].push_back(col);
+
+        rebuildColumnIndex_();
     }
 
     template <typename OutputIterator>
@@ -1869,6 +1995,76 @@ private:
         ncols_ = static_cast<nz_index_type>(ncols);
     }
 
+    /**
+     * Recomputes the column index from the rows, if it is enabled.
+     */
+    inline void rebuildColumnIndex_()
+    {
+        if (!dual_)
+            return;
+
+        tind_.resize(nCols());
+        for (nz_index_type col = 0; col != nCols(); ++col)
+            tind_[col].clear();
+
+        for (size_type row = 0; row != nRows(); ++row)
+            for (nz_index_type k = 0; k != ind_[row].size(); ++k)
+                tind_[ind_[row][k]].push_back(row);
+    }
+
+    /**
+     * Patches the column index for a row going from the sorted indices in
+     * [old_begin, old_end) to the sorted indices in [new_begin, new_end).
+     * Only the columns present in one range but not the other are touched.
+     */
+    template <typename It1, typename It2>
+    inline void updateColumnIndex_(size_type row, It1 old_begin, It1 old_end,
+                                   It2 new_begin, It2 new_end)
+    {
+        while (old_begin != old_end && new_begin != new_end)
+        {
+            if (*old_begin < *new_begin)
+                eraseFromCol_(*old_begin++, row);
+            else if (*new_begin < *old_begin)
+                insertIntoCol_(*new_begin++, row);
+            else
+            {
+                ++old_begin;
+                ++new_begin;
+            }
+        }
+
+        for (; old_begin != old_end; ++old_begin)
+            eraseFromCol_(*old_begin, row);
+
+        for (; new_begin != new_end; ++new_begin)
+            insertIntoCol_(*new_begin, row);
+    }
+
+    inline void insertIntoCol_(nz_index_type col, size_type row)
+    {
+        Col &c = tind_[col];
+        if (c.empty() || c.back() < row)
+        {
+            c.push_back(row);
+            return;
+        }
+
+        typename Col::iterator it = std::lower_bound(c.begin(), c.end(), row);
+        if (*it != row)
+            c.insert(it, row);
+    }
+
+    inline void eraseFromCol_(nz_index_type col, size_type row)
+    {
+        Col &c = tind_[col];
+        typename Col::iterator it = std::lower_bound(c.begin(), c.end(), row);
+        NTA_ASSERT(it != c.end() && *it == row)
+            << "SparseBinaryMatrix::eraseFromCol_: "
+            << "Column index out of sync at: " << row << ", " << col;
+        c.erase(it);
+    }
+
     template <typename OutputIterator>
     inline void fillLine_(size_type row, OutputIterator out,
                           OutputIterator out_end, bool reverse = false)
@@ -29,16 +29,22 @@
 
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
-#include <crucian/SparseBinaryMatrix.hpp>
-#include <crucian/SparseMatrix.hpp>
+#include <crucian/ArrayAlgo.hpp>
+#include <crucian/Inhibition.hpp>
+#include <crucian/SerialWorker.hpp>
+#include <crucian/SynapseStore.hpp>
+#include <crucian/ThreadPool.hpp>
 #include <crucian/Types.hpp>
 
 namespace crucian
 {
 
+class FrozenSpatialPooler;
+
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
@@ -64,10 +70,70 @@ namespace crucian
  *        <do something with output>
  *     }
  *
+ * Inference can also run concurrently on a trained spatial pooler shared
+ * by several threads, each with its own InferenceContext:
+ *
+ *     SpatialPooler::InferenceContext context;
+ *     sharedSp.compute(inputVector, activeColumns, context);
+ *
+ * With asynchronous learning on, see setAsyncLearning, compute returns as
+ * soon as the active columns are known and learning runs in the
+ * background until the next call.
+ *
  */
 class CRU_API SpatialPooler
 {
+    friend class FrozenSpatialPooler;
+
 public:
+    /**
+    The state of one caller of the const compute: the overlaps and active
+    columns of its last input, and the scratch of the inhibition. The
+    spatial pooler itself only holds the learned model during the const
+    compute, so any number of threads can run it at once on the same
+    spatial pooler, each with its own context.
+
+    A context can be used with any spatial pooler. Its buffers grow on the
+    first calls and are then reused.
+    */
+    class CRU_API InferenceContext
+    {
+    public:
+        InferenceContext() : parallel_(false) {}
+
+        /**
+        The overlaps of the last input computed with this context.
+        */
+        const std::vector<UInt> &getOverlaps() const { return overlaps_; }
+
+        /**
+        The active columns of the last input computed with this context,
+        sorted.
+        */
+        const std::vector<UInt> &getActiveColumns() const
+        {
+            return activeColumns_;
+        }
+
+    private:
+        friend class SpatialPooler;
+        friend class FrozenSpatialPooler;
+
+        // Reserves the buffers for numColumns columns, so that the
+        // inhibition does not allocate when its engine changes.
+        void reserve_(UInt numColumns);
+
+        // Whether the loops run on the spatial pooler's thread pool, which
+        // is only the case for its own context.
+        bool parallel_;
+
+        std::vector<UInt> overlaps_;
+        std::vector<Real> boostedOverlaps_;
+        std::vector<UInt> activeColumns_;
+
+        InhibitionScratch inhibition_;
+    };
+
     SpatialPooler();
     SpatialPooler(const std::vector<UInt> &inputDimensions,
                   const std::vector<UInt> &columnDimensions,
@@ -78,7 +144,23 @@ public:
                   Real synPermActiveInc = 0.05, Real synPermConnected = 0.1,
                   Real minPctOverlapDutyCycles = 0.001,
                   UInt dutyCyclePeriod = 1000, Real boostStrength = 0.0,
-                  Int seed = 1, UInt spVerbosity = 0, bool wrapAround = true);
+                  Int seed = 1, UInt spVerbosity = 0, bool wrapAround = true,
+                  UInt numThreads = 1);
+
+    /**
+    Waits for a pending learning step, see setAsyncLearning.
+     */
+    ~SpatialPooler();
+
+    /**
+    Copying or moving a spatial pooler first waits for the pending learning
+    steps of both sides, see setAsyncLearning. A copy with asynchronous
+    learning gets its own background thread.
+    */
+    SpatialPooler(const SpatialPooler &) = default;
+    SpatialPooler(SpatialPooler &&) = default;
+    SpatialPooler &operator=(const SpatialPooler &) = default;
+    SpatialPooler &operator=(SpatialPooler &&) = default;
 
     /**
     Initialize the spatial pooler using the given parameters.
@@ -199,6 +281,9 @@ public:
           at the beginning and end of an input dimension are considered
           neighbors for the purpose of mapping inputs to columns.
 
+    @param numThreads Number of threads used by compute, see
+          setNumThreads. The results do not depend on it.
+
      */
     void initialize(const std::vector<UInt> &inputDimensions,
                     const std::vector<UInt> &columnDimensions,
@@ -209,7 +294,8 @@ public:
                     Real synPermActiveInc = 0.1, Real synPermConnected = 0.1,
                     Real minPctOverlapDutyCycles = 0.001,
                     UInt dutyCyclePeriod = 1000, Real boostStrength = 0.0,
-                    Int seed = 1, UInt spVerbosity = 0, bool wrapAround = true);
+                    Int seed = 1, UInt spVerbosity = 0, bool wrapAround = true,
+                    UInt numThreads = 1);
 
     /**
     This is the main workshorse method of the SpatialPooler class. This
@@ -244,6 +330,98 @@ public:
      */
     void compute(UInt inputVector[], bool learn, UInt activeVector[]);
 
+    /**
+    Sparse variant of compute. The input is given as the list of indices of
+    the active input bits and the output as the list of indices of the
+    active columns. Overlaps are computed through an inverted index from
+    inputs to the columns connected to them, so the cost scales with the
+    number of active inputs times their fan-out rather than with the total
+    number of connected synapses.
+
+    @param activeInputs A vector of unique indices of the input bits that
+          are on. Each index must be smaller than getNumInputs().
+
+    @param learn A boolean value indicating whether learning should be
+          performed, see the dense compute.
+
+    @param activeColumns A vector that receives the indices of the winning
+          columns after inhibition, sorted in increasing order.
+     */
+    void compute(const std::vector<UInt> &activeInputs, bool learn,
+                 std::vector<UInt> &activeColumns);
+
+    /**
+    Bit-packed variant of compute, for inputs too dense for the sparse
+    variant. Each call counts the active input bits and computes the
+    overlaps either through the inverted index, as the sparse variant, or
+    as popcounts of the input words ANDed with each column's connected
+    synapses packed the same way, whichever costs less. The result is the
+    same as the dense compute.
+
+    @param inputBits The getNumInputs() input bits packed 64 per word:
+          input i is bit i % 64 of inputBits[i / 64]. The bits past
+          getNumInputs() in the last word are ignored.
+
+    @param learn A boolean value indicating whether learning should be
+          performed, see the dense compute.
+
+    @param activeVector An array of getNumColumns() integers receiving the
+          dense active columns, see the dense compute.
+     */
+    void compute(const UInt64 inputBits[], bool learn, UInt activeVector[]);
+
+    /**
+    Inference on a shared spatial pooler. Gives the same active columns as
+    compute(inputVector, false, activeVector), but leaves the spatial
+    pooler untouched: the overlaps and the active columns are kept in the
+    caller's context, and the iteration number and duty cycles do not
+    change. Several threads can thus call it at once on the same spatial
+    pooler, as long as no other method modifies it meanwhile. The calls do
+    not use the thread pool of the spatial pooler.
+
+    @param inputVector An array of getNumInputs() integer 0's and 1's, see
+          the dense compute.
+
+    @param activeVector An array of getNumColumns() integers receiving the
+          dense active columns.
+
+    @param context The state of the calling thread, see InferenceContext.
+     */
+    void compute(const UInt inputVector[], UInt activeVector[],
+                 InferenceContext &context) const;
+
+    /**
+    Sparse variant of the const compute, with the input and output as lists
+    of indices, see the sparse compute.
+     */
+    void compute(const std::vector<UInt> &activeInputs,
+                 std::vector<UInt> &activeColumns,
+                 InferenceContext &context) const;
+
+    /**
+    Runs inference (learn = false) on a batch of input vectors. The result
+    and the final state of the spatial pooler are the same as calling
+    compute(input, false, active) on each record in turn, but the overlaps
+    of a block of records are computed in one pass over each column's
+    connected synapses, which is much faster for large batches.
+
+    @param inputs An array of nRecords input vectors of getNumInputs()
+          integers each, stored one after the other.
+
+    @param nRecords The number of records in the batch.
+
+    @param activeOut An array of nRecords vectors of getNumColumns()
+          integers each, receiving the dense active columns of each record.
+     */
+    void computeBatch(const UInt inputs[], UInt nRecords, UInt activeOut[]);
+
+    /**
+    Returns an inference-only copy of the spatial pooler, which gives the
+    same active columns as compute with learning off in a fraction of the
+    memory, see FrozenSpatialPooler. Later learning does not change it.
+     */
+    FrozenSpatialPooler freeze() const;
+
     /**
      Removes the set of columns who have never been active from the set
      of active columns selected in the inhibition round. Such columns
@@ -265,28 +443,97 @@ public:
 
     /**
     Save (serialize) the current state of the spatial pooler to the
-    specified file.
+    specified stream, in the version 5 binary format: a little-endian
+    header followed by 64-byte aligned sections holding the column
+    statistics and the synapses as raw arrays, in the layout of their
+    SynapseStore. Open file streams in binary mode.
 
-    @param fd A valid file descriptor.
+    @param outStream A valid ostream.
      */
     void save(std::ostream &outStream) const;
 
+    /**
+    Save the current state of the spatial pooler in the version 2 text
+    format, which load still reads.
+
+    @param outStream A valid ostream.
+     */
+    void saveText(std::ostream &outStream) const;
+
     /**
     Load (deserialize) and initialize the spatial pooler from the
-    specified input stream.
+    specified input stream, in the binary format or the text format.
 
     @param inStream A valid istream.
      */
     void load(std::istream &inStream);
 
     /**
-    Returns the number of bytes that a save operation would result in.
-    Note: this method is currently somewhat inefficient as it just does
-    a full save into an ostream and counts the resulting size.
+    Load a file written by save by mapping it into memory, so that the
+    sections are copied straight into the spatial pooler without going
+    through a stream. The mapping is released once loaded.
+
+    @param path Path of the file.
+     */
+    void loadMapped(const std::string &path);
+
+    /**
+    Returns the number of bytes that a save operation would result in,
+    computed from the sizes of the sections.
 
     @returns Integer number of bytes
      */
-    UInt persistentSize() const;
+    size_t persistentSize() const;
+
+    /**
+    Starts a new checkpoint: saveDelta will save the changes from the
+    current state. Typically called right after saving a full checkpoint
+    with save. load and loadDelta also start a new checkpoint.
+     */
+    void markCheckpoint();
+
+    /**
+    Returns the number of columns whose synapses changed since the last
+    checkpoint, see markCheckpoint.
+
+    @returns Integer number of columns
+     */
+    UInt getNumDirtyColumns() const;
+
+    /**
+    Save the changes since the last checkpoint, then start a new one, see
+    markCheckpoint. A delta holds the parameters, the duty cycles, boost
+    factors and other per-column arrays, and the synapses of the columns
+    that changed only, which between frequent checkpoints are a small part
+    of the spatial pooler. Deltas can be appended to one stream.
+
+    @param outStream A valid ostream.
+     */
+    void saveDelta(std::ostream &outStream);
+
+    /**
+    Applies a delta written by saveDelta to the checkpoint it was saved
+    from, that is to a spatial pooler loaded from that checkpoint and
+    updated with the deltas saved before it, in order. Throws if the
+    spatial pooler is not at that checkpoint.
+
+    @param inStream A valid istream.
+     */
+    void loadDelta(std::istream &inStream);
+
+    /**
+    Merges a full checkpoint and the deltas saved after it into a new full
+    checkpoint, which loads as the spatial pooler at the last delta.
+
+    @param base A valid istream holding a checkpoint written by save.
+
+    @param deltas A valid istream holding the deltas, in order, up to its
+          end.
+
+    @param outStream A valid ostream receiving the new checkpoint.
+     */
+    static void compactCheckpoint(std::istream &base, std::istream &deltas,
+                                  std::ostream &outStream);
 
     /**
     Returns the dimensions of the columns in the region.
@@ -503,6 +750,81 @@ public:
     */
     void setWrapAround(bool wrapAround);
 
+    /**
+    Returns the number of threads used by compute.
+
+    @returns integer number of threads.
+    */
+    UInt getNumThreads() const;
+
+    /**
+    Sets the number of threads used by compute. With more than one thread,
+    the per-column phases (overlap, local inhibition, duty cycles, boost
+    factors, inhibition radius and minimum duty cycles) are split by column
+    range over a thread pool. So are the permanence updates of learning,
+    whose rows are then stored in column order. The split is deterministic
+    and every column is computed exactly as in the serial path, so the
+    results are bit-identical for any number of threads. Copies of the
+    spatial pooler share the pool.
+
+    @param numThreads number of threads, 0 for one per hardware thread.
+    */
+    void setNumThreads(UInt numThreads);
+
+    /**
+    Returns whether the boost factors of global inhibition use an
+    approximation of exp.
+
+    @returns boolean value of approximateBoost.
+    */
+    bool getApproximateBoost() const;
+
+    /**
+    Turns the approximation of exp for the boost factors of global
+    inhibition on or off. It is off by default. The approximation is
+    computed 4 or 8 columns at a time along with the duty cycles, instead
+    of one call to exp per column, and is within 1 ulp of it. The boost
+    factors then differ slightly, and so may the columns that win the
+    inhibition, so the results are no longer bit-identical to those of the
+    exact path. They still do not depend on the number of threads or on the
+    instruction set. The setting is not saved.
+
+    @param approximateBoost boolean value
+    */
+    void setApproximateBoost(bool approximateBoost);
+
+    /**
+    Returns whether learning is asynchronous.
+
+    @returns boolean value of asyncLearning.
+    */
+    bool getAsyncLearning() const;
+
+    /**
+    Turns asynchronous learning on or off. With asynchronous learning, a
+    compute with learning on returns once the active columns are known,
+    and the rest of the step (the duty cycles, the boost factors, the
+    permanences and, on update rounds, the inhibition radius) runs on a
+    background thread while the caller uses the output.
+
+    The input is copied before compute returns, so the caller may reuse
+    it. Every compute, save, load, freeze, copy and setter, and every getter
+    of what learning changes (the inhibition radius, the duty cycles, the
+    boost factors and the synapses), first waits for the pending step, so
+    the results are bit-identical to synchronous learning. An error of a
+    learning step is thrown by the next call that waits. Each copy of the
+    spatial pooler has its own background thread.
+
+    @param asyncLearning boolean value
+    */
+    void setAsyncLearning(bool asyncLearning);
+
+    /**
+    Waits until the pending learning step, if any, is done, see
+    setAsyncLearning. Rethrows its error.
+    */
+    void waitForLearning() const;
+
     /**
     Returns the update period.
 
@@ -612,6 +934,27 @@ public:
     */
     void setSynPermMax(Real synPermMax);
 
+    /**
+    Returns the number of bits of the fixed-point permanences, or 0 when
+    they are floating point.
+
+    @returns integer number of bits.
+    */
+    UInt getPermanenceBits() const;
+    /**
+    Chooses between floating point permanences (0) and 8 or 16-bit
+    fixed-point permanences over [synPermMin, synPermMax], converting the
+    current ones. Fixed-point permanences take 1 or 2 bytes per input of
+    each potential pool instead of 8 bytes per non-zero permanence. Values
+    are rounded to the nearest step and the increments and decrements of
+    learning to a whole, non zero number of steps, so learning stays
+    deterministic. Permanences of inputs outside a column's potential pool
+    are 0.
+
+    @param permanenceBits integer number of bits: 0, 8 or 16.
+    */
+    void setPermanenceBits(UInt permanenceBits);
+
     /**
     Returns the minimum tolerated overlaps, given as percent of
     neighbors overlap score.
@@ -773,11 +1116,122 @@ public:
     // Implementation methods. all methods below this line are
     // NOT part of the public API
 
-    static void toDense_(std::vector<UInt> &sparse, UInt dense[], UInt n);
+    static void toDense_(const std::vector<UInt> &sparse, UInt dense[],
+                         UInt n);
+
+    /**
+      Performs the learning part of compute that follows
+      updateColumnStatistics_: adapts the synapses of the active columns
+      (activeColumns_), bumps up the weak columns, updates the local boost
+      factors and, on update rounds, the inhibition radius and minimum duty
+      cycles.
+
+      @param inputVector  a dense int array of 0's and 1's that comprises
+      the input to the spatial pooler.
+    */
+    void learn_(const UInt inputVector[]);
+
+    /**
+      Performs the learning part of compute after inhibition: the column
+      statistics and learn_, now or on the learning thread, see
+      setAsyncLearning.
+
+      @param inputVector  the dense input of compute.
+
+      @param activeVector  the dense active columns, or nullptr to expand
+      them from activeColumns_.
+    */
+    void learnStep_(const UInt inputVector[], const UInt activeVector[]);
+
+    /**
+      Updates the per-column statistics of a compute step in one pass over
+      the columns: the overlap percentages and, when learning, the overlap
+      and active duty cycles (see updateDutyCyclesHelper_) and the global
+      boost factors. The pass is vectorized with AVX2 or SSE2, chosen at run
+      time from what the CPU supports. Every instruction set gives the same
+      results as the scalar loop, and so does the approximation of exp of
+      setApproximateBoost.
+
+      The boost factors increase the overlap of inactive columns to improve
+      their chances of becoming active, and hence encourage participation of
+      more columns in the learning process:
+      boostFactors = exp[ - boostStrength * (dutyCycle - targetDensity)]
+      With global inhibition, targetDensity is the sparsity of the spatial
+      pooler; see updateBoostFactorsLocal_ for local inhibition.
+
+      @param overlaps     the overlap score of each column.
+
+      @param activeArray  a dense int array of 0's and 1's marking the
+      columns that survived inhibition. Only read when learning.
+
+      @param learn        whether to update the duty cycles and boost
+      factors.
+
+      @param overlapPct   receives the overlap percentage of each column.
+    */
+    void updateColumnStatistics_(const std::vector<UInt> &overlaps,
+                                 const UInt activeArray[], bool learn,
+                                 std::vector<Real> &overlapPct);
+
+    /**
+      Returns the target density of active columns used by the inhibition
+      and the global boosting.
+    */
+    Real inhibitionDensity_() const;
+
+    /**
+      Copies the parameters the inhibition reads into inhibition_. Called
+      whenever one of them changes.
+    */
+    void updateInhibitionParameters_();
+
+    /**
+      Returns the thread pool the inhibition of a context runs on, which is
+      only set for the spatial pooler's own context.
+    */
+    ThreadPool *inhibitionThreadPool_(const InferenceContext &context) const
+    {
+        return context.parallel_ ? threadPool_.get() : nullptr;
+    }
 
     void boostOverlaps_(std::vector<UInt> &overlaps,
                         std::vector<Real> &boostedOverlaps);
 
+    /**
+      Calls f(begin, end) on contiguous column ranges covering
+      [begin, end), on the thread pool if there is one.
+    */
+    template <typename Function>
+    void parallelFor_(UInt begin, UInt end, const Function &f) const
+    {
+        if (threadPool_)
+        {
+            threadPool_->parallelFor(begin, end, f);
+        }
+        else if (begin < end)
+        {
+            f(begin, end);
+        }
+    }
+
+    /**
+      Same as parallelFor_ for the loops of a context, which only use the
+      thread pool for the spatial pooler's own context.
+    */
+    template <typename Function>
+    void parallelFor_(const InferenceContext &context, UInt begin, UInt end,
+                      const Function &f) const
+    {
+        if (context.parallel_)
+        {
+            parallelFor_(begin, end, f);
+        }
+        else if (begin < end)
+        {
+            f(begin, end);
+        }
+    }
+
     /**
       Maps a column to its respective input index, keeping to the topology of
       the region. It takes the index of the column as an argument and determines
@@ -832,6 +1286,14 @@ public:
     */
     std::vector<UInt> mapPotential_(UInt column, bool wrapAround);
 
+    /**
+      Same as mapPotential_, drawing from rng, with the potential pool
+      returned as a sorted list of inputs. Only reads the pooler, so columns
+      can be mapped concurrently with different generators.
+    */
+    void mapPotentialSparse_(UInt column, bool wrapAround, Random &rng,
+                             std::vector<UInt> &potential);
+
     /**
     Returns a randomly generated permanence value for a synapses that is
     initialized in a connected state.
@@ -847,6 +1309,7 @@ public:
     that is initialized in a connected state.
     */
     Real initPermConnected_();
+    Real initPermConnected_(Random &rng);
     /**
         Returns a randomly generated permanence value for a synapses that is to
        be initialized in a non-connected state.
@@ -855,6 +1318,7 @@ public:
        synapses that is to be initialized in a non-connected state.
     */
     Real initPermNonConnected_();
+    Real initPermNonConnected_(Random &rng);
 
     /**
       Initializes the permanences of a column. The method
@@ -872,6 +1336,24 @@ public:
     */
     std::vector<Real> initPermanence_(std::vector<UInt> &potential,
                                       Real connectedPct);
+
+    /**
+      Same as initPermanence_, drawing from rng, for the sorted potential
+      pool returned by mapPotentialSparse_: perm[i] is the permanence of
+      input potential[i].
+    */
+    void initPermanenceSparse_(const std::vector<UInt> &potential,
+                               Real connectedPct, Random &rng,
+                               std::vector<Real> &perm);
+
+    /**
+      Draws the potential pool and the initial permanences of a column, from
+      stream column + 1 of the generator seeded with seed, and raises them
+      to the stimulus threshold. Only reads the pooler, so columns can be
+      initialized concurrently.
+    */
+    void initColumn_(UInt column, UInt64 seed, std::vector<UInt> &potential,
+                     std::vector<Real> &perm);
     void clip_(std::vector<Real> &perm, bool trim);
 
     /**
@@ -910,6 +1392,157 @@ public:
     UInt raisePermanencesToThreshold_(std::vector<Real> &perm,
                                       std::vector<UInt> &potential);
 
+    /**
+       Allocates the scratch space used by compute for the current numbers
+       of inputs and columns, so that compute does not allocate memory in
+       steady state. Called by initialize and load.
+    */
+    void allocateScratch_();
+
+    /**
+       Writes the binary format of the given version, 4 or the current one,
+       which save writes.
+    */
+    void saveBinary_(std::ostream &outStream, UInt32 version) const;
+
+    /**
+       Loads the binary format written by save from size bytes at data.
+       The synapses of version 5 are copied in bulk, those of versions 3
+       and 4 are merged column by column.
+    */
+    void loadBinary_(const char *data, size_t size);
+
+    /**
+       Fills the UInt, Int and bool parameters and the Real parameters as
+       the binary formats store them.
+    */
+    void getBinaryParameters_(UInt uints[], Real reals[]) const;
+
+    /**
+       Sets the parameters from the arrays of getBinaryParameters_, except
+       for the dimensions and the permanence format.
+    */
+    void setBinaryParameters_(const UInt uints[], const Real reals[]);
+
+    /**
+       Checks that loaded dimensions are consistent with the numbers of
+       inputs and columns, which the topology code relies on.
+    */
+    void checkDimensions_() const;
+
+    /**
+       A column's permanences in sparse form: the inputs of its potential
+       pool and the inputs with a non-zero permanence, in increasing order,
+       with their permanences, whether they are in the potential pool and,
+       once prepared by prepareColumnSparse_, whether they are connected.
+    */
+    struct ColumnUpdate
+    {
+        std::vector<UInt> inputs;
+        std::vector<Real> perms;
+        std::vector<bool> potential;
+        std::vector<bool> connected;
+
+        void reserve(UInt size);
+    };
+
+    /**
+       Loads the permanences of a column in sparse form into column_, for
+       updatePermanencesForColumnSparse_.
+
+       @param column   The index of the column.
+    */
+    void loadColumnSparse_(UInt column);
+    void loadColumnSparse_(UInt column, ColumnUpdate &update) const;
+
+    /**
+       Whether updatePermanencesForColumnSparse_ can update a column from
+       its sparse form alone, which is the case unless the permanence
+       parameters are unusual.
+    */
+    bool canUpdateSparse_() const;
+
+    /**
+       The arithmetic of updatePermanencesForColumnSparse_, which leaves the
+       synapses to store in update: raises the permanences to the stimulus
+       threshold if raisePerm, then clips, rounds and trims them and decides
+       the connected synapses. It only reads the spatial pooler, so columns
+       can be prepared in parallel. Requires canUpdateSparse_.
+    */
+    void prepareColumnSparse_(ColumnUpdate &update, bool raisePerm) const;
+
+    /**
+       Rewrites a column's row of synapses_ with the synapses of update, as
+       left by prepareColumnSparse_.
+    */
+    void storeColumnSparse_(UInt column, const ColumnUpdate &update);
+
+    /**
+       Updates the permanences of the given columns: for each, loads it,
+       calls change(update) and updates it as
+       updatePermanencesForColumnSparse_ does. The columns are loaded,
+       changed and prepared in parallel by blocks, and stored in order, so
+       the result is the same as one column after the other.
+    */
+    template <typename Function>
+    void updateColumns_(const std::vector<UInt> &columns, bool raisePerm,
+                        const Function &change);
+
+    /**
+       Sizes columnUpdates_ for the number of threads, reserved for the
+       largest row, so that learning does not allocate.
+    */
+    void reserveColumnUpdates_();
+
+    /**
+       Sparse version of updatePermanencesForColumn_, for the permanences
+       of column_, loaded by loadColumnSparse_ and possibly modified since.
+
+       It gives exactly the same permanences, connected synapses and
+       connected counts as updatePermanencesForColumn_, but its cost is
+       proportional to the size of the column's potential pool instead of
+       the number of inputs. Every input of the column's potential pool
+       must be loaded.
+
+       @param column      The index of the column.
+
+       @param raisePerm   See updatePermanencesForColumn_.
+    */
+    void updatePermanencesForColumnSparse_(UInt column, bool raisePerm = true);
+
+    /**
+       Ends the rewriting of a column's row of synapses_ and updates its
+       connected count and, if its connected synapses changed, its connected
+       span.
+    */
+    void storeColumn_(UInt column);
+
+    /**
+       The bounds of the connected inputs of a column along one input
+       dimension: the lowest and highest coordinates and how many connected
+       inputs are at each of them.
+    */
+    struct ConnectedExtent
+    {
+        UInt lowest;
+        UInt highest;
+        UInt numLowest;
+        UInt numHighest;
+    };
+
+    /**
+       Sets the connected span of every column to 0, for empty rows.
+    */
+    void resetConnectedSpans_();
+
+    /**
+       Updates the connected extents and span of a column from the inputs
+       connected and disconnected by the last endRow of synapses_. A
+       dimension is rescanned only when the last connected input at one of
+       its bounds is disconnected, or every dimension when rescan is set.
+    */
+    void updateConnectedSpan_(UInt column, bool rescan = false);
+
     /**
        This function determines each column's overlap with the current
        input vector.
@@ -917,8 +1550,8 @@ public:
        The overlap of a column is the number of synapses for that column
        that are connected (permanence value is greater than
        '_synPermConnected') to input bits which are turned on. The
-       implementation takes advantage of the SparseBinaryMatrix class to
-       perform this calculation efficiently.
+       connected synapses of a column are a contiguous array of synapses_,
+       which makes this calculation efficient.
 
        @param inputVector
        a int array of 0's and 1's that comprises the input to the spatial
@@ -931,9 +1564,75 @@ public:
        input bits which are turned on.
     */
     void calculateOverlap_(UInt inputVector[], std::vector<UInt> &overlap);
+    void calculateOverlap_(const UInt inputVector[],
+                           std::vector<UInt> &overlap,
+                           const InferenceContext &context) const;
     void calculateOverlapPct_(std::vector<UInt> &overlaps,
                               std::vector<Real> &overlapPct);
 
+    /**
+       Same as calculateOverlap_ but takes the indices of the active input
+       bits. The overlaps are accumulated by walking, for every active
+       input, the list of columns connected to it, which synapses_ keeps
+       up to date as synapses change.
+
+       @param activeInputs
+       a vector of unique indices of the input bits that are on.
+
+       @param overlap
+       an int vector containing the overlap score for each column.
+    */
+    void calculateOverlapSparse_(const std::vector<UInt> &activeInputs,
+                                 std::vector<UInt> &overlap) const;
+
+    /**
+       Same as calculateOverlap_ for bit-packed input bits, see the packed
+       compute. The packed connected synapses are laid out on first use
+       and repacked for the columns whose connected synapses changed.
+    */
+    void calculateOverlapPacked_(const UInt64 inputBits[],
+                                 std::vector<UInt> &overlap);
+
+    /**
+       Whether calculateOverlapPacked_ uses the packed connected synapses
+       rather than the inverted index for an input with numActiveInputs
+       active bits.
+    */
+    bool usePackedOverlap_(UInt numActiveInputs);
+
+    /**
+       Lays out the packed connected synapses of all columns, each over the
+       words spanned by the inputs of its row of synapses_, and marks them
+       all for packing.
+    */
+    void layoutPackedConnected_();
+
+    /**
+       Packs the connected synapses of a column into its words.
+    */
+    void packConnected_(UInt column);
+
+    /**
+       Computes the overlaps of nRecords (at most BATCH_BLOCK) input vectors
+       at once. The inputs are first transposed so that the values of all
+       the records for a given input bit are contiguous, then every column's
+       connected synapses are walked once for the whole block.
+
+       @param inputs
+       nRecords dense input vectors stored one after the other.
+
+       @param nRecords
+       the number of records, between 1 and BATCH_BLOCK.
+
+       @param overlaps
+       receives nRecords overlap vectors of numColumns_ entries each.
+    */
+    void calculateOverlapBatch_(const UInt inputs[], UInt nRecords,
+                                std::vector<UInt> &overlaps);
+
+    // Number of records whose overlaps computeBatch computes in one pass.
+    static const UInt BATCH_BLOCK = 16;
+
     bool isWinner_(Real score, std::vector<std::pair<UInt, Real>> &winners,
                    UInt numWinners);
 
@@ -955,7 +1654,18 @@ public:
        columns.
     */
     void inhibitColumns_(const std::vector<Real> &overlaps,
-                         std::vector<UInt> &activeColumns);
+                         std::vector<UInt> &activeColumns)
+    {
+        inhibitColumns_(overlaps, activeColumns, context_);
+    }
+
+    /**
+       Same as inhibitColumns_ with the scratch of a context. The other
+       inhibition methods have the same two forms.
+    */
+    void inhibitColumns_(const std::vector<Real> &overlaps,
+                         std::vector<UInt> &activeColumns,
+                         InferenceContext &context) const;
 
     /**
        Perform global inhibition.
@@ -979,7 +1689,13 @@ public:
        an int array containing the indices of the active columns.
     */
     void inhibitColumnsGlobal_(const std::vector<Real> &overlaps, Real density,
-                               std::vector<UInt> &activeColumns);
+                               std::vector<UInt> &activeColumns)
+    {
+        inhibitColumnsGlobal_(overlaps, density, activeColumns, context_);
+    }
+    void inhibitColumnsGlobal_(const std::vector<Real> &overlaps, Real density,
+                               std::vector<UInt> &activeColumns,
+                               InferenceContext &context) const;
 
     /**
        Performs local inhibition.
@@ -1008,7 +1724,46 @@ public:
        an int array containing the indices of the active columns.
     */
     void inhibitColumnsLocal_(const std::vector<Real> &overlaps, Real density,
-                              std::vector<UInt> &activeColumns);
+                              std::vector<UInt> &activeColumns)
+    {
+        inhibitColumnsLocal_(overlaps, density, activeColumns, context_);
+    }
+    void inhibitColumnsLocal_(const std::vector<Real> &overlaps, Real density,
+                              std::vector<UInt> &activeColumns,
+                              InferenceContext &context) const;
+
+    /**
+       Local inhibition that visits the neighborhood of every column. Works
+       with any number of dimensions, in parallel when a thread pool is set.
+    */
+    void inhibitColumnsLocalWindow_(const std::vector<Real> &overlaps,
+                                    Real density,
+                                    std::vector<UInt> &activeColumns)
+    {
+        inhibitColumnsLocalWindow_(overlaps, density, activeColumns, context_);
+    }
+    void inhibitColumnsLocalWindow_(const std::vector<Real> &overlaps,
+                                    Real density,
+                                    std::vector<UInt> &activeColumns,
+                                    InferenceContext &context) const;
+
+    /**
+       Local inhibition with the same result as inhibitColumnsLocalWindow_,
+       for 1D and 2D topologies. It visits the columns by decreasing overlap
+       and counts the bigger neighbors with 2D Fenwick trees, so the cost per
+       column grows with log(numColumns) instead of with the size of the
+       neighborhood.
+    */
+    void inhibitColumnsLocalSweep_(const std::vector<Real> &overlaps,
+                                   Real density,
+                                   std::vector<UInt> &activeColumns)
+    {
+        inhibitColumnsLocalSweep_(overlaps, density, activeColumns, context_);
+    }
+    void inhibitColumnsLocalSweep_(const std::vector<Real> &overlaps,
+                                   Real density,
+                                   std::vector<UInt> &activeColumns,
+                                   InferenceContext &context) const;
 
     /**
         The primary method in charge of learning.
@@ -1046,6 +1801,8 @@ public:
        that exist for each input. For multiple dimension the aforementioned
         calculations are averaged over all dimensions of inputs and columns.
        This value is meaningless if global inhibition is enabled.
+       The connected span of each column is kept up to date as its
+       synapses change, so this only averages numColumns values.
     */
     void updateInhibitionRadius_();
 
@@ -1113,6 +1870,9 @@ public:
     locally. Each column's minimum duty cycles are set to be a percent of the
     maximum duty cycles in the column's neighborhood. Unlike
     _updateMinDutyCycles
+
+    For 1D and 2D topologies the neighborhood maxima come from separable
+    sliding-window maxima, in O(numColumns) whatever the inhibition radius.
     */
     void updateMinDutyCyclesLocal_();
 
@@ -1144,67 +1904,15 @@ public:
                                         std::vector<UInt> &newValues,
                                         UInt period);
 
-    /**
-    Updates the duty cycles for each column. The OVERLAP duty cycle is a moving
-    average of the number of inputs which overlapped with the each column. The
-    ACTIVITY duty cycles is a moving average of the frequency of activation for
-    each column.
-
-    @param overlaps       an int vector containing the overlap score for each
-    column. The overlap score for a column is defined as the number of synapses
-    in a "connected state" (connected synapses) that are connected to input bits
-    which are turned on.
-
-    @param activeArray  An int array containing the indices of the active
-    columns, the sprase set of columns which survived inhibition
-    */
-    void updateDutyCycles_(std::vector<UInt> &overlaps, const UInt activeArray[]);
-
-    /**
-      Update the boost factors for all columns. The boost factors are used to
-      increase the overlap of inactive columns to improve their chances of
-      becoming active, and hence encourage participation of more columns in the
-      learning process. The boosting function is a curve defined as:
-      boostFactors = exp[ - boostStrength * (dutyCycle - targetDensity)]
-      Intuitively this means that columns that have been active at the target
-      activation level have a boost factor of 1, meaning their overlap is not
-      boosted. Columns whose active duty cycle drops too much below that of
-      their neighbors are boosted depending on how infrequently they have been
-      active. Columns that has been active more than the target activation level
-      have a boost factor below 1, meaning their overlap is suppressed
-
-      The boostFactor depends on the activeDutyCycle via an exponential
-      function:
-
-                  boostFactor
-                  ^
-                  |
-                  |\
-                  | \
-            1  _  |  \
-                  |    _
-                  |      _ _
-                  |          _ _ _ _
-                  +--------------------> activeDutyCycle
-                        |
-                  targetDensity
-        @endverbatim
-      */
-    void updateBoostFactors_();
-
     /**
     Update boost factors when local inhibition is enabled. In this case,
     the target activation level for each column is estimated as the
     average activation level for columns in its neighborhood.
-    */
-    void updateBoostFactorsLocal_();
 
-    /**
-    Update boost factors when global inhibition is enabled. All columns
-    share the same target activation level in this case, which is the
-    sparsity of spatial pooler.
+    For 1D and 2D topologies the neighborhood averages come from a
+    summed-area table, in O(numColumns) whatever the inhibition radius.
     */
-    void updateBoostFactorsGlobal_();
+    void updateBoostFactorsLocal_();
 
     /**
     Updates counter instance variables each round.
@@ -1243,6 +1951,42 @@ public:
     static void printState(std::vector<Real> &state);
 
 protected:
+    /**
+      Owns the background thread of the asynchronous learning, if any.
+      Copying or moving it first waits for the pending steps of both sides,
+      and a copy starts a thread of its own, so a step never runs on a
+      spatial pooler that has been moved or assigned to.
+    */
+    class LearningWorker
+    {
+    public:
+        LearningWorker() {}
+        LearningWorker(const LearningWorker &other);
+        LearningWorker(LearningWorker &&other);
+        LearningWorker &operator=(const LearningWorker &other);
+        LearningWorker &operator=(LearningWorker &&other);
+
+        explicit operator bool() const { return worker_ != nullptr; }
+        SerialWorker *operator->() const { return worker_.get(); }
+
+        /**
+          Starts the thread if there is none, or stops it.
+        */
+        void setEnabled(bool enabled);
+
+        /**
+          Waits for the pending steps and rethrows their error.
+        */
+        void wait() const;
+
+    private:
+        std::unique_ptr<SerialWorker> worker_;
+    };
+
+    // Declared first, so that copies and moves wait for the pending
+    // learning steps before any of the members they write is copied.
+    LearningWorker learningWorker_;
+
     UInt numInputs_;
     UInt numColumns_;
     std::vector<UInt> columnDimensions_;
@@ -1263,6 +2007,11 @@ protected:
     bool wrapAround_;
     UInt updatePeriod_;
 
+    // Copy of the parameters above that the inhibition reads, kept by
+    // updateInhibitionParameters_ so that compute does not copy the column
+    // dimensions.
+    InhibitionParameters inhibition_;
+
     Real synPermMin_;
     Real synPermMax_;
     Real synPermTrimThreshold_;
@@ -1279,10 +2028,62 @@ protected:
 
     Real minPctOverlapDutyCycles_;
 
-    SparseMatrix<UInt, Real, Int, Real64> permanences_;
-    SparseBinaryMatrix<UInt, UInt> potentialPools_;
-    SparseBinaryMatrix<UInt, UInt> connectedSynapses_;
+    // The potential pools, permanences and connected synapses, one row per
+    // column.
+    SynapseStore synapses_;
     std::vector<UInt> connectedCounts_;
+    // avgConnectedSpanForColumnND_ of every column, kept up to date from
+    // the extents of its connected inputs along each input dimension.
+    std::vector<Real> connectedSpans_;
+    std::vector<ConnectedExtent> connectedExtents_;
+    // The iteration of the last checkpoint, see markCheckpoint.
+    UInt checkpointIteration_;
+
+    std::vector<UInt> inputDense_;
+    std::vector<UInt> activeDense_;
+
+    // A column's permanences in sparse form, see loadColumnSparse_.
+    ColumnUpdate column_;
+    // The columns updated in parallel by updateColumns_, a block at a time.
+    std::vector<ColumnUpdate> columnUpdates_;
+    // The columns bumped by bumpUpWeakColumns_.
+    std::vector<UInt> weakColumns_;
+
+    // Scratch for the window sums and maxima of the local boosting and
+    // minimum duty cycles.
+    std::vector<Real64> windowSums_;
+    std::vector<Real> windowMax_;
+    std::vector<Real> windowLine_;
+    std::vector<Real> windowPrefix_;
+    std::vector<Real> windowSuffix_;
+
+    // The scratch of the inhibition for compute. Only its inhibition
+    // scratch is used: the overlaps and active columns of compute are the
+    // members below.
+    InferenceContext context_;
+
+    // Scratch for computeBatch.
+    std::vector<UInt> batchInputs_;
+    std::vector<UInt> batchOverlaps_;
+
+    // The connected synapses packed 64 per word for the packed compute.
+    // Column i has packedRows_[i].numWords words at packedRows_[i].offset
+    // in packedConnected_, for the inputs from 64 * packedRows_[i].firstWord.
+    // Empty until the first packed compute.
+    struct PackedRow
+    {
+        size_t offset;
+        UInt firstWord;
+        UInt numWords;
+    };
+    std::vector<PackedRow> packedRows_;
+    std::vector<UInt64> packedConnected_;
+    std::vector<unsigned char> packedDirty_;
+    std::vector<UInt> activeInputs_;
+
+    UInt numThreads_;
+    std::shared_ptr<ThreadPool> threadPool_;
+    bool approximateBoost_;
 
     std::vector<UInt> overlaps_;
     std::vector<Real> overlapsPct_;
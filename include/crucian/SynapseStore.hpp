@@ -0,0 +1,464 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Definition of SynapseStore
+ */
+
+#ifndef NTA_SYNAPSE_STORE_HPP
+#define NTA_SYNAPSE_STORE_HPP
+
+#include <iosfwd>
+#include <vector>
+
+#include <crucian/FixedPointPermanences.hpp>
+#include <crucian/Log.hpp>
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * The synapses of the spatial pooler's columns: for every row (column),
+ * the inputs it has a synapse to, with their permanences, whether they are
+ * in the potential pool and whether they are connected.
+ *
+ * The rows share one arena of parallel arrays: inputs, potential flags and
+ * either floating point permanences or fixed-point codes. A row is a
+ * contiguous slice of the arena, its connected synapses first, then the
+ * others, both sorted by input. The connected synapses of a row are thus a
+ * plain array, and the potential pool, the permanences and the connected
+ * synapses are read and written together.
+ *
+ * A row holds every input of its potential pool, even with a permanence of
+ * 0, plus the connected inputs and the inputs with a non-zero permanence
+ * outside of it. Learning only changes permanences, so rows keep their
+ * size and are rewritten in place. A row that grows is moved to the end of
+ * the arena, and the arena is compacted when more than half of it is
+ * unused.
+ *
+ * An inverted index lists, for every input, the rows connected to it.
+ *
+ * The inputs of the arena take 16 bits when there are at most 65536
+ * inputs, 32 bits otherwise, and the rows of the inverted index take 16
+ * bits when there are at most 65536 rows, so that small models take about
+ * half the memory for their indices. The width is chosen by resize.
+ *
+ * Every rewritten row is marked dirty until clearDirty, so that a
+ * checkpoint can be limited to the rows that changed.
+ *
+ * Rows are rewritten with beginRow, append and endRow:
+ *   store.beginRow(row);
+ *   store.append(3, 0.2, true, true);
+ *   store.append(7, 0.0, true, false);
+ *   store.endRow();
+ */
+class CRU_API SynapseStore
+{
+public:
+    SynapseStore();
+
+    /**
+     * Removes all synapses and sets the number of rows and inputs. The
+     * permanence format is kept.
+     */
+    void resize(UInt numRows, UInt numInputs);
+
+    UInt getNumRows() const { return (UInt)rows_.size(); }
+
+    UInt getNumInputs() const { return numInputs_; }
+
+    /**
+     * The number of bits of the inputs of the arena, 16 or 32.
+     */
+    UInt getInputBits() const { return wideInputs_ ? 32 : 16; }
+
+    /**
+     * The number of bits of the inputs of the arena for a number of inputs.
+     */
+    static UInt getInputBits(UInt numInputs)
+    {
+        return numInputs > 0x10000 ? 32 : 16;
+    }
+
+    /**
+     * The number of bits of the rows of the inverted index, 16 or 32.
+     */
+    UInt getRowBits() const { return wideRows_ ? 32 : 16; }
+
+    /**
+     * The number of bytes of the synapses and the inverted index.
+     */
+    size_t getNumBytes() const;
+
+    /**
+     * Stores the permanences as floating point values (0 bits) or as
+     * fixed-point codes, see FixedPointPermanences, converting the stored
+     * ones in place. The connected flags are kept: rows should be
+     * rewritten if rounding changes them. Every row is marked dirty if
+     * the format changes.
+     */
+    void setPermanenceFormat(UInt bits, Real minimum, Real maximum);
+
+    /**
+     * The fixed-point format, disabled with floating point permanences.
+     */
+    const FixedPointPermanences &getFixedPoint() const { return codes_; }
+
+    /**
+     * Returns a permanence as it would be stored.
+     */
+    Real round(Real permanence) const
+    {
+        return codes_.enabled() ? codes_.decode(codes_.encode(permanence))
+                                : permanence;
+    }
+
+    UInt getRowSize(UInt row) const { return rows_[row].size; }
+
+    UInt getNumConnected(UInt row) const { return rows_[row].numConnected; }
+
+    /**
+     * The i-th connected input of a row, by increasing input.
+     */
+    UInt getConnected(UInt row, UInt i) const
+    {
+        NTA_ASSERT(i < rows_[row].numConnected);
+        return getInput_(rows_[row].begin + i);
+    }
+
+    /**
+     * Calls f(input) for the connected inputs of a row, by increasing
+     * input.
+     */
+    template <typename Function>
+    void forEachConnected(UInt row, const Function &f) const
+    {
+        const Row &r = rows_[row];
+        if (wideInputs_)
+        {
+            forEachIndex_(inputs32_.data() + r.begin, r.numConnected, f);
+        }
+        else
+        {
+            forEachIndex_(inputs16_.data() + r.begin, r.numConnected, f);
+        }
+    }
+
+    /**
+     * Calls f(row) for the rows connected to an input, in no particular
+     * order.
+     */
+    template <typename Function>
+    void forEachConnectedRow(UInt input, const Function &f) const
+    {
+        if (wideRows_)
+        {
+            const std::vector<UInt32> &rows = connectedRows32_[input];
+            forEachIndex_(rows.data(), rows.size(), f);
+        }
+        else
+        {
+            const std::vector<UInt16> &rows = connectedRows16_[input];
+            forEachIndex_(rows.data(), rows.size(), f);
+        }
+    }
+
+    /**
+     * The number of rows connected to an input.
+     */
+    UInt getNumConnectedRows(UInt input) const
+    {
+        return (UInt)(wideRows_ ? connectedRows32_[input].size()
+                                : connectedRows16_[input].size());
+    }
+
+    /**
+     * Reserves room in the inverted index for every input to be connected
+     * to all rows that have it in their potential pool, and room for the
+     * changes of a row, see getConnectedAdded, so that learning does not
+     * allocate.
+     */
+    void reserveConnectedRows();
+
+    /**
+     * The number of synapses of all rows.
+     */
+    size_t getNumSynapses() const;
+
+    /**
+     * The number of synapses in the potential pools of all rows.
+     */
+    size_t getNumPotential() const;
+
+    /**
+     * The number of synapses with a non-zero permanence in all rows.
+     */
+    size_t getNumNonZeros() const;
+
+    /**
+     * Calls f(input, permanence, potential, connected) for the synapses of
+     * a row, by increasing input.
+     */
+    template <typename Function>
+    void forEachSynapse(UInt row, const Function &f) const
+    {
+        if (wideInputs_)
+        {
+            forEachSynapse_(inputs32_.data(), row, f);
+        }
+        else
+        {
+            forEachSynapse_(inputs16_.data(), row, f);
+        }
+    }
+
+    /**
+     * Loads the synapses of a row by increasing input.
+     */
+    void getRow(UInt row, std::vector<UInt> &inputs, std::vector<Real> &perms,
+                std::vector<bool> &potential) const;
+
+    /**
+     * Starts rewriting a row. The synapses are then appended by increasing
+     * input and the row is replaced by endRow.
+     */
+    void beginRow(UInt row);
+
+    /**
+     * Appends a synapse to the row being rewritten. The permanence is
+     * stored rounded. A synapse outside of the potential pool that is not
+     * connected and has a permanence of 0 is dropped.
+     */
+    void append(UInt input, Real permanence, bool potential, bool connected)
+    {
+        if (!potential && !connected && permanence == 0)
+        {
+            return;
+        }
+        newInputs_.push_back(input);
+        newPerms_.push_back(permanence);
+        newFlags_.push_back((unsigned char)((potential ? POTENTIAL : 0) |
+                                            (connected ? CONNECTED : 0)));
+    }
+
+    /**
+     * Replaces the row started by beginRow with the appended synapses and
+     * returns its number of connected synapses.
+     */
+    UInt endRow();
+
+    /**
+     * Whether the last endRow changed the connected synapses of its row.
+     */
+    bool getConnectedChanged() const
+    {
+        return !connectedAdded_.empty() || !connectedRemoved_.empty();
+    }
+
+    /**
+     * The inputs that the last endRow connected to its row, by increasing
+     * input.
+     */
+    const std::vector<UInt> &getConnectedAdded() const
+    {
+        return connectedAdded_;
+    }
+
+    /**
+     * The inputs that the last endRow disconnected from its row, by
+     * increasing input.
+     */
+    const std::vector<UInt> &getConnectedRemoved() const
+    {
+        return connectedRemoved_;
+    }
+
+    /**
+     * Replaces the potential pool of a row with the sorted inputs in
+     * [begin, end), keeping the permanences and connected flags. The new
+     * inputs of the pool have a permanence of 0 and are not connected.
+     */
+    void setPotential(UInt row, const UInt *begin, const UInt *end);
+
+    /**
+     * Writes the inputs, the potential flags or the permanences of the
+     * synapses of all rows, row after row, as they are stored: inputs of
+     * getInputBits bits, one byte per potential flag (0 or 1) and the
+     * permanences as Real or as fixed-point codes of getBytesPerCode bytes,
+     * all in host byte order. Within a row the connected synapses come
+     * first.
+     */
+    void writeInputs(std::ostream &outStream) const;
+    void writePotential(std::ostream &outStream) const;
+    void writePermanences(std::ostream &outStream) const;
+
+    /**
+     * Replaces all rows with numSynapses synapses written by writeInputs,
+     * writePotential and writePermanences with the current number of inputs
+     * and permanence format. Row i has sizes[i] synapses, the first
+     * numConnected[i] of which are connected. The arrays are copied as a
+     * whole and the inverted index is rebuilt. Throws if the rows are not
+     * sorted, hold an input twice or an input out of range. Every row is
+     * marked dirty.
+     */
+    void loadRows(const UInt sizes[], const UInt numConnected[],
+                  size_t numSynapses, const char *inputs,
+                  const char *potential, const char *permanences);
+
+    /**
+     * Whether a row was rewritten since the last resize or clearDirty.
+     */
+    bool isDirty(UInt row) const { return dirty_[row] != 0; }
+
+    /**
+     * The number of dirty rows, see isDirty.
+     */
+    UInt getNumDirty() const;
+
+    /**
+     * Marks all rows as clean.
+     */
+    void clearDirty();
+
+private:
+    struct Row
+    {
+        size_t begin;
+        UInt size;
+        UInt capacity;
+        UInt numConnected;
+    };
+
+    enum
+    {
+        POTENTIAL = 1,
+        CONNECTED = 2
+    };
+
+    template <typename Index, typename Function>
+    static void forEachIndex_(const Index indices[], size_t n,
+                              const Function &f)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            f((UInt)indices[i]);
+        }
+    }
+
+    template <typename Index, typename Function>
+    void forEachSynapse_(const Index inputs[], UInt row,
+                         const Function &f) const
+    {
+        const Row &r = rows_[row];
+        size_t connected = r.begin;
+        const size_t connectedEnd = r.begin + r.numConnected;
+        size_t other = connectedEnd;
+        const size_t otherEnd = r.begin + r.size;
+        while (connected != connectedEnd || other != otherEnd)
+        {
+            const bool isConnected =
+                other == otherEnd ||
+                (connected != connectedEnd &&
+                 inputs[connected] < inputs[other]);
+            const size_t k = isConnected ? connected++ : other++;
+            f((UInt)inputs[k], getPermanence_(k), potential_[k] != 0,
+              isConnected);
+        }
+    }
+
+    UInt getInput_(size_t k) const
+    {
+        return wideInputs_ ? inputs32_[k] : inputs16_[k];
+    }
+
+    void setInput_(size_t k, UInt input)
+    {
+        if (wideInputs_)
+        {
+            inputs32_[k] = input;
+        }
+        else
+        {
+            inputs16_[k] = (UInt16)input;
+        }
+    }
+
+    Real getPermanence_(size_t k) const
+    {
+        return codes_.enabled() ? codes_.get(k) : perms_[k];
+    }
+
+    void setPermanence_(size_t k, Real permanence)
+    {
+        if (codes_.enabled())
+        {
+            codes_.set(k, permanence);
+        }
+        else
+        {
+            perms_[k] = permanence;
+        }
+    }
+
+    void resizeArena_(size_t size);
+    void reserveRow_(UInt row, UInt size);
+    void compact_();
+    template <typename RowId>
+    void buildConnectedRows_(std::vector<std::vector<RowId>> &connectedRows);
+    template <typename RowId>
+    void updateConnectedRows_(std::vector<std::vector<RowId>> &connectedRows,
+                              UInt row);
+
+    std::vector<Row> rows_;
+    size_t unused_;
+    std::vector<unsigned char> dirty_;
+
+    UInt numInputs_;
+
+    // The arena, with the inputs in inputs16_ or inputs32_, see
+    // getInputBits. perms_ is empty when codes_ is enabled.
+    bool wideInputs_;
+    std::vector<UInt16> inputs16_;
+    std::vector<UInt32> inputs32_;
+    std::vector<unsigned char> potential_;
+    std::vector<Real> perms_;
+    FixedPointPermanences codes_;
+
+    // The inverted index, in connectedRows16_ or connectedRows32_, see
+    // getRowBits.
+    bool wideRows_;
+    std::vector<std::vector<UInt16>> connectedRows16_;
+    std::vector<std::vector<UInt32>> connectedRows32_;
+
+    // The row being rewritten.
+    UInt newRow_;
+    std::vector<UInt> connectedAdded_;
+    std::vector<UInt> connectedRemoved_;
+    std::vector<UInt> newInputs_;
+    std::vector<Real> newPerms_;
+    std::vector<unsigned char> newFlags_;
+};
+
+} // namespace crucian
+
+#endif // NTA_SYNAPSE_STORE_HPP
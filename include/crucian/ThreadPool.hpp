@@ -0,0 +1,144 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Definition of ThreadPool
+ */
+
+#ifndef NTA_THREAD_POOL_HPP
+#define NTA_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <crucian/Types.hpp>
+
+namespace crucian
+{
+
+/**
+ * A fixed set of worker threads that run data parallel loops.
+ *
+ * Usage:
+ *   ThreadPool pool(4);
+ *   pool.parallelFor(0, n, [&](UInt begin, UInt end) {
+ *     for (UInt i = begin; i < end; i++)
+ *     {
+ *       out[i] = f(in[i]);
+ *     }
+ *   });
+ *
+ * parallelFor splits [begin, end) into at most getNumThreads() contiguous
+ * chunks. The split only depends on the range and the number of threads,
+ * never on scheduling, so a loop whose iterations are independent gives the
+ * same result as the serial loop. The calling thread runs the first chunk
+ * and returns once all chunks are done. If a chunk throws, the first
+ * exception is rethrown in the calling thread.
+ *
+ * Calls from different threads are serialized, so several objects may share
+ * one pool. parallelFor must not be called from inside a chunk.
+ */
+class CRU_API ThreadPool
+{
+public:
+    /**
+     * @param numThreads Total number of threads running a loop, including
+     * the calling thread. 0 means std::thread::hardware_concurrency().
+     */
+    explicit ThreadPool(UInt numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    UInt getNumThreads() const { return numThreads_; }
+
+    /**
+     * Calls f(chunkBegin, chunkEnd) on contiguous, non overlapping chunks
+     * that cover [begin, end).
+     */
+    template <typename Function>
+    void parallelFor(UInt begin, UInt end, const Function &f)
+    {
+        if (end <= begin)
+        {
+            return;
+        }
+
+        if (numThreads_ == 1 || end - begin == 1)
+        {
+            f(begin, end);
+            return;
+        }
+
+        run_(begin, end, &invoke_<Function>, &f);
+    }
+
+    /**
+     * Returns the bounds of chunk i when [begin, end) is split in n chunks.
+     */
+    static void chunk(UInt begin, UInt end, UInt n, UInt i, UInt &chunkBegin,
+                      UInt &chunkEnd)
+    {
+        const UInt64 size = end - begin;
+        chunkBegin = begin + (UInt)(size * i / n);
+        chunkEnd = begin + (UInt)(size * (i + 1) / n);
+    }
+
+private:
+    typedef void (*Task)(const void *, UInt, UInt);
+
+    template <typename Function>
+    static void invoke_(const void *f, UInt begin, UInt end)
+    {
+        (*static_cast<const Function *>(f))(begin, end);
+    }
+
+    void run_(UInt begin, UInt end, Task task, const void *f);
+    void runChunk_(UInt i);
+    void workerLoop_(UInt id);
+
+    UInt numThreads_;
+    std::vector<std::thread> workers_;
+
+    std::mutex runMutex_; // serializes parallelFor calls
+    std::mutex mutex_;    // protects the fields below
+    std::condition_variable start_;
+    std::condition_variable done_;
+    UInt64 generation_;
+    UInt pending_;
+    bool stop_;
+
+    Task task_;
+    const void *function_;
+    UInt begin_;
+    UInt end_;
+    UInt numChunks_;
+    std::exception_ptr error_;
+};
+
+} // namespace crucian
+
+#endif // NTA_THREAD_POOL_HPP
@@ -214,6 +214,69 @@ private:
     const UInt radius_;
 };
 
+/**
+ * Splits the neighborhood of center along one dimension of the given size
+ * into at most two half-open intervals, listed in the order in which
+ * Neighborhood and WrappingNeighborhood visit them.
+ *
+ * @returns
+ * The number of intervals.
+ */
+UInt neighborhoodIntervals(UInt center, UInt radius, UInt size, bool wrapAround,
+                           UInt begins[2], UInt ends[2]);
+
+/**
+ * Calls f on every index in the neighborhood of center, the center
+ * included, in the same order as Neighborhood or WrappingNeighborhood. One
+ * and two dimensional neighborhoods are visited without allocating.
+ */
+template <typename Function>
+void forEachNeighbor(UInt center, UInt radius,
+                     const std::vector<UInt> &dimensions, bool wrapAround,
+                     Function f)
+{
+    if (dimensions.size() <= 2)
+    {
+        const UInt nrows = dimensions.size() == 2 ? dimensions[0] : 1;
+        const UInt ncols = dimensions.back();
+        UInt rowBegins[2], rowEnds[2], colBegins[2], colEnds[2];
+        const UInt numRowIntervals =
+            neighborhoodIntervals(center / ncols, radius, nrows, wrapAround,
+                                  rowBegins, rowEnds);
+        const UInt numColIntervals =
+            neighborhoodIntervals(center % ncols, radius, ncols, wrapAround,
+                                  colBegins, colEnds);
+
+        for (UInt i = 0; i < numRowIntervals; i++)
+        {
+            for (UInt row = rowBegins[i]; row < rowEnds[i]; row++)
+            {
+                for (UInt j = 0; j < numColIntervals; j++)
+                {
+                    for (UInt col = colBegins[j]; col < colEnds[j]; col++)
+                    {
+                        f(row * ncols + col);
+                    }
+                }
+            }
+        }
+    }
+    else if (wrapAround)
+    {
+        for (UInt neighbor : WrappingNeighborhood(center, radius, dimensions))
+        {
+            f(neighbor);
+        }
+    }
+    else
+    {
+        for (UInt neighbor : Neighborhood(center, radius, dimensions))
+        {
+            f(neighbor);
+        }
+    }
+}
+
 } // end namespace crucian
 
 #endif // NTA_TOPOLOGY_HPP
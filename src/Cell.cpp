@@ -20,6 +20,8 @@
  * ---------------------------------------------------------------------
  */
 
+#include <atomic>
+
 #include <crucian/Cell.hpp>
 
 namespace crucian
@@ -38,8 +40,10 @@ Cell::Cell() : _segments(0), _freeSegments(0) {}
  * For example, in getBestMatchingCell if the two segments have activity equal
  * the max activity, different segments can get chosen.
  * The variable has no functional impact as far as accuracy is concerned.
+ * It is atomic since every Cells4 sets it when initialized, possibly on
+ * different threads.
  */
-static bool cellMatchPythonSegOrder = false;
+static std::atomic<bool> cellMatchPythonSegOrder(false);
 
 void Cell::setSegmentOrder(bool matchPythonOrder)
 {
@@ -69,7 +69,7 @@ Cells4::Cells4(UInt nColumns, UInt nCellsPerCol, UInt activationThreshold,
                Real permConnected, Real permMax, Real permDec, Real permInc,
                Real globalDecay, bool doPooling, int seed,
                bool checkSynapseConsistency)
-    : _rng(seed < 0 ? random() : seed)
+    : _rng(seed < 0 ? random() : seed), _numThreads(1)
 {
     _version = VERSION;
     initialize(nColumns, nCellsPerCol, activationThreshold, minThreshold,
@@ -162,7 +162,7 @@ bool Cells4::computeUpdate(UInt cellIdx, UInt segIdx,
         NTA_ASSERT(segIdx == (UInt)-1 || segIdx < _cells[cellIdx].size());
     }
 
-    static std::vector<UInt> newSynapses;
+    std::vector<UInt> &newSynapses = _newSynapses;
     newSynapses.clear(); // purge residual data
 
     if (segIdx != (UInt)-1)
@@ -170,12 +170,6 @@ bool Cells4::computeUpdate(UInt cellIdx, UInt segIdx,
 
         Segment &segment = _cells[cellIdx][segIdx];
 
-        static UInt highWaterSize = 0;
-        if (highWaterSize < segment.size())
-        {
-            highWaterSize = segment.size();
-            newSynapses.reserve(highWaterSize);
-        }
         for (UInt i = 0; i < segment.size(); ++i)
         {
             if (activeState.isSet(segment[i].srcCellIdx()))
@@ -229,9 +223,7 @@ void Cells4::addOutSynapses(UInt dstCellIdx, UInt dstSegIdx, It newSynapse,
     for (; newSynapse != newSynapsesEnd; ++newSynapse)
     {
         UInt srcCellIdx = *newSynapse;
-        OutSynapse newOutSyn(dstCellIdx, dstSegIdx);
-        NTA_ASSERT(not_in(newOutSyn, _outSynapses[srcCellIdx]));
-        _outSynapses[srcCellIdx].push_back(newOutSyn);
+        _outSynapses.add(srcCellIdx, OutSynapse(dstCellIdx, dstSegIdx));
     }
 }
 
@@ -253,15 +245,7 @@ void Cells4::eraseOutSynapses(UInt dstCellIdx, UInt dstSegIdx,
 
     for (auto &srcCellIdx : srcCells)
     {
-        OutSynapses &outSyns = _outSynapses[srcCellIdx];
-        // TODO: binary search or faster
-        for (UInt j = 0; j != outSyns.size(); ++j)
-            if (outSyns[j].goesTo(dstCellIdx, dstSegIdx))
-            {
-                std::swap(outSyns[j], outSyns[outSyns.size() - 1]);
-                outSyns.resize(outSyns.size() - 1);
-                break; // TODO: make sure we can do that
-            }
+        _outSynapses.erase(srcCellIdx, dstCellIdx, dstSegIdx);
     }
 }
 
@@ -296,7 +280,7 @@ void Cells4::inferBacktrack(const std::vector<UInt> &activeColumns)
     // up to the current time step and remove all the ones at the head of the
     // input history queue so that we don't waste time evaluating them again at
     // a later time step.
-    static std::vector<UInt> badPatterns;
+    std::vector<UInt> &badPatterns = _badPatterns;
     badPatterns.clear(); // purge residual data
 
     //---------------------------------------------------------------------------
@@ -588,7 +572,7 @@ UInt Cells4::learnBacktrack()
     // up to the current time step and remove all the ones at the head of the
     // input history queue so that we don't waste time evaluating them again at
     // a later time step.
-    static std::vector<UInt> badPatterns;
+    std::vector<UInt> &badPatterns = _badPatterns;
     badPatterns.clear(); // purge residual data
 
     //---------------------------------------------------------------------------
@@ -699,7 +683,7 @@ UInt Cells4::getCellForNewSegment(UInt colIdx)
     //  represent an 'A' in both context 1 and context 2. This is because the
     //  cell indices we choose in each column of a pattern will advance in
     //  lockstep (i.e. we pick cell indices of 1, then cell indices of 2, etc.).
-    static std::vector<UInt> candidateCellIdxs;
+    std::vector<UInt> &candidateCellIdxs = _candidateCellIdxs;
     candidateCellIdxs.clear(); // purge residual data
     UInt minIdx = getCellIdx(colIdx, 0), maxIdx = getCellIdx(colIdx, 0);
     if (_nCellsPerCol > 0)
@@ -980,7 +964,12 @@ void Cells4::updateLearningState(const std::vector<UInt> &activeColumns)
     // Process queued up segment updates, now that we have bottom-up, we
     // can update the permanences on the cells that we predicted to turn on
     // and did receive bottom-up
-    processSegmentUpdates(activeColumns, _learnPredictedStateT);
+    memset(_tmpInputBuffer.data(), 0, _nColumns * sizeof(_tmpInputBuffer[0]));
+    for (auto &elem : activeColumns)
+    {
+        _tmpInputBuffer[elem] = 1;
+    }
+    processSegmentUpdates(_tmpInputBuffer, _learnPredictedStateT);
 
     // Decrement the PAM counter if it is running and increment our learned
     // sequence length
@@ -1444,7 +1433,7 @@ void Cells4::_updateAvgLearnedSeqLength(UInt prevSeqLength)
 void Cells4::processSegmentUpdates(const std::vector<UInt>& input,
                                    const CState &predictedState)
 {
-    static std::vector<UInt> delUpdates;
+    std::vector<UInt> &delUpdates = _delUpdates;
     delUpdates.clear(); // purge residual data
 
     for (UInt i = 0; i != _segmentUpdates.size(); ++i)
@@ -1511,7 +1500,7 @@ void Cells4::processSegmentUpdates(const std::vector<UInt>& input,
  */
 void Cells4::cleanUpdatesList(UInt cellIdx, UInt segIdx)
 {
-    static std::vector<UInt> delUpdates;
+    std::vector<UInt> &delUpdates = _cleanUpdates;
     delUpdates.clear(); // purge residual data
 
     for (UInt i = 0; i != _segmentUpdates.size(); ++i)
@@ -1567,7 +1556,7 @@ void Cells4::applyGlobalDecay()
                 if (age > _maxAge)
                 {
 
-                    static std::vector<UInt> removedSynapses;
+                    std::vector<UInt> &removedSynapses = _removedSynapses;
                     removedSynapses.clear(); // purge residual data
                     nSegmentsDecayed++;
 
@@ -1711,17 +1700,18 @@ void Cells4::adaptSegment(const SegmentUpdate &update)
         // Tracks source cell indexes corresponding to synapses in
         // the given segment that have been removed during execution of this
         // method
-        static std::vector<UInt> removed;
+        std::vector<UInt> &removed = _removed;
         // Source cell indexes corresponding to synapses in the given segment
         // whose permances are to be decremented/incremented; ordered by index
         // of those synapses within the segment
-        static std::vector<UInt> synToDec, synToInc;
+        std::vector<UInt> &synToDec = _synToDec, &synToInc = _synToInc;
         // Indexes of synapses within the current segment corresponding to
         // synapses that are inactive/active in ascending order; these variables
         // correlate with synToDec and synToInc.
-        static std::vector<UInt> inactiveSegmentIndices, activeSegmentIndices;
+        std::vector<UInt> &inactiveSegmentIndices = _inactiveSegmentIndices;
+        std::vector<UInt> &activeSegmentIndices = _activeSegmentIndices;
 
-        // Purge residual data from static variable; the others will be purged
+        // Purge residual data from scratch variable; the others will be purged
         // by _generateListsOfSynapsesToAdjustForAdaptSegment
         removed.clear();
 
@@ -1808,6 +1798,7 @@ void Cells4::adaptSegment(const SegmentUpdate &update)
 
         // Initialize the new segment's last active iteration and frequency
         // related counts
+        _learnActivity.reserveSegments(_cells[cellIdx].size());
         _cells[cellIdx][si]._lastActiveIteration = _nLrnIterations;
         _cells[cellIdx][si]._positiveActivations = 1;
         _cells[cellIdx][si]._totalActivations = 1;
@@ -1867,7 +1858,7 @@ void Cells4::trimOldSegments(UInt maxAge)
 
             if ((age > maxAge) && (seg.nConnected() < _activationThreshold))
             {
-                static std::vector<UInt> removedSynapses;
+                std::vector<UInt> &removedSynapses = _removedSynapses;
                 removedSynapses.clear(); // purge residual data
 
                 for (UInt i = 0; i != seg.size(); ++i)
@@ -1889,14 +1880,28 @@ void Cells4::trimOldSegments(UInt maxAge)
 // This is useful if segments have changed.
 void Cells4::rebuildOutSynapses()
 {
-    // TODO: Is this logic sufficient?
+    // Count the out synapses of every source cell first, so that the rows
+    // are laid out contiguously, with a little slack to grow in place.
     _outSynapses.resize(_nCells);
-
-    // Clear existing out synapses
-    for (UInt srcCellIdx = 0; srcCellIdx != _nCells; ++srcCellIdx)
+    std::vector<UInt> capacities(_nCells, 0);
+    size_t numSynapses = 0;
+    for (UInt dstCellIdx = 0; dstCellIdx != _nCells; ++dstCellIdx)
+    {
+        for (UInt segIdx = 0; segIdx != _cells[dstCellIdx].size(); ++segIdx)
+        {
+            const Segment &seg = _cells[dstCellIdx][segIdx];
+            for (UInt synIdx = 0; synIdx != seg.size(); ++synIdx)
+            {
+                ++capacities[seg.getSrcCellIdx(synIdx)];
+            }
+            numSynapses += seg.size();
+        }
+    }
+    for (UInt &capacity : capacities)
     {
-        _outSynapses[srcCellIdx].clear();
+        capacity += capacity / 4;
     }
+    _outSynapses.reserve(capacities, numSynapses);
 
     // Iterate through every synapse in every cell and rebuild new OutSynapses
     // data structure
@@ -1908,8 +1913,7 @@ void Cells4::rebuildOutSynapses()
             for (UInt synIdx = 0; synIdx != seg.size(); ++synIdx)
             {
                 UInt srcCellIdx = seg.getSrcCellIdx(synIdx);
-                OutSynapse newOutSyn(dstCellIdx, segIdx);
-                _outSynapses[srcCellIdx].push_back(newOutSyn);
+                _outSynapses.add(srcCellIdx, OutSynapse(dstCellIdx, segIdx));
             }
         }
     }
@@ -1922,8 +1926,8 @@ void Cells4::rebuildOutSynapses()
                 << "] connects to: ";
 
       // Analyze OutSynapses
-      for (UInt j = 0; j != _outSynapses[i].size(); ++j) {
-        const OutSynapse& syn = _outSynapses[i][j];
+      for (UInt j = 0; j != _outSynapses.getRowSize(i); ++j) {
+        const OutSynapse& syn = _outSynapses.getRow(i)[j];
         UInt destCol =  (UInt) (syn.dstCellIdx() / _nCellsPerCol);
         UInt destCell = syn.dstCellIdx() - destCol*_nCellsPerCol;
 
@@ -2150,6 +2154,11 @@ void Cells4::load(std::istream &inStream)
     for (UInt i = 0; i != _nCells; ++i)
     {
         _cells[i].load(inStream);
+        _learnActivity.reserveSegments(_cells[i].size());
+    }
+    if (_maxSegmentsPerCell > 0)
+    {
+        _learnActivity.reserveSegments((UInt)_maxSegmentsPerCell);
     }
 
     _infActiveStateT.load(inStream);
@@ -2270,10 +2279,10 @@ bool Cells4::invariants(bool verbose) const
         }
 
         // Analyze OutSynapses
-        for (UInt j = 0; j != _outSynapses[i].size(); ++j)
+        for (UInt j = 0; j != _outSynapses.getRowSize(i); ++j)
         {
 
-            const OutSynapse &syn = _outSynapses[i][j];
+            const OutSynapse &syn = _outSynapses.getRow(i)[j];
 
             stringstream buf;
             buf << syn.dstCellIdx() << '.' << syn.dstSegIdx() << '.' << i;
@@ -2289,6 +2298,7 @@ bool Cells4::invariants(bool verbose) const
     }
 
     consistent &= back_map == forward_map;
+    consistent &= _outSynapses.invariants();
 
     if (!consistent)
     {
@@ -2323,7 +2333,7 @@ void Cells4::addNewSegment(
 
     UInt cellIdx = colIdx * _nCellsPerCol + cellIdxInCol;
 
-    static std::vector<UInt> synapses;
+    std::vector<UInt> &synapses = _extSynapses;
     synapses.resize(extSynapses.size()); // how many slots we need
     for (UInt i = 0; i != extSynapses.size(); ++i)
         synapses[i] =
@@ -2347,7 +2357,7 @@ void Cells4::updateSegment(
     UInt cellIdx = colIdx * _nCellsPerCol + cellIdxInCol;
     bool sequenceSegmentFlag = segment(cellIdx, segIdx).isSequenceSegment();
 
-    static std::vector<UInt> synapses;
+    std::vector<UInt> &synapses = _extSynapses;
     synapses.resize(extSynapses.size()); // how many slots we need
     for (UInt i = 0; i != extSynapses.size(); ++i)
         synapses[i] =
@@ -2364,6 +2374,24 @@ void Cells4::setCellSegmentOrder(bool matchPythonOrder)
     Cell::setSegmentOrder(matchPythonOrder);
 }
 
+void Cells4::setNumThreads(UInt numThreads)
+{
+    if (numThreads == 1)
+    {
+        _threadPool.reset();
+        _numThreads = 1;
+        return;
+    }
+
+    _threadPool = std::make_shared<ThreadPool>(numThreads);
+    _numThreads = _threadPool->getNumThreads();
+    _nonzeroCells.resize(_numThreads);
+    _nonzeroSegs.resize(_numThreads);
+    _forwardKeys.resize(_numThreads);
+    _forwardOffsets.resize(_numThreads * (_numThreads + 16));
+    _forwardEnds.resize(_numThreads * (_numThreads + 8));
+}
+
 void Cells4::initialize(UInt nColumns, UInt nCellsPerCol,
                         UInt activationThreshold, UInt minThreshold,
                         UInt newSynapseCount, UInt segUpdateValidDuration,
@@ -2375,7 +2403,6 @@ void Cells4::initialize(UInt nColumns, UInt nCellsPerCol,
     _nColumns = nColumns;
     _nCellsPerCol = nCellsPerCol;
     _nCells = nColumns * nCellsPerCol;
-    NTA_CHECK(_nCells <= _MAX_CELLS);
 
     _activationThreshold = activationThreshold;
     _minThreshold = minThreshold;
@@ -2410,6 +2437,7 @@ void Cells4::initialize(UInt nColumns, UInt nCellsPerCol,
     _cells.resize(_nCells);
     Cell::setSegmentOrder(false);
     _outSynapses.resize(_nCells);
+    _learnActivity.initialize(_nCells, 1);
 
     _infActiveStateT.initialize(_nCells);
     _infActiveStateT1.initialize(_nCells);
@@ -2662,17 +2690,17 @@ void Cells4::chooseCellsToLearnFrom(UInt cellIdx, UInt segIdx, UInt nSynToAdd,
 
     // start with a sorted vector of all the cells that are on in the current
     // state
-    static std::vector<UInt> vecCellBuffer;
+    std::vector<UInt> &vecCellBuffer = _cellBuffer;
     vecCellBuffer = state.cellsOn(true);
 
     // remove any cells already in this segment
-    static std::vector<UInt> vecPruned;
+    std::vector<UInt> &vecPruned = _prunedCells;
     if (segIdx != (UInt)-1)
     {
 
         // collect the sorted list of source cell indices
-        Segment segThis = _cells[cellIdx][segIdx];
-        static std::vector<UInt> vecAlreadyHave;
+        const Segment &segThis = _cells[cellIdx][segIdx];
+        std::vector<UInt> &vecAlreadyHave = _alreadyHave;
         if (vecAlreadyHave.capacity() < segThis.size())
             vecAlreadyHave.reserve(segThis.size());
         vecAlreadyHave.clear(); // purge residual data
@@ -2757,7 +2785,7 @@ std::pair<UInt, UInt> Cells4::trimSegments(Real minPermanence, UInt minNumSyns)
         for (UInt segIdx = 0; segIdx != _cells[cellIdx].size(); ++segIdx)
         {
 
-            static std::vector<UInt> removedSynapses;
+            std::vector<UInt> &removedSynapses = _removedSynapses;
             removedSynapses.clear(); // purge residual data
 
             Segment &seg = segment(cellIdx, segIdx);
@@ -3054,14 +3082,22 @@ void Cells4::computeForwardPropagation(CStateIndexed &state)
     // activity coming into a cell.
 
     // process all cells that are on in the current state
-    static std::vector<UInt> vecCellBuffer;
+    std::vector<UInt> &vecCellBuffer = _cellBuffer;
     vecCellBuffer = state.cellsOn();
+    if (_threadPool)
+    {
+        propagateForward(vecCellBuffer);
+        return;
+    }
     std::vector<UInt>::iterator iterCellBuffer;
     for (iterCellBuffer = vecCellBuffer.begin();
          iterCellBuffer != vecCellBuffer.end(); ++iterCellBuffer)
     {
-        std::vector<OutSynapse> &os = _outSynapses[*iterCellBuffer];
-        for (UInt j = 0; j != os.size(); ++j)
+        if (iterCellBuffer + 1 != vecCellBuffer.end())
+            _outSynapses.prefetch(iterCellBuffer[1]);
+        const OutSynapse *os = _outSynapses.getRow(*iterCellBuffer);
+        const UInt nOut = _outSynapses.getRowSize(*iterCellBuffer);
+        for (UInt j = 0; j != nOut; ++j)
         {
             UInt dstCellIdx = os[j].dstCellIdx();
             UInt dstSegIdx = os[j].dstSegIdx();
@@ -3089,6 +3125,18 @@ void Cells4::computeForwardPropagation(CState &state)
     // on Neo15!
     _inferActivity.reset();
 
+    if (_threadPool)
+    {
+        _cellBuffer.clear();
+        for (UInt i = 0; i < _nCells; i++)
+        {
+            if (state.isSet(i))
+                _cellBuffer.push_back(i);
+        }
+        propagateForward(_cellBuffer);
+        return;
+    }
+
     // Compute cell and segment activity by following forward propagation
     // links from each source cell.  _cellActivity will be set to the total
     // activity coming into a cell.
@@ -3102,8 +3150,9 @@ void Cells4::computeForwardPropagation(CState &state)
         {
             if ((eightStates & 0xffu) != 0)
             {
-                std::vector<OutSynapse> &os = _outSynapses[i + k];
-                for (UInt j = 0; j != os.size(); ++j)
+                const OutSynapse *os = _outSynapses.getRow(i + k);
+                const UInt nOut = _outSynapses.getRowSize(i + k);
+                for (UInt j = 0; j != nOut; ++j)
                 {
                     UInt dstCellIdx = os[j].dstCellIdx();
                     UInt dstSegIdx = os[j].dstSegIdx();
@@ -3118,8 +3167,9 @@ void Cells4::computeForwardPropagation(CState &state)
     {
         if (state.isSet(i))
         {
-            std::vector<OutSynapse> &os = _outSynapses[i];
-            for (UInt j = 0; j != os.size(); ++j)
+            const OutSynapse *os = _outSynapses.getRow(i);
+            const UInt nOut = _outSynapses.getRowSize(i);
+            for (UInt j = 0; j != nOut; ++j)
             {
                 UInt dstCellIdx = os[j].dstCellIdx();
                 UInt dstSegIdx = os[j].dstSegIdx();
@@ -3137,8 +3187,9 @@ void Cells4::computeForwardPropagation(CState &state)
         {
             if ((fourStates & 0xff) != 0)
             {
-                std::vector<OutSynapse> &os = _outSynapses[i + k];
-                for (UInt j = 0; j != os.size(); ++j)
+                const OutSynapse *os = _outSynapses.getRow(i + k);
+                const UInt nOut = _outSynapses.getRowSize(i + k);
+                for (UInt j = 0; j != nOut; ++j)
                 {
                     UInt dstCellIdx = os[j].dstCellIdx();
                     UInt dstSegIdx = os[j].dstSegIdx();
@@ -3153,8 +3204,9 @@ void Cells4::computeForwardPropagation(CState &state)
     {
         if (state.isSet(i))
         {
-            std::vector<OutSynapse> &os = _outSynapses[i];
-            for (UInt j = 0; j != os.size(); ++j)
+            const OutSynapse *os = _outSynapses.getRow(i);
+            const UInt nOut = _outSynapses.getRowSize(i);
+            for (UInt j = 0; j != nOut; ++j)
             {
                 UInt dstCellIdx = os[j].dstCellIdx();
                 UInt dstSegIdx = os[j].dstSegIdx();
@@ -3166,6 +3218,90 @@ void Cells4::computeForwardPropagation(CState &state)
 }
 #endif // SOME_STATES_NOT_INDEXED
 
+void Cells4::propagateForward(const std::vector<UInt> &srcCells)
+{
+    NTA_ASSERT(_threadPool);
+    const UInt numThreads = _numThreads;
+    const UInt numSrcCells = (UInt)srcCells.size();
+
+    // Each thread follows the out synapses of its share of srcCells and
+    // files their segments by destination range: cell c is in range
+    // c * numThreads / _nCells, computed in 32.32 fixed point.
+    const UInt64 rangeScale = ((UInt64)numThreads << 32) / _nCells;
+    _threadPool->parallelFor(0, numThreads, [&](UInt begin, UInt end) {
+        for (UInt t = begin; t < end; t++)
+        {
+            UInt srcBegin, srcEnd;
+            ThreadPool::chunk(0, numSrcCells, numThreads, t, srcBegin, srcEnd);
+
+            // Count the keys of every range first, so that the ranges are
+            // laid out back to back in a buffer of exactly as many keys.
+            UInt *offsets = &_forwardOffsets[t * (numThreads + 16)];
+            std::fill(offsets, offsets + numThreads + 1, 0);
+            for (UInt i = srcBegin; i != srcEnd; ++i)
+            {
+                const OutSynapse *os = _outSynapses.getRow(srcCells[i]);
+                const UInt nOut = _outSynapses.getRowSize(srcCells[i]);
+                for (UInt j = 0; j != nOut; ++j)
+                {
+                    ++offsets[((os[j].dstCellIdx() * rangeScale) >> 32) + 1];
+                }
+            }
+            for (UInt d = 0; d < numThreads; d++)
+                offsets[d + 1] += offsets[d];
+
+            std::vector<UInt> &keys = _forwardKeys[t];
+            if (keys.size() < offsets[numThreads])
+                keys.resize(offsets[numThreads]);
+            UInt **ends = &_forwardEnds[t * (numThreads + 8)];
+            for (UInt d = 0; d < numThreads; d++)
+                ends[d] = keys.data() + offsets[d];
+
+            for (UInt i = srcBegin; i != srcEnd; ++i)
+            {
+                if (i + 1 != srcEnd)
+                    _outSynapses.prefetch(srcCells[i + 1]);
+                const OutSynapse *os = _outSynapses.getRow(srcCells[i]);
+                const UInt nOut = _outSynapses.getRowSize(srcCells[i]);
+                for (UInt j = 0; j != nOut; ++j)
+                {
+                    const UInt dstCellIdx = os[j].dstCellIdx();
+                    const UInt d = (UInt)((dstCellIdx * rangeScale) >> 32);
+                    *ends[d]++ = _learnActivity.getSegmentKey(
+                        dstCellIdx, os[j].dstSegIdx());
+                }
+            }
+        }
+    });
+
+    // Then each thread increments the segments of its own destination
+    // range.
+    _threadPool->parallelFor(0, numThreads, [&](UInt begin, UInt end) {
+        for (UInt d = begin; d < end; d++)
+        {
+            std::vector<UInt> &nonzeroCells = _nonzeroCells[d];
+            std::vector<UInt> &nonzeroSegs = _nonzeroSegs[d];
+            nonzeroCells.clear();
+            nonzeroSegs.clear();
+            for (UInt t = 0; t < numThreads; t++)
+            {
+                const UInt *offsets = &_forwardOffsets[t * (numThreads + 16)];
+                const UInt *keys = _forwardKeys[t].data();
+                for (UInt k = offsets[d]; k != offsets[d + 1]; ++k)
+                {
+                    _learnActivity.incrementUntracked(keys[k], nonzeroCells,
+                                                      nonzeroSegs);
+                }
+            }
+        }
+    });
+
+    for (UInt t = 0; t < numThreads; t++)
+    {
+        _learnActivity.track(_nonzeroCells[t], _nonzeroSegs[t]);
+    }
+}
+
 //--------------------------------------------------------------------------------
 // Dump detailed Cells4 timing report to stdout
 //--------------------------------------------------------------------------------
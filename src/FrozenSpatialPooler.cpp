@@ -0,0 +1,116 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of FrozenSpatialPooler
+ */
+
+#include <algorithm>
+
+#include <crucian/FrozenSpatialPooler.hpp>
+#include <crucian/Log.hpp>
+
+namespace crucian
+{
+
+FrozenSpatialPooler::FrozenSpatialPooler()
+    : numInputs_(0), numColumns_(0), offsets_(1, 0)
+{
+}
+
+size_t FrozenSpatialPooler::getIndexSize() const
+{
+    return offsets_.size() * sizeof(size_t) +
+           columns16_.size() * sizeof(UInt16) +
+           columns32_.size() * sizeof(UInt32);
+}
+
+template <typename ColumnId>
+void FrozenSpatialPooler::addOverlaps_(const ColumnId columns[], UInt input,
+                                       std::vector<UInt> &overlaps) const
+{
+    const ColumnId *end = columns + offsets_[input + 1];
+    for (const ColumnId *column = columns + offsets_[input]; column != end;
+         ++column)
+    {
+        ++overlaps[*column];
+    }
+}
+
+void FrozenSpatialPooler::addOverlaps_(UInt input,
+                                       std::vector<UInt> &overlaps) const
+{
+    NTA_ASSERT(input < numInputs_);
+    if (!columns16_.empty())
+    {
+        addOverlaps_(columns16_.data(), input, overlaps);
+    }
+    else
+    {
+        addOverlaps_(columns32_.data(), input, overlaps);
+    }
+}
+
+void FrozenSpatialPooler::inhibit_(
+    SpatialPooler::InferenceContext &context) const
+{
+    context.boostedOverlaps_.assign(context.overlaps_.begin(),
+                                    context.overlaps_.end());
+    inhibitColumns(inhibition_, context.boostedOverlaps_,
+                   context.activeColumns_, context.inhibition_);
+    std::sort(context.activeColumns_.begin(), context.activeColumns_.end());
+}
+
+void FrozenSpatialPooler::compute(
+    const UInt inputVector[], UInt activeVector[],
+    SpatialPooler::InferenceContext &context) const
+{
+    context.reserve_(numColumns_);
+    context.overlaps_.assign(numColumns_, 0);
+    for (UInt input = 0; input < numInputs_; input++)
+    {
+        if (inputVector[input])
+        {
+            addOverlaps_(input, context.overlaps_);
+        }
+    }
+    inhibit_(context);
+    SpatialPooler::toDense_(context.activeColumns_, activeVector,
+                            numColumns_);
+}
+
+void FrozenSpatialPooler::compute(
+    const std::vector<UInt> &activeInputs, std::vector<UInt> &activeColumns,
+    SpatialPooler::InferenceContext &context) const
+{
+    context.reserve_(numColumns_);
+    context.overlaps_.assign(numColumns_, 0);
+    for (UInt input : activeInputs)
+    {
+        addOverlaps_(input, context.overlaps_);
+    }
+    inhibit_(context);
+    activeColumns.assign(context.activeColumns_.begin(),
+                         context.activeColumns_.end());
+}
+
+} // namespace crucian
@@ -0,0 +1,412 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of the inhibition of the spatial pooler's columns
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <crucian/Inhibition.hpp>
+#include <crucian/Log.hpp>
+#include <crucian/Topology.hpp>
+
+namespace crucian
+{
+
+// Neighborhood size from which inhibitColumnsLocal uses the sweep.
+static const UInt SWEEP_MIN_NEIGHBORHOOD = 25;
+
+// Counts marked columns in rectangles of a 2D topology, using a 2D Fenwick
+// tree stored in a vector owned by the caller.
+class NeighborhoodCounter2D
+{
+public:
+    NeighborhoodCounter2D(std::vector<Int> &tree, UInt nrows, UInt ncols)
+        : tree_(tree), nrows_(nrows), ncols_(ncols)
+    {
+        tree_.assign(nrows * ncols, 0);
+    }
+
+    void add(UInt row, UInt col, Int delta)
+    {
+        for (UInt r = row + 1; r <= nrows_; r += r & (~r + 1))
+        {
+            for (UInt c = col + 1; c <= ncols_; c += c & (~c + 1))
+            {
+                tree_[(r - 1) * ncols_ + (c - 1)] += delta;
+            }
+        }
+    }
+
+    // Counts the marks in [rowBegin, rowEnd) x [colBegin, colEnd).
+    Int count(UInt rowBegin, UInt rowEnd, UInt colBegin, UInt colEnd) const
+    {
+        return prefix_(rowEnd, colEnd) - prefix_(rowBegin, colEnd) -
+               prefix_(rowEnd, colBegin) + prefix_(rowBegin, colBegin);
+    }
+
+private:
+    Int prefix_(UInt rows, UInt cols) const
+    {
+        Int sum = 0;
+        for (UInt r = rows; r > 0; r -= r & (~r + 1))
+        {
+            for (UInt c = cols; c > 0; c -= c & (~c + 1))
+            {
+                sum += tree_[(r - 1) * ncols_ + (c - 1)];
+            }
+        }
+        return sum;
+    }
+
+    std::vector<Int> &tree_;
+    UInt nrows_;
+    UInt ncols_;
+};
+
+// Calls f(begin, end) on contiguous column ranges covering [begin, end), on
+// the thread pool if there is one.
+template <typename Function>
+static void parallelFor(ThreadPool *threadPool, UInt begin, UInt end,
+                        const Function &f)
+{
+    if (threadPool)
+    {
+        threadPool->parallelFor(begin, end, f);
+    }
+    else if (begin < end)
+    {
+        f(begin, end);
+    }
+}
+
+void InhibitionScratch::reserve(UInt numColumns)
+{
+    state.reserve(numColumns);
+    numBigger.reserve(numColumns);
+    numActive.reserve(numColumns);
+    sweepOrder.reserve(numColumns);
+    sweepBigger.reserve(numColumns);
+    sweepEqualWinners.reserve(numColumns);
+    topK.reserve(numColumns);
+}
+
+Real inhibitionDensity(const InhibitionParameters &parameters)
+{
+    if (parameters.numActiveColumnsPerInhArea == 0)
+    {
+        return parameters.localAreaDensity;
+    }
+
+    UInt inhibitionArea = pow((Real)(2 * parameters.inhibitionRadius + 1),
+                              (Real)parameters.columnDimensions.size());
+    inhibitionArea = std::min(inhibitionArea, parameters.numColumns);
+    Real density =
+        ((Real)parameters.numActiveColumnsPerInhArea) / inhibitionArea;
+    return std::min(density, (Real)0.5);
+}
+
+void inhibitColumns(const InhibitionParameters &parameters,
+                    const std::vector<Real> &overlaps,
+                    std::vector<UInt> &activeColumns,
+                    InhibitionScratch &scratch, ThreadPool *threadPool)
+{
+    const Real density = inhibitionDensity(parameters);
+    const std::vector<UInt> &dimensions = parameters.columnDimensions;
+
+    if (parameters.globalInhibition ||
+        parameters.inhibitionRadius >
+            *max_element(dimensions.begin(), dimensions.end()))
+    {
+        inhibitColumnsGlobal(parameters, overlaps, density, activeColumns,
+                             scratch);
+    }
+    else
+    {
+        inhibitColumnsLocal(parameters, overlaps, density, activeColumns,
+                            scratch, threadPool);
+    }
+}
+
+void inhibitColumnsGlobal(const InhibitionParameters &parameters,
+                          const std::vector<Real> &overlaps, Real density,
+                          std::vector<UInt> &activeColumns,
+                          InhibitionScratch &scratch)
+{
+    activeColumns.clear();
+    const UInt numColumns = parameters.numColumns;
+    const UInt numDesired = (UInt)(density * numColumns);
+    NTA_CHECK(numDesired > 0) << "Not enough columns (" << numColumns << ") "
+                              << "for desired density (" << density << ").";
+
+    // Same order as SpatialPooler's isWinner_/addToWinners_: highest overlap
+    // first, ties go to the column with the highest index, and columns under
+    // the stimulus threshold never win.
+    activeColumns.resize(numDesired);
+    const size_t numActual = scratch.topK.select(
+        numDesired, overlaps.begin(), overlaps.end(), activeColumns.begin(),
+        (Real32)parameters.stimulusThreshold, true);
+    activeColumns.resize(numActual);
+}
+
+void inhibitColumnsLocal(const InhibitionParameters &parameters,
+                         const std::vector<Real> &overlaps, Real density,
+                         std::vector<UInt> &activeColumns,
+                         InhibitionScratch &scratch, ThreadPool *threadPool)
+{
+    // The window engine visits the whole neighborhood of every column, the
+    // sweep engine only needs a few tree queries per column. The window
+    // engine is faster for small neighborhoods and handles any number of
+    // dimensions.
+    if (parameters.columnDimensions.size() <= 2)
+    {
+        UInt64 neighborhoodSize = 1;
+        for (UInt dimension : parameters.columnDimensions)
+        {
+            neighborhoodSize *= std::min<UInt64>(
+                dimension, 2 * (UInt64)parameters.inhibitionRadius + 1);
+        }
+
+        if (neighborhoodSize >= SWEEP_MIN_NEIGHBORHOOD)
+        {
+            inhibitColumnsLocalSweep(parameters, overlaps, density,
+                                     activeColumns, scratch);
+            return;
+        }
+    }
+
+    inhibitColumnsLocalWindow(parameters, overlaps, density, activeColumns,
+                              scratch, threadPool);
+}
+
+void inhibitColumnsLocalWindow(const InhibitionParameters &parameters,
+                               const std::vector<Real> &overlaps, Real density,
+                               std::vector<UInt> &activeColumns,
+                               InhibitionScratch &scratch,
+                               ThreadPool *threadPool)
+{
+    // Tie-breaking: when overlaps are equal, columns that have already been
+    // selected are treated as "bigger". Only columns with a smaller index can
+    // have been selected, so a column is decided without knowing which of
+    // its neighbors win unless it has equal-overlap neighbors with a smaller
+    // index that could tip the balance. Those undecided columns are resolved
+    // serially in index order after the parallel pass, which gives exactly
+    // the result of a serial sweep.
+    enum
+    {
+        LOSER = 0,
+        WINNER = 1,
+        UNDECIDED = 2
+    };
+
+    const UInt numColumns = parameters.numColumns;
+    const UInt radius = parameters.inhibitionRadius;
+    const std::vector<UInt> &dimensions = parameters.columnDimensions;
+    const bool wrapAround = parameters.wrapAround;
+
+    scratch.state.resize(numColumns);
+    scratch.numBigger.resize(numColumns);
+    scratch.numActive.resize(numColumns);
+
+    parallelFor(threadPool, 0, numColumns, [&](UInt begin, UInt end) {
+        for (UInt column = begin; column < end; column++)
+        {
+            scratch.state[column] = LOSER;
+            if (overlaps[column] < parameters.stimulusThreshold)
+            {
+                continue;
+            }
+
+            UInt numNeighbors = 0;
+            UInt numBigger = 0;
+            UInt numEqualBefore = 0;
+            forEachNeighbor(column, radius, dimensions, wrapAround,
+                            [&](UInt neighbor) {
+                                if (neighbor == column)
+                                {
+                                    return;
+                                }
+                                numNeighbors++;
+
+                                const Real difference =
+                                    overlaps[neighbor] - overlaps[column];
+                                if (difference > 0)
+                                {
+                                    numBigger++;
+                                }
+                                else if (difference == 0 && neighbor < column)
+                                {
+                                    numEqualBefore++;
+                                }
+                            });
+
+            UInt numActive = (UInt)(0.5 + (density * (numNeighbors + 1)));
+            if (numBigger >= numActive)
+            {
+                continue;
+            }
+
+            if (numBigger + numEqualBefore < numActive)
+            {
+                scratch.state[column] = WINNER;
+            }
+            else
+            {
+                scratch.state[column] = UNDECIDED;
+                scratch.numBigger[column] = numBigger;
+                scratch.numActive[column] = numActive;
+            }
+        }
+    });
+
+    activeColumns.clear();
+    for (UInt column = 0; column < numColumns; column++)
+    {
+        if (scratch.state[column] == UNDECIDED)
+        {
+            UInt numBigger = scratch.numBigger[column];
+            forEachNeighbor(column, radius, dimensions, wrapAround,
+                            [&](UInt neighbor) {
+                                if (neighbor < column &&
+                                    overlaps[neighbor] - overlaps[column] ==
+                                        0 &&
+                                    scratch.state[neighbor] == WINNER)
+                                {
+                                    numBigger++;
+                                }
+                            });
+            scratch.state[column] =
+                numBigger < scratch.numActive[column] ? WINNER : LOSER;
+        }
+
+        if (scratch.state[column] == WINNER)
+        {
+            activeColumns.push_back(column);
+        }
+    }
+}
+
+void inhibitColumnsLocalSweep(const InhibitionParameters &parameters,
+                              const std::vector<Real> &overlaps, Real density,
+                              std::vector<UInt> &activeColumns,
+                              InhibitionScratch &scratch)
+{
+    // Columns are visited by decreasing overlap, so when a column is visited
+    // the neighbors with a bigger overlap are exactly the visited columns of
+    // the previous overlap values, which the 'bigger' tree counts. Columns of
+    // equal overlap are visited by increasing index, and the ones that
+    // already won are counted by the 'equalWinners' tree, which gives the
+    // same tie-breaking as the window engine.
+    const UInt numColumns = parameters.numColumns;
+    const UInt radius = parameters.inhibitionRadius;
+    const std::vector<UInt> &dimensions = parameters.columnDimensions;
+    const bool wrapAround = parameters.wrapAround;
+
+    NTA_ASSERT(dimensions.size() <= 2);
+    const UInt nrows = dimensions.size() == 2 ? dimensions[0] : 1;
+    const UInt ncols = dimensions.back();
+
+    std::vector<UInt> &order = scratch.sweepOrder;
+    order.clear();
+    for (UInt column = 0; column < numColumns; column++)
+    {
+        if (overlaps[column] >= parameters.stimulusThreshold)
+        {
+            order.push_back(column);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](UInt a, UInt b) {
+        return overlaps[a] > overlaps[b] ||
+               (overlaps[a] == overlaps[b] && a < b);
+    });
+
+    NeighborhoodCounter2D bigger(scratch.sweepBigger, nrows, ncols);
+    NeighborhoodCounter2D equalWinners(scratch.sweepEqualWinners, nrows,
+                                       ncols);
+    scratch.state.assign(numColumns, 0);
+
+    UInt rowBegins[2], rowEnds[2], colBegins[2], colEnds[2];
+    size_t groupBegin = 0;
+    while (groupBegin < order.size())
+    {
+        const Real overlap = overlaps[order[groupBegin]];
+        size_t groupEnd = groupBegin;
+        for (; groupEnd < order.size() && overlaps[order[groupEnd]] == overlap;
+             groupEnd++)
+        {
+            const UInt column = order[groupEnd];
+            const UInt row = column / ncols;
+            const UInt col = column % ncols;
+            const UInt numRowIntervals = neighborhoodIntervals(
+                row, radius, nrows, wrapAround, rowBegins, rowEnds);
+            const UInt numColIntervals = neighborhoodIntervals(
+                col, radius, ncols, wrapAround, colBegins, colEnds);
+
+            UInt numNeighbors = 0;
+            Int numBigger = 0;
+            for (UInt i = 0; i < numRowIntervals; i++)
+            {
+                for (UInt j = 0; j < numColIntervals; j++)
+                {
+                    numNeighbors += (rowEnds[i] - rowBegins[i]) *
+                                    (colEnds[j] - colBegins[j]);
+                    numBigger += bigger.count(rowBegins[i], rowEnds[i],
+                                              colBegins[j], colEnds[j]);
+                    numBigger += equalWinners.count(rowBegins[i], rowEnds[i],
+                                                    colBegins[j], colEnds[j]);
+                }
+            }
+            numNeighbors--; // the column itself
+
+            const UInt numActive = (UInt)(0.5 + (density * (numNeighbors + 1)));
+            if ((UInt)numBigger < numActive)
+            {
+                scratch.state[column] = 1;
+                equalWinners.add(row, col, 1);
+            }
+        }
+
+        for (size_t i = groupBegin; i < groupEnd; i++)
+        {
+            const UInt column = order[i];
+            bigger.add(column / ncols, column % ncols, 1);
+            if (scratch.state[column])
+            {
+                equalWinners.add(column / ncols, column % ncols, -1);
+            }
+        }
+        groupBegin = groupEnd;
+    }
+
+    activeColumns.clear();
+    for (UInt column = 0; column < numColumns; column++)
+    {
+        if (scratch.state[column])
+        {
+            activeColumns.push_back(column);
+        }
+    }
+}
+
+} // namespace crucian
@@ -0,0 +1,307 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of OutSynapseStore
+ */
+
+#include <algorithm>
+
+#include <crucian/OutSynapseStore.hpp>
+
+namespace crucian
+{
+
+OutSynapseStore::OutSynapseStore() : unused_(0), numIndexed_(0) {}
+
+void OutSynapseStore::resize(UInt numRows)
+{
+    rows_.assign(numRows, Row{0, 0, 0});
+    synapses_.clear();
+    unused_ = 0;
+    slots_.clear();
+    numIndexed_ = 0;
+}
+
+void OutSynapseStore::reserve(const std::vector<UInt> &capacities,
+                              size_t numSynapses)
+{
+    NTA_CHECK(capacities.size() == rows_.size());
+    size_t begin = 0;
+    for (UInt row = 0; row < rows_.size(); row++)
+    {
+        rows_[row] = Row{begin, 0, capacities[row]};
+        begin += capacities[row];
+    }
+    NTA_CHECK(begin <= EMPTY) << "Too many out synapses: " << begin;
+    synapses_.assign(begin, OutSynapse());
+    unused_ = 0;
+
+    size_t numSlots = 16;
+    while (numSlots * 3 < numSynapses * 4)
+    {
+        numSlots *= 2;
+    }
+    slots_.clear();
+    numIndexed_ = 0;
+    rehash_(numSlots);
+}
+
+size_t OutSynapseStore::getNumBytes() const
+{
+    return rows_.capacity() * sizeof(Row) +
+           synapses_.capacity() * sizeof(OutSynapse) +
+           slots_.capacity() * sizeof(Slot);
+}
+
+void OutSynapseStore::add(UInt row, const OutSynapse &synapse)
+{
+    NTA_ASSERT(row < rows_.size());
+    NTA_ASSERT(!contains(row, synapse.dstCellIdx(), synapse.dstSegIdx()));
+    reserveRow_(row, rows_[row].size + 1);
+    Row &r = rows_[row];
+    const size_t position = r.begin + r.size;
+    synapses_[position] = synapse;
+    insert_(row, synapse, position);
+    ++r.size;
+}
+
+bool OutSynapseStore::erase(UInt row, UInt dstCellIdx, UInt dstSegIdx)
+{
+    const size_t slot = find_(row, dstCellIdx, dstSegIdx);
+    if (slot == NOT_FOUND)
+    {
+        return false;
+    }
+
+    const size_t position = slots_[slot].position;
+    remove_(slot);
+
+    // The last synapse of the row fills the hole.
+    Row &r = rows_[row];
+    const size_t last = r.begin + r.size - 1;
+    if (position != last)
+    {
+        const OutSynapse &moved = synapses_[last];
+        slots_[find_(row, moved.dstCellIdx(), moved.dstSegIdx())].position =
+            (UInt)position;
+        synapses_[position] = moved;
+    }
+    --r.size;
+    return true;
+}
+
+bool OutSynapseStore::invariants() const
+{
+    size_t numSynapses = 0;
+    for (UInt row = 0; row < rows_.size(); row++)
+    {
+        const Row &r = rows_[row];
+        if (r.size > r.capacity || r.begin + r.capacity > synapses_.size())
+        {
+            return false;
+        }
+        for (size_t k = r.begin; k < r.begin + r.size; k++)
+        {
+            const size_t slot = find_(row, synapses_[k].dstCellIdx(),
+                                      synapses_[k].dstSegIdx());
+            if (slot == NOT_FOUND || slots_[slot].position != k)
+            {
+                return false;
+            }
+        }
+        numSynapses += r.size;
+    }
+    return numSynapses == numIndexed_;
+}
+
+size_t OutSynapseStore::hash_(UInt row, UInt dstCellIdx, UInt dstSegIdx) const
+{
+    UInt64 h = (((UInt64)row << 32u) | dstCellIdx) * 0x9E3779B97F4A7C15ull;
+    h ^= (dstSegIdx + 1) * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 32u;
+    return (size_t)h & (slots_.size() - 1);
+}
+
+size_t OutSynapseStore::hash_(const Slot &slot) const
+{
+    const OutSynapse &synapse = synapses_[slot.position];
+    return hash_(slot.row, synapse.dstCellIdx(), synapse.dstSegIdx());
+}
+
+size_t OutSynapseStore::find_(UInt row, UInt dstCellIdx, UInt dstSegIdx) const
+{
+    if (slots_.empty())
+    {
+        return NOT_FOUND;
+    }
+
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash_(row, dstCellIdx, dstSegIdx);; i = (i + 1) & mask)
+    {
+        const Slot &slot = slots_[i];
+        if (slot.row == EMPTY)
+        {
+            return NOT_FOUND;
+        }
+        if (slot.row == row)
+        {
+            const OutSynapse &synapse = synapses_[slot.position];
+            if (synapse.dstCellIdx() == dstCellIdx &&
+                synapse.dstSegIdx() == dstSegIdx)
+            {
+                return i;
+            }
+        }
+    }
+}
+
+void OutSynapseStore::insert_(UInt row, const OutSynapse &synapse,
+                              size_t position)
+{
+    // At most 3/4 of the slots are used, so that probes stay short.
+    if ((numIndexed_ + 1) * 4 > slots_.size() * 3)
+    {
+        rehash_(slots_.empty() ? 16 : slots_.size() * 2);
+    }
+
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash_(row, synapse.dstCellIdx(), synapse.dstSegIdx());
+    while (slots_[i].row != EMPTY)
+    {
+        i = (i + 1) & mask;
+    }
+    slots_[i] = Slot{row, (UInt)position};
+    ++numIndexed_;
+}
+
+void OutSynapseStore::remove_(size_t slot)
+{
+    // Backward shift deletion: the following slots of the probe sequence
+    // move back unless that would put them before their home slot.
+    const size_t mask = slots_.size() - 1;
+    size_t i = slot;
+    for (size_t j = (i + 1) & mask; slots_[j].row != EMPTY; j = (j + 1) & mask)
+    {
+        const Slot &s = slots_[j];
+        const size_t home = hash_(s);
+        const bool stays =
+            i < j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays)
+        {
+            slots_[i] = s;
+            i = j;
+        }
+    }
+    slots_[i].row = EMPTY;
+    --numIndexed_;
+}
+
+void OutSynapseStore::rehash_(size_t numSlots)
+{
+    std::vector<Slot> slots(numSlots, Slot{EMPTY, 0});
+    slots.swap(slots_);
+    const size_t mask = numSlots - 1;
+    for (const Slot &s : slots)
+    {
+        if (s.row != EMPTY)
+        {
+            size_t i = hash_(s);
+            while (slots_[i].row != EMPTY)
+            {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = s;
+        }
+    }
+}
+
+void OutSynapseStore::reserveRow_(UInt row, UInt size)
+{
+    if (size <= rows_[row].capacity)
+    {
+        return;
+    }
+
+    if (rows_[row].begin + rows_[row].capacity != synapses_.size() &&
+        unused_ + rows_[row].capacity > synapses_.size() / 2)
+    {
+        compact_();
+    }
+
+    Row &r = rows_[row];
+    const UInt capacity = std::max(size, r.capacity < 2 ? 4 : 2 * r.capacity);
+
+    // The last row grows in place.
+    if (r.begin + r.capacity == synapses_.size())
+    {
+        NTA_CHECK(r.begin + capacity <= EMPTY) << "Too many out synapses";
+        synapses_.resize(r.begin + capacity);
+        r.capacity = capacity;
+        return;
+    }
+
+    const size_t begin = synapses_.size();
+    NTA_CHECK(begin + capacity <= EMPTY) << "Too many out synapses";
+    synapses_.resize(begin + capacity);
+    for (UInt i = 0; i < r.size; i++)
+    {
+        const OutSynapse &synapse = synapses_[r.begin + i];
+        slots_[find_(row, synapse.dstCellIdx(), synapse.dstSegIdx())]
+            .position = (UInt)(begin + i);
+        synapses_[begin + i] = synapse;
+    }
+    unused_ += r.capacity;
+    r.begin = begin;
+    r.capacity = capacity;
+}
+
+void OutSynapseStore::compact_()
+{
+    std::vector<size_t> oldBegins(rows_.size());
+    std::vector<OutSynapse> synapses(synapses_.size() - unused_);
+    size_t begin = 0;
+    for (UInt row = 0; row < rows_.size(); row++)
+    {
+        Row &r = rows_[row];
+        std::copy(synapses_.begin() + r.begin,
+                  synapses_.begin() + r.begin + r.size,
+                  synapses.begin() + begin);
+        oldBegins[row] = r.begin;
+        r.begin = begin;
+        begin += r.capacity;
+    }
+    NTA_ASSERT(begin == synapses.size());
+    synapses_.swap(synapses);
+    unused_ = 0;
+
+    for (Slot &s : slots_)
+    {
+        if (s.row != EMPTY)
+        {
+            s.position = (UInt)(rows_[s.row].begin +
+                                (s.position - oldBegins[s.row]));
+        }
+    }
+}
+
+} // namespace crucian
@@ -62,7 +62,7 @@ static NTA_UInt64 badSeeder()
 class RandomImpl
 {
 public:
-    RandomImpl(UInt64 seed);
+    explicit RandomImpl(UInt64 seed, UInt64 stream = 0);
 
     UInt32 getUInt32();
 
@@ -80,6 +80,8 @@ private:
 
     friend std::istream &operator>>(std::istream &inStream, RandomImpl &r);
 
+    friend class Random;
+
     const static UInt32 VERSION = 2;
     // internal state
     static const int stateSize_ = 31;
@@ -89,6 +91,10 @@ private:
     int fptr_;
 };
 
+const size_t Random::BINARY_SIZE = sizeof(UInt64) +
+                                   RandomImpl::stateSize_ * sizeof(UInt32) +
+                                   2 * sizeof(Int32);
+
 Random::Random(const Random &r)
 {
     NTA_CHECK(r.impl_ != nullptr);
@@ -124,7 +130,9 @@ bool Random::operator==(const Random &o) const
 
 Random::~Random() { delete impl_; }
 
-Random::Random(UInt64 seed)
+Random::Random(UInt64 seed) : Random(seed, 0) {}
+
+Random::Random(UInt64 seed, UInt64 stream)
 {
     // Get the seeder even if we don't need it, because
     // this will have the side effect of allocating the
@@ -151,7 +159,7 @@ Random::Random(UInt64 seed)
     }
     // if seed is zero at this point, there is a logic error.
     NTA_CHECK(seed_ != 0);
-    impl_ = new RandomImpl(seed_);
+    impl_ = new RandomImpl(seed_, stream);
 }
 
 RandomSeedFuncPtr Random::getSeeder()
@@ -260,7 +268,7 @@ UInt32 RandomImpl::getUInt32(void)
     return i;
 }
 
-RandomImpl::RandomImpl(UInt64 seed)
+RandomImpl::RandomImpl(UInt64 seed, UInt64 stream)
 {
 
     /**
@@ -285,6 +293,24 @@ RandomImpl::RandomImpl(UInt64 seed)
     }
     fptr_ = sep_;
     rptr_ = 0;
+    /**
+     * Other streams scramble the whole state with a splitmix64 sequence of
+     * the stream, so that nearby streams do not share any state word.
+     */
+    if (stream != 0)
+    {
+        UInt64 x = stream;
+        for (long i = 0; i < stateSize_; i++)
+        {
+            x += 0x9E3779B97F4A7C15ull;
+            UInt64 z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            state_[i] = static_cast<UInt32>((state_[i] ^ z) % Random::MAX32);
+        }
+    }
+
 #ifdef RANDOM_SUPERDEBUG
     printf("Random: init for seed = %lu\n", seed);
     for (int i = 0; i < stateSize_; i++)
@@ -344,6 +370,40 @@ std::istream &operator>>(std::istream &inStream, Random &r)
     return inStream;
 }
 
+void Random::saveBinary(char *out) const
+{
+    NTA_CHECK(impl_ != nullptr);
+    const Int32 rptr = impl_->rptr_;
+    const Int32 fptr = impl_->fptr_;
+    std::memcpy(out, &seed_, sizeof(seed_));
+    out += sizeof(seed_);
+    std::memcpy(out, impl_->state_, sizeof(impl_->state_));
+    out += sizeof(impl_->state_);
+    std::memcpy(out, &rptr, sizeof(rptr));
+    out += sizeof(rptr);
+    std::memcpy(out, &fptr, sizeof(fptr));
+}
+
+void Random::loadBinary(const char *in)
+{
+    if (!impl_)
+        impl_ = new RandomImpl(0);
+
+    Int32 rptr, fptr;
+    std::memcpy(&seed_, in, sizeof(seed_));
+    in += sizeof(seed_);
+    std::memcpy(impl_->state_, in, sizeof(impl_->state_));
+    in += sizeof(impl_->state_);
+    std::memcpy(&rptr, in, sizeof(rptr));
+    in += sizeof(rptr);
+    std::memcpy(&fptr, in, sizeof(fptr));
+    NTA_CHECK(rptr >= 0 && rptr < RandomImpl::stateSize_ && fptr >= 0 &&
+              fptr < RandomImpl::stateSize_)
+        << "Random::loadBinary -- invalid state";
+    impl_->rptr_ = rptr;
+    impl_->fptr_ = fptr;
+}
+
 std::ostream &operator<<(std::ostream &outStream, const RandomImpl &r)
 {
     outStream << "RandomImpl " << RandomImpl::VERSION << " ";
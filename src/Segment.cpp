@@ -242,8 +242,7 @@ void Segment::decaySynapses(Real decay, std::vector<UInt> &removed,
     if (_synapses.empty())
         return;
 
-    static std::vector<UInt> del;
-    del.clear(); // purge residual data
+    std::vector<UInt> del;
 
     for (UInt i = 0; i != _synapses.size(); ++i)
     {
@@ -286,8 +285,7 @@ void Segment::decaySynapses2(Real decay, std::vector<UInt> &removed,
     if (_synapses.empty())
         return;
 
-    static std::vector<UInt> del;
-    del.clear(); // purge residual data
+    std::vector<UInt> del;
 
     for (UInt i = 0; i != _synapses.size(); ++i)
     {
@@ -410,8 +408,7 @@ void Segment::freeNSynapses(UInt numToFree,
 
     //----------------------------------------------------------------------
     // Create the final list of synapses we will remove
-    static std::vector<UInt> del;
-    del.clear(); // purge residual data
+    std::vector<UInt> del;
     for (UInt i = 0; i < numToFree; i++)
     {
         del.push_back(candidates[i].srcCellIdx());
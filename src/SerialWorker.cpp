@@ -0,0 +1,109 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of SerialWorker
+ */
+
+#include <crucian/SerialWorker.hpp>
+
+namespace crucian
+{
+
+SerialWorker::SerialWorker()
+    : busy_(false), stop_(false), thread_(&SerialWorker::loop_, this)
+{
+}
+
+SerialWorker::~SerialWorker()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return tasks_.empty() && !busy_; });
+        stop_ = true;
+    }
+    start_.notify_one();
+    thread_.join();
+}
+
+void SerialWorker::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    start_.notify_one();
+}
+
+void SerialWorker::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return tasks_.empty() && !busy_; });
+
+    if (error_)
+    {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void SerialWorker::loop_()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        start_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if (stop_)
+        {
+            return;
+        }
+
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        busy_ = true;
+        lock.unlock();
+
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            lock.lock();
+            if (!error_)
+            {
+                error_ = std::current_exception();
+            }
+            lock.unlock();
+        }
+
+        lock.lock();
+        busy_ = false;
+        if (tasks_.empty())
+        {
+            done_.notify_all();
+        }
+    }
+}
+
+} // namespace crucian
@@ -24,11 +24,32 @@
  * Implementation of SpatialPooler
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 
+#if defined(NTA_ASM) && defined(NTA_ARCH_64)
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#include <immintrin.h>
+#endif
+#endif
+
+#if !defined(NTA_OS_WINDOWS)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <crucian/FrozenSpatialPooler.hpp>
+#include <crucian/Inhibition.hpp>
 #include <crucian/Math.hpp>
 #include <crucian/SpatialPooler.hpp>
 #include <crucian/Topology.hpp>
@@ -41,6 +62,11 @@ namespace crucian
 
 static const Real PERMANENCE_EPSILON = 0.000001;
 
+// Version of the binary format written by save, see BinaryLayout.
+static const UInt32 BINARY_VERSION = 5;
+
+const UInt SpatialPooler::BATCH_BLOCK;
+
 // MSVC doesn't provide round() which only became standard in C99 or C++11
 #if defined(NTA_COMPILER_MSVC)
 template <typename T> T round(T num)
@@ -58,6 +84,12 @@ static Real round5_(const Real f)
     return p;
 }
 
+// One step of the duty cycle moving average, see updateDutyCyclesHelper_.
+static inline Real updateDutyCycle_(Real dutyCycle, UInt newValue, UInt period)
+{
+    return (dutyCycle * static_cast<Real>(period - 1) + newValue) / period;
+}
+
 class CoordinateConverter2D
 {
 public:
@@ -112,10 +144,423 @@ private:
     std::vector<UInt> bounds_;
 };
 
+// Computes out[i * stride] = max(0, max of in[j * stride] over the
+// neighborhood of i) along a line of n values, with the neighborhoods of
+// Neighborhood and WrappingNeighborhood. Uses the van Herk/Gil-Werman
+// algorithm, so the cost is O(n + radius) whatever the radius. line, prefix
+// and suffix are scratch space.
+static void slidingMax_(const Real *in, Real *out, UInt n, UInt stride,
+                        UInt radius, bool wrapAround, std::vector<Real> &line,
+                        std::vector<Real> &prefix, std::vector<Real> &suffix)
+{
+    if (wrapAround && 2 * (UInt64)radius + 1 >= n)
+    {
+        Real max = 0;
+        for (UInt i = 0; i < n; i++)
+        {
+            max = std::max(max, in[i * stride]);
+        }
+        for (UInt i = 0; i < n; i++)
+        {
+            out[i * stride] = max;
+        }
+        return;
+    }
+
+    // Lay out the line with 'radius' values on each side: zeros without
+    // wrap-around, which is neutral since the result is at least 0, or the
+    // values from the other end with it. Then out[i] is the max of the
+    // window line[i, i + width).
+    radius = std::min(radius, n);
+    const UInt width = 2 * radius + 1;
+    const UInt size = n + 2 * radius;
+    line.resize(size);
+    for (UInt k = 0; k < size; k++)
+    {
+        if (wrapAround)
+        {
+            line[k] = in[((k + n - radius) % n) * stride];
+        }
+        else
+        {
+            line[k] = k >= radius && k < radius + n ? in[(k - radius) * stride]
+                                                    : 0;
+        }
+    }
+
+    // Running max from the start of each block of 'width' values, and to
+    // its end. A window straddles at most two blocks.
+    prefix.resize(size);
+    suffix.resize(size);
+    for (UInt k = 0; k < size; k++)
+    {
+        prefix[k] = k % width == 0 ? line[k] : std::max(prefix[k - 1], line[k]);
+    }
+    for (UInt k = size; k-- > 0;)
+    {
+        suffix[k] = k + 1 == size || (k + 1) % width == 0
+                        ? line[k]
+                        : std::max(suffix[k + 1], line[k]);
+    }
+
+    for (UInt i = 0; i < n; i++)
+    {
+        out[i * stride] =
+            std::max((Real)0, std::max(suffix[i], prefix[i + width - 1]));
+    }
+}
+
+static inline UInt popcount64_(UInt64 x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (UInt)((x * 0x0101010101010101ull) >> 56);
+}
+
+// Number of bits set in the AND of the n words of a and b.
+static UInt andPopcount_(const UInt64 *a, const UInt64 *b, UInt n)
+{
+    UInt count = 0;
+    for (UInt i = 0; i < n; i++)
+    {
+        count += popcount64_(a[i] & b[i]);
+    }
+    return count;
+}
+
+#if defined(NTA_ASM) && defined(NTA_ARCH_64) && defined(__GNUC__)
+// Same with the POPCNT instruction, which comes with SSE 4.2.
+__attribute__((target("popcnt"))) static UInt
+andPopcountHardware_(const UInt64 *a, const UInt64 *b, UInt n)
+{
+    UInt count = 0;
+    for (UInt i = 0; i < n; i++)
+    {
+        count += (UInt)__builtin_popcountll(a[i] & b[i]);
+    }
+    return count;
+}
+#endif
+
+#if defined(NTA_ASM) && defined(NTA_ARCH_64) && defined(__GNUC__)
+static bool hasAvx2_()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}
+
+static const bool HAS_AVX2 = hasAvx2_();
+#endif
+
+// The arrays and constants of updateColumnStatistics_, for its kernels.
+struct ColumnStatistics
+{
+    const UInt *overlaps;
+    const UInt *connectedCounts;
+    const UInt *active;
+    Real *overlapPct;
+    Real *overlapDutyCycles;
+    Real *activeDutyCycles;
+    Real *boostFactors;
+    UInt period;
+    bool learn;
+    bool boostGlobal;
+    bool approximateExp;
+    Real targetDensity;
+    Real boostStrength;
+};
+
+// exp(x) = 2^n exp(r) with n the nearest integer to x / ln 2, so that
+// |r| <= ln 2 / 2, and exp(r) from a polynomial (the Cephes expf). x is
+// clamped to the range of normal results. The vector versions below do the
+// same float operations in the same order, so a column gets the same boost
+// factor whichever version computes it.
+static const Real EXP_MIN = -87.3f;
+static const Real EXP_MAX = 88.3f;
+static const Real EXP_LOG2E = 1.44269504088896341f;
+static const Real EXP_LN2_HI = 0.693359375f;
+static const Real EXP_LN2_LO = -2.12194440e-4f;
+static const Real EXP_P[] = {1.9875691500e-4f, 1.3981999507e-3f,
+                             8.3334519073e-3f, 4.1665795894e-2f,
+                             1.6666665459e-1f, 5.0000001201e-1f};
+
+static inline Real expApproximate_(Real x)
+{
+    x = std::min(std::max(x, EXP_MIN), EXP_MAX);
+    const Real n = std::nearbyint(x * EXP_LOG2E);
+    const Real r = (x - n * EXP_LN2_HI) - n * EXP_LN2_LO;
+    Real p = EXP_P[0];
+    for (UInt k = 1; k < 6; k++)
+    {
+        p = p * r + EXP_P[k];
+    }
+    const Real y = (p * (r * r) + r) + 1;
+    const UInt32 bits = (UInt32)((Int32)n + 127) << 23;
+    Real scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return y * scale;
+}
+
+static inline Real boostFactor_(const ColumnStatistics &s, Real dutyCycle)
+{
+    const Real x = (s.targetDensity - dutyCycle) * s.boostStrength;
+    return s.approximateExp ? expApproximate_(x) : exp(x);
+}
+
+// The columns [begin, end) of updateColumnStatistics_.
+static void columnStatistics_(const ColumnStatistics &s, UInt begin, UInt end)
+{
+    for (UInt i = begin; i < end; i++)
+    {
+        s.overlapPct[i] = s.connectedCounts[i] != 0
+                              ? ((Real)s.overlaps[i]) / s.connectedCounts[i]
+                              : 0;
+
+        if (!s.learn)
+        {
+            continue;
+        }
+
+        s.overlapDutyCycles[i] = updateDutyCycle_(
+            s.overlapDutyCycles[i], s.overlaps[i] > 0 ? 1 : 0, s.period);
+        s.activeDutyCycles[i] = updateDutyCycle_(
+            s.activeDutyCycles[i], s.active[i] > 0 ? 1 : 0, s.period);
+
+        if (s.boostGlobal)
+        {
+            s.boostFactors[i] = boostFactor_(s, s.activeDutyCycles[i]);
+        }
+    }
+}
+
+#if defined(NTA_ASM) && defined(NTA_ARCH_64)
+// expApproximate_ of four values.
+static inline __m128 expApproximate4_(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_MIN)), _mm_set1_ps(EXP_MAX));
+    const __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(EXP_LOG2E)));
+    const __m128 nReal = _mm_cvtepi32_ps(n);
+    const __m128 r =
+        _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(nReal, _mm_set1_ps(EXP_LN2_HI))),
+                   _mm_mul_ps(nReal, _mm_set1_ps(EXP_LN2_LO)));
+    __m128 p = _mm_set1_ps(EXP_P[0]);
+    for (UInt k = 1; k < 6; k++)
+    {
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P[k]));
+    }
+    const __m128 y = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), _mm_set1_ps(1));
+    const __m128i scale =
+        _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(scale));
+}
+
+// Four columns at a time with SSE2. The arithmetic is the same as in
+// columnStatistics_, so the results are bit-identical. Returns the first
+// column left to columnStatistics_.
+static UInt columnStatisticsSse2_(const ColumnStatistics &s, UInt begin,
+                                  UInt end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 previousWeight =
+        _mm_set1_ps(static_cast<Real>(s.period - 1));
+    const __m128 divisor = _mm_set1_ps(static_cast<Real>(s.period));
+    const __m128 targetDensity = _mm_set1_ps(s.targetDensity);
+    const __m128 boostStrength = _mm_set1_ps(s.boostStrength);
+
+    UInt i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        const __m128i overlap =
+            _mm_loadu_si128((const __m128i *)&s.overlaps[i]);
+        const __m128i count =
+            _mm_loadu_si128((const __m128i *)&s.connectedCounts[i]);
+        const __m128 noneConnected =
+            _mm_castsi128_ps(_mm_cmpeq_epi32(count, zero));
+        const __m128 pct =
+            _mm_div_ps(_mm_cvtepi32_ps(overlap), _mm_cvtepi32_ps(count));
+        _mm_storeu_ps(&s.overlapPct[i], _mm_andnot_ps(noneConnected, pct));
+
+        if (!s.learn)
+        {
+            continue;
+        }
+
+        const __m128 overlapValue = _mm_andnot_ps(
+            _mm_castsi128_ps(_mm_cmpeq_epi32(overlap, zero)), one);
+        const __m128 overlapDuty = _mm_div_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&s.overlapDutyCycles[i]),
+                                  previousWeight),
+                       overlapValue),
+            divisor);
+        _mm_storeu_ps(&s.overlapDutyCycles[i], overlapDuty);
+
+        const __m128i active = _mm_loadu_si128((const __m128i *)&s.active[i]);
+        const __m128 activeValue = _mm_andnot_ps(
+            _mm_castsi128_ps(_mm_cmpeq_epi32(active, zero)), one);
+        const __m128 activeDuty = _mm_div_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&s.activeDutyCycles[i]),
+                                  previousWeight),
+                       activeValue),
+            divisor);
+        _mm_storeu_ps(&s.activeDutyCycles[i], activeDuty);
+
+        if (!s.boostGlobal)
+        {
+            continue;
+        }
+        if (s.approximateExp)
+        {
+            _mm_storeu_ps(&s.boostFactors[i],
+                          expApproximate4_(_mm_mul_ps(
+                              _mm_sub_ps(targetDensity, activeDuty),
+                              boostStrength)));
+        }
+        else
+        {
+            for (UInt j = i; j < i + 4; j++)
+            {
+                s.boostFactors[j] = boostFactor_(s, s.activeDutyCycles[j]);
+            }
+        }
+    }
+    return i;
+}
+#endif
+
+#if defined(NTA_ASM) && defined(NTA_ARCH_64) && defined(__GNUC__)
+// expApproximate_ of eight values.
+__attribute__((target("avx2"))) static inline __m256
+expApproximate8_(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)),
+                      _mm256_set1_ps(EXP_MAX));
+    const __m256i n =
+        _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)));
+    const __m256 nReal = _mm256_cvtepi32_ps(n);
+    const __m256 r = _mm256_sub_ps(
+        _mm256_sub_ps(x, _mm256_mul_ps(nReal, _mm256_set1_ps(EXP_LN2_HI))),
+        _mm256_mul_ps(nReal, _mm256_set1_ps(EXP_LN2_LO)));
+    __m256 p = _mm256_set1_ps(EXP_P[0]);
+    for (UInt k = 1; k < 6; k++)
+    {
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(EXP_P[k]));
+    }
+    const __m256 y =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p, _mm256_mul_ps(r, r)), r),
+                      _mm256_set1_ps(1));
+    const __m256i scale =
+        _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(scale));
+}
+
+// Same as columnStatisticsSse2_, eight columns at a time with AVX2. The
+// target excludes FMA, so products and sums stay separately rounded.
+__attribute__((target("avx2"))) static UInt
+columnStatisticsAvx2_(const ColumnStatistics &s, UInt begin, UInt end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 previousWeight =
+        _mm256_set1_ps(static_cast<Real>(s.period - 1));
+    const __m256 divisor = _mm256_set1_ps(static_cast<Real>(s.period));
+    const __m256 targetDensity = _mm256_set1_ps(s.targetDensity);
+    const __m256 boostStrength = _mm256_set1_ps(s.boostStrength);
+
+    UInt i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        const __m256i overlap =
+            _mm256_loadu_si256((const __m256i *)&s.overlaps[i]);
+        const __m256i count =
+            _mm256_loadu_si256((const __m256i *)&s.connectedCounts[i]);
+        const __m256 noneConnected =
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(count, zero));
+        const __m256 pct = _mm256_div_ps(_mm256_cvtepi32_ps(overlap),
+                                         _mm256_cvtepi32_ps(count));
+        _mm256_storeu_ps(&s.overlapPct[i],
+                         _mm256_andnot_ps(noneConnected, pct));
+
+        if (!s.learn)
+        {
+            continue;
+        }
+
+        const __m256 overlapValue = _mm256_andnot_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(overlap, zero)), one);
+        const __m256 overlapDuty = _mm256_div_ps(
+            _mm256_add_ps(
+                _mm256_mul_ps(_mm256_loadu_ps(&s.overlapDutyCycles[i]),
+                              previousWeight),
+                overlapValue),
+            divisor);
+        _mm256_storeu_ps(&s.overlapDutyCycles[i], overlapDuty);
+
+        const __m256i active =
+            _mm256_loadu_si256((const __m256i *)&s.active[i]);
+        const __m256 activeValue = _mm256_andnot_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(active, zero)), one);
+        const __m256 activeDuty = _mm256_div_ps(
+            _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&s.activeDutyCycles[i]),
+                                        previousWeight),
+                          activeValue),
+            divisor);
+        _mm256_storeu_ps(&s.activeDutyCycles[i], activeDuty);
+
+        if (!s.boostGlobal)
+        {
+            continue;
+        }
+        if (s.approximateExp)
+        {
+            _mm256_storeu_ps(&s.boostFactors[i],
+                             expApproximate8_(_mm256_mul_ps(
+                                 _mm256_sub_ps(targetDensity, activeDuty),
+                                 boostStrength)));
+        }
+        else
+        {
+            for (UInt j = i; j < i + 8; j++)
+            {
+                s.boostFactors[j] = boostFactor_(s, s.activeDutyCycles[j]);
+            }
+        }
+    }
+    return i;
+}
+#endif
+
+void SpatialPooler::InferenceContext::reserve_(UInt numColumns)
+{
+    overlaps_.reserve(numColumns);
+    boostedOverlaps_.reserve(numColumns);
+    activeColumns_.reserve(numColumns);
+    inhibition_.reserve(numColumns);
+}
+
 SpatialPooler::SpatialPooler()
 {
     // The current version number.
-    version_ = 2;
+    version_ = BINARY_VERSION;
+    numThreads_ = 1;
+    approximateBoost_ = false;
+    checkpointIteration_ = 0;
+    context_.parallel_ = true;
+}
+
+SpatialPooler::~SpatialPooler()
+{
+    // A pending learning step writes into this spatial pooler, and its
+    // errors have nowhere to go.
+    try
+    {
+        waitForLearning();
+    }
+    catch (...)
+    {
+    }
 }
 
 SpatialPooler::SpatialPooler(const std::vector<UInt> &inputDimensions,
@@ -127,14 +572,14 @@ SpatialPooler::SpatialPooler(const std::vector<UInt> &inputDimensions,
                              Real synPermActiveInc, Real synPermConnected,
                              Real minPctOverlapDutyCycles, UInt dutyCyclePeriod,
                              Real boostStrength, Int seed, UInt spVerbosity,
-                             bool wrapAround)
+                             bool wrapAround, UInt numThreads)
     : SpatialPooler::SpatialPooler()
 {
     initialize(inputDimensions, columnDimensions, potentialRadius, potentialPct,
                globalInhibition, localAreaDensity, numActiveColumnsPerInhArea,
                stimulusThreshold, synPermInactiveDec, synPermActiveInc,
                synPermConnected, minPctOverlapDutyCycles, dutyCyclePeriod,
-               boostStrength, seed, spVerbosity, wrapAround);
+               boostStrength, seed, spVerbosity, wrapAround, numThreads);
 }
 
 std::vector<UInt> SpatialPooler::getColumnDimensions() const
@@ -155,6 +600,7 @@ UInt SpatialPooler::getPotentialRadius() const { return potentialRadius_; }
 
 void SpatialPooler::setPotentialRadius(UInt potentialRadius)
 {
+    waitForLearning();
     potentialRadius_ = potentialRadius;
 }
 
@@ -162,6 +608,7 @@ Real SpatialPooler::getPotentialPct() const { return potentialPct_; }
 
 void SpatialPooler::setPotentialPct(Real potentialPct)
 {
+    waitForLearning();
     potentialPct_ = potentialPct;
 }
 
@@ -169,7 +616,9 @@ bool SpatialPooler::getGlobalInhibition() const { return globalInhibition_; }
 
 void SpatialPooler::setGlobalInhibition(bool globalInhibition)
 {
+    waitForLearning();
     globalInhibition_ = globalInhibition;
+    updateInhibitionParameters_();
 }
 
 Int SpatialPooler::getNumActiveColumnsPerInhArea() const
@@ -180,38 +629,51 @@ Int SpatialPooler::getNumActiveColumnsPerInhArea() const
 void SpatialPooler::setNumActiveColumnsPerInhArea(
     UInt numActiveColumnsPerInhArea)
 {
+    waitForLearning();
     NTA_ASSERT(numActiveColumnsPerInhArea > 0);
     numActiveColumnsPerInhArea_ = numActiveColumnsPerInhArea;
     localAreaDensity_ = 0;
+    updateInhibitionParameters_();
 }
 
 Real SpatialPooler::getLocalAreaDensity() const { return localAreaDensity_; }
 
 void SpatialPooler::setLocalAreaDensity(Real localAreaDensity)
 {
+    waitForLearning();
     NTA_ASSERT(localAreaDensity > 0 && localAreaDensity <= 1);
     localAreaDensity_ = localAreaDensity;
     numActiveColumnsPerInhArea_ = 0;
+    updateInhibitionParameters_();
 }
 
 UInt SpatialPooler::getStimulusThreshold() const { return stimulusThreshold_; }
 
 void SpatialPooler::setStimulusThreshold(UInt stimulusThreshold)
 {
+    waitForLearning();
     stimulusThreshold_ = stimulusThreshold;
+    updateInhibitionParameters_();
 }
 
-UInt SpatialPooler::getInhibitionRadius() const { return inhibitionRadius_; }
+UInt SpatialPooler::getInhibitionRadius() const
+{
+    waitForLearning();
+    return inhibitionRadius_;
+}
 
 void SpatialPooler::setInhibitionRadius(UInt inhibitionRadius)
 {
+    waitForLearning();
     inhibitionRadius_ = inhibitionRadius;
+    updateInhibitionParameters_();
 }
 
 UInt SpatialPooler::getDutyCyclePeriod() const { return dutyCyclePeriod_; }
 
 void SpatialPooler::setDutyCyclePeriod(UInt dutyCyclePeriod)
 {
+    waitForLearning();
     dutyCyclePeriod_ = dutyCyclePeriod;
 }
 
@@ -219,6 +681,7 @@ Real SpatialPooler::getBoostStrength() const { return boostStrength_; }
 
 void SpatialPooler::setBoostStrength(Real boostStrength)
 {
+    waitForLearning();
     boostStrength_ = boostStrength;
 }
 
@@ -226,6 +689,7 @@ UInt SpatialPooler::getIterationNum() const { return iterationNum_; }
 
 void SpatialPooler::setIterationNum(UInt iterationNum)
 {
+    waitForLearning();
     iterationNum_ = iterationNum;
 }
 
@@ -233,6 +697,7 @@ UInt SpatialPooler::getIterationLearnNum() const { return iterationLearnNum_; }
 
 void SpatialPooler::setIterationLearnNum(UInt iterationLearnNum)
 {
+    waitForLearning();
     iterationLearnNum_ = iterationLearnNum;
 }
 
@@ -240,17 +705,116 @@ UInt SpatialPooler::getSpVerbosity() const { return spVerbosity_; }
 
 void SpatialPooler::setSpVerbosity(UInt spVerbosity)
 {
+    waitForLearning();
     spVerbosity_ = spVerbosity;
 }
 
 bool SpatialPooler::getWrapAround() const { return wrapAround_; }
 
-void SpatialPooler::setWrapAround(bool wrapAround) { wrapAround_ = wrapAround; }
+void SpatialPooler::setWrapAround(bool wrapAround)
+{
+    waitForLearning();
+    wrapAround_ = wrapAround;
+    updateInhibitionParameters_();
+}
+
+UInt SpatialPooler::getNumThreads() const { return numThreads_; }
+
+void SpatialPooler::setNumThreads(UInt numThreads)
+{
+    waitForLearning();
+    if (numThreads == 1)
+    {
+        threadPool_.reset();
+        numThreads_ = 1;
+        reserveColumnUpdates_();
+        return;
+    }
+
+    threadPool_ = std::make_shared<ThreadPool>(numThreads);
+    numThreads_ = threadPool_->getNumThreads();
+    reserveColumnUpdates_();
+}
+
+bool SpatialPooler::getApproximateBoost() const { return approximateBoost_; }
+
+void SpatialPooler::setApproximateBoost(bool approximateBoost)
+{
+    waitForLearning();
+    approximateBoost_ = approximateBoost;
+}
+
+bool SpatialPooler::getAsyncLearning() const
+{
+    return bool(learningWorker_);
+}
+
+void SpatialPooler::setAsyncLearning(bool asyncLearning)
+{
+    learningWorker_.setEnabled(asyncLearning);
+}
+
+void SpatialPooler::waitForLearning() const { learningWorker_.wait(); }
+
+SpatialPooler::LearningWorker::LearningWorker(const LearningWorker &other)
+{
+    other.wait();
+    setEnabled(bool(other));
+}
+
+SpatialPooler::LearningWorker::LearningWorker(LearningWorker &&other)
+{
+    other.wait();
+    worker_ = std::move(other.worker_);
+}
+
+SpatialPooler::LearningWorker &SpatialPooler::LearningWorker::
+operator=(const LearningWorker &other)
+{
+    wait();
+    other.wait();
+    setEnabled(bool(other));
+    return *this;
+}
+
+SpatialPooler::LearningWorker &SpatialPooler::LearningWorker::
+operator=(LearningWorker &&other)
+{
+    wait();
+    other.wait();
+    if (this != &other)
+    {
+        worker_ = std::move(other.worker_);
+    }
+    return *this;
+}
+
+void SpatialPooler::LearningWorker::setEnabled(bool enabled)
+{
+    wait();
+    if (!enabled)
+    {
+        worker_.reset();
+    }
+    else if (!worker_)
+    {
+        worker_.reset(new SerialWorker());
+    }
+}
+
+void SpatialPooler::LearningWorker::wait() const
+{
+    if (worker_)
+    {
+        worker_->wait();
+    }
+}
 
 UInt SpatialPooler::getUpdatePeriod() const { return updatePeriod_; }
 
 void SpatialPooler::setUpdatePeriod(UInt updatePeriod)
 {
+    waitForLearning();
     updatePeriod_ = updatePeriod;
 }
 
@@ -261,6 +825,7 @@ Real SpatialPooler::getSynPermTrimThreshold() const
 
 void SpatialPooler::setSynPermTrimThreshold(Real synPermTrimThreshold)
 {
+    waitForLearning();
     synPermTrimThreshold_ = synPermTrimThreshold;
 }
 
@@ -268,6 +833,7 @@ Real SpatialPooler::getSynPermActiveInc() const { return synPermActiveInc_; }
 
 void SpatialPooler::setSynPermActiveInc(Real synPermActiveInc)
 {
+    waitForLearning();
     synPermActiveInc_ = synPermActiveInc;
 }
 
@@ -278,6 +844,7 @@ Real SpatialPooler::getSynPermInactiveDec() const
 
 void SpatialPooler::setSynPermInactiveDec(Real synPermInactiveDec)
 {
+    waitForLearning();
     synPermInactiveDec_ = synPermInactiveDec;
 }
 
@@ -288,6 +855,7 @@ Real SpatialPooler::getSynPermBelowStimulusInc() const
 
 void SpatialPooler::setSynPermBelowStimulusInc(Real synPermBelowStimulusInc)
 {
+    waitForLearning();
     synPermBelowStimulusInc_ = synPermBelowStimulusInc;
 }
 
@@ -295,12 +863,52 @@ Real SpatialPooler::getSynPermConnected() const { return synPermConnected_; }
 
 void SpatialPooler::setSynPermConnected(Real synPermConnected)
 {
+    waitForLearning();
     synPermConnected_ = synPermConnected;
 }
 
 Real SpatialPooler::getSynPermMax() const { return synPermMax_; }
 
-void SpatialPooler::setSynPermMax(Real synPermMax) { synPermMax_ = synPermMax; }
+void SpatialPooler::setSynPermMax(Real synPermMax)
+{
+    waitForLearning();
+    synPermMax_ = synPermMax;
+}
+
+UInt SpatialPooler::getPermanenceBits() const
+{
+    return synapses_.getFixedPoint().getBits();
+}
+
+void SpatialPooler::setPermanenceBits(UInt permanenceBits)
+{
+    waitForLearning();
+
+    // The permanences are converted in place, then only the columns whose
+    // rounded permanences would be stored differently are rewritten: those
+    // with a connected flag that rounding changed, a permanence that now
+    // trims to 0, or synapses outside of the potential pool, which
+    // fixed-point columns do not keep.
+    synapses_.setPermanenceFormat(permanenceBits, synPermMin_, synPermMax_);
+    const bool fixedPoint = synapses_.getFixedPoint().enabled();
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        bool changed = false;
+        synapses_.forEachSynapse(
+            i, [&](UInt, Real perm, bool potential, bool connected) {
+                changed |=
+                    (fixedPoint && !potential) ||
+                    (perm != 0 && perm < synPermTrimThreshold_) ||
+                    connected !=
+                        (perm >= synPermConnected_ - PERMANENCE_EPSILON);
+            });
+        if (changed)
+        {
+            loadColumnSparse_(i);
+            updatePermanencesForColumnSparse_(i, false);
+        }
+    }
+}
 
 Real SpatialPooler::getMinPctOverlapDutyCycles() const
 {
@@ -309,74 +917,110 @@ Real SpatialPooler::getMinPctOverlapDutyCycles() const
 
 void SpatialPooler::setMinPctOverlapDutyCycles(Real minPctOverlapDutyCycles)
 {
+    waitForLearning();
     minPctOverlapDutyCycles_ = minPctOverlapDutyCycles;
 }
 
 void SpatialPooler::getBoostFactors(Real boostFactors[]) const
 {
+    waitForLearning();
     copy(boostFactors_.begin(), boostFactors_.end(), boostFactors);
 }
 
 void SpatialPooler::setBoostFactors(Real boostFactors[])
 {
+    waitForLearning();
     boostFactors_.assign(&boostFactors[0], &boostFactors[numColumns_]);
 }
 
 void SpatialPooler::getOverlapDutyCycles(Real overlapDutyCycles[]) const
 {
+    waitForLearning();
     copy(overlapDutyCycles_.begin(), overlapDutyCycles_.end(),
          overlapDutyCycles);
 }
 
 void SpatialPooler::setOverlapDutyCycles(Real overlapDutyCycles[])
 {
+    waitForLearning();
     overlapDutyCycles_.assign(&overlapDutyCycles[0],
                               &overlapDutyCycles[numColumns_]);
 }
 
 void SpatialPooler::getActiveDutyCycles(Real activeDutyCycles[]) const
 {
+    waitForLearning();
     copy(activeDutyCycles_.begin(), activeDutyCycles_.end(), activeDutyCycles);
 }
 
 void SpatialPooler::setActiveDutyCycles(Real activeDutyCycles[])
 {
+    waitForLearning();
     activeDutyCycles_.assign(&activeDutyCycles[0],
                              &activeDutyCycles[numColumns_]);
 }
 
 void SpatialPooler::getMinOverlapDutyCycles(Real minOverlapDutyCycles[]) const
 {
+    waitForLearning();
     copy(minOverlapDutyCycles_.begin(), minOverlapDutyCycles_.end(),
          minOverlapDutyCycles);
 }
 
 void SpatialPooler::setMinOverlapDutyCycles(Real minOverlapDutyCycles[])
 {
+    waitForLearning();
     minOverlapDutyCycles_.assign(&minOverlapDutyCycles[0],
                                  &minOverlapDutyCycles[numColumns_]);
 }
 
 void SpatialPooler::getPotential(UInt column, UInt potential[]) const
 {
+    waitForLearning();
     NTA_ASSERT(column < numColumns_);
-    potentialPools_.getRow(column, &potential[0], &potential[numInputs_]);
+    std::fill(potential, potential + numInputs_, 0);
+    synapses_.forEachSynapse(
+        column, [&](UInt input, Real, bool isPotential, bool) {
+            potential[input] = isPotential ? 1 : 0;
+        });
 }
 
 void SpatialPooler::setPotential(UInt column, UInt potential[])
 {
+    waitForLearning();
     NTA_ASSERT(column < numColumns_);
-    potentialPools_.rowFromDense(column, &potential[0], &potential[numInputs_]);
+    std::vector<UInt> potentialSparse;
+    for (UInt i = 0; i < numInputs_; i++)
+    {
+        if (potential[i])
+        {
+            potentialSparse.push_back(i);
+        }
+    }
+    synapses_.setPotential(column, potentialSparse.data(),
+                           potentialSparse.data() + potentialSparse.size());
+
+    // The fixed-point permanences follow the potential pool.
+    if (synapses_.getFixedPoint().enabled())
+    {
+        loadColumnSparse_(column);
+        updatePermanencesForColumnSparse_(column, false);
+    }
 }
 
 void SpatialPooler::getPermanence(UInt column, Real permanences[]) const
 {
+    waitForLearning();
     NTA_ASSERT(column < numColumns_);
-    permanences_.getRowToDense(column, permanences);
+    std::fill(permanences, permanences + numInputs_, (Real)0);
+    synapses_.forEachSynapse(column, [&](UInt input, Real perm, bool, bool) {
+        permanences[input] = perm;
+    });
 }
 
 void SpatialPooler::setPermanence(UInt column, Real permanences[])
 {
+    waitForLearning();
     NTA_ASSERT(column < numColumns_);
     std::vector<Real> perm;
     perm.assign(&permanences[0], &permanences[numInputs_]);
@@ -386,13 +1030,16 @@ void SpatialPooler::setPermanence(UInt column, Real permanences[])
 void SpatialPooler::getConnectedSynapses(UInt column,
                                          UInt connectedSynapses[]) const
 {
+    waitForLearning();
     NTA_ASSERT(column < numColumns_);
-    connectedSynapses_.getRow(column, &connectedSynapses[0],
-                              &connectedSynapses[numInputs_]);
+    std::fill(connectedSynapses, connectedSynapses + numInputs_, 0);
+    synapses_.forEachConnected(
+        column, [&](UInt input) { connectedSynapses[input] = 1; });
 }
 
 void SpatialPooler::getConnectedCounts(UInt connectedCounts[]) const
 {
+    waitForLearning();
     copy(connectedCounts_.begin(), connectedCounts_.end(), connectedCounts);
 }
 
@@ -415,8 +1062,10 @@ void SpatialPooler::initialize(const std::vector<UInt> &inputDimensions,
                                Real synPermActiveInc, Real synPermConnected,
                                Real minPctOverlapDutyCycles,
                                UInt dutyCyclePeriod, Real boostStrength,
-                               Int seed, UInt spVerbosity, bool wrapAround)
+                               Int seed, UInt spVerbosity, bool wrapAround,
+                               UInt numThreads)
 {
+    waitForLearning();
 
     numInputs_ = 1;
     inputDimensions_.clear();
@@ -467,6 +1116,7 @@ void SpatialPooler::initialize(const std::vector<UInt> &inputDimensions,
     initConnectedPct_ = 0.5;
     iterationNum_ = 0;
     iterationLearnNum_ = 0;
+    setNumThreads(numThreads);
 
     tieBreaker_.resize(numColumns_);
     for (UInt i = 0; i < numColumns_; i++)
@@ -474,10 +1124,10 @@ void SpatialPooler::initialize(const std::vector<UInt> &inputDimensions,
         tieBreaker_[i] = 0.01 * rng_.getReal64();
     }
 
-    potentialPools_.resize(numColumns_, numInputs_);
-    permanences_.resize(numColumns_, numInputs_);
-    connectedSynapses_.resize(numColumns_, numInputs_);
+    synapses_.setPermanenceFormat(0, 0, 0);
+    synapses_.resize(numColumns_, numInputs_);
     connectedCounts_.resize(numColumns_);
+    resetConnectedSpans_();
 
     overlapDutyCycles_.assign(numColumns_, 0);
     activeDutyCycles_.assign(numColumns_, 0);
@@ -489,15 +1139,40 @@ void SpatialPooler::initialize(const std::vector<UInt> &inputDimensions,
 
     inhibitionRadius_ = 0;
 
-    for (UInt i = 0; i < numColumns_; ++i)
-    {
-        std::vector<UInt> potential = mapPotential_(i, wrapAround_);
-        std::vector<Real> perm = initPermanence_(potential, initConnectedPct_);
-        potentialPools_.rowFromDense(i, potential.begin(), potential.end());
-        updatePermanencesForColumn_(perm, i, true);
+    // The columns are initialized by blocks: their potential pools and
+    // permanences are drawn in parallel, each column from its own stream of
+    // the generator so that the result does not depend on the number of
+    // threads, then stored in column order.
+    const UInt64 initSeed = (UInt64)rng_.getUInt32() + 1;
+    const UInt blockSize = 4096;
+    std::vector<std::vector<UInt>> potentials(
+        std::min(blockSize, numColumns_));
+    std::vector<std::vector<Real>> perms(potentials.size());
+    for (UInt block = 0; block < numColumns_; block += blockSize)
+    {
+        const UInt blockEnd = std::min(numColumns_, block + blockSize);
+        parallelFor_(block, blockEnd, [&](UInt begin, UInt end) {
+            for (UInt i = begin; i < end; i++)
+            {
+                initColumn_(i, initSeed, potentials[i - block],
+                            perms[i - block]);
+            }
+        });
+
+        for (UInt i = block; i < blockEnd; i++)
+        {
+            std::vector<UInt> &potential = potentials[i - block];
+            synapses_.setPotential(i, potential.data(),
+                                   potential.data() + potential.size());
+            column_.inputs.swap(potential);
+            column_.perms.swap(perms[i - block]);
+            column_.potential.assign(column_.inputs.size(), true);
+            updatePermanencesForColumnSparse_(i, false);
+        }
     }
 
     updateInhibitionRadius_();
+    allocateScratch_();
 
     if (spVerbosity_ > 0)
     {
@@ -506,11 +1181,66 @@ void SpatialPooler::initialize(const std::vector<UInt> &inputDimensions,
     }
 }
 
+void SpatialPooler::allocateScratch_()
+{
+    activeColumns_.reserve(numColumns_);
+    inputDense_.reserve(numInputs_);
+    activeDense_.reserve(numColumns_);
+
+    context_.reserve_(numColumns_);
+
+    if (columnDimensions_.size() <= 2)
+    {
+        const UInt nrows =
+            columnDimensions_.size() == 2 ? columnDimensions_[0] : 1;
+        const UInt ncols = columnDimensions_.back();
+        const UInt maxLine = 3 * std::max(nrows, ncols);
+        windowSums_.reserve((nrows + 1) * (ncols + 1));
+        windowMax_.reserve(numColumns_);
+        windowLine_.reserve(maxLine);
+        windowPrefix_.reserve(maxLine);
+        windowSuffix_.reserve(maxLine);
+    }
+
+    synapses_.reserveConnectedRows();
+    activeInputs_.reserve(numInputs_);
+    packedRows_.clear();
+    packedDirty_.clear();
+    weakColumns_.reserve(numColumns_);
+    reserveColumnUpdates_();
+}
+
+void SpatialPooler::reserveColumnUpdates_()
+{
+    UInt maxRowSize = 0;
+    for (UInt i = 0; i < synapses_.getNumRows(); i++)
+    {
+        maxRowSize = std::max(maxRowSize, synapses_.getRowSize(i));
+    }
+    column_.reserve(maxRowSize);
+
+    // A few columns per thread and block, so that the threads are kept
+    // busy while the block is stored.
+    columnUpdates_.resize(numThreads_ > 1 ? 16 * numThreads_ : 0);
+    for (ColumnUpdate &update : columnUpdates_)
+    {
+        update.reserve(maxRowSize);
+    }
+}
+
+void SpatialPooler::ColumnUpdate::reserve(UInt size)
+{
+    inputs.reserve(size);
+    perms.reserve(size);
+    potential.reserve(size);
+    connected.reserve(size);
+}
+
 void SpatialPooler::compute(UInt inputArray[], bool learn, UInt activeArray[])
 {
+    waitForLearning();
     updateBookeepingVars_(learn);
     calculateOverlap_(inputArray, overlaps_);
-    calculateOverlapPct_(overlaps_, overlapsPct_);
 
     if (learn)
     {
@@ -524,38 +1254,264 @@ void SpatialPooler::compute(UInt inputArray[], bool learn, UInt activeArray[])
     inhibitColumns_(boostedOverlaps_, activeColumns_);
     toDense_(activeColumns_, activeArray, numColumns_);
 
-    if (learn)
+    if (!learn)
     {
-        adaptSynapses_(inputArray, activeColumns_);
-        updateDutyCycles_(overlaps_, activeArray);
-        bumpUpWeakColumns_();
-        updateBoostFactors_();
-        if (isUpdateRound_())
-        {
-            updateInhibitionRadius_();
-            updateMinDutyCycles_();
-        }
+        updateColumnStatistics_(overlaps_, activeArray, false, overlapsPct_);
+        return;
     }
+
+    learnStep_(inputArray, activeArray);
 }
 
-void SpatialPooler::stripUnlearnedColumns(UInt activeArray[]) const
+void SpatialPooler::compute(const UInt64 inputBits[], bool learn,
+                            UInt activeArray[])
 {
-    for (UInt i = 0; i < numColumns_; i++)
+    waitForLearning();
+    updateBookeepingVars_(learn);
+    calculateOverlapPacked_(inputBits, overlaps_);
+
+    if (learn)
     {
-        if (activeDutyCycles_[i] == 0)
-        {
-            activeArray[i] = 0;
-        }
+        boostOverlaps_(overlaps_, boostedOverlaps_);
+    }
+    else
+    {
+        boostedOverlaps_.assign(overlaps_.begin(), overlaps_.end());
     }
-}
 
-void SpatialPooler::toDense_(std::vector<UInt> &sparse, UInt dense[], UInt n)
-{
-    std::fill(dense, dense + n, 0);
-    for (auto &elem : sparse)
+    inhibitColumns_(boostedOverlaps_, activeColumns_);
+    toDense_(activeColumns_, activeArray, numColumns_);
+
+    if (!learn)
     {
-        UInt index = elem;
-        dense[index] = 1;
+        updateColumnStatistics_(overlaps_, activeArray, false, overlapsPct_);
+        return;
+    }
+
+    // Learning works on dense vectors, so expand the input once.
+    inputDense_.resize(numInputs_);
+    for (UInt i = 0; i < numInputs_; i++)
+    {
+        inputDense_[i] = (UInt)(inputBits[i / 64] >> (i % 64)) & 1;
+    }
+    learnStep_(inputDense_.data(), activeArray);
+}
+
+void SpatialPooler::compute(const std::vector<UInt> &activeInputs, bool learn,
+                            std::vector<UInt> &activeColumns)
+{
+    waitForLearning();
+    updateBookeepingVars_(learn);
+    calculateOverlapSparse_(activeInputs, overlaps_);
+
+    if (learn)
+    {
+        boostOverlaps_(overlaps_, boostedOverlaps_);
+    }
+    else
+    {
+        boostedOverlaps_.assign(overlaps_.begin(), overlaps_.end());
+    }
+
+    inhibitColumns_(boostedOverlaps_, activeColumns_);
+    activeColumns.assign(activeColumns_.begin(), activeColumns_.end());
+    std::sort(activeColumns.begin(), activeColumns.end());
+
+    if (!learn)
+    {
+        updateColumnStatistics_(overlaps_, nullptr, false, overlapsPct_);
+        return;
+    }
+
+    // Learning works on dense vectors, so expand the input once. The
+    // output is expanded by learnStep_.
+    inputDense_.assign(numInputs_, 0);
+    for (auto &elem : activeInputs)
+    {
+        inputDense_[elem] = 1;
+    }
+    learnStep_(inputDense_.data(), nullptr);
+}
+
+void SpatialPooler::compute(const UInt inputArray[], UInt activeArray[],
+                            InferenceContext &context) const
+{
+    waitForLearning();
+    context.reserve_(numColumns_);
+    calculateOverlap_(inputArray, context.overlaps_, context);
+    context.boostedOverlaps_.assign(context.overlaps_.begin(),
+                                    context.overlaps_.end());
+    inhibitColumns_(context.boostedOverlaps_, context.activeColumns_, context);
+    std::sort(context.activeColumns_.begin(), context.activeColumns_.end());
+    toDense_(context.activeColumns_, activeArray, numColumns_);
+}
+
+void SpatialPooler::compute(const std::vector<UInt> &activeInputs,
+                            std::vector<UInt> &activeColumns,
+                            InferenceContext &context) const
+{
+    waitForLearning();
+    context.reserve_(numColumns_);
+    calculateOverlapSparse_(activeInputs, context.overlaps_);
+    context.boostedOverlaps_.assign(context.overlaps_.begin(),
+                                    context.overlaps_.end());
+    inhibitColumns_(context.boostedOverlaps_, context.activeColumns_, context);
+    std::sort(context.activeColumns_.begin(), context.activeColumns_.end());
+    activeColumns.assign(context.activeColumns_.begin(),
+                         context.activeColumns_.end());
+}
+
+void SpatialPooler::computeBatch(const UInt inputs[], UInt nRecords,
+                                 UInt activeOut[])
+{
+    waitForLearning();
+    for (UInt first = 0; first < nRecords; first += BATCH_BLOCK)
+    {
+        const UInt n = std::min(BATCH_BLOCK, nRecords - first);
+        calculateOverlapBatch_(inputs + (size_t)first * numInputs_, n,
+                               batchOverlaps_);
+
+        for (UInt r = 0; r < n; r++)
+        {
+            updateBookeepingVars_(false);
+            const auto overlaps =
+                batchOverlaps_.begin() + (size_t)r * numColumns_;
+            boostedOverlaps_.assign(overlaps, overlaps + numColumns_);
+            inhibitColumns_(boostedOverlaps_, activeColumns_);
+            toDense_(activeColumns_,
+                     activeOut + (size_t)(first + r) * numColumns_,
+                     numColumns_);
+        }
+    }
+
+    // Leave the same state behind as the last call to compute would have.
+    if (nRecords > 0)
+    {
+        const UInt last = (nRecords - 1) % BATCH_BLOCK;
+        const auto overlaps =
+            batchOverlaps_.begin() + (size_t)last * numColumns_;
+        overlaps_.assign(overlaps, overlaps + numColumns_);
+        calculateOverlapPct_(overlaps_, overlapsPct_);
+    }
+}
+
+// Fills the inverted index of a frozen spatial pooler, whose offsets are
+// the starts of the lists of every input.
+template <typename ColumnId>
+static void fillFrozenIndex_(const SynapseStore &synapses,
+                             std::vector<size_t> offsets,
+                             std::vector<ColumnId> &columns)
+{
+    columns.resize(offsets.back());
+    for (UInt column = 0; column < synapses.getNumRows(); column++)
+    {
+        synapses.forEachConnected(column, [&](UInt input) {
+            columns[offsets[input]++] = (ColumnId)column;
+        });
+    }
+}
+
+FrozenSpatialPooler SpatialPooler::freeze() const
+{
+    waitForLearning();
+    FrozenSpatialPooler frozen;
+    frozen.numInputs_ = numInputs_;
+    frozen.numColumns_ = numColumns_;
+
+    // The lists of columns are filled by increasing column, so they are
+    // sorted.
+    std::vector<size_t> &offsets = frozen.offsets_;
+    offsets.assign(numInputs_ + 1, 0);
+    for (UInt column = 0; column < numColumns_; column++)
+    {
+        synapses_.forEachConnected(column,
+                                   [&](UInt input) { ++offsets[input + 1]; });
+    }
+    for (UInt input = 0; input < numInputs_; input++)
+    {
+        offsets[input + 1] += offsets[input];
+    }
+    if (numColumns_ <= 0x10000)
+    {
+        fillFrozenIndex_(synapses_, offsets, frozen.columns16_);
+    }
+    else
+    {
+        fillFrozenIndex_(synapses_, offsets, frozen.columns32_);
+    }
+
+    frozen.inhibition_ = inhibition_;
+    return frozen;
+}
+
+void SpatialPooler::learnStep_(const UInt inputVector[],
+                               const UInt activeVector[])
+{
+    if (!learningWorker_)
+    {
+        if (activeVector == nullptr)
+        {
+            activeDense_.resize(numColumns_);
+            toDense_(activeColumns_, activeDense_.data(), numColumns_);
+            activeVector = activeDense_.data();
+        }
+        updateColumnStatistics_(overlaps_, activeVector, true, overlapsPct_);
+        learn_(inputVector);
+        return;
+    }
+
+    // The next call waits for this step, so the only state to set aside is
+    // the caller's input, which may change meanwhile. The active columns
+    // are expanded again from activeColumns_.
+    if (inputVector != inputDense_.data())
+    {
+        inputDense_.assign(inputVector, inputVector + numInputs_);
+    }
+    learningWorker_->post([this]() {
+        activeDense_.resize(numColumns_);
+        toDense_(activeColumns_, activeDense_.data(), numColumns_);
+        updateColumnStatistics_(overlaps_, activeDense_.data(), true,
+                                overlapsPct_);
+        learn_(inputDense_.data());
+    });
+}
+
+void SpatialPooler::learn_(const UInt inputVector[])
+{
+    // The duty cycles and the global boost factors have already been updated
+    // by updateColumnStatistics_.
+    adaptSynapses_(inputVector, activeColumns_);
+    bumpUpWeakColumns_();
+    if (!globalInhibition_)
+    {
+        updateBoostFactorsLocal_();
+    }
+    if (isUpdateRound_())
+    {
+        updateInhibitionRadius_();
+        updateMinDutyCycles_();
+    }
+}
+
+void SpatialPooler::stripUnlearnedColumns(UInt activeArray[]) const
+{
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        if (activeDutyCycles_[i] == 0)
+        {
+            activeArray[i] = 0;
+        }
+    }
+}
+
+void SpatialPooler::toDense_(const std::vector<UInt> &sparse, UInt dense[],
+                             UInt n)
+{
+    std::fill(dense, dense + n, 0);
+    for (auto &elem : sparse)
+    {
+        UInt index = elem;
+        dense[index] = 1;
     }
 }
 
@@ -591,31 +1547,8 @@ UInt SpatialPooler::mapColumn_(UInt column)
 
 std::vector<UInt> SpatialPooler::mapPotential_(UInt column, bool wrapAround)
 {
-    const UInt centerInput = mapColumn_(column);
-
-    std::vector<UInt> columnInputs;
-    if (wrapAround)
-    {
-        for (UInt input : WrappingNeighborhood(centerInput, potentialRadius_,
-                                               inputDimensions_))
-        {
-            columnInputs.push_back(input);
-        }
-    }
-    else
-    {
-        for (UInt input :
-             Neighborhood(centerInput, potentialRadius_, inputDimensions_))
-        {
-            columnInputs.push_back(input);
-        }
-    }
-
-    UInt numPotential = round(columnInputs.size() * potentialPct_);
-
-    std::vector<UInt> selectedInputs(numPotential, 0);
-    rng_.sample(&columnInputs.front(), columnInputs.size(),
-                &selectedInputs.front(), numPotential);
+    std::vector<UInt> selectedInputs;
+    mapPotentialSparse_(column, wrapAround, rng_, selectedInputs);
 
     std::vector<UInt> potential(numInputs_, 0);
     for (UInt input : selectedInputs)
@@ -626,43 +1559,127 @@ std::vector<UInt> SpatialPooler::mapPotential_(UInt column, bool wrapAround)
     return potential;
 }
 
-Real SpatialPooler::initPermConnected_()
+void SpatialPooler::mapPotentialSparse_(UInt column, bool wrapAround,
+                                        Random &rng,
+                                        std::vector<UInt> &potential)
+{
+    const UInt centerInput = mapColumn_(column);
+
+    potential.clear();
+    forEachNeighbor(centerInput, potentialRadius_, inputDimensions_,
+                    wrapAround,
+                    [&](UInt input) { potential.push_back(input); });
+
+    // The choices are written before the population they are drawn from.
+    const UInt numPotential = round(potential.size() * potentialPct_);
+    rng.sample(potential.data(), (UInt32)potential.size(), potential.data(),
+               numPotential);
+    potential.resize(numPotential);
+    std::sort(potential.begin(), potential.end());
+}
+
+Real SpatialPooler::initPermConnected_() { return initPermConnected_(rng_); }
+
+Real SpatialPooler::initPermConnected_(Random &rng)
 {
     Real p = synPermConnected_ +
-             (synPermMax_ - synPermConnected_) * rng_.getReal64();
+             (synPermMax_ - synPermConnected_) * rng.getReal64();
 
     return round5_(p);
 }
 
 Real SpatialPooler::initPermNonConnected_()
 {
-    Real p = synPermConnected_ * rng_.getReal64();
+    return initPermNonConnected_(rng_);
+}
+
+Real SpatialPooler::initPermNonConnected_(Random &rng)
+{
+    Real p = synPermConnected_ * rng.getReal64();
     return round5_(p);
 }
 
 std::vector<Real> SpatialPooler::initPermanence_(std::vector<UInt> &potential,
                                                  Real connectedPct)
 {
-    std::vector<Real> perm(numInputs_, 0);
+    std::vector<UInt> potentialSparse;
     for (UInt i = 0; i < numInputs_; i++)
     {
-        if (potential[i] < 1)
+        if (potential[i] >= 1)
         {
-            continue;
+            potentialSparse.push_back(i);
         }
+    }
+    std::vector<Real> permSparse;
+    initPermanenceSparse_(potentialSparse, connectedPct, rng_, permSparse);
+
+    std::vector<Real> perm(numInputs_, 0);
+    for (size_t i = 0; i < potentialSparse.size(); i++)
+    {
+        perm[potentialSparse[i]] = permSparse[i];
+    }
 
-        if (rng_.getReal64() <= connectedPct)
+    return perm;
+}
+
+void SpatialPooler::initPermanenceSparse_(const std::vector<UInt> &potential,
+                                          Real connectedPct, Random &rng,
+                                          std::vector<Real> &perm)
+{
+    perm.resize(potential.size());
+    for (auto &p : perm)
+    {
+        if (rng.getReal64() <= connectedPct)
         {
-            perm[i] = initPermConnected_();
+            p = initPermConnected_(rng);
         }
         else
         {
-            perm[i] = initPermNonConnected_();
+            p = initPermNonConnected_(rng);
         }
-        perm[i] = perm[i] < synPermTrimThreshold_ ? 0 : perm[i];
+        p = p < synPermTrimThreshold_ ? 0 : p;
     }
+}
 
-    return perm;
+void SpatialPooler::initColumn_(UInt column, UInt64 seed,
+                                std::vector<UInt> &potential,
+                                std::vector<Real> &perm)
+{
+    Random rng(seed, (UInt64)column + 1);
+    mapPotentialSparse_(column, wrapAround_, rng, potential);
+    initPermanenceSparse_(potential, initConnectedPct_, rng, perm);
+
+    // Same as raisePermanencesToThreshold_ on the dense row, whose inputs
+    // outside of the pool stay at 0.
+    for (auto &p : perm)
+    {
+        p = p > synPermMax_ ? synPermMax_ : p;
+        p = p < synPermMin_ ? synPermMin_ : p;
+    }
+    const UInt numOutside =
+        synPermMin_ >= synPermConnected_ - PERMANENCE_EPSILON
+            ? numInputs_ - (UInt)potential.size()
+            : 0;
+    while (true)
+    {
+        UInt numConnected = numOutside;
+        for (Real p : perm)
+        {
+            if (p >= synPermConnected_ - PERMANENCE_EPSILON)
+            {
+                ++numConnected;
+            }
+        }
+        if (numConnected >= stimulusThreshold_)
+        {
+            break;
+        }
+
+        for (auto &p : perm)
+        {
+            p += synPermBelowStimulusInc_;
+        }
+    }
 }
 
 void SpatialPooler::clip_(std::vector<Real> &perm, bool trim = false)
@@ -678,32 +1695,218 @@ void SpatialPooler::clip_(std::vector<Real> &perm, bool trim = false)
 void SpatialPooler::updatePermanencesForColumn_(std::vector<Real> &perm,
                                                 UInt column, bool raisePerm)
 {
-    std::vector<UInt> connectedSparse;
+    if (synapses_.getFixedPoint().enabled())
+    {
+        column_.inputs.clear();
+        column_.perms.clear();
+        synapses_.forEachSynapse(
+            column, [&](UInt input, Real, bool isPotential, bool) {
+                if (isPotential)
+                {
+                    column_.inputs.push_back(input);
+                    column_.perms.push_back(perm[input]);
+                }
+            });
+        column_.potential.assign(column_.inputs.size(), true);
+        updatePermanencesForColumnSparse_(column, raisePerm);
+        return;
+    }
 
-    UInt numConnected;
+    std::vector<UInt> potential(numInputs_);
+    getPotential(column, potential.data());
     if (raisePerm)
     {
-        std::vector<UInt> potential;
-        potential.resize(numInputs_);
-        potential = potentialPools_.getSparseRow(column);
-        raisePermanencesToThreshold_(perm, potential);
+        std::vector<UInt> potentialSparse;
+        for (UInt i = 0; i < numInputs_; i++)
+        {
+            if (potential[i])
+            {
+                potentialSparse.push_back(i);
+            }
+        }
+        raisePermanencesToThreshold_(perm, potentialSparse);
+    }
+
+    synapses_.beginRow(column);
+    for (UInt i = 0; i < numInputs_; ++i)
+    {
+        const bool connected =
+            perm[i] >= synPermConnected_ - PERMANENCE_EPSILON;
+        perm[i] = perm[i] > synPermMax_ ? synPermMax_ : perm[i];
+        perm[i] = perm[i] < synPermTrimThreshold_ ? synPermMin_ : perm[i];
+        synapses_.append(i, nearlyZero(perm[i]) ? 0 : perm[i],
+                         potential[i] != 0, connected);
     }
+    storeColumn_(column);
+}
+
+void SpatialPooler::loadColumnSparse_(UInt column)
+{
+    loadColumnSparse_(column, column_);
+}
 
-    numConnected = 0;
-    for (size_t i = 0; i < perm.size(); ++i)
+void SpatialPooler::loadColumnSparse_(UInt column, ColumnUpdate &update) const
+{
+    synapses_.getRow(column, update.inputs, update.perms, update.potential);
+}
+
+bool SpatialPooler::canUpdateSparse_() const
+{
+    // The inputs that were not loaded have a permanence of 0, which the
+    // dense update leaves at 0 and never counts as connected, except with
+    // unusual parameters where the dense update is used instead.
+    return synapses_.getFixedPoint().enabled() ||
+           (synPermConnected_ - PERMANENCE_EPSILON > 0 && synPermMin_ == 0 &&
+            synPermMax_ >= 0);
+}
+
+void SpatialPooler::updatePermanencesForColumnSparse_(UInt column,
+                                                      bool raisePerm)
+{
+    if (!canUpdateSparse_())
     {
-        if (perm[i] >= synPermConnected_ - PERMANENCE_EPSILON)
+        std::vector<Real> perm(numInputs_, 0);
+        for (size_t i = 0; i < column_.inputs.size(); i++)
         {
-            connectedSparse.push_back(i);
-            ++numConnected;
+            perm[column_.inputs[i]] = column_.perms[i];
         }
+        updatePermanencesForColumn_(perm, column, raisePerm);
+        return;
     }
 
-    clip_(perm, true);
-    connectedSynapses_.replaceSparseRow(column, connectedSparse.begin(),
-                                        connectedSparse.end());
-    permanences_.setRowFromDense(column, perm);
-    connectedCounts_[column] = numConnected;
+    prepareColumnSparse_(column_, raisePerm);
+    storeColumnSparse_(column, column_);
+}
+
+void SpatialPooler::prepareColumnSparse_(ColumnUpdate &update,
+                                         bool raisePerm) const
+{
+    NTA_ASSERT(canUpdateSparse_());
+    const FixedPointPermanences &fixedPoint = synapses_.getFixedPoint();
+    std::vector<UInt> &inputs = update.inputs;
+    std::vector<Real> &perms = update.perms;
+    std::vector<bool> &potential = update.potential;
+    const size_t size = inputs.size();
+    if (raisePerm)
+    {
+        const Real belowStimulusInc =
+            fixedPoint.quantizeDelta(synPermBelowStimulusInc_);
+        for (size_t i = 0; i < size; i++)
+        {
+            Real &perm = perms[i];
+            perm = perm > synPermMax_ ? synPermMax_ : perm;
+            perm = perm < synPermMin_ ? synPermMin_ : perm;
+        }
+
+        while (true)
+        {
+            UInt numConnected = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                if (perms[i] >= synPermConnected_ - PERMANENCE_EPSILON)
+                {
+                    ++numConnected;
+                }
+            }
+            if (numConnected >= stimulusThreshold_)
+            {
+                break;
+            }
+
+            for (size_t i = 0; i < size; i++)
+            {
+                if (potential[i])
+                {
+                    perms[i] += belowStimulusInc;
+                }
+            }
+        }
+    }
+
+    // Same connected scan, trimming and zero filtering as the dense update.
+    // Fixed-point columns only keep their potential pool, and their
+    // connections are decided on the rounded permanences, which are the
+    // ones getPermanence returns.
+    update.connected.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        Real perm = perms[i];
+        bool connected = perm >= synPermConnected_ - PERMANENCE_EPSILON;
+        perm = perm > synPermMax_ ? synPermMax_ : perm;
+        if (fixedPoint.enabled())
+        {
+            if (!potential[i])
+            {
+                continue;
+            }
+            // Rounded before trimming, so that the stored permanences are
+            // trimmed the same way when they are loaded again.
+            perm = synapses_.round(perm);
+            perm = perm < synPermTrimThreshold_ ? synPermMin_ : perm;
+            connected = perm >= synPermConnected_ - PERMANENCE_EPSILON;
+        }
+        else
+        {
+            perm = perm < synPermTrimThreshold_ ? synPermMin_ : perm;
+        }
+        inputs[kept] = inputs[i];
+        perms[kept] = nearlyZero(perm) ? 0 : perm;
+        potential[kept] = potential[i];
+        update.connected.push_back(connected);
+        ++kept;
+    }
+    inputs.resize(kept);
+    perms.resize(kept);
+    potential.resize(kept);
+}
+
+void SpatialPooler::storeColumnSparse_(UInt column, const ColumnUpdate &update)
+{
+    synapses_.beginRow(column);
+    for (size_t i = 0; i < update.inputs.size(); i++)
+    {
+        synapses_.append(update.inputs[i], update.perms[i],
+                         update.potential[i], update.connected[i]);
+    }
+    storeColumn_(column);
+}
+
+template <typename Function>
+void SpatialPooler::updateColumns_(const std::vector<UInt> &columns,
+                                   bool raisePerm, const Function &change)
+{
+    const UInt blockSize = (UInt)columnUpdates_.size();
+    if (blockSize == 0 || !canUpdateSparse_())
+    {
+        for (UInt column : columns)
+        {
+            loadColumnSparse_(column);
+            change(column_);
+            updatePermanencesForColumnSparse_(column, raisePerm);
+        }
+        return;
+    }
+
+    const UInt numColumns = (UInt)columns.size();
+    for (UInt block = 0; block < numColumns; block += blockSize)
+    {
+        const UInt blockEnd = std::min(numColumns, block + blockSize);
+        parallelFor_(block, blockEnd, [&](UInt begin, UInt end) {
+            for (UInt i = begin; i < end; i++)
+            {
+                ColumnUpdate &update = columnUpdates_[i - block];
+                loadColumnSparse_(columns[i], update);
+                change(update);
+                prepareColumnSparse_(update, raisePerm);
+            }
+        });
+
+        for (UInt i = block; i < blockEnd; i++)
+        {
+            storeColumnSparse_(columns[i], columnUpdates_[i - block]);
+        }
+    }
 }
 
 UInt SpatialPooler::countConnected_(std::vector<Real> &perm)
@@ -739,19 +1942,116 @@ UInt SpatialPooler::raisePermanencesToThreshold_(std::vector<Real> &perm,
     return numConnected;
 }
 
+void SpatialPooler::storeColumn_(UInt column)
+{
+    connectedCounts_[column] = synapses_.endRow();
+    if (synapses_.getConnectedChanged())
+    {
+        updateConnectedSpan_(column);
+        if (!packedDirty_.empty())
+        {
+            packedDirty_[column] = 1;
+        }
+    }
+}
+
+void SpatialPooler::resetConnectedSpans_()
+{
+    const size_t numDims = inputDimensions_.size();
+    connectedSpans_.assign(numColumns_, 0);
+    connectedExtents_.resize(numColumns_ * numDims);
+    for (size_t i = 0; i < connectedExtents_.size(); i++)
+    {
+        connectedExtents_[i] = ConnectedExtent{inputDimensions_[i % numDims],
+                                               0, 0, 0};
+    }
+}
+
+void SpatialPooler::updateConnectedSpan_(UInt column, bool rescan)
+{
+    const std::vector<UInt> &added = synapses_.getConnectedAdded();
+    const std::vector<UInt> &removed = synapses_.getConnectedRemoved();
+    const size_t numDims = inputDimensions_.size();
+    ConnectedExtent *extents = connectedExtents_.data() + column * numDims;
+
+    auto include = [](ConnectedExtent &extent, UInt coord) {
+        if (coord < extent.lowest)
+        {
+            extent.lowest = coord;
+            extent.numLowest = 0;
+        }
+        extent.numLowest += coord == extent.lowest;
+        if (coord > extent.highest)
+        {
+            extent.highest = coord;
+            extent.numHighest = 0;
+        }
+        extent.numHighest += coord == extent.highest;
+    };
+
+    // As in avgConnectedSpanForColumnND_, the last dimension varies
+    // fastest.
+    UInt totalSpan = 0;
+    UInt stride = 1;
+    for (size_t j = numDims; j-- > 0;)
+    {
+        const UInt dimension = inputDimensions_[j];
+        ConnectedExtent &extent = extents[j];
+        bool rescanDimension = rescan;
+        for (size_t k = 0; !rescan && k < removed.size(); k++)
+        {
+            const UInt coord = (removed[k] / stride) % dimension;
+            if (coord == extent.lowest && --extent.numLowest == 0)
+            {
+                rescanDimension = true;
+            }
+            if (coord == extent.highest && --extent.numHighest == 0)
+            {
+                rescanDimension = true;
+            }
+        }
+
+        if (rescanDimension)
+        {
+            extent = ConnectedExtent{dimension, 0, 0, 0};
+            synapses_.forEachConnected(column, [&](UInt input) {
+                include(extent, (input / stride) % dimension);
+            });
+        }
+        else
+        {
+            for (UInt input : added)
+            {
+                include(extent, (input / stride) % dimension);
+            }
+        }
+
+        // A column without connected inputs has empty extents.
+        if (extent.numLowest > 0)
+        {
+            totalSpan += extent.highest - extent.lowest + 1;
+        }
+        stride *= dimension;
+    }
+
+    connectedSpans_[column] = (Real)totalSpan / numDims;
+}
+
 void SpatialPooler::updateInhibitionRadius_()
 {
     if (globalInhibition_)
     {
         inhibitionRadius_ =
             *max_element(columnDimensions_.begin(), columnDimensions_.end());
+        updateInhibitionParameters_();
         return;
     }
 
+    // The spans are kept up to date by storeColumn_.
     Real connectedSpan = 0;
     for (UInt i = 0; i < numColumns_; i++)
     {
-        connectedSpan += avgConnectedSpanForColumnND_(i);
+        connectedSpan += connectedSpans_[i];
     }
     connectedSpan /= numColumns_;
     Real columnsPerInput = avgColumnsPerInput_();
@@ -759,6 +2059,7 @@ void SpatialPooler::updateInhibitionRadius_()
     Real radius = (diameter - 1) / 2.0;
     radius = std::max((Real)1.0, radius);
     inhibitionRadius_ = UInt(round(radius));
+    updateInhibitionParameters_();
 }
 
 void SpatialPooler::updateMinDutyCycles_()
@@ -786,54 +2087,50 @@ void SpatialPooler::updateMinDutyCyclesGlobal_()
 
 void SpatialPooler::updateMinDutyCyclesLocal_()
 {
-    for (UInt i = 0; i < numColumns_; i++)
+    // The max over a box is separable: take the max along the rows, then
+    // along the columns of the result.
+    if (columnDimensions_.size() <= 2)
     {
-        Real maxActiveDuty = 0;
-        Real maxOverlapDuty = 0;
-        if (wrapAround_)
+        const UInt nrows =
+            columnDimensions_.size() == 2 ? columnDimensions_[0] : 1;
+        const UInt ncols = columnDimensions_.back();
+        windowMax_.resize(numColumns_);
+        for (UInt row = 0; row < nrows; row++)
         {
-            for (UInt column :
-                 WrappingNeighborhood(i, inhibitionRadius_, columnDimensions_))
-            {
-                maxActiveDuty =
-                    std::max(maxActiveDuty, activeDutyCycles_[column]);
-                maxOverlapDuty =
-                    std::max(maxOverlapDuty, overlapDutyCycles_[column]);
-            }
+            slidingMax_(&overlapDutyCycles_[row * ncols],
+                        &windowMax_[row * ncols], ncols, 1, inhibitionRadius_,
+                        wrapAround_, windowLine_, windowPrefix_,
+                        windowSuffix_);
         }
-        else
+        for (UInt col = 0; col < ncols; col++)
         {
-            for (UInt column :
-                 Neighborhood(i, inhibitionRadius_, columnDimensions_))
-            {
-                maxActiveDuty =
-                    std::max(maxActiveDuty, activeDutyCycles_[column]);
-                maxOverlapDuty =
-                    std::max(maxOverlapDuty, overlapDutyCycles_[column]);
-            }
+            slidingMax_(&windowMax_[col], &windowMax_[col], nrows, ncols,
+                        inhibitionRadius_, wrapAround_, windowLine_,
+                        windowPrefix_, windowSuffix_);
         }
 
-        minOverlapDutyCycles_[i] = maxOverlapDuty * minPctOverlapDutyCycles_;
-    }
-}
-
-void SpatialPooler::updateDutyCycles_(std::vector<UInt> &overlaps,
-                                      const UInt activeArray[])
-{
-    std::vector<UInt> newOverlapVal(numColumns_, 0);
-    std::vector<UInt> newActiveVal(numColumns_, 0);
-
-    for (UInt i = 0; i < numColumns_; i++)
-    {
-        newOverlapVal[i] = overlaps[i] > 0 ? 1 : 0;
-        newActiveVal[i] = activeArray[i] > 0 ? 1 : 0;
+        for (UInt i = 0; i < numColumns_; i++)
+        {
+            minOverlapDutyCycles_[i] = windowMax_[i] * minPctOverlapDutyCycles_;
+        }
+        return;
     }
 
-    UInt period =
-        dutyCyclePeriod_ > iterationNum_ ? iterationNum_ : dutyCyclePeriod_;
-
-    updateDutyCyclesHelper_(overlapDutyCycles_, newOverlapVal, period);
-    updateDutyCyclesHelper_(activeDutyCycles_, newActiveVal, period);
+    parallelFor_(0, numColumns_, [&](UInt begin, UInt end) {
+        for (UInt i = begin; i < end; i++)
+        {
+            Real maxOverlapDuty = 0;
+            forEachNeighbor(i, inhibitionRadius_, columnDimensions_,
+                            wrapAround_, [&](UInt column) {
+                                maxOverlapDuty =
+                                    std::max(maxOverlapDuty,
+                                             overlapDutyCycles_[column]);
+                            });
+
+            minOverlapDutyCycles_[i] =
+                maxOverlapDuty * minPctOverlapDutyCycles_;
+        }
+    });
 }
 
 Real SpatialPooler::avgColumnsPerInput_()
@@ -853,12 +2150,12 @@ Real SpatialPooler::avgConnectedSpanForColumn1D_(UInt column)
 {
 
     NTA_ASSERT(inputDimensions_.size() == 1);
-    std::vector<UInt> connectedSparse = connectedSynapses_.getSparseRow(column);
-    if (connectedSparse.empty())
+    const UInt numConnected = synapses_.getNumConnected(column);
+    if (numConnected == 0)
         return 0;
-    auto minmax =
-        minmax_element(connectedSparse.begin(), connectedSparse.end());
-    return *minmax.second /*max*/ - *minmax.first /*min*/ + 1;
+    // The connected inputs are sorted.
+    return synapses_.getConnected(column, numConnected - 1) /*max*/ -
+           synapses_.getConnected(column, 0) /*min*/ + 1;
 }
 
 Real SpatialPooler::avgConnectedSpanForColumn2D_(UInt column)
@@ -871,60 +2168,50 @@ Real SpatialPooler::avgConnectedSpanForColumn2D_(UInt column)
 
     CoordinateConverter2D conv(nrows, ncols);
 
-    std::vector<UInt> connectedSparse = connectedSynapses_.getSparseRow(column);
-    std::vector<UInt> rows, cols;
-    for (auto &elem : connectedSparse)
-    {
-        UInt index = elem;
-        rows.push_back(conv.toRow(index));
-        cols.push_back(conv.toCol(index));
-    }
-
-    if (rows.empty() && cols.empty())
+    if (synapses_.getNumConnected(column) == 0)
     {
         return 0;
     }
 
-    auto minmaxRows = minmax_element(rows.begin(), rows.end());
-    UInt rowSpan = *minmaxRows.second /*max*/ - *minmaxRows.first /*min*/ + 1;
+    UInt minRow = nrows, maxRow = 0;
+    UInt minCol = ncols, maxCol = 0;
+    synapses_.forEachConnected(column, [&](UInt index) {
+        const UInt row = conv.toRow(index);
+        const UInt col = conv.toCol(index);
+        minRow = std::min(minRow, row);
+        maxRow = std::max(maxRow, row);
+        minCol = std::min(minCol, col);
+        maxCol = std::max(maxCol, col);
+    });
 
-    auto minmaxCols = minmax_element(cols.begin(), cols.end());
-    UInt colSpan = *minmaxCols.second - *minmaxCols.first + 1;
+    UInt rowSpan = maxRow - minRow + 1;
+    UInt colSpan = maxCol - minCol + 1;
 
     return (rowSpan + colSpan) / 2.0;
 }
 
 Real SpatialPooler::avgConnectedSpanForColumnND_(UInt column)
 {
-    UInt numDimensions = inputDimensions_.size();
-    std::vector<UInt> connectedSparse = connectedSynapses_.getSparseRow(column);
-    std::vector<UInt> maxCoord(numDimensions, 0);
-    std::vector<UInt> minCoord(
-        numDimensions,
-        *max_element(inputDimensions_.begin(), inputDimensions_.end()));
-
-    CoordinateConverterND conv(inputDimensions_);
-
-    if (connectedSparse.empty())
+    if (synapses_.getNumConnected(column) == 0)
     {
         return 0;
     }
 
-    std::vector<UInt> columnCoord;
-    for (auto &elem : connectedSparse)
-    {
-        conv.toCoord(elem, columnCoord);
-        for (size_t j = 0; j < columnCoord.size(); j++)
-        {
-            maxCoord[j] = std::max(maxCoord[j], columnCoord[j]);
-            minCoord[j] = std::min(minCoord[j], columnCoord[j]);
-        }
-    }
-
+    // One pass per dimension, so that no coordinate vector is needed.
     UInt totalSpan = 0;
-    for (size_t j = 0; j < inputDimensions_.size(); j++)
+    UInt stride = 1;
+    for (size_t j = inputDimensions_.size(); j-- > 0;)
     {
-        totalSpan += maxCoord[j] - minCoord[j] + 1;
+        const UInt dimension = inputDimensions_[j];
+        UInt minCoord = dimension;
+        UInt maxCoord = 0;
+        synapses_.forEachConnected(column, [&](UInt input) {
+            const UInt coord = (input / stride) % dimension;
+            minCoord = std::min(minCoord, coord);
+            maxCoord = std::max(maxCoord, coord);
+        });
+        totalSpan += maxCoord - minCoord + 1;
+        stride *= dimension;
     }
 
     return (Real)totalSpan / inputDimensions_.size();
@@ -933,52 +2220,46 @@ Real SpatialPooler::avgConnectedSpanForColumnND_(UInt column)
 void SpatialPooler::adaptSynapses_(const UInt inputVector[],
                                    std::vector<UInt> &activeColumns)
 {
-    std::vector<Real> permChanges(numInputs_, -1 * synPermInactiveDec_);
-    for (UInt i = 0; i < numInputs_; i++)
-    {
-        if (inputVector[i] > 0)
-        {
-            permChanges[i] = synPermActiveInc_;
-        }
-    }
+    const Real activeChange =
+        synapses_.getFixedPoint().quantizeDelta(synPermActiveInc_);
+    const Real inactiveChange =
+        synapses_.getFixedPoint().quantizeDelta(-1 * synPermInactiveDec_);
 
-    for (size_t i = 0; i < activeColumns.size(); i++)
-    {
-        UInt column = activeColumns[i];
-        std::vector<UInt> potential;
-        std::vector<Real> perm(numInputs_, 0);
-        potential.resize(potentialPools_.nNonZerosOnRow(i));
-        potential = potentialPools_.getSparseRow(column);
-        permanences_.getRowToDense(column, perm);
-        for (auto &elem : potential)
+    updateColumns_(activeColumns, true, [&](ColumnUpdate &update) {
+        for (size_t j = 0; j < update.inputs.size(); j++)
         {
-            UInt index = elem;
-            perm[index] += permChanges[index];
+            if (update.potential[j])
+            {
+                update.perms[j] += inputVector[update.inputs[j]] > 0
+                                       ? activeChange
+                                       : inactiveChange;
+            }
         }
-        updatePermanencesForColumn_(perm, column, true);
-    }
+    });
 }
 
 void SpatialPooler::bumpUpWeakColumns_()
 {
+    weakColumns_.clear();
     for (UInt i = 0; i < numColumns_; i++)
     {
-        if (overlapDutyCycles_[i] >= minOverlapDutyCycles_[i])
+        if (overlapDutyCycles_[i] < minOverlapDutyCycles_[i])
         {
-            continue;
+            weakColumns_.push_back(i);
         }
-        std::vector<Real> perm(numInputs_, 0);
-        std::vector<UInt> potential;
-        potential.resize(potentialPools_.nNonZerosOnRow(i));
-        potential = potentialPools_.getSparseRow(i);
-        permanences_.getRowToDense(i, perm);
-        for (auto &elem : potential)
+    }
+
+    const Real belowStimulusInc =
+        synapses_.getFixedPoint().quantizeDelta(synPermBelowStimulusInc_);
+    updateColumns_(weakColumns_, false, [&](ColumnUpdate &update) {
+        for (size_t j = 0; j < update.inputs.size(); j++)
         {
-            UInt index = elem;
-            perm[index] += synPermBelowStimulusInc_;
+            if (update.potential[j])
+            {
+                update.perms[j] += belowStimulusInc;
+            }
         }
-        updatePermanencesForColumn_(perm, i, false);
-    }
+    });
 }
 
 void SpatialPooler::updateDutyCyclesHelper_(std::vector<Real> &dutyCycles,
@@ -989,94 +2270,309 @@ void SpatialPooler::updateDutyCyclesHelper_(std::vector<Real> &dutyCycles,
     NTA_ASSERT(dutyCycles.size() == newValues.size());
     for (size_t i = 0; i < dutyCycles.size(); i++)
     {
-        dutyCycles[i] =
-            (dutyCycles[i] * static_cast<Real>(period - 1) + newValues[i]) /
-            period;
+        dutyCycles[i] = updateDutyCycle_(dutyCycles[i], newValues[i], period);
     }
 }
 
-void SpatialPooler::updateBoostFactors_()
+Real SpatialPooler::inhibitionDensity_() const
 {
-    if (globalInhibition_)
+    return inhibitionDensity(inhibition_);
+}
+
+void SpatialPooler::updateInhibitionParameters_()
+{
+    inhibition_.numColumns = numColumns_;
+    inhibition_.columnDimensions = columnDimensions_;
+    inhibition_.globalInhibition = globalInhibition_;
+    inhibition_.numActiveColumnsPerInhArea = numActiveColumnsPerInhArea_;
+    inhibition_.localAreaDensity = localAreaDensity_;
+    inhibition_.stimulusThreshold = stimulusThreshold_;
+    inhibition_.inhibitionRadius = inhibitionRadius_;
+    inhibition_.wrapAround = wrapAround_;
+}
+
+void SpatialPooler::updateBoostFactorsLocal_()
+{
+    // The neighborhood sums come from a summed-area table, in double
+    // precision so that the differences of large partial sums stay accurate.
+    if (columnDimensions_.size() <= 2)
+    {
+        const UInt nrows =
+            columnDimensions_.size() == 2 ? columnDimensions_[0] : 1;
+        const UInt ncols = columnDimensions_.back();
+        const UInt stride = ncols + 1;
+        windowSums_.assign((nrows + 1) * stride, 0);
+        for (UInt row = 0; row < nrows; row++)
+        {
+            Real64 rowSum = 0;
+            for (UInt col = 0; col < ncols; col++)
+            {
+                rowSum += activeDutyCycles_[row * ncols + col];
+                windowSums_[(row + 1) * stride + col + 1] =
+                    windowSums_[row * stride + col + 1] + rowSum;
+            }
+        }
+
+        parallelFor_(0, numColumns_, [&](UInt begin, UInt end) {
+            UInt rowBegins[2], rowEnds[2], colBegins[2], colEnds[2];
+            for (UInt i = begin; i < end; ++i)
+            {
+                const UInt numRowIntervals =
+                    neighborhoodIntervals(i / ncols, inhibitionRadius_, nrows,
+                                          wrapAround_, rowBegins, rowEnds);
+                const UInt numColIntervals =
+                    neighborhoodIntervals(i % ncols, inhibitionRadius_, ncols,
+                                          wrapAround_, colBegins, colEnds);
+
+                UInt numNeighbors = 0;
+                Real64 localActivity = 0;
+                for (UInt r = 0; r < numRowIntervals; r++)
+                {
+                    for (UInt c = 0; c < numColIntervals; c++)
+                    {
+                        numNeighbors += (rowEnds[r] - rowBegins[r]) *
+                                        (colEnds[c] - colBegins[c]);
+                        localActivity +=
+                            windowSums_[rowEnds[r] * stride + colEnds[c]] -
+                            windowSums_[rowBegins[r] * stride + colEnds[c]] -
+                            windowSums_[rowEnds[r] * stride + colBegins[c]] +
+                            windowSums_[rowBegins[r] * stride + colBegins[c]];
+                    }
+                }
+
+                Real targetDensity = (Real)(localActivity / numNeighbors);
+                boostFactors_[i] = exp((targetDensity - activeDutyCycles_[i]) *
+                                       boostStrength_);
+            }
+        });
+        return;
+    }
+
+    parallelFor_(0, numColumns_, [&](UInt begin, UInt end) {
+        for (UInt i = begin; i < end; ++i)
+        {
+            UInt numNeighbors = 0;
+            Real localActivityDensity = 0;
+
+            forEachNeighbor(i, inhibitionRadius_, columnDimensions_,
+                            wrapAround_, [&](UInt neighbor) {
+                                localActivityDensity +=
+                                    activeDutyCycles_[neighbor];
+                                numNeighbors += 1;
+                            });
+
+            Real targetDensity = localActivityDensity / numNeighbors;
+            boostFactors_[i] =
+                exp((targetDensity - activeDutyCycles_[i]) * boostStrength_);
+        }
+    });
+}
+
+void SpatialPooler::updateBookeepingVars_(bool learn)
+{
+    iterationNum_++;
+    if (learn)
     {
-        updateBoostFactorsGlobal_();
+        iterationLearnNum_++;
     }
-    else
+}
+
+void SpatialPooler::calculateOverlap_(UInt inputVector[],
+                                      std::vector<UInt> &overlaps)
+{
+    calculateOverlap_(inputVector, overlaps, context_);
+}
+
+void SpatialPooler::calculateOverlap_(const UInt inputVector[],
+                                      std::vector<UInt> &overlaps,
+                                      const InferenceContext &context) const
+{
+    overlaps.assign(numColumns_, 0);
+    parallelFor_(context, 0, numColumns_, [&](UInt begin, UInt end) {
+        for (UInt i = begin; i < end; i++)
+        {
+            UInt overlap = 0;
+            synapses_.forEachConnected(
+                i, [&](UInt input) { overlap += inputVector[input]; });
+            overlaps[i] = overlap;
+        }
+    });
+}
+
+void SpatialPooler::calculateOverlapSparse_(
+    const std::vector<UInt> &activeInputs, std::vector<UInt> &overlaps) const
+{
+    overlaps.assign(numColumns_, 0);
+    for (auto &input : activeInputs)
     {
-        updateBoostFactorsLocal_();
+        NTA_ASSERT(input < numInputs_);
+        synapses_.forEachConnectedRow(input,
+                                      [&](UInt column) { ++overlaps[column]; });
+    }
+}
+
+void SpatialPooler::layoutPackedConnected_()
+{
+    // Each column's words cover all the inputs of its row of synapses_,
+    // which its connected synapses stay within unless the row grows.
+    packedRows_.resize(numColumns_);
+    size_t offset = 0;
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        UInt first = numInputs_;
+        UInt last = 0;
+        synapses_.forEachSynapse(i, [&](UInt input, Real, bool, bool) {
+            first = std::min(first, input);
+            last = std::max(last, input);
+        });
+        PackedRow &row = packedRows_[i];
+        row.offset = offset;
+        row.firstWord = first <= last ? first / 64 : 0;
+        row.numWords = first <= last ? last / 64 - row.firstWord + 1 : 0;
+        offset += row.numWords;
     }
+    packedConnected_.resize(offset);
+    packedDirty_.assign(numColumns_, 1);
 }
 
-void SpatialPooler::updateBoostFactorsGlobal_()
+void SpatialPooler::packConnected_(UInt column)
 {
-    Real targetDensity;
-    if (numActiveColumnsPerInhArea_ > 0)
-    {
-        UInt inhibitionArea = pow((Real)(2 * inhibitionRadius_ + 1),
-                                  (Real)columnDimensions_.size());
-        inhibitionArea = std::min(inhibitionArea, numColumns_);
-        targetDensity = ((Real)numActiveColumnsPerInhArea_) / inhibitionArea;
-        targetDensity = std::min(targetDensity, (Real)0.5);
-    }
-    else
+    const PackedRow &row = packedRows_[column];
+    UInt64 *words = packedConnected_.data() + row.offset;
+    std::fill(words, words + row.numWords, 0);
+    synapses_.forEachConnected(column, [&](UInt input) {
+        words[input / 64 - row.firstWord] |= (UInt64)1 << (input % 64);
+    });
+    packedDirty_[column] = 0;
+}
+
+bool SpatialPooler::usePackedOverlap_(UInt numActiveInputs)
+{
+    if (packedRows_.empty())
     {
-        targetDensity = localAreaDensity_;
+        layoutPackedConnected_();
     }
 
-    for (UInt i = 0; i < numColumns_; ++i)
+    // The sparse path does about one increment per connected synapse of
+    // the active inputs, the packed path one popcount per packed word.
+    UInt64 numConnected = 0;
+    for (UInt i = 0; i < numColumns_; i++)
     {
-        boostFactors_[i] =
-            exp((targetDensity - activeDutyCycles_[i]) * boostStrength_);
+        numConnected += connectedCounts_[i];
     }
+    return (UInt64)numActiveInputs * numConnected >=
+           (UInt64)packedConnected_.size() * numInputs_;
 }
 
-void SpatialPooler::updateBoostFactorsLocal_()
+void SpatialPooler::calculateOverlapPacked_(const UInt64 inputBits[],
+                                            std::vector<UInt> &overlaps)
 {
-    for (UInt i = 0; i < numColumns_; ++i)
+    // Bits past numInputs_ in the last word are ignored: no packed row
+    // has them.
+    const UInt numWords = (numInputs_ + 63) / 64;
+    const UInt lastBits = numInputs_ - (numWords - 1) * 64;
+    const UInt64 lastMask =
+        lastBits == 64 ? ~(UInt64)0 : ((UInt64)1 << lastBits) - 1;
+    auto inputWord = [&](UInt w) {
+        return w + 1 == numWords ? inputBits[w] & lastMask : inputBits[w];
+    };
+
+    UInt numActiveInputs = 0;
+    for (UInt w = 0; w < numWords; w++)
     {
-        UInt numNeighbors = 0;
-        Real localActivityDensity = 0;
+        numActiveInputs += popcount64_(inputWord(w));
+    }
 
-        if (wrapAround_)
+    if (!usePackedOverlap_(numActiveInputs))
+    {
+        activeInputs_.clear();
+        for (UInt w = 0; w < numWords; w++)
         {
-            for (UInt neighbor :
-                 WrappingNeighborhood(i, inhibitionRadius_, columnDimensions_))
+            UInt64 word = inputWord(w);
+            for (UInt bit = 0; word != 0; bit++, word >>= 1)
             {
-                localActivityDensity += activeDutyCycles_[neighbor];
-                numNeighbors += 1;
+                if (word & 1)
+                {
+                    activeInputs_.push_back(w * 64 + bit);
+                }
             }
         }
-        else
+        calculateOverlapSparse_(activeInputs_, overlaps);
+        return;
+    }
+
+    // A column whose connected synapses left its words needs a new layout.
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        const UInt numConnected = synapses_.getNumConnected(i);
+        const PackedRow &row = packedRows_[i];
+        if (packedDirty_[i] && numConnected != 0 &&
+            (synapses_.getConnected(i, 0) / 64 < row.firstWord ||
+             synapses_.getConnected(i, numConnected - 1) / 64 >=
+                 row.firstWord + row.numWords))
         {
-            for (UInt neighbor :
-                 Neighborhood(i, inhibitionRadius_, columnDimensions_))
-            {
-                localActivityDensity += activeDutyCycles_[neighbor];
-                numNeighbors += 1;
-            }
+            layoutPackedConnected_();
+            break;
         }
+    }
 
-        Real targetDensity = localActivityDensity / numNeighbors;
-        boostFactors_[i] =
-            exp((targetDensity - activeDutyCycles_[i]) * boostStrength_);
+    auto popcount = andPopcount_;
+#if defined(NTA_ASM) && defined(NTA_ARCH_64) && defined(__GNUC__)
+    if (SSE_LEVEL >= 42)
+    {
+        popcount = andPopcountHardware_;
     }
+#endif
+
+    overlaps.assign(numColumns_, 0);
+    parallelFor_(0, numColumns_, [&](UInt begin, UInt end) {
+        for (UInt i = begin; i < end; i++)
+        {
+            if (packedDirty_[i])
+            {
+                packConnected_(i);
+            }
+            const PackedRow &row = packedRows_[i];
+            overlaps[i] = popcount(packedConnected_.data() + row.offset,
+                                   inputBits + row.firstWord, row.numWords);
+        }
+    });
 }
 
-void SpatialPooler::updateBookeepingVars_(bool learn)
+void SpatialPooler::calculateOverlapBatch_(const UInt inputs[], UInt nRecords,
+                                           std::vector<UInt> &overlaps)
 {
-    iterationNum_++;
-    if (learn)
+    NTA_ASSERT(nRecords >= 1 && nRecords <= BATCH_BLOCK);
+
+    batchInputs_.resize((size_t)numInputs_ * BATCH_BLOCK);
+    for (UInt r = 0; r < nRecords; r++)
     {
-        iterationLearnNum_++;
+        const UInt *input = inputs + (size_t)r * numInputs_;
+        for (UInt i = 0; i < numInputs_; i++)
+        {
+            batchInputs_[(size_t)i * BATCH_BLOCK + r] = input[i];
+        }
     }
-}
 
-void SpatialPooler::calculateOverlap_(UInt inputVector[],
-                                      std::vector<UInt> &overlaps)
-{
-    overlaps.assign(numColumns_, 0);
-    connectedSynapses_.rightVecSumAtNZ(inputVector, inputVector + numInputs_,
-                                       overlaps.begin(), overlaps.end());
+    overlaps.resize((size_t)numColumns_ * BATCH_BLOCK);
+    parallelFor_(0, numColumns_, [&](UInt begin, UInt end) {
+        UInt sums[BATCH_BLOCK];
+        for (UInt column = begin; column < end; column++)
+        {
+            std::fill(sums, sums + BATCH_BLOCK, 0);
+            synapses_.forEachConnected(column, [&](UInt input) {
+                const UInt *values = &batchInputs_[(size_t)input * BATCH_BLOCK];
+                for (UInt r = 0; r < BATCH_BLOCK; r++)
+                {
+                    sums[r] += values[r];
+                }
+            });
+            for (UInt r = 0; r < nRecords; r++)
+            {
+                overlaps[(size_t)r * numColumns_ + column] = sums[r];
+            }
+        }
+    });
 }
 
 void SpatialPooler::calculateOverlapPct_(std::vector<UInt> &overlaps,
@@ -1098,29 +2594,60 @@ void SpatialPooler::calculateOverlapPct_(std::vector<UInt> &overlaps,
     }
 }
 
-void SpatialPooler::inhibitColumns_(const std::vector<Real> &overlaps,
-                                    std::vector<UInt> &activeColumns)
+void SpatialPooler::updateColumnStatistics_(const std::vector<UInt> &overlaps,
+                                            const UInt activeArray[],
+                                            bool learn,
+                                            std::vector<Real> &overlapPct)
 {
-    Real density = localAreaDensity_;
-    if (numActiveColumnsPerInhArea_ > 0)
-    {
-        UInt inhibitionArea = pow((Real)(2 * inhibitionRadius_ + 1),
-                                  (Real)columnDimensions_.size());
-        inhibitionArea = std::min(inhibitionArea, numColumns_);
-        density = ((Real)numActiveColumnsPerInhArea_) / inhibitionArea;
-        density = std::min(density, (Real)0.5);
+    overlapPct.resize(numColumns_);
+    const UInt period =
+        dutyCyclePeriod_ > iterationNum_ ? iterationNum_ : dutyCyclePeriod_;
+    NTA_ASSERT(!learn || period >= 1);
+    const bool boostGlobal = learn && globalInhibition_;
+
+    ColumnStatistics statistics;
+    statistics.overlaps = overlaps.data();
+    statistics.connectedCounts = connectedCounts_.data();
+    statistics.active = activeArray;
+    statistics.overlapPct = overlapPct.data();
+    statistics.overlapDutyCycles = overlapDutyCycles_.data();
+    statistics.activeDutyCycles = activeDutyCycles_.data();
+    statistics.boostFactors = boostFactors_.data();
+    statistics.period = period;
+    statistics.learn = learn;
+    statistics.boostGlobal = boostGlobal;
+    statistics.approximateExp = approximateBoost_;
+    statistics.targetDensity = boostGlobal ? inhibitionDensity_() : 0;
+    statistics.boostStrength = boostStrength_;
+
+    // The widest kernel the CPU supports takes the columns it can, the
+    // scalar loop the rest.
+    UInt (*kernel)(const ColumnStatistics &, UInt, UInt) = nullptr;
+#if defined(NTA_ASM) && defined(NTA_ARCH_64)
+    if (SSE_LEVEL >= 2)
+    {
+        kernel = columnStatisticsSse2_;
+    }
+#if defined(__GNUC__)
+    if (HAS_AVX2)
+    {
+        kernel = columnStatisticsAvx2_;
     }
+#endif
+#endif
 
-    if (globalInhibition_ ||
-        inhibitionRadius_ >
-            *max_element(columnDimensions_.begin(), columnDimensions_.end()))
-    {
-        inhibitColumnsGlobal_(overlaps, density, activeColumns);
-    }
-    else
-    {
-        inhibitColumnsLocal_(overlaps, density, activeColumns);
-    }
+    parallelFor_(0, numColumns_, [&](UInt begin, UInt end) {
+        const UInt i = kernel ? kernel(statistics, begin, end) : begin;
+        columnStatistics_(statistics, i, end);
+    });
+}
+
+void SpatialPooler::inhibitColumns_(const std::vector<Real> &overlaps,
+                                    std::vector<UInt> &activeColumns,
+                                    InferenceContext &context) const
+{
+    inhibitColumns(inhibition_, overlaps, activeColumns,
+                   context.inhibition_, inhibitionThreadPool_(context));
 }
 
 bool SpatialPooler::isWinner_(Real score,
@@ -1157,110 +2684,495 @@ void SpatialPooler::addToWinners_(UInt index, Real score,
 
 void SpatialPooler::inhibitColumnsGlobal_(const std::vector<Real> &overlaps,
                                           Real density,
-                                          std::vector<UInt> &activeColumns)
+                                          std::vector<UInt> &activeColumns,
+                                          InferenceContext &context) const
 {
-    activeColumns.clear();
-    const UInt numDesired = (UInt)(density * numColumns_);
-    NTA_CHECK(numDesired > 0) << "Not enough columns (" << numColumns_ << ") "
-                              << "for desired density (" << density << ").";
-    std::vector<std::pair<UInt, Real>> winners;
-    for (UInt i = 0; i < numColumns_; i++)
-    {
-        if (isWinner_(overlaps[i], winners, numDesired))
+    inhibitColumnsGlobal(inhibition_, overlaps, density, activeColumns,
+                         context.inhibition_);
+}
+
+void SpatialPooler::inhibitColumnsLocal_(const std::vector<Real> &overlaps,
+                                         Real density,
+                                         std::vector<UInt> &activeColumns,
+                                         InferenceContext &context) const
+{
+    inhibitColumnsLocal(inhibition_, overlaps, density, activeColumns,
+                        context.inhibition_, inhibitionThreadPool_(context));
+}
+
+void SpatialPooler::inhibitColumnsLocalWindow_(
+    const std::vector<Real> &overlaps, Real density,
+    std::vector<UInt> &activeColumns, InferenceContext &context) const
+{
+    inhibitColumnsLocalWindow(inhibition_, overlaps, density, activeColumns,
+                              context.inhibition_,
+                              inhibitionThreadPool_(context));
+}
+
+void SpatialPooler::inhibitColumnsLocalSweep_(
+    const std::vector<Real> &overlaps, Real density,
+    std::vector<UInt> &activeColumns, InferenceContext &context) const
+{
+    inhibitColumnsLocalSweep(inhibition_, overlaps, density, activeColumns,
+                             context.inhibition_);
+}
+
+bool SpatialPooler::isUpdateRound_()
+{
+    return (iterationNum_ % updatePeriod_) == 0;
+}
+
+/* create a RNG with given seed */
+void SpatialPooler::seed_(UInt64 seed) { rng_ = Random(seed); }
+
+// Layout of the version 5 binary format. All values are little-endian
+// and are stored with the sizes of UInt and Real recorded in the header.
+//
+//   magic[8] version realSize uintSize numSections    (UInt32)
+//   totalSize numSynapses 0                           (UInt64)
+//   the UInt, Int and bool parameters                 (UInt)
+//   the Real parameters                               (Real)
+//   offset and size of each section                   (UInt64)
+//
+// followed by the sections, each starting at a multiple of
+// BINARY_ALIGNMENT. The synapses are stored as SynapseStore holds them:
+// the size and number of connected synapses of each column, then the
+// inputs, potential flags and permanences of all synapses, column after
+// column, see SynapseStore::writeInputs. Loading copies each array as a
+// whole, from a mapped file too, and only rebuilds the inverted index and
+// the connected spans.
+//
+// Versions 3 and 4 store the potential pools and the non-zero permanences
+// of the columns in separate sections, which load merges column by column,
+// and have numSynapses and 0 replaced by potentialNonZeros and
+// permanenceNonZeros. Their synapse sections are empty from version 5.
+// Version 3 has neither the number of permanence bits, nor the range of
+// the fixed-point permanences, nor the section of their codes. With
+// fixed-point permanences the permanence sections are empty and the codes
+// follow the order of the potential pools.
+static const char BINARY_MAGIC[8] = {'\x89', 'S', 'P', 'B',
+                                     '\r',   '\n', '\x1a', '\n'};
+static const UInt64 BINARY_ALIGNMENT = 64;
+
+// The numbers of UInt and Real parameters of the current version.
+static const UInt NUM_BINARY_UINTS = 16;
+static const UInt NUM_BINARY_REALS = 14;
+
+static UInt binaryNumUInts_(UInt32 version)
+{
+    return version < 4 ? 15 : NUM_BINARY_UINTS;
+}
+
+static UInt binaryNumReals_(UInt32 version)
+{
+    return version < 4 ? 12 : NUM_BINARY_REALS;
+}
+
+enum BinarySection
+{
+    SECTION_INPUT_DIMENSIONS,
+    SECTION_COLUMN_DIMENSIONS,
+    SECTION_BOOST_FACTORS,
+    SECTION_OVERLAP_DUTY_CYCLES,
+    SECTION_ACTIVE_DUTY_CYCLES,
+    SECTION_MIN_OVERLAP_DUTY_CYCLES,
+    SECTION_TIE_BREAKER,
+    SECTION_POTENTIAL_OFFSETS,
+    SECTION_POTENTIAL_INDICES,
+    SECTION_PERMANENCE_OFFSETS,
+    SECTION_PERMANENCE_INDICES,
+    SECTION_PERMANENCE_VALUES,
+    SECTION_RANDOM,
+    SECTION_PERMANENCE_CODES,
+    SECTION_ROW_SIZES,
+    SECTION_ROW_CONNECTED,
+    SECTION_SYNAPSE_INPUTS,
+    SECTION_SYNAPSE_POTENTIAL,
+    SECTION_SYNAPSE_PERMANENCES,
+    NUM_SECTIONS
+};
+
+static UInt binaryNumSections_(UInt32 version)
+{
+    return version < 4 ? SECTION_RANDOM + 1
+                       : version < 5 ? SECTION_PERMANENCE_CODES + 1
+                                     : NUM_SECTIONS;
+}
+
+// Offsets and sizes of the sections, which only depend on the version and
+// the numbers of dimensions, inputs, columns, non-zeros (synapses from
+// version 5) and permanence bits.
+class BinaryLayout
+{
+public:
+    BinaryLayout(UInt32 version, UInt64 numInputDimensions,
+                 UInt64 numColumnDimensions, UInt64 numInputs,
+                 UInt64 numColumns, UInt64 potentialNonZeros,
+                 UInt64 permanenceNonZeros, UInt64 permanenceBits)
+        : numSections(binaryNumSections_(version))
+    {
+        std::fill(sizes, sizes + NUM_SECTIONS, 0);
+        sizes[SECTION_INPUT_DIMENSIONS] = numInputDimensions * sizeof(UInt);
+        sizes[SECTION_COLUMN_DIMENSIONS] = numColumnDimensions * sizeof(UInt);
+        sizes[SECTION_BOOST_FACTORS] = numColumns * sizeof(Real);
+        sizes[SECTION_OVERLAP_DUTY_CYCLES] = numColumns * sizeof(Real);
+        sizes[SECTION_ACTIVE_DUTY_CYCLES] = numColumns * sizeof(Real);
+        sizes[SECTION_MIN_OVERLAP_DUTY_CYCLES] = numColumns * sizeof(Real);
+        sizes[SECTION_TIE_BREAKER] = numColumns * sizeof(Real);
+        sizes[SECTION_RANDOM] = Random::BINARY_SIZE;
+        if (version < 5)
+        {
+            sizes[SECTION_POTENTIAL_OFFSETS] =
+                (numColumns + 1) * sizeof(UInt64);
+            sizes[SECTION_POTENTIAL_INDICES] = potentialNonZeros * sizeof(UInt);
+            sizes[SECTION_PERMANENCE_OFFSETS] =
+                (numColumns + 1) * sizeof(UInt64);
+            sizes[SECTION_PERMANENCE_INDICES] =
+                permanenceNonZeros * sizeof(UInt);
+            sizes[SECTION_PERMANENCE_VALUES] =
+                permanenceNonZeros * sizeof(Real);
+            sizes[SECTION_PERMANENCE_CODES] =
+                potentialNonZeros * (permanenceBits / 8);
+        }
+        else
+        {
+            const UInt64 numSynapses = potentialNonZeros;
+            sizes[SECTION_ROW_SIZES] = numColumns * sizeof(UInt);
+            sizes[SECTION_ROW_CONNECTED] = numColumns * sizeof(UInt);
+            sizes[SECTION_SYNAPSE_INPUTS] =
+                numSynapses * (SynapseStore::getInputBits((UInt)numInputs) / 8);
+            sizes[SECTION_SYNAPSE_POTENTIAL] = numSynapses;
+            sizes[SECTION_SYNAPSE_PERMANENCES] =
+                numSynapses *
+                (permanenceBits == 0 ? sizeof(Real) : permanenceBits / 8);
+        }
+
+        UInt64 offset = headerSize(version);
+        for (UInt i = 0; i < numSections; i++)
         {
-            addToWinners_(i, overlaps[i], winners);
+            offset = align(offset);
+            offsets[i] = offset;
+            offset += sizes[i];
         }
+        totalSize = offset;
     }
 
-    const UInt numActual = std::min(numDesired, (UInt)winners.size());
-    for (UInt i = 0; i < numActual; i++)
+    static UInt64 headerSize(UInt32 version)
     {
-        activeColumns.push_back(winners[i].first);
+        return sizeof(BINARY_MAGIC) + 4 * sizeof(UInt32) +
+               3 * sizeof(UInt64) + binaryNumUInts_(version) * sizeof(UInt) +
+               binaryNumReals_(version) * sizeof(Real) +
+               2 * binaryNumSections_(version) * sizeof(UInt64);
     }
+
+    static UInt64 align(UInt64 offset)
+    {
+        return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT *
+               BINARY_ALIGNMENT;
+    }
+
+    UInt numSections;
+    UInt64 offsets[NUM_SECTIONS];
+    UInt64 sizes[NUM_SECTIONS];
+    UInt64 totalSize;
+};
+
+static bool isLittleEndian_()
+{
+    const UInt32 one = 1;
+    char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+template <typename T> static void writeValue_(std::ostream &outStream, T v)
+{
+    outStream.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+template <typename T>
+static void writeArray_(std::ostream &outStream, const T *begin, size_t n)
+{
+    outStream.write(reinterpret_cast<const char *>(begin), n * sizeof(T));
+}
+
+template <typename T> static T readValue_(const char *&data)
+{
+    T v;
+    std::memcpy(&v, data, sizeof(T));
+    data += sizeof(T);
+    return v;
+}
+
+void SpatialPooler::getBinaryParameters_(UInt uints[], Real reals[]) const
+{
+    const FixedPointPermanences &fixedPoint = synapses_.getFixedPoint();
+    const UInt u[] = {numInputs_,
+                      numColumns_,
+                      potentialRadius_,
+                      globalInhibition_,
+                      (UInt)numActiveColumnsPerInhArea_,
+                      stimulusThreshold_,
+                      inhibitionRadius_,
+                      dutyCyclePeriod_,
+                      iterationNum_,
+                      iterationLearnNum_,
+                      spVerbosity_,
+                      updatePeriod_,
+                      wrapAround_,
+                      (UInt)inputDimensions_.size(),
+                      (UInt)columnDimensions_.size(),
+                      fixedPoint.getBits()};
+    NTA_ASSERT(sizeof(u) / sizeof(UInt) == NUM_BINARY_UINTS);
+    std::copy(u, u + NUM_BINARY_UINTS, uints);
+
+    const Real r[] = {potentialPct_,
+                      initConnectedPct_,
+                      localAreaDensity_,
+                      boostStrength_,
+                      synPermMin_,
+                      synPermMax_,
+                      synPermTrimThreshold_,
+                      synPermInactiveDec_,
+                      synPermActiveInc_,
+                      synPermBelowStimulusInc_,
+                      synPermConnected_,
+                      minPctOverlapDutyCycles_,
+                      fixedPoint.getMinimum(),
+                      fixedPoint.getMaximum()};
+    NTA_ASSERT(sizeof(r) / sizeof(Real) == NUM_BINARY_REALS);
+    std::copy(r, r + NUM_BINARY_REALS, reals);
+}
+
+void SpatialPooler::setBinaryParameters_(const UInt uints[],
+                                         const Real reals[])
+{
+    numInputs_ = uints[0];
+    numColumns_ = uints[1];
+    potentialRadius_ = uints[2];
+    globalInhibition_ = uints[3] != 0;
+    numActiveColumnsPerInhArea_ = (Int)uints[4];
+    stimulusThreshold_ = uints[5];
+    inhibitionRadius_ = uints[6];
+    dutyCyclePeriod_ = uints[7];
+    iterationNum_ = uints[8];
+    iterationLearnNum_ = uints[9];
+    spVerbosity_ = uints[10];
+    updatePeriod_ = uints[11];
+    wrapAround_ = uints[12] != 0;
+
+    potentialPct_ = reals[0];
+    initConnectedPct_ = reals[1];
+    localAreaDensity_ = reals[2];
+    boostStrength_ = reals[3];
+    synPermMin_ = reals[4];
+    synPermMax_ = reals[5];
+    synPermTrimThreshold_ = reals[6];
+    synPermInactiveDec_ = reals[7];
+    synPermActiveInc_ = reals[8];
+    synPermBelowStimulusInc_ = reals[9];
+    synPermConnected_ = reals[10];
+    minPctOverlapDutyCycles_ = reals[11];
+}
+
+void SpatialPooler::checkDimensions_() const
+{
+    auto check = [](const std::vector<UInt> &dimensions, UInt size,
+                    const char *what) {
+        NTA_CHECK(!dimensions.empty())
+            << "SpatialPooler::load -- no " << what << " dimensions";
+        UInt64 product = 1;
+        for (UInt dimension : dimensions)
+        {
+            product *= dimension;
+            NTA_CHECK(dimension > 0 && product <= size)
+                << "SpatialPooler::load -- invalid " << what << " dimension "
+                << dimension;
+        }
+        NTA_CHECK(product == size)
+            << "SpatialPooler::load -- " << what << " dimensions make "
+            << product << " instead of " << size;
+    };
+    check(inputDimensions_, numInputs_, "input");
+    check(columnDimensions_, numColumns_, "column");
+    NTA_CHECK(inputDimensions_.size() == columnDimensions_.size())
+        << "SpatialPooler::load -- " << inputDimensions_.size()
+        << " input dimensions and " << columnDimensions_.size()
+        << " column dimensions";
 }
 
-void SpatialPooler::inhibitColumnsLocal_(const std::vector<Real> &overlaps,
-                                         Real density,
-                                         std::vector<UInt> &activeColumns)
+size_t SpatialPooler::persistentSize() const
 {
-    activeColumns.clear();
+    waitForLearning();
+    const BinaryLayout layout(
+        BINARY_VERSION, inputDimensions_.size(), columnDimensions_.size(),
+        numInputs_, numColumns_, synapses_.getNumSynapses(), 0,
+        synapses_.getFixedPoint().getBits());
+    return (size_t)layout.totalSize;
+}
 
-    // Tie-breaking: when overlaps are equal, columns that have already been
-    // selected are treated as "bigger".
-    std::vector<bool> activeColumnsDense(numColumns_, false);
+void SpatialPooler::save(std::ostream &outStream) const
+{
+    waitForLearning();
+    saveBinary_(outStream, BINARY_VERSION);
+}
+
+void SpatialPooler::saveBinary_(std::ostream &outStream,
+                                UInt32 version) const
+{
+    NTA_CHECK(isLittleEndian_())
+        << "SpatialPooler::save -- the binary format is little-endian";
+    NTA_CHECK(version == 4 || version == BINARY_VERSION)
+        << "SpatialPooler::save -- cannot write version " << version;
+
+    // Version 4 saves fixed-point permanences as codes, one per input of
+    // each potential pool, instead of as non-zero permanences.
+    const FixedPointPermanences &fixedPoint = synapses_.getFixedPoint();
+    const UInt64 potentialNonZeros = version < 5
+                                         ? synapses_.getNumPotential()
+                                         : synapses_.getNumSynapses();
+    const UInt64 permanenceNonZeros =
+        version < 5 && !fixedPoint.enabled() ? synapses_.getNumNonZeros()
+                                             : 0;
+    const BinaryLayout layout(version, inputDimensions_.size(),
+                              columnDimensions_.size(), numInputs_,
+                              numColumns_, potentialNonZeros,
+                              permanenceNonZeros, fixedPoint.getBits());
+
+    outStream.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    writeValue_<UInt32>(outStream, version);
+    writeValue_<UInt32>(outStream, sizeof(Real));
+    writeValue_<UInt32>(outStream, sizeof(UInt));
+    writeValue_<UInt32>(outStream, layout.numSections);
+    writeValue_<UInt64>(outStream, layout.totalSize);
+    writeValue_<UInt64>(outStream, potentialNonZeros);
+    writeValue_<UInt64>(outStream, permanenceNonZeros);
+
+    UInt uints[NUM_BINARY_UINTS];
+    Real reals[NUM_BINARY_REALS];
+    getBinaryParameters_(uints, reals);
+    writeArray_(outStream, uints, NUM_BINARY_UINTS);
+    writeArray_(outStream, reals, NUM_BINARY_REALS);
+
+    for (UInt i = 0; i < layout.numSections; i++)
+    {
+        writeValue_<UInt64>(outStream, layout.offsets[i]);
+        writeValue_<UInt64>(outStream, layout.sizes[i]);
+    }
+
+    UInt64 position = BinaryLayout::headerSize(version);
+    auto startSection = [&](BinarySection section) {
+        static const char zeros[BINARY_ALIGNMENT] = {};
+        outStream.write(zeros, layout.offsets[section] - position);
+        position = layout.offsets[section] + layout.sizes[section];
+    };
 
-    for (UInt column = 0; column < numColumns_; column++)
+    startSection(SECTION_INPUT_DIMENSIONS);
+    writeArray_(outStream, inputDimensions_.data(), inputDimensions_.size());
+    startSection(SECTION_COLUMN_DIMENSIONS);
+    writeArray_(outStream, columnDimensions_.data(), columnDimensions_.size());
+    startSection(SECTION_BOOST_FACTORS);
+    writeArray_(outStream, boostFactors_.data(), numColumns_);
+    startSection(SECTION_OVERLAP_DUTY_CYCLES);
+    writeArray_(outStream, overlapDutyCycles_.data(), numColumns_);
+    startSection(SECTION_ACTIVE_DUTY_CYCLES);
+    writeArray_(outStream, activeDutyCycles_.data(), numColumns_);
+    startSection(SECTION_MIN_OVERLAP_DUTY_CYCLES);
+    writeArray_(outStream, minOverlapDutyCycles_.data(), numColumns_);
+    startSection(SECTION_TIE_BREAKER);
+    writeArray_(outStream, tieBreaker_.data(), numColumns_);
+
+    // Loads the inputs and permanences of the potential pool of a column,
+    // or of its non-zero permanences, for version 4.
+    std::vector<UInt> inputs;
+    std::vector<Real> perms;
+    auto loadRow = [&](UInt column, bool potentialPool) {
+        inputs.clear();
+        perms.clear();
+        synapses_.forEachSynapse(
+            column, [&](UInt input, Real perm, bool isPotential, bool) {
+                if (potentialPool ? isPotential
+                                  : !fixedPoint.enabled() && perm != 0)
+                {
+                    inputs.push_back(input);
+                    perms.push_back(perm);
+                }
+            });
+    };
+
+    if (version < 5)
     {
-        if (overlaps[column] >= stimulusThreshold_)
+        for (bool potentialPool : {true, false})
         {
-            UInt numNeighbors = 0;
-            UInt numBigger = 0;
-
-            if (wrapAround_)
+            startSection(potentialPool ? SECTION_POTENTIAL_OFFSETS
+                                       : SECTION_PERMANENCE_OFFSETS);
+            UInt64 offset = 0;
+            writeValue_<UInt64>(outStream, offset);
+            for (UInt i = 0; i < numColumns_; i++)
             {
-                for (UInt neighbor : WrappingNeighborhood(
-                         column, inhibitionRadius_, columnDimensions_))
-                {
-                    if (neighbor != column)
-                    {
-                        numNeighbors++;
-
-                        const Real difference =
-                            overlaps[neighbor] - overlaps[column];
-                        if (difference > 0 ||
-                            (difference == 0 && activeColumnsDense[neighbor]))
-                        {
-                            numBigger++;
-                        }
-                    }
-                }
+                loadRow(i, potentialPool);
+                offset += inputs.size();
+                writeValue_<UInt64>(outStream, offset);
             }
-            else
+            startSection(potentialPool ? SECTION_POTENTIAL_INDICES
+                                       : SECTION_PERMANENCE_INDICES);
+            for (UInt i = 0; i < numColumns_; i++)
             {
-                for (UInt neighbor :
-                     Neighborhood(column, inhibitionRadius_, columnDimensions_))
-                {
-                    if (neighbor != column)
-                    {
-                        numNeighbors++;
-
-                        const Real difference =
-                            overlaps[neighbor] - overlaps[column];
-                        if (difference > 0 ||
-                            (difference == 0 && activeColumnsDense[neighbor]))
-                        {
-                            numBigger++;
-                        }
-                    }
-                }
+                loadRow(i, potentialPool);
+                writeArray_(outStream, inputs.data(), inputs.size());
             }
+        }
+        startSection(SECTION_PERMANENCE_VALUES);
+        for (UInt i = 0; i < numColumns_; i++)
+        {
+            loadRow(i, false);
+            writeArray_(outStream, perms.data(), perms.size());
+        }
+    }
 
-            UInt numActive = (UInt)(0.5 + (density * (numNeighbors + 1)));
-            if (numBigger < numActive)
+    startSection(SECTION_RANDOM);
+    char random[Random::BINARY_SIZE];
+    rng_.saveBinary(random);
+    outStream.write(random, Random::BINARY_SIZE);
+
+    if (version < 5)
+    {
+        startSection(SECTION_PERMANENCE_CODES);
+        for (UInt i = 0; fixedPoint.enabled() && i < numColumns_; i++)
+        {
+            loadRow(i, true);
+            for (Real perm : perms)
             {
-                activeColumns.push_back(column);
-                activeColumnsDense[column] = true;
+                const UInt code = fixedPoint.encode(perm);
+                if (fixedPoint.getBytesPerCode() == 1)
+                {
+                    writeValue_<unsigned char>(outStream, (unsigned char)code);
+                }
+                else
+                {
+                    writeValue_<UInt16>(outStream, (UInt16)code);
+                }
             }
         }
+        return;
     }
-}
-
-bool SpatialPooler::isUpdateRound_()
-{
-    return (iterationNum_ % updatePeriod_) == 0;
-}
 
-/* create a RNG with given seed */
-void SpatialPooler::seed_(UInt64 seed) { rng_ = Random(seed); }
-
-UInt SpatialPooler::persistentSize() const
-{
-    // TODO: this won't scale!
-    std::stringstream s;
-    s.flags(std::ios::scientific);
-    s.precision(std::numeric_limits<double>::digits10 + 1);
-    this->save(s);
-    return s.str().size();
+    startSection(SECTION_ROW_SIZES);
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        writeValue_<UInt>(outStream, synapses_.getRowSize(i));
+    }
+    startSection(SECTION_ROW_CONNECTED);
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        writeValue_<UInt>(outStream, synapses_.getNumConnected(i));
+    }
+    startSection(SECTION_SYNAPSE_INPUTS);
+    synapses_.writeInputs(outStream);
+    startSection(SECTION_SYNAPSE_POTENTIAL);
+    synapses_.writePotential(outStream);
+    startSection(SECTION_SYNAPSE_PERMANENCES);
+    synapses_.writePermanences(outStream);
 }
 
 template <typename FloatType>
@@ -1270,11 +3182,12 @@ static void saveFloat_(std::ostream &outStream, FloatType v)
               << v << " ";
 }
 
-void SpatialPooler::save(std::ostream &outStream) const
+void SpatialPooler::saveText(std::ostream &outStream) const
 {
+    waitForLearning();
     // Write a starting marker and version.
     outStream << "SpatialPooler" << std::endl;
-    outStream << version_ << std::endl;
+    outStream << 2 << std::endl;
 
     // Store the simple variables first.
     outStream << numInputs_ << " " << numColumns_ << " " << potentialRadius_
@@ -1355,8 +3268,13 @@ void SpatialPooler::save(std::ostream &outStream) const
     for (UInt i = 0; i < numColumns_; i++)
     {
         std::vector<UInt> pot;
-        pot.resize(potentialPools_.nNonZerosOnRow(i));
-        pot = potentialPools_.getSparseRow(i);
+        synapses_.forEachSynapse(
+            i, [&](UInt input, Real, bool isPotential, bool) {
+                if (isPotential)
+                {
+                    pot.push_back(input);
+                }
+            });
         outStream << pot.size() << std::endl;
         for (auto &elem : pot)
         {
@@ -1369,9 +3287,13 @@ void SpatialPooler::save(std::ostream &outStream) const
     for (UInt i = 0; i < numColumns_; i++)
     {
         std::vector<std::pair<UInt, Real>> perm;
-        perm.resize(permanences_.nNonZerosOnRow(i));
+        synapses_.forEachSynapse(i, [&](UInt input, Real value, bool, bool) {
+            if (value != 0)
+            {
+                perm.push_back(std::make_pair(input, value));
+            }
+        });
         outStream << perm.size() << std::endl;
-        permanences_.getRowToSparse(i, perm.begin());
         for (auto &elem : perm)
         {
             outStream << elem.first << " ";
@@ -1391,8 +3313,33 @@ void SpatialPooler::save(std::ostream &outStream) const
 // that everything in initialize is handled properly here.
 void SpatialPooler::load(std::istream &inStream)
 {
+    waitForLearning();
     // Current version
-    version_ = 2;
+    version_ = BINARY_VERSION;
+
+    if (inStream.peek() == std::char_traits<char>::to_int_type(BINARY_MAGIC[0]))
+    {
+        // Read the header up to the total size, then the rest.
+        std::vector<char> buffer(sizeof(BINARY_MAGIC) + 4 * sizeof(UInt32) +
+                                 sizeof(UInt64));
+        inStream.read(buffer.data(), buffer.size());
+        NTA_CHECK(inStream.good()) << "SpatialPooler::load -- truncated data";
+        UInt32 version;
+        std::memcpy(&version, &buffer[sizeof(BINARY_MAGIC)], sizeof(UInt32));
+        UInt64 totalSize;
+        std::memcpy(&totalSize, &buffer[buffer.size() - sizeof(UInt64)],
+                    sizeof(UInt64));
+        NTA_CHECK(version <= BINARY_VERSION &&
+                  totalSize >= BinaryLayout::headerSize(version))
+            << "SpatialPooler::load -- invalid size " << totalSize;
+
+        const size_t headerRead = buffer.size();
+        buffer.resize(totalSize);
+        inStream.read(&buffer[headerRead], totalSize - headerRead);
+        NTA_CHECK(inStream.good()) << "SpatialPooler::load -- truncated data";
+        loadBinary_(buffer.data(), buffer.size());
+        return;
+    }
 
     // Check the marker
     std::string marker;
@@ -1402,7 +3349,7 @@ void SpatialPooler::load(std::istream &inStream)
     // Check the saved version.
     UInt version;
     inStream >> version;
-    NTA_CHECK(version <= version_);
+    NTA_CHECK(version <= 2);
 
     // Retrieve simple variables
     inStream >> numInputs_ >> numColumns_ >> potentialRadius_ >>
@@ -1440,6 +3387,8 @@ void SpatialPooler::load(std::istream &inStream)
     {
         inStream >> columnDimensions_[i];
     }
+    checkDimensions_();
+    updateInhibitionParameters_();
 
     boostFactors_.resize(numColumns_);
     for (UInt i = 0; i < numColumns_; i++)
@@ -1472,7 +3421,8 @@ void SpatialPooler::load(std::istream &inStream)
     }
 
     // Retrieve matrices.
-    potentialPools_.resize(numColumns_, numInputs_);
+    synapses_.setPermanenceFormat(0, 0, 0);
+    synapses_.resize(numColumns_, numInputs_);
     for (UInt i = 0; i < numColumns_; i++)
     {
         UInt nNonZerosOnRow;
@@ -1482,12 +3432,11 @@ void SpatialPooler::load(std::istream &inStream)
         {
             inStream >> pot[j];
         }
-        potentialPools_.replaceSparseRow(i, pot.begin(), pot.end());
+        synapses_.setPotential(i, pot.data(), pot.data() + pot.size());
     }
 
-    permanences_.resize(numColumns_, numInputs_);
-    connectedSynapses_.resize(numColumns_, numInputs_);
     connectedCounts_.resize(numColumns_);
+    resetConnectedSpans_();
     for (UInt i = 0; i < numColumns_; i++)
     {
         UInt nNonZerosOnRow;
@@ -1514,6 +3463,518 @@ void SpatialPooler::load(std::istream &inStream)
     overlaps_.resize(numColumns_);
     overlapsPct_.resize(numColumns_);
     boostedOverlaps_.resize(numColumns_);
+    allocateScratch_();
+    markCheckpoint();
+}
+
+void SpatialPooler::loadBinary_(const char *data, size_t size)
+{
+    NTA_CHECK(isLittleEndian_())
+        << "SpatialPooler::load -- the binary format is little-endian";
+    NTA_CHECK(size >= sizeof(BINARY_MAGIC) + sizeof(UInt32))
+        << "SpatialPooler::load -- truncated data";
+    NTA_CHECK(std::memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0)
+        << "SpatialPooler::load -- not a binary spatial pooler";
+
+    const char *header = data + sizeof(BINARY_MAGIC);
+    const UInt32 version = readValue_<UInt32>(header);
+    NTA_CHECK(version >= 3 && version <= BINARY_VERSION)
+        << "SpatialPooler::load -- unexpected version " << version;
+    NTA_CHECK(size >= BinaryLayout::headerSize(version))
+        << "SpatialPooler::load -- truncated data";
+    const UInt32 realSize = readValue_<UInt32>(header);
+    const UInt32 uintSize = readValue_<UInt32>(header);
+    const UInt32 numSections = readValue_<UInt32>(header);
+    NTA_CHECK(realSize == sizeof(Real) && uintSize == sizeof(UInt))
+        << "SpatialPooler::load -- saved with Real of " << realSize
+        << " bytes and UInt of " << uintSize << " bytes";
+    NTA_CHECK(numSections == binaryNumSections_(version));
+
+    const UInt64 totalSize = readValue_<UInt64>(header);
+    const UInt64 potentialNonZeros = readValue_<UInt64>(header);
+    const UInt64 permanenceNonZeros = readValue_<UInt64>(header);
+
+    UInt uints[NUM_BINARY_UINTS] = {};
+    for (UInt i = 0; i < binaryNumUInts_(version); i++)
+    {
+        uints[i] = readValue_<UInt>(header);
+    }
+    Real reals[NUM_BINARY_REALS] = {};
+    for (UInt i = 0; i < binaryNumReals_(version); i++)
+    {
+        reals[i] = readValue_<Real>(header);
+    }
+    setBinaryParameters_(uints, reals);
+    const UInt permanenceBits = uints[15];
+    synapses_.setPermanenceFormat(permanenceBits, reals[12], reals[13]);
+    const FixedPointPermanences &fixedPoint = synapses_.getFixedPoint();
+    NTA_CHECK((version < 5 && !fixedPoint.enabled()) ||
+              permanenceNonZeros == 0)
+        << "SpatialPooler::load -- invalid permanences";
+
+    // The section table must be the one the sizes imply, which also checks
+    // that every section lies within the data.
+    const BinaryLayout layout(version, uints[13], uints[14], numInputs_,
+                              numColumns_, potentialNonZeros,
+                              permanenceNonZeros, permanenceBits);
+    NTA_CHECK(totalSize == layout.totalSize && size >= layout.totalSize)
+        << "SpatialPooler::load -- invalid size " << totalSize;
+    for (UInt i = 0; i < layout.numSections; i++)
+    {
+        const UInt64 offset = readValue_<UInt64>(header);
+        const UInt64 sectionSize = readValue_<UInt64>(header);
+        NTA_CHECK(offset == layout.offsets[i] && sectionSize == layout.sizes[i])
+            << "SpatialPooler::load -- invalid section " << i;
+    }
+
+    auto section = [&](BinarySection s) { return data + layout.offsets[s]; };
+    auto loadArray = [&](BinarySection s, std::vector<UInt> &v, size_t n) {
+        v.resize(n);
+        std::memcpy(v.data(), section(s), n * sizeof(UInt));
+    };
+    auto loadReals = [&](BinarySection s, std::vector<Real> &v) {
+        v.resize(numColumns_);
+        std::memcpy(v.data(), section(s), numColumns_ * sizeof(Real));
+    };
+
+    loadArray(SECTION_INPUT_DIMENSIONS, inputDimensions_, uints[13]);
+    loadArray(SECTION_COLUMN_DIMENSIONS, columnDimensions_, uints[14]);
+    checkDimensions_();
+    updateInhibitionParameters_();
+    loadReals(SECTION_BOOST_FACTORS, boostFactors_);
+    loadReals(SECTION_OVERLAP_DUTY_CYCLES, overlapDutyCycles_);
+    loadReals(SECTION_ACTIVE_DUTY_CYCLES, activeDutyCycles_);
+    loadReals(SECTION_MIN_OVERLAP_DUTY_CYCLES, minOverlapDutyCycles_);
+    loadReals(SECTION_TIE_BREAKER, tieBreaker_);
+
+    synapses_.resize(numColumns_, numInputs_);
+    connectedCounts_.resize(numColumns_);
+    resetConnectedSpans_();
+    if (version >= 5)
+    {
+        // The rows are copied as a whole and checked by loadRows, which
+        // also rebuilds the inverted index.
+        synapses_.loadRows(
+            reinterpret_cast<const UInt *>(section(SECTION_ROW_SIZES)),
+            reinterpret_cast<const UInt *>(section(SECTION_ROW_CONNECTED)),
+            (size_t)potentialNonZeros, section(SECTION_SYNAPSE_INPUTS),
+            section(SECTION_SYNAPSE_POTENTIAL),
+            section(SECTION_SYNAPSE_PERMANENCES));
+        for (UInt i = 0; i < numColumns_; i++)
+        {
+            connectedCounts_[i] = synapses_.getNumConnected(i);
+            updateConnectedSpan_(i, true);
+        }
+    }
+    else
+    {
+        // Checks that row offsets are increasing and end at the number of
+        // non-zeros, so that the rows can be read without further checks.
+        auto rowOffsets = [&](BinarySection s, UInt64 nonZeros) {
+            const char *offsets = section(s);
+            UInt64 previous = readValue_<UInt64>(offsets);
+            NTA_CHECK(previous == 0);
+            for (UInt i = 0; i < numColumns_; i++)
+            {
+                const UInt64 next = readValue_<UInt64>(offsets);
+                NTA_CHECK(next >= previous && next - previous <= numInputs_)
+                    << "SpatialPooler::load -- invalid row " << i;
+                previous = next;
+            }
+            NTA_CHECK(previous == nonZeros);
+            return section(s);
+        };
+
+        const char *potentialOffsets =
+            rowOffsets(SECTION_POTENTIAL_OFFSETS, potentialNonZeros);
+        const UInt *potentialIndices =
+            reinterpret_cast<const UInt *>(section(SECTION_POTENTIAL_INDICES));
+        const char *permanenceOffsets =
+            rowOffsets(SECTION_PERMANENCE_OFFSETS, permanenceNonZeros);
+        const UInt *permanenceIndices =
+            reinterpret_cast<const UInt *>(section(SECTION_PERMANENCE_INDICES));
+        const Real *permanenceValues =
+            reinterpret_cast<const Real *>(section(SECTION_PERMANENCE_VALUES));
+        const char *codes = section(SECTION_PERMANENCE_CODES);
+
+        // Each column's potential pool is merged with its non-zero permanences,
+        // or with its codes, which are rounded back to the same codes.
+        UInt64 potentialBegin = readValue_<UInt64>(potentialOffsets);
+        UInt64 permanenceBegin = readValue_<UInt64>(permanenceOffsets);
+        for (UInt i = 0; i < numColumns_; i++)
+        {
+            const UInt64 potentialEnd = readValue_<UInt64>(potentialOffsets);
+            const UInt64 permanenceEnd = readValue_<UInt64>(permanenceOffsets);
+            const UInt *potential = potentialIndices + potentialBegin;
+            const UInt *permanence = permanenceIndices + permanenceBegin;
+            const Real *value = permanenceValues + permanenceBegin;
+
+            column_.inputs.clear();
+            column_.perms.clear();
+            column_.potential.clear();
+            while (potential != potentialIndices + potentialEnd ||
+                   permanence != permanenceIndices + permanenceEnd)
+            {
+                const bool inPool =
+                    potential != potentialIndices + potentialEnd &&
+                    (permanence == permanenceIndices + permanenceEnd ||
+                     *potential <= *permanence);
+                const bool inPermanences =
+                    permanence != permanenceIndices + permanenceEnd &&
+                    (!inPool || *permanence == *potential);
+                const UInt input = inPool ? *potential++ : *permanence++;
+                NTA_CHECK(input < numInputs_ &&
+                          (column_.inputs.empty() ||
+                           column_.inputs.back() < input))
+                    << "SpatialPooler::load -- invalid synapses of column "
+                    << i;
+
+                Real perm = 0;
+                if (inPermanences)
+                {
+                    perm = *value++;
+                    if (inPool)
+                    {
+                        ++permanence;
+                    }
+                }
+                else if (fixedPoint.enabled())
+                {
+                    perm = fixedPoint.decode(
+                        fixedPoint.getBytesPerCode() == 1
+                            ? readValue_<unsigned char>(codes)
+                            : readValue_<UInt16>(codes));
+                }
+                column_.inputs.push_back(input);
+                column_.perms.push_back(perm);
+                column_.potential.push_back(inPool);
+            }
+            updatePermanencesForColumnSparse_(i, false);
+
+            potentialBegin = potentialEnd;
+            permanenceBegin = permanenceEnd;
+        }
+    }
+
+    rng_.loadBinary(section(SECTION_RANDOM));
+
+    // initialize ephemeral members
+    overlaps_.resize(numColumns_);
+    overlapsPct_.resize(numColumns_);
+    boostedOverlaps_.resize(numColumns_);
+    allocateScratch_();
+    markCheckpoint();
+}
+
+void SpatialPooler::loadMapped(const std::string &path)
+{
+    waitForLearning();
+#if defined(NTA_OS_WINDOWS)
+    std::ifstream inStream(path, std::ios::binary);
+    NTA_CHECK(inStream.good()) << "SpatialPooler::loadMapped -- cannot open "
+                               << path;
+    load(inStream);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    NTA_CHECK(fd >= 0) << "SpatialPooler::loadMapped -- cannot open " << path;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        NTA_THROW << "SpatialPooler::loadMapped -- cannot read " << path;
+    }
+
+    const size_t size = (size_t)st.st_size;
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    NTA_CHECK(data != MAP_FAILED) << "SpatialPooler::loadMapped -- cannot map "
+                                  << path;
+    ::madvise(data, size, MADV_SEQUENTIAL);
+
+    try
+    {
+        loadBinary_(static_cast<const char *>(data), size);
+    }
+    catch (...)
+    {
+        ::munmap(data, size);
+        throw;
+    }
+    ::munmap(data, size);
+#endif
+}
+
+// Layout of a delta written by saveDelta, little-endian like the binary
+// format and with the same parameters:
+//
+//   magic[8] version realSize uintSize                (UInt32)
+//   totalSize                                         (UInt64)
+//   baseIteration numDirtyColumns                     (UInt)
+//   the UInt, Int and bool parameters                 (UInt)
+//   the Real parameters                               (Real)
+//   the boost factors, overlap, active and minimum overlap duty cycles
+//   and tie breakers                                  (numColumns Real each)
+//   the random number generator
+//
+// followed, for every dirty column by increasing column, by its index and
+// its number of synapses (UInt), their inputs (UInt), their permanences
+// (Real) and their flags (one byte each, 1 for the potential pool and 2
+// for connected).
+static const char DELTA_MAGIC[8] = {'\x89', 'S', 'P', 'D',
+                                    '\r',   '\n', '\x1a', '\n'};
+static const UInt32 DELTA_VERSION = 1;
+static const UInt DELTA_NUM_ARRAYS = 5;
+
+static UInt64 deltaHeaderSize_()
+{
+    return sizeof(DELTA_MAGIC) + 3 * sizeof(UInt32) + sizeof(UInt64) +
+           2 * sizeof(UInt) + NUM_BINARY_UINTS * sizeof(UInt) +
+           NUM_BINARY_REALS * sizeof(Real);
+}
+
+static UInt64 deltaRowSize_(UInt numSynapses)
+{
+    return 2 * sizeof(UInt) +
+           (UInt64)numSynapses * (sizeof(UInt) + sizeof(Real) + 1);
+}
+
+void SpatialPooler::markCheckpoint()
+{
+    waitForLearning();
+    synapses_.clearDirty();
+    checkpointIteration_ = iterationNum_;
+}
+
+UInt SpatialPooler::getNumDirtyColumns() const
+{
+    waitForLearning();
+    return synapses_.getNumDirty();
+}
+
+void SpatialPooler::saveDelta(std::ostream &outStream)
+{
+    waitForLearning();
+    NTA_CHECK(isLittleEndian_())
+        << "SpatialPooler::saveDelta -- the binary format is little-endian";
+
+    UInt numDirty = 0;
+    UInt64 totalSize = deltaHeaderSize_() +
+                       DELTA_NUM_ARRAYS * numColumns_ * sizeof(Real) +
+                       Random::BINARY_SIZE;
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        if (synapses_.isDirty(i))
+        {
+            ++numDirty;
+            totalSize += deltaRowSize_(synapses_.getRowSize(i));
+        }
+    }
+
+    outStream.write(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    writeValue_<UInt32>(outStream, DELTA_VERSION);
+    writeValue_<UInt32>(outStream, sizeof(Real));
+    writeValue_<UInt32>(outStream, sizeof(UInt));
+    writeValue_<UInt64>(outStream, totalSize);
+    writeValue_<UInt>(outStream, checkpointIteration_);
+    writeValue_<UInt>(outStream, numDirty);
+
+    UInt uints[NUM_BINARY_UINTS];
+    Real reals[NUM_BINARY_REALS];
+    getBinaryParameters_(uints, reals);
+    writeArray_(outStream, uints, NUM_BINARY_UINTS);
+    writeArray_(outStream, reals, NUM_BINARY_REALS);
+
+    writeArray_(outStream, boostFactors_.data(), numColumns_);
+    writeArray_(outStream, overlapDutyCycles_.data(), numColumns_);
+    writeArray_(outStream, activeDutyCycles_.data(), numColumns_);
+    writeArray_(outStream, minOverlapDutyCycles_.data(), numColumns_);
+    writeArray_(outStream, tieBreaker_.data(), numColumns_);
+
+    char random[Random::BINARY_SIZE];
+    rng_.saveBinary(random);
+    outStream.write(random, Random::BINARY_SIZE);
+
+    std::vector<UInt> inputs;
+    std::vector<Real> perms;
+    std::vector<unsigned char> flags;
+    for (UInt i = 0; i < numColumns_; i++)
+    {
+        if (!synapses_.isDirty(i))
+        {
+            continue;
+        }
+
+        inputs.clear();
+        perms.clear();
+        flags.clear();
+        synapses_.forEachSynapse(
+            i, [&](UInt input, Real perm, bool potential, bool connected) {
+                inputs.push_back(input);
+                perms.push_back(perm);
+                flags.push_back(
+                    (unsigned char)((potential ? 1 : 0) | (connected ? 2 : 0)));
+            });
+        writeValue_<UInt>(outStream, i);
+        writeValue_<UInt>(outStream, (UInt)inputs.size());
+        writeArray_(outStream, inputs.data(), inputs.size());
+        writeArray_(outStream, perms.data(), perms.size());
+        writeArray_(outStream, flags.data(), flags.size());
+    }
+
+    markCheckpoint();
+}
+
+void SpatialPooler::loadDelta(std::istream &inStream)
+{
+    waitForLearning();
+    NTA_CHECK(isLittleEndian_())
+        << "SpatialPooler::loadDelta -- the binary format is little-endian";
+
+    // Read the header up to the total size, then the rest.
+    std::vector<char> buffer(sizeof(DELTA_MAGIC) + 3 * sizeof(UInt32) +
+                             sizeof(UInt64));
+    inStream.read(buffer.data(), buffer.size());
+    NTA_CHECK(inStream.good()) << "SpatialPooler::loadDelta -- truncated data";
+    NTA_CHECK(std::memcmp(buffer.data(), DELTA_MAGIC, sizeof(DELTA_MAGIC)) ==
+              0)
+        << "SpatialPooler::loadDelta -- not a spatial pooler delta";
+
+    const char *header = buffer.data() + sizeof(DELTA_MAGIC);
+    const UInt32 version = readValue_<UInt32>(header);
+    const UInt32 realSize = readValue_<UInt32>(header);
+    const UInt32 uintSize = readValue_<UInt32>(header);
+    const UInt64 totalSize = readValue_<UInt64>(header);
+    NTA_CHECK(version == DELTA_VERSION)
+        << "SpatialPooler::loadDelta -- unexpected version " << version;
+    NTA_CHECK(realSize == sizeof(Real) && uintSize == sizeof(UInt))
+        << "SpatialPooler::loadDelta -- saved with Real of " << realSize
+        << " bytes and UInt of " << uintSize << " bytes";
+    const UInt64 fixedSize = deltaHeaderSize_() +
+                             DELTA_NUM_ARRAYS * numColumns_ * sizeof(Real) +
+                             Random::BINARY_SIZE;
+    NTA_CHECK(totalSize >= fixedSize)
+        << "SpatialPooler::loadDelta -- invalid size " << totalSize;
+
+    const size_t headerRead = buffer.size();
+    buffer.resize(totalSize);
+    inStream.read(&buffer[headerRead], totalSize - headerRead);
+    NTA_CHECK(inStream.good()) << "SpatialPooler::loadDelta -- truncated data";
+
+    const char *data = buffer.data() + headerRead;
+    const UInt baseIteration = readValue_<UInt>(data);
+    const UInt numDirty = readValue_<UInt>(data);
+    NTA_CHECK(baseIteration == iterationNum_)
+        << "SpatialPooler::loadDelta -- the delta follows iteration "
+        << baseIteration << ", not " << iterationNum_;
+
+    UInt uints[NUM_BINARY_UINTS];
+    Real reals[NUM_BINARY_REALS];
+    for (UInt i = 0; i < NUM_BINARY_UINTS; i++)
+    {
+        uints[i] = readValue_<UInt>(data);
+    }
+    for (UInt i = 0; i < NUM_BINARY_REALS; i++)
+    {
+        reals[i] = readValue_<Real>(data);
+    }
+    NTA_CHECK(uints[0] == numInputs_ && uints[1] == numColumns_ &&
+              uints[13] == inputDimensions_.size() &&
+              uints[14] == columnDimensions_.size())
+        << "SpatialPooler::loadDelta -- the dimensions differ";
+    const FixedPointPermanences &fixedPoint = synapses_.getFixedPoint();
+    const bool formatChanged = uints[15] != fixedPoint.getBits() ||
+                               reals[12] != fixedPoint.getMinimum() ||
+                               reals[13] != fixedPoint.getMaximum();
+    NTA_CHECK(!formatChanged || numDirty == numColumns_)
+        << "SpatialPooler::loadDelta -- invalid permanence format";
+
+    const char *arrays = data;
+    const char *random = arrays + DELTA_NUM_ARRAYS * numColumns_ * sizeof(Real);
+    const char *rows = random + Random::BINARY_SIZE;
+
+    // Check the rows before changing anything.
+    const char *end = buffer.data() + totalSize;
+    const char *row = rows;
+    UInt previous = 0;
+    for (UInt n = 0; n < numDirty; n++)
+    {
+        NTA_CHECK((UInt64)(end - row) >= deltaRowSize_(0))
+            << "SpatialPooler::loadDelta -- truncated data";
+        const UInt column = readValue_<UInt>(row);
+        const UInt size = readValue_<UInt>(row);
+        NTA_CHECK(column < numColumns_ && (n == 0 || column > previous) &&
+                  size <= numInputs_ &&
+                  (UInt64)(end - row) >=
+                      deltaRowSize_(size) - deltaRowSize_(0))
+            << "SpatialPooler::loadDelta -- invalid column " << column;
+        UInt input = 0;
+        for (UInt i = 0; i < size; i++)
+        {
+            const UInt next = readValue_<UInt>(row);
+            NTA_CHECK(next < numInputs_ && (i == 0 || next > input))
+                << "SpatialPooler::loadDelta -- invalid synapses of column "
+                << column;
+            input = next;
+        }
+        row += (size_t)size * (sizeof(Real) + 1);
+        previous = column;
+    }
+    NTA_CHECK(row == end) << "SpatialPooler::loadDelta -- invalid size "
+                          << totalSize;
+
+    setBinaryParameters_(uints, reals);
+    if (formatChanged)
+    {
+        synapses_.setPermanenceFormat(uints[15], reals[12], reals[13]);
+    }
+
+    auto loadReals = [&](std::vector<Real> &v) {
+        v.resize(numColumns_);
+        std::memcpy(v.data(), arrays, numColumns_ * sizeof(Real));
+        arrays += numColumns_ * sizeof(Real);
+    };
+    loadReals(boostFactors_);
+    loadReals(overlapDutyCycles_);
+    loadReals(activeDutyCycles_);
+    loadReals(minOverlapDutyCycles_);
+    loadReals(tieBreaker_);
+    rng_.loadBinary(random);
+
+    row = rows;
+    for (UInt n = 0; n < numDirty; n++)
+    {
+        const UInt column = readValue_<UInt>(row);
+        const UInt size = readValue_<UInt>(row);
+        const char *inputs = row;
+        const char *perms = inputs + (size_t)size * sizeof(UInt);
+        const char *flags = perms + (size_t)size * sizeof(Real);
+        synapses_.beginRow(column);
+        for (UInt i = 0; i < size; i++)
+        {
+            const UInt input = readValue_<UInt>(inputs);
+            const Real perm = readValue_<Real>(perms);
+            const unsigned char flag = readValue_<unsigned char>(flags);
+            synapses_.append(input, perm, (flag & 1) != 0, (flag & 2) != 0);
+        }
+        storeColumn_(column);
+        row = flags;
+    }
+
+    allocateScratch_();
+    markCheckpoint();
+}
+
+void SpatialPooler::compactCheckpoint(std::istream &base,
+                                      std::istream &deltas,
+                                      std::ostream &outStream)
+{
+    SpatialPooler sp;
+    sp.load(base);
+    while (deltas.peek() != std::char_traits<char>::eof())
+    {
+        sp.loadDelta(deltas);
+    }
+    sp.save(outStream);
 }
 
 //----------------------------------------------------------------------
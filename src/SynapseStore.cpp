@@ -0,0 +1,592 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of SynapseStore
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+
+#include <crucian/Log.hpp>
+#include <crucian/SynapseStore.hpp>
+
+namespace crucian
+{
+
+SynapseStore::SynapseStore()
+    : unused_(0), numInputs_(0), wideInputs_(false), wideRows_(false),
+      newRow_(0)
+{
+}
+
+void SynapseStore::resize(UInt numRows, UInt numInputs)
+{
+    rows_.assign(numRows, Row{0, 0, 0, 0});
+    unused_ = 0;
+    dirty_.assign(numRows, 0);
+    numInputs_ = numInputs;
+    wideInputs_ = getInputBits(numInputs) == 32;
+    inputs16_.clear();
+    inputs32_.clear();
+    potential_.clear();
+    perms_.clear();
+    codes_.resize(0);
+    wideRows_ = numRows > 0x10000;
+    connectedRows16_.clear();
+    connectedRows32_.clear();
+    if (wideRows_)
+    {
+        connectedRows32_.resize(numInputs);
+    }
+    else
+    {
+        connectedRows16_.resize(numInputs);
+    }
+    newInputs_.clear();
+    newPerms_.clear();
+    newFlags_.clear();
+    connectedAdded_.clear();
+    connectedRemoved_.clear();
+}
+
+void SynapseStore::setPermanenceFormat(UInt bits, Real minimum, Real maximum)
+{
+    FixedPointPermanences codes;
+    codes.setFormat(bits, minimum, maximum);
+    if (codes.getBits() == codes_.getBits() &&
+        codes.getMinimum() == codes_.getMinimum() &&
+        codes.getMaximum() == codes_.getMaximum())
+    {
+        return;
+    }
+    std::vector<Real> perms;
+    const size_t size = potential_.size();
+    if (codes.enabled())
+    {
+        codes.resize(size);
+    }
+    else
+    {
+        perms.resize(size);
+    }
+
+    for (size_t k = 0; k < size; k++)
+    {
+        if (codes.enabled())
+        {
+            codes.set(k, getPermanence_(k));
+        }
+        else
+        {
+            perms[k] = getPermanence_(k);
+        }
+    }
+
+    std::swap(codes_, codes);
+    perms_.swap(perms);
+    std::fill(dirty_.begin(), dirty_.end(), 1);
+}
+
+size_t SynapseStore::getNumBytes() const
+{
+    size_t size = rows_.size() * sizeof(Row) + dirty_.size() +
+                  inputs16_.size() * sizeof(UInt16) +
+                  inputs32_.size() * sizeof(UInt32) + potential_.size() +
+                  perms_.size() * sizeof(Real) +
+                  codes_.size() * codes_.getBytesPerCode();
+    for (const std::vector<UInt16> &rows : connectedRows16_)
+    {
+        size += sizeof(rows) + rows.capacity() * sizeof(UInt16);
+    }
+    for (const std::vector<UInt32> &rows : connectedRows32_)
+    {
+        size += sizeof(rows) + rows.capacity() * sizeof(UInt32);
+    }
+    return size;
+}
+
+void SynapseStore::reserveConnectedRows()
+{
+    std::vector<UInt> numRows(numInputs_, 0);
+    UInt maxSize = 0;
+    for (const Row &r : rows_)
+    {
+        maxSize = std::max(maxSize, r.size);
+        for (size_t k = r.begin; k < r.begin + r.size; k++)
+        {
+            numRows[getInput_(k)] += potential_[k];
+        }
+    }
+    for (UInt input = 0; input < numInputs_; input++)
+    {
+        if (wideRows_)
+        {
+            connectedRows32_[input].reserve(numRows[input]);
+        }
+        else
+        {
+            connectedRows16_[input].reserve(numRows[input]);
+        }
+    }
+    connectedAdded_.reserve(maxSize);
+    connectedRemoved_.reserve(maxSize);
+}
+
+size_t SynapseStore::getNumSynapses() const
+{
+    size_t numSynapses = 0;
+    for (const Row &r : rows_)
+    {
+        numSynapses += r.size;
+    }
+    return numSynapses;
+}
+
+size_t SynapseStore::getNumPotential() const
+{
+    size_t numPotential = 0;
+    for (const Row &r : rows_)
+    {
+        for (size_t k = r.begin; k < r.begin + r.size; k++)
+        {
+            numPotential += potential_[k];
+        }
+    }
+    return numPotential;
+}
+
+size_t SynapseStore::getNumNonZeros() const
+{
+    size_t numNonZeros = 0;
+    for (const Row &r : rows_)
+    {
+        for (size_t k = r.begin; k < r.begin + r.size; k++)
+        {
+            if (getPermanence_(k) != 0)
+            {
+                ++numNonZeros;
+            }
+        }
+    }
+    return numNonZeros;
+}
+
+void SynapseStore::getRow(UInt row, std::vector<UInt> &inputs,
+                          std::vector<Real> &perms,
+                          std::vector<bool> &potential) const
+{
+    inputs.clear();
+    perms.clear();
+    potential.clear();
+    forEachSynapse(row, [&](UInt input, Real perm, bool isPotential, bool) {
+        inputs.push_back(input);
+        perms.push_back(perm);
+        potential.push_back(isPotential);
+    });
+}
+
+void SynapseStore::beginRow(UInt row)
+{
+    NTA_ASSERT(row < rows_.size());
+    newRow_ = row;
+    newInputs_.clear();
+    newPerms_.clear();
+    newFlags_.clear();
+}
+
+UInt SynapseStore::endRow()
+{
+    const UInt row = newRow_;
+    const UInt size = (UInt)newInputs_.size();
+    if (wideRows_)
+    {
+        updateConnectedRows_(connectedRows32_, row);
+    }
+    else
+    {
+        updateConnectedRows_(connectedRows16_, row);
+    }
+    reserveRow_(row, size);
+
+    // Connected synapses first, then the others.
+    Row &r = rows_[row];
+    size_t k = r.begin;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const int connected = pass == 0 ? CONNECTED : 0;
+        for (UInt i = 0; i < size; i++)
+        {
+            if ((newFlags_[i] & CONNECTED) == connected)
+            {
+                NTA_ASSERT(i == 0 || newInputs_[i - 1] < newInputs_[i]);
+                setInput_(k, newInputs_[i]);
+                potential_[k] = newFlags_[i] & POTENTIAL;
+                setPermanence_(k, newPerms_[i]);
+                ++k;
+            }
+        }
+        if (connected)
+        {
+            r.numConnected = (UInt)(k - r.begin);
+        }
+    }
+    r.size = size;
+    dirty_[row] = 1;
+
+    newInputs_.clear();
+    newPerms_.clear();
+    newFlags_.clear();
+    return r.numConnected;
+}
+
+void SynapseStore::setPotential(UInt row, const UInt *begin, const UInt *end)
+{
+    beginRow(row);
+    const UInt *next = begin;
+    forEachSynapse(row, [&](UInt input, Real perm, bool, bool connected) {
+        while (next != end && *next < input)
+        {
+            append(*next++, 0, true, false);
+        }
+        const bool potential = next != end && *next == input;
+        if (potential)
+        {
+            ++next;
+        }
+        append(input, perm, potential, connected);
+    });
+    while (next != end)
+    {
+        append(*next++, 0, true, false);
+    }
+    endRow();
+}
+
+void SynapseStore::writeInputs(std::ostream &outStream) const
+{
+    const size_t bytes = getInputBits() / 8;
+    const char *inputs =
+        wideInputs_ ? reinterpret_cast<const char *>(inputs32_.data())
+                    : reinterpret_cast<const char *>(inputs16_.data());
+    for (const Row &r : rows_)
+    {
+        outStream.write(inputs + r.begin * bytes, r.size * bytes);
+    }
+}
+
+void SynapseStore::writePotential(std::ostream &outStream) const
+{
+    for (const Row &r : rows_)
+    {
+        outStream.write(
+            reinterpret_cast<const char *>(potential_.data() + r.begin),
+            r.size);
+    }
+}
+
+void SynapseStore::writePermanences(std::ostream &outStream) const
+{
+    const size_t bytes =
+        codes_.enabled() ? codes_.getBytesPerCode() : sizeof(Real);
+    const char *perms = codes_.enabled()
+                            ? codes_.data()
+                            : reinterpret_cast<const char *>(perms_.data());
+    for (const Row &r : rows_)
+    {
+        outStream.write(perms + r.begin * bytes, r.size * bytes);
+    }
+}
+
+void SynapseStore::loadRows(const UInt sizes[], const UInt numConnected[],
+                            size_t numSynapses, const char *inputs,
+                            const char *potential, const char *permanences)
+{
+    size_t begin = 0;
+    for (UInt row = 0; row < rows_.size(); row++)
+    {
+        NTA_CHECK(sizes[row] <= numInputs_ && numConnected[row] <= sizes[row] &&
+                  sizes[row] <= numSynapses - begin)
+            << "SynapseStore::loadRows -- invalid row " << row;
+        rows_[row] = Row{begin, sizes[row], sizes[row], numConnected[row]};
+        begin += sizes[row];
+    }
+    NTA_CHECK(begin == numSynapses)
+        << "SynapseStore::loadRows -- " << begin << " synapses instead of "
+        << numSynapses;
+
+    unused_ = 0;
+    std::fill(dirty_.begin(), dirty_.end(), 1);
+    resizeArena_(numSynapses);
+    if (wideInputs_)
+    {
+        std::memcpy(inputs32_.data(), inputs, numSynapses * sizeof(UInt32));
+    }
+    else
+    {
+        std::memcpy(inputs16_.data(), inputs, numSynapses * sizeof(UInt16));
+    }
+    std::memcpy(potential_.data(), potential, numSynapses);
+    if (codes_.enabled())
+    {
+        std::memcpy(codes_.data(), permanences,
+                    numSynapses * codes_.getBytesPerCode());
+    }
+    else
+    {
+        std::memcpy(perms_.data(), permanences, numSynapses * sizeof(Real));
+    }
+
+    // Both parts of a row are sorted and do not share an input.
+    for (UInt row = 0; row < rows_.size(); row++)
+    {
+        const Row &r = rows_[row];
+        const size_t connectedEnd = r.begin + r.numConnected;
+        const size_t end = r.begin + r.size;
+        for (size_t k = r.begin; k < end; k++)
+        {
+            NTA_CHECK(getInput_(k) < numInputs_ && potential_[k] <= 1 &&
+                      (k == r.begin || k == connectedEnd ||
+                       getInput_(k - 1) < getInput_(k)))
+                << "SynapseStore::loadRows -- invalid synapses of row "
+                << row;
+        }
+        size_t connected = r.begin;
+        size_t other = connectedEnd;
+        while (connected != connectedEnd && other != end)
+        {
+            const UInt input = getInput_(connected);
+            NTA_CHECK(input != getInput_(other))
+                << "SynapseStore::loadRows -- invalid synapses of row "
+                << row;
+            input < getInput_(other) ? ++connected : ++other;
+        }
+    }
+
+    if (wideRows_)
+    {
+        buildConnectedRows_(connectedRows32_);
+    }
+    else
+    {
+        buildConnectedRows_(connectedRows16_);
+    }
+}
+
+UInt SynapseStore::getNumDirty() const
+{
+    return (UInt)std::count(dirty_.begin(), dirty_.end(), 1);
+}
+
+void SynapseStore::clearDirty() { std::fill(dirty_.begin(), dirty_.end(), 0); }
+
+void SynapseStore::resizeArena_(size_t size)
+{
+    if (wideInputs_)
+    {
+        inputs32_.resize(size);
+    }
+    else
+    {
+        inputs16_.resize(size);
+    }
+    potential_.resize(size);
+    if (codes_.enabled())
+    {
+        codes_.resize(size);
+    }
+    else
+    {
+        perms_.resize(size);
+    }
+}
+
+void SynapseStore::reserveRow_(UInt row, UInt size)
+{
+    Row &r = rows_[row];
+    if (size <= r.capacity)
+    {
+        return;
+    }
+
+    // The last row grows in place.
+    const size_t arenaSize = potential_.size();
+    if (r.begin + r.capacity == arenaSize)
+    {
+        resizeArena_(r.begin + size);
+        r.capacity = size;
+        return;
+    }
+
+    if (unused_ + r.capacity > arenaSize / 2)
+    {
+        compact_();
+    }
+    unused_ += r.capacity;
+    r.begin = potential_.size();
+    r.capacity = size;
+    resizeArena_(r.begin + size);
+}
+
+void SynapseStore::compact_()
+{
+    size_t size = 0;
+    for (const Row &r : rows_)
+    {
+        size += r.size;
+    }
+
+    std::vector<UInt16> inputs16(wideInputs_ ? 0 : size);
+    std::vector<UInt32> inputs32(wideInputs_ ? size : 0);
+    std::vector<unsigned char> potential(size);
+    std::vector<Real> perms;
+    FixedPointPermanences codes;
+    codes.setFormat(codes_.getBits(), codes_.getMinimum(),
+                    codes_.getMaximum());
+    if (codes.enabled())
+    {
+        codes.resize(size);
+    }
+    else
+    {
+        perms.resize(size);
+    }
+
+    size_t begin = 0;
+    for (Row &r : rows_)
+    {
+        if (wideInputs_)
+        {
+            std::copy(inputs32_.data() + r.begin,
+                      inputs32_.data() + r.begin + r.size,
+                      inputs32.data() + begin);
+        }
+        else
+        {
+            std::copy(inputs16_.data() + r.begin,
+                      inputs16_.data() + r.begin + r.size,
+                      inputs16.data() + begin);
+        }
+        std::copy(potential_.data() + r.begin,
+                  potential_.data() + r.begin + r.size,
+                  potential.data() + begin);
+        for (UInt i = 0; i < r.size; i++)
+        {
+            if (codes.enabled())
+            {
+                codes.setCode(begin + i, codes_.getCode(r.begin + i));
+            }
+            else
+            {
+                perms[begin + i] = perms_[r.begin + i];
+            }
+        }
+        r.begin = begin;
+        r.capacity = r.size;
+        begin += r.size;
+    }
+
+    inputs16_.swap(inputs16);
+    inputs32_.swap(inputs32);
+    potential_.swap(potential);
+    perms_.swap(perms);
+    std::swap(codes_, codes);
+    unused_ = 0;
+}
+
+template <typename RowId>
+void SynapseStore::buildConnectedRows_(
+    std::vector<std::vector<RowId>> &connectedRows)
+{
+    std::vector<UInt> numRows(numInputs_, 0);
+    for (const Row &r : rows_)
+    {
+        for (size_t k = r.begin; k < r.begin + r.numConnected; k++)
+        {
+            ++numRows[getInput_(k)];
+        }
+    }
+    for (UInt input = 0; input < numInputs_; input++)
+    {
+        connectedRows[input].clear();
+        connectedRows[input].reserve(numRows[input]);
+    }
+    for (UInt row = 0; row < rows_.size(); row++)
+    {
+        const Row &r = rows_[row];
+        for (size_t k = r.begin; k < r.begin + r.numConnected; k++)
+        {
+            connectedRows[getInput_(k)].push_back((RowId)row);
+        }
+    }
+}
+
+template <typename RowId>
+void SynapseStore::updateConnectedRows_(
+    std::vector<std::vector<RowId>> &connectedRows, UInt row)
+{
+    // Both the current and the new connected inputs are sorted.
+    size_t old = rows_[row].begin;
+    const size_t oldEnd = old + rows_[row].numConnected;
+    const size_t size = newInputs_.size();
+    size_t i = 0;
+    auto skipUnconnected = [&]() {
+        while (i < size && !(newFlags_[i] & CONNECTED))
+        {
+            ++i;
+        }
+    };
+
+    connectedAdded_.clear();
+    connectedRemoved_.clear();
+    skipUnconnected();
+    while (old != oldEnd || i < size)
+    {
+        if (i == size || (old != oldEnd && getInput_(old) < newInputs_[i]))
+        {
+            const UInt input = getInput_(old++);
+            std::vector<RowId> &rows = connectedRows[input];
+            auto it = std::find(rows.begin(), rows.end(), (RowId)row);
+            NTA_ASSERT(it != rows.end());
+            *it = rows.back();
+            rows.pop_back();
+            connectedRemoved_.push_back(input);
+        }
+        else
+        {
+            if (old == oldEnd || newInputs_[i] < getInput_(old))
+            {
+                connectedRows[newInputs_[i]].push_back((RowId)row);
+                connectedAdded_.push_back(newInputs_[i]);
+            }
+            else
+            {
+                ++old;
+            }
+            ++i;
+            skipUnconnected();
+        }
+    }
+}
+
+} // namespace crucian
@@ -0,0 +1,145 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of ThreadPool
+ */
+
+#include <algorithm>
+
+#include <crucian/ThreadPool.hpp>
+
+namespace crucian
+{
+
+ThreadPool::ThreadPool(UInt numThreads)
+    : numThreads_(numThreads), generation_(0), pending_(0), stop_(false),
+      task_(nullptr), function_(nullptr), begin_(0), end_(0), numChunks_(0)
+{
+    if (numThreads_ == 0)
+    {
+        numThreads_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    workers_.reserve(numThreads_ - 1);
+    for (UInt i = 1; i < numThreads_; i++)
+    {
+        workers_.emplace_back(&ThreadPool::workerLoop_, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto &worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::run_(UInt begin, UInt end, Task task, const void *f)
+{
+    std::lock_guard<std::mutex> runLock(runMutex_);
+
+    const UInt numChunks = std::min(numThreads_, end - begin);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = task;
+        function_ = f;
+        begin_ = begin;
+        end_ = end;
+        numChunks_ = numChunks;
+        pending_ = numChunks - 1;
+        error_ = nullptr;
+        ++generation_;
+    }
+    start_.notify_all();
+
+    runChunk_(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+
+    if (error_)
+    {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::runChunk_(UInt i)
+{
+    UInt chunkBegin, chunkEnd;
+    chunk(begin_, end_, numChunks_, i, chunkBegin, chunkEnd);
+    try
+    {
+        task_(function_, chunkBegin, chunkEnd);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+        {
+            error_ = std::current_exception();
+        }
+    }
+}
+
+void ThreadPool::workerLoop_(UInt id)
+{
+    UInt64 seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_)
+            {
+                return;
+            }
+            seen = generation_;
+            if (id >= numChunks_)
+            {
+                continue;
+            }
+        }
+
+        runChunk_(id);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last = --pending_ == 0;
+        }
+        if (last)
+        {
+            done_.notify_one();
+        }
+    }
+}
+
+} // namespace crucian
@@ -24,6 +24,8 @@
  * Topology helpers
  */
 
+#include <algorithm>
+
 #include <crucian/Log.hpp>
 #include <crucian/Topology.hpp>
 
@@ -262,4 +264,32 @@ WrappingNeighborhood::Iterator WrappingNeighborhood::end() const
     return {*this, /*end*/ true};
 }
 
+UInt neighborhoodIntervals(UInt center, UInt radius, UInt size, bool wrapAround,
+                           UInt begins[2], UInt ends[2])
+{
+    if (!wrapAround)
+    {
+        begins[0] = center > radius ? center - radius : 0;
+        ends[0] = (UInt)std::min<UInt64>(size, (UInt64)center + radius + 1);
+        return 1;
+    }
+
+    // WrappingNeighborhood starts at center - radius and visits at most
+    // 'size' coordinates.
+    const UInt first = (center + size - radius % size) % size;
+    const UInt length = (UInt)std::min<UInt64>(size, 2 * (UInt64)radius + 1);
+    if (first + length <= size)
+    {
+        begins[0] = first;
+        ends[0] = first + length;
+        return 1;
+    }
+
+    begins[0] = first;
+    ends[0] = size;
+    begins[1] = 0;
+    ends[1] = first + length - size;
+    return 2;
+}
+
 } // namespace crucian
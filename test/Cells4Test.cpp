@@ -24,12 +24,16 @@
  * Implementation of unit tests for Segment
  */
 
+#include <algorithm>
 #include <gtest/gtest.h>
+#include <memory>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include <crucian/ArrayAlgo.hpp> // is_in
 #include <crucian/Cells4.hpp>
+#include <crucian/Random.hpp>
 #include <crucian/Segment.hpp>
 
 namespace crucian
@@ -110,35 +114,17 @@ std::vector<UInt> _getOrderedSynapseIndexesForSrcCells(const Segment &segment,
 
 TEST(Cells4Test, pickleSerialization)
 {
-    Cells4 cells(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, -1, true,
-                 false);
-    std::vector<Real> input1(10, 0.0);
-    input1[1] = 1.0;
-    input1[4] = 1.0;
-    input1[5] = 1.0;
-    input1[9] = 1.0;
-    std::vector<Real> input2(10, 0.0);
-    input2[0] = 1.0;
-    input2[2] = 1.0;
-    input2[5] = 1.0;
-    input2[6] = 1.0;
-    std::vector<Real> input3(10, 0.0);
-    input3[1] = 1.0;
-    input3[3] = 1.0;
-    input3[6] = 1.0;
-    input3[7] = 1.0;
-    std::vector<Real> input4(10, 0.0);
-    input4[2] = 1.0;
-    input4[4] = 1.0;
-    input4[7] = 1.0;
-    input4[8] = 1.0;
-    std::vector<Real> output(10 * 2);
+    Cells4 cells(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, -1, false);
+    const std::vector<UInt> input1 = {1, 4, 5, 9};
+    const std::vector<UInt> input2 = {0, 2, 5, 6};
+    const std::vector<UInt> input3 = {1, 3, 6, 7};
+    const std::vector<UInt> input4 = {2, 4, 7, 8};
     for (UInt i = 0; i < 10; ++i)
     {
-        cells.compute(&input1.front(), &output.front(), true, true);
-        cells.compute(&input2.front(), &output.front(), true, true);
-        cells.compute(&input3.front(), &output.front(), true, true);
-        cells.compute(&input4.front(), &output.front(), true, true);
+        cells.compute(input1, true, true);
+        cells.compute(input2, true, true);
+        cells.compute(input3, true, true);
+        cells.compute(input4, true, true);
         cells.reset();
     }
 
@@ -151,22 +137,16 @@ TEST(Cells4Test, pickleSerialization)
     }
     ASSERT_TRUE(cells == secondCells);
 
-    std::vector<Real> secondOutput(10 * 2);
-    cells.compute(&input1.front(), &output.front(), true, true);
-    secondCells.compute(&input1.front(), &secondOutput.front(), true, true);
+    cells.compute(input1, true, true);
+    secondCells.compute(input1, true, true);
     ASSERT_TRUE(cells == secondCells);
-
-    for (UInt i = 0; i < 10; ++i)
-    {
-        ASSERT_EQ(output[i], secondOutput[i])
-            << "Outputs differ at index " << i;
-    }
+    ASSERT_TRUE(cells.predictedState() == secondCells.predictedState());
 
     // Check serialization of cells4 before calling reset
-    cells.compute(&input1.front(), &output.front(), true, true);
-    cells.compute(&input2.front(), &output.front(), true, true);
-    cells.compute(&input3.front(), &output.front(), true, true);
-    cells.compute(&input4.front(), &output.front(), true, true);
+    cells.compute(input1, true, true);
+    cells.compute(input2, true, true);
+    cells.compute(input3, true, true);
+    cells.compute(input4, true, true);
 
     Cells4 secondCellsNoReset;
     {
@@ -177,16 +157,11 @@ TEST(Cells4Test, pickleSerialization)
     }
     ASSERT_TRUE(cells == secondCellsNoReset);
 
-    cells.compute(&input1.front(), &output.front(), true, true);
-    secondCellsNoReset.compute(&input1.front(), &secondOutput.front(), true,
-                               true);
+    cells.compute(input1, true, true);
+    secondCellsNoReset.compute(input1, true, true);
     ASSERT_TRUE(cells == secondCellsNoReset);
-
-    for (UInt i = 0; i < 10; ++i)
-    {
-        ASSERT_EQ(output[i], secondOutput[i])
-            << "Outputs differ at index " << i;
-    }
+    ASSERT_TRUE(cells.predictedState() ==
+                secondCellsNoReset.predictedState());
 }
 
 /*
@@ -522,52 +497,35 @@ TEST(Cells4Test,
  */
 TEST(Cells4Test, testEqualsOperator)
 {
-    Cells4 cells1(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42, true,
+    Cells4 cells1(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42,
                   false);
-    Cells4 cells2(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42, true,
+    Cells4 cells2(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42,
                   false);
     ASSERT_TRUE(cells1 == cells2);
-    std::vector<Real> input1(10, 0.0);
-    input1[1] = 1.0;
-    input1[4] = 1.0;
-    input1[5] = 1.0;
-    input1[9] = 1.0;
-    std::vector<Real> input2(10, 0.0);
-    input2[0] = 1.0;
-    input2[2] = 1.0;
-    input2[5] = 1.0;
-    input2[6] = 1.0;
-    std::vector<Real> input3(10, 0.0);
-    input3[1] = 1.0;
-    input3[3] = 1.0;
-    input3[6] = 1.0;
-    input3[7] = 1.0;
-    std::vector<Real> input4(10, 0.0);
-    input4[2] = 1.0;
-    input4[4] = 1.0;
-    input4[7] = 1.0;
-    input4[8] = 1.0;
-    std::vector<Real> output(10 * 2);
+    const std::vector<UInt> input1 = {1, 4, 5, 9};
+    const std::vector<UInt> input2 = {0, 2, 5, 6};
+    const std::vector<UInt> input3 = {1, 3, 6, 7};
+    const std::vector<UInt> input4 = {2, 4, 7, 8};
     for (UInt i = 0; i < 10; ++i)
     {
-        cells1.compute(&input1.front(), &output.front(), true, true);
+        cells1.compute(input1, true, true);
         ASSERT_TRUE(cells1 != cells2);
-        cells2.compute(&input1.front(), &output.front(), true, true);
+        cells2.compute(input1, true, true);
         ASSERT_TRUE(cells1 == cells2);
 
-        cells1.compute(&input2.front(), &output.front(), true, true);
+        cells1.compute(input2, true, true);
         ASSERT_TRUE(cells1 != cells2);
-        cells2.compute(&input2.front(), &output.front(), true, true);
+        cells2.compute(input2, true, true);
         ASSERT_TRUE(cells1 == cells2);
 
-        cells1.compute(&input3.front(), &output.front(), true, true);
+        cells1.compute(input3, true, true);
         ASSERT_TRUE(cells1 != cells2);
-        cells2.compute(&input3.front(), &output.front(), true, true);
+        cells2.compute(input3, true, true);
         ASSERT_TRUE(cells1 == cells2);
 
-        cells1.compute(&input4.front(), &output.front(), true, true);
+        cells1.compute(input4, true, true);
         ASSERT_TRUE(cells1 != cells2);
-        cells2.compute(&input4.front(), &output.front(), true, true);
+        cells2.compute(input4, true, true);
         ASSERT_TRUE(cells1 == cells2);
 
         cells1.reset();
@@ -577,4 +535,229 @@ TEST(Cells4Test, testEqualsOperator)
     }
 }
 
+/**
+ * The activity tables grow with the segments per cell, keeping their counts.
+ */
+TEST(Cells4Test, activityTables)
+{
+    CCellSegActivity<UChar> activity;
+    activity.initialize(3, 1);
+    ASSERT_EQ(1, activity.getNumSegments());
+    activity.increment(2, 0);
+    activity.increment(2, 0);
+    activity.increment(1, 0);
+
+    activity.reserveSegments(5);
+    ASSERT_EQ(8, activity.getNumSegments());
+    ASSERT_EQ(1, activity.get(1, 0));
+    ASSERT_EQ(2, activity.get(2, 0));
+    ASSERT_EQ(2, activity.get(2));
+    activity.increment(2, 7);
+    ASSERT_EQ(1, activity.get(2, 7));
+    ASSERT_EQ(0, activity.get(0, 7));
+
+    activity.reset();
+    ASSERT_EQ(0, activity.get(2, 0));
+    ASSERT_EQ(0, activity.get(2, 7));
+    ASSERT_EQ(0, activity.get(2));
+
+    // The tables are sized from the cells actually used.
+    Cells4 cells(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42,
+                 false);
+    ASSERT_LT(cells.getActivity().getNumBytes(), 1024u);
+    cells.setMaxSegmentsPerCell(200);
+    ASSERT_EQ(256, cells.getActivity().getNumSegments());
+
+    const std::vector<UInt> input1 = {1, 4, 5, 9};
+    const std::vector<UInt> input2 = {0, 2, 5, 6};
+    Cells4 unbounded(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42,
+                     false);
+    for (UInt i = 0; i < 10; ++i)
+    {
+        unbounded.compute(input1, true, true);
+        unbounded.compute(input2, true, true);
+    }
+    UInt maxSegments = 0;
+    for (UInt i = 0; i < unbounded.nCells(); ++i)
+    {
+        maxSegments = std::max(maxSegments, unbounded.__nSegmentsOnCell(i));
+    }
+    ASSERT_GT(maxSegments, 0u);
+    ASSERT_GE(unbounded.getActivity().getNumSegments(), maxSegments);
+}
+
+/**
+ * Runs a Cells4 on a noisy repeating sequence, with learning, backtracking,
+ * segment recycling when maxSegmentsPerCell is set, and trimming.
+ */
+static void runStream(Cells4 &cells, UInt stream)
+{
+    const UInt nColumns = cells.nColumns();
+    Random rng(stream + 1);
+    std::vector<std::vector<UInt>> sequence(8);
+    for (std::vector<UInt> &pattern : sequence)
+    {
+        while (pattern.size() < 5)
+        {
+            const UInt column = rng.getUInt32(nColumns);
+            if (std::find(pattern.begin(), pattern.end(), column) ==
+                pattern.end())
+            {
+                pattern.push_back(column);
+            }
+        }
+        std::sort(pattern.begin(), pattern.end());
+    }
+
+    std::vector<UInt> noise;
+    for (UInt pass = 0; pass < 20; ++pass)
+    {
+        for (const std::vector<UInt> &pattern : sequence)
+        {
+            if (rng.getUInt32(10) == 0)
+            {
+                noise = {rng.getUInt32(nColumns / 2),
+                         nColumns / 2 + rng.getUInt32(nColumns / 2)};
+                cells.compute(noise, true, true);
+            }
+            cells.compute(pattern, true, true);
+        }
+        cells.reset();
+    }
+    cells.trimSegments(0.2f, 2);
+}
+
+/**
+ * Instances computing on different threads give the same results as when
+ * computing one after another.
+ */
+TEST(Cells4Test, concurrentInstances)
+{
+    const UInt numStreams = 8;
+    std::vector<std::unique_ptr<Cells4>> expected;
+    std::vector<std::unique_ptr<Cells4>> results;
+    for (UInt stream = 0; stream < numStreams; ++stream)
+    {
+        for (auto *cells : {&expected, &results})
+        {
+            cells->emplace_back(new Cells4(64, 8, 3, 2, 5, 1, 0.5f, 0.5f,
+                                           1.0f, 0.1f, 0.1f, 0.0f, false, 42,
+                                           false));
+            if (stream % 2 == 1)
+            {
+                cells->back()->setMaxSegmentsPerCell(3);
+            }
+        }
+    }
+
+    for (UInt stream = 0; stream < numStreams; ++stream)
+    {
+        runStream(*expected[stream], stream);
+    }
+
+    std::vector<std::thread> threads;
+    for (UInt stream = 0; stream < numStreams; ++stream)
+    {
+        threads.emplace_back(
+            [&results, stream]() { runStream(*results[stream], stream); });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    for (UInt stream = 0; stream < numStreams; ++stream)
+    {
+        ASSERT_GT(expected[stream]->nSegments(), 0u);
+        ASSERT_TRUE(*results[stream] == *expected[stream]);
+        ASSERT_TRUE(results[stream]->predictedState() ==
+                    expected[stream]->predictedState());
+    }
+}
+
+/**
+ * Forward propagation on several threads gives the same activities, and so
+ * the same results, as on one thread.
+ */
+TEST(Cells4Test, parallelForwardPropagation)
+{
+    for (UInt stream = 0; stream < 2; ++stream)
+    {
+        Cells4 serial(64, 8, 3, 2, 5, 1, 0.5f, 0.5f, 1.0f, 0.1f, 0.1f, 0.0f,
+                      false, 42, false);
+        Cells4 parallel(64, 8, 3, 2, 5, 1, 0.5f, 0.5f, 1.0f, 0.1f, 0.1f,
+                        0.0f, false, 42, false);
+        parallel.setNumThreads(3);
+        ASSERT_EQ(3u, parallel.getNumThreads());
+        if (stream == 1)
+        {
+            serial.setMaxSegmentsPerCell(3);
+            parallel.setMaxSegmentsPerCell(3);
+        }
+
+        runStream(serial, stream);
+        runStream(parallel, stream);
+        ASSERT_GT(serial.nSegments(), 0u);
+        ASSERT_TRUE(parallel == serial);
+        ASSERT_TRUE(parallel.predictedState() == serial.predictedState());
+
+        // Same counts for every cell and segment.
+        CStateIndexed state;
+        state.initialize(serial.nCells());
+        for (UInt i = 0; i < serial.nCells(); i += 3)
+        {
+            state.set(i);
+        }
+        serial.computeForwardPropagation(state);
+        parallel.computeForwardPropagation(state);
+        const CCellSegActivity<UChar> &expected = serial.getActivity();
+        const CCellSegActivity<UChar> &actual = parallel.getActivity();
+        UInt numActive = 0;
+        for (UInt i = 0; i < serial.nCells(); ++i)
+        {
+            numActive += expected.get(i) != 0;
+            ASSERT_EQ(expected.get(i), actual.get(i));
+            for (UInt j = 0; j < serial.__nSegmentsOnCell(i); ++j)
+            {
+                ASSERT_EQ(expected.get(i, j), actual.get(i, j));
+            }
+        }
+        ASSERT_GT(numActive, 0u);
+    }
+}
+
+/**
+ * Queued segment updates are applied to the cells of the active columns
+ * only, as learning gets the active columns as a sparse list.
+ */
+TEST(Cells4Test, segmentUpdatesFollowActiveColumns)
+{
+    Cells4 cells(10, 2, 1, 1, 1, 1, 0.5, 0.8, 1, 0.1, 0.1, 0, false, 42,
+                 false);
+    const std::vector<std::pair<UInt, UInt>> synapses = {{5, 0}, {6, 0}};
+    cells.addNewSegment(0, 1, true, synapses);
+    cells.addNewSegment(1, 1, true, synapses);
+
+    // As a dense array, {1, 4} would make column 0 active and column 1
+    // inactive.
+    cells.compute({1, 4}, true, true);
+
+    auto hasQueuedSegment = [&](UInt colIdx, UInt cellIdxInCol) {
+        for (UInt i = 0; i < cells.nSegmentsOnCell(colIdx, cellIdxInCol);
+             ++i)
+        {
+            const Segment *segment =
+                cells.getSegment(colIdx, cellIdxInCol, i);
+            if (segment->has(cells.getCellIdx(5, 0)) &&
+                segment->has(cells.getCellIdx(6, 0)))
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    ASSERT_TRUE(hasQueuedSegment(1, 1));
+    ASSERT_FALSE(hasQueuedSegment(0, 1));
+}
+
 } // namespace crucian
@@ -0,0 +1,193 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Unit tests for FrozenSpatialPooler
+ */
+
+#include <sstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <crucian/FrozenSpatialPooler.hpp>
+#include <crucian/Random.hpp>
+#include <crucian/SpatialPooler.hpp>
+
+namespace crucian
+{
+
+// Checks that frozen gives the same active columns as sp without learning,
+// through both variants of compute.
+static void checkSameInference(SpatialPooler &sp,
+                               const FrozenSpatialPooler &frozen,
+                               Real density, UInt nRecords)
+{
+    const UInt numInputs = sp.getNumInputs();
+    const UInt numColumns = sp.getNumColumns();
+    ASSERT_EQ(numInputs, frozen.getNumInputs());
+    ASSERT_EQ(numColumns, frozen.getNumColumns());
+
+    SpatialPooler::InferenceContext context;
+    Random rng(11);
+    std::vector<UInt> input(numInputs);
+    std::vector<UInt> expected(numColumns);
+    std::vector<UInt> actual(numColumns);
+    std::vector<UInt> activeInputs;
+    std::vector<UInt> activeColumns;
+    for (UInt r = 0; r < nRecords; r++)
+    {
+        activeInputs.clear();
+        for (UInt i = 0; i < numInputs; i++)
+        {
+            input[i] = rng.getReal64() < density ? 1 : 0;
+            if (input[i])
+            {
+                activeInputs.push_back(i);
+            }
+        }
+
+        sp.compute(input.data(), false, expected.data());
+        frozen.compute(input.data(), actual.data(), context);
+        ASSERT_EQ(expected, actual);
+        ASSERT_EQ(sp.getOverlaps(), context.getOverlaps());
+
+        frozen.compute(activeInputs, activeColumns, context);
+        std::vector<UInt> dense(numColumns, 0);
+        for (UInt column : activeColumns)
+        {
+            dense[column] = 1;
+        }
+        ASSERT_EQ(expected, dense);
+    }
+}
+
+TEST(FrozenSpatialPoolerTest, sameAsSpatialPooler)
+{
+    struct Config
+    {
+        std::vector<UInt> inputDimensions;
+        std::vector<UInt> columnDimensions;
+        bool globalInhibition;
+        UInt potentialRadius;
+    };
+    // Global, window and sweep inhibition.
+    std::vector<Config> configs = {{{200}, {150}, true, 10},
+                                   {{200}, {150}, false, 1},
+                                   {{16, 16}, {12, 12}, false, 5}};
+
+    for (auto &config : configs)
+    {
+        SpatialPooler sp(config.inputDimensions, config.columnDimensions,
+                         /*potentialRadius*/ config.potentialRadius,
+                         /*potentialPct*/ 0.5,
+                         /*globalInhibition*/ config.globalInhibition,
+                         /*localAreaDensity*/ -1.0,
+                         /*numActiveColumnsPerInhArea*/ 5,
+                         /*stimulusThreshold*/ 1);
+
+        Random rng(42);
+        std::vector<UInt> input(sp.getNumInputs());
+        std::vector<UInt> active(sp.getNumColumns());
+        for (UInt iter = 0; iter < 50; iter++)
+        {
+            for (auto &bit : input)
+            {
+                bit = rng.getReal64() < 0.1 ? 1 : 0;
+            }
+            sp.compute(input.data(), true, active.data());
+        }
+
+        const FrozenSpatialPooler frozen = sp.freeze();
+        EXPECT_EQ(16u, frozen.getColumnIdBits());
+        size_t numSynapses = 0;
+        std::vector<UInt> connectedCounts(sp.getNumColumns());
+        sp.getConnectedCounts(connectedCounts.data());
+        for (UInt count : connectedCounts)
+        {
+            numSynapses += count;
+        }
+        EXPECT_EQ(numSynapses, frozen.getNumSynapses());
+
+        // Later learning does not change the frozen spatial pooler.
+        SpatialPooler before = sp;
+        for (UInt iter = 0; iter < 20; iter++)
+        {
+            for (auto &bit : input)
+            {
+                bit = rng.getReal64() < 0.1 ? 1 : 0;
+            }
+            sp.compute(input.data(), true, active.data());
+        }
+        ASSERT_NO_FATAL_FAILURE(checkSameInference(before, frozen, 0.1, 30));
+    }
+}
+
+TEST(FrozenSpatialPoolerTest, inhibitionParameters)
+{
+    SpatialPooler sp({16, 16}, {12, 12},
+                     /*potentialRadius*/ 5,
+                     /*potentialPct*/ 0.5,
+                     /*globalInhibition*/ false,
+                     /*localAreaDensity*/ -1.0,
+                     /*numActiveColumnsPerInhArea*/ 5,
+                     /*stimulusThreshold*/ 1);
+
+    // The parameters changed by the setters reach the inhibition of both
+    // sp and its frozen copy. The loaded copy rebuilds them from scratch.
+    auto check = [&sp]() {
+        std::stringstream stream;
+        sp.save(stream);
+        SpatialPooler loaded;
+        loaded.load(stream);
+        ASSERT_NO_FATAL_FAILURE(
+            checkSameInference(sp, loaded.freeze(), 0.2, 10));
+        ASSERT_NO_FATAL_FAILURE(
+            checkSameInference(loaded, sp.freeze(), 0.2, 10));
+    };
+
+    sp.setLocalAreaDensity(0.2);
+    sp.setStimulusThreshold(2);
+    sp.setInhibitionRadius(2);
+    sp.setWrapAround(false);
+    ASSERT_NO_FATAL_FAILURE(check());
+
+    sp.setGlobalInhibition(true);
+    sp.setNumActiveColumnsPerInhArea(7);
+    ASSERT_NO_FATAL_FAILURE(check());
+}
+
+TEST(FrozenSpatialPoolerTest, wideColumnIds)
+{
+    SpatialPooler sp({500}, {70000},
+                     /*potentialRadius*/ 20,
+                     /*potentialPct*/ 0.5,
+                     /*globalInhibition*/ true,
+                     /*localAreaDensity*/ -1.0,
+                     /*numActiveColumnsPerInhArea*/ 40,
+                     /*stimulusThreshold*/ 1);
+    const FrozenSpatialPooler frozen = sp.freeze();
+    EXPECT_EQ(32u, frozen.getColumnIdBits());
+    ASSERT_NO_FATAL_FAILURE(checkSameInference(sp, frozen, 0.2, 3));
+}
+
+} // namespace crucian
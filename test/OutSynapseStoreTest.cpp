@@ -0,0 +1,194 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Unit tests for OutSynapseStore
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <crucian/OutSynapseStore.hpp>
+#include <crucian/Random.hpp>
+
+namespace crucian
+{
+
+static std::vector<OutSynapse> row(const OutSynapseStore &store, UInt r)
+{
+    const OutSynapse *synapses = store.getRow(r);
+    return std::vector<OutSynapse>(synapses, synapses + store.getRowSize(r));
+}
+
+TEST(OutSynapseStoreTest, addAndErase)
+{
+    OutSynapseStore store;
+    store.resize(3);
+    store.add(1, OutSynapse(5, 0));
+    store.add(1, OutSynapse(5, 1));
+    store.add(1, OutSynapse(7, 2));
+    store.add(2, OutSynapse(5, 0));
+
+    EXPECT_EQ(4u, store.getNumSynapses());
+    EXPECT_EQ(0u, store.getRowSize(0));
+    EXPECT_EQ(std::vector<OutSynapse>(
+                  {OutSynapse(5, 0), OutSynapse(5, 1), OutSynapse(7, 2)}),
+              row(store, 1));
+    EXPECT_TRUE(store.contains(1, 5, 1));
+    EXPECT_TRUE(store.contains(2, 5, 0));
+    EXPECT_FALSE(store.contains(0, 5, 0));
+    EXPECT_FALSE(store.contains(2, 5, 1));
+
+    // The last synapse of the row fills the hole.
+    EXPECT_TRUE(store.erase(1, 5, 0));
+    EXPECT_FALSE(store.erase(1, 5, 0));
+    EXPECT_EQ(std::vector<OutSynapse>({OutSynapse(7, 2), OutSynapse(5, 1)}),
+              row(store, 1));
+    EXPECT_FALSE(store.contains(1, 5, 0));
+    EXPECT_TRUE(store.contains(1, 7, 2));
+    EXPECT_EQ(3u, store.getNumSynapses());
+    EXPECT_TRUE(store.invariants());
+
+    store.resize(3);
+    EXPECT_EQ(0u, store.getNumSynapses());
+    EXPECT_EQ(0u, store.getRowSize(1));
+    EXPECT_FALSE(store.contains(1, 7, 2));
+}
+
+TEST(OutSynapseStoreTest, rowsMoveAndCompact)
+{
+    OutSynapseStore store;
+    store.resize(2);
+    store.add(0, OutSynapse(0, 0));
+    store.add(1, OutSynapse(0, 0));
+    const UInt capacity = store.getRowCapacity(0);
+
+    // Row 0 is not last in the arena, so growing moves it.
+    for (UInt i = 1; i <= capacity; i++)
+    {
+        store.add(0, OutSynapse(i, 0));
+    }
+    EXPECT_EQ(capacity + 1, store.getRowSize(0));
+    EXPECT_EQ(2 * capacity, store.getRowCapacity(0));
+    EXPECT_EQ(capacity, store.getNumUnused());
+    EXPECT_TRUE(store.invariants());
+
+    // Row 1 now is not last either, and moves too, leaving half of the
+    // arena unused.
+    for (UInt i = 1; i <= capacity; i++)
+    {
+        store.add(1, OutSynapse(i, 0));
+    }
+    EXPECT_EQ(2 * capacity, store.getNumUnused());
+    EXPECT_TRUE(store.invariants());
+
+    // Moving row 0 again would leave more than half of the arena unused:
+    // the arena is compacted first, and only the last move is left.
+    for (UInt i = capacity + 1; i <= 2 * capacity; i++)
+    {
+        store.add(0, OutSynapse(i, 0));
+    }
+    EXPECT_EQ(2 * capacity, store.getNumUnused());
+    EXPECT_EQ(4 * capacity, store.getRowCapacity(0));
+    EXPECT_EQ(2 * capacity, store.getRowCapacity(1));
+    EXPECT_TRUE(store.invariants());
+    for (UInt i = 0; i <= 2 * capacity; i++)
+    {
+        EXPECT_TRUE(store.contains(0, i, 0));
+        EXPECT_EQ(i <= capacity, store.contains(1, i, 0));
+    }
+}
+
+TEST(OutSynapseStoreTest, reserve)
+{
+    OutSynapseStore store;
+    store.resize(3);
+    store.add(0, OutSynapse(1, 1));
+    store.reserve({2, 0, 3}, 5);
+
+    EXPECT_EQ(0u, store.getNumSynapses());
+    EXPECT_EQ(2u, store.getRowCapacity(0));
+    EXPECT_EQ(3u, store.getRowCapacity(2));
+    EXPECT_EQ(store.getRow(0) + 2, store.getRow(2));
+
+    // Rows fill their reserved capacity in place.
+    const OutSynapse *row2 = store.getRow(2);
+    for (UInt i = 0; i < 3; i++)
+    {
+        store.add(2, OutSynapse(i, 0));
+    }
+    EXPECT_EQ(row2, store.getRow(2));
+    EXPECT_EQ(0u, store.getNumUnused());
+    EXPECT_TRUE(store.invariants());
+}
+
+TEST(OutSynapseStoreTest, matchesModel)
+{
+    // Random adds and erases, which move rows, compact the arena and grow
+    // the reverse index, compared with a vector per row.
+    const UInt numRows = 30;
+    OutSynapseStore store;
+    store.resize(numRows);
+    std::vector<std::vector<OutSynapse>> model(numRows);
+
+    Random rng(3);
+    for (UInt iter = 0; iter < 20000; iter++)
+    {
+        const UInt r = rng.getUInt32(numRows);
+        const OutSynapse synapse(rng.getUInt32(20), rng.getUInt32(10));
+        std::vector<OutSynapse> &expected = model[r];
+        auto it = std::find(expected.begin(), expected.end(), synapse);
+        if (it == expected.end() && rng.getUInt32(3) != 0)
+        {
+            store.add(r, synapse);
+            expected.push_back(synapse);
+        }
+        else
+        {
+            const bool found = it != expected.end();
+            if (found)
+            {
+                *it = expected.back();
+                expected.pop_back();
+            }
+            ASSERT_EQ(found, store.erase(r, synapse.dstCellIdx(),
+                                         synapse.dstSegIdx()));
+        }
+
+        if (iter % 1000 != 999)
+        {
+            continue;
+        }
+        ASSERT_TRUE(store.invariants());
+        size_t numSynapses = 0;
+        for (UInt i = 0; i < numRows; i++)
+        {
+            ASSERT_EQ(model[i], row(store, i));
+            numSynapses += model[i].size();
+        }
+        ASSERT_EQ(numSynapses, store.getNumSynapses());
+    }
+}
+
+} // namespace crucian
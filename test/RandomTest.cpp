@@ -29,6 +29,7 @@
 #include <fstream>
 #include <gtest/gtest.h>
 #include <sstream>
+#include <vector>
 
 #include <crucian/Random.hpp>
 
@@ -225,6 +226,34 @@ TEST(RandomTest, Seeding)
     }
 }
 
+TEST(RandomTest, Streams)
+{
+    // stream 0 is the plain generator
+    Random r(98765);
+    Random r0(98765, 0);
+    ASSERT_TRUE(r == r0);
+    ASSERT_EQ(98765U, Random(98765, 7).getSeed());
+
+    // streams are reproducible and differ from each other
+    std::vector<std::vector<UInt32>> streams;
+    for (UInt64 stream = 0; stream < 4; stream++)
+    {
+        Random s1(98765, stream);
+        Random s2(98765, stream);
+        std::vector<UInt32> values;
+        for (int i = 0; i < 20; i++)
+        {
+            values.push_back(s1.getUInt32());
+            ASSERT_EQ(values.back(), s2.getUInt32());
+        }
+        for (auto &other : streams)
+        {
+            ASSERT_NE(other, values);
+        }
+        streams.push_back(values);
+    }
+}
+
 TEST(RandomTest, CopyConstructor)
 {
     // test copy constructor.
@@ -312,6 +341,25 @@ TEST(RandomTest, SerializationDeserialization)
     ASSERT_EQ(v1, v2) << "serialization";
 }
 
+TEST(RandomTest, BinarySerialization)
+{
+    Random r1(862973);
+    for (int i = 0; i < 100; i++)
+        r1.getUInt32();
+
+    std::vector<char> buffer(Random::BINARY_SIZE);
+    r1.saveBinary(buffer.data());
+
+    Random r2(1);
+    r2.loadBinary(buffer.data());
+    ASSERT_TRUE(r1 == r2);
+    ASSERT_EQ(r1.getSeed(), r2.getSeed());
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(r1.getUInt32(), r2.getUInt32());
+    }
+}
+
 TEST(RandomTest, ReturnInCorrectRange)
 {
     // make sure that we are returning values in the correct range
@@ -0,0 +1,92 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Unit tests for SerialWorker
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <crucian/SerialWorker.hpp>
+
+namespace crucian
+{
+
+TEST(SerialWorkerTest, tasksRunInOrder)
+{
+    SerialWorker worker;
+    std::vector<UInt> order;
+    for (UInt i = 0; i < 100; i++)
+    {
+        worker.post([&order, i]() { order.push_back(i); });
+    }
+    worker.wait();
+
+    ASSERT_EQ(100u, order.size());
+    for (UInt i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(i, order[i]);
+    }
+
+    // Waiting again with nothing posted returns at once.
+    worker.wait();
+}
+
+TEST(SerialWorkerTest, exceptionIsRethrownOnce)
+{
+    SerialWorker worker;
+    UInt numRun = 0;
+    worker.post([&]() {
+        ++numRun;
+        throw std::runtime_error("first");
+    });
+    worker.post([&]() {
+        ++numRun;
+        throw std::logic_error("second");
+    });
+    EXPECT_THROW(worker.wait(), std::runtime_error);
+    EXPECT_EQ(2u, numRun);
+    EXPECT_NO_THROW(worker.wait());
+
+    // The worker is still usable after an exception.
+    worker.post([&]() { ++numRun; });
+    worker.wait();
+    EXPECT_EQ(3u, numRun);
+}
+
+TEST(SerialWorkerTest, destructorWaits)
+{
+    UInt numRun = 0;
+    {
+        SerialWorker worker;
+        for (UInt i = 0; i < 10; i++)
+        {
+            worker.post([&]() { ++numRun; });
+        }
+    }
+    EXPECT_EQ(10u, numRun);
+}
+
+} // namespace crucian
@@ -0,0 +1,201 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2013, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ---------------------------------------------------------------------
+ */
+
+/** @file
+ * Unit tests for SparseBinaryMatrix class
+ */
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+#include <crucian/Random.hpp>
+#include <crucian/SparseBinaryMatrix.hpp>
+
+namespace crucian
+{
+
+typedef SparseBinaryMatrix<UInt32, UInt32> SBM;
+
+// Checks the column index of m against the columns extracted from its rows.
+static void checkColumnIndex(const SBM &m)
+{
+    ASSERT_TRUE(m.hasColumnIndex());
+    for (UInt32 col = 0; col != m.nCols(); ++col)
+    {
+        std::vector<UInt32> dense(m.nRows());
+        m.getColToDense(col, dense.begin(), dense.end());
+        std::vector<UInt32> expected;
+        for (UInt32 row = 0; row != m.nRows(); ++row)
+        {
+            if (dense[row])
+            {
+                expected.push_back(row);
+            }
+        }
+        ASSERT_EQ(expected, m.getSparseCol(col)) << "col " << col;
+    }
+}
+
+TEST(SparseBinaryMatrixTest, columnIndex)
+{
+    const UInt32 nrows = 20;
+    const UInt32 ncols = 30;
+    Random rng(7);
+
+    SBM m(nrows, ncols);
+    m.enableColumnIndex();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    for (UInt32 iter = 0; iter != 200; ++iter)
+    {
+        UInt32 row = rng.getUInt32(nrows);
+        std::vector<UInt32> dense(ncols, 0);
+        for (UInt32 col = 0; col != ncols; ++col)
+        {
+            dense[col] = rng.getReal64() < 0.3 ? 1 : 0;
+        }
+
+        switch (iter % 3)
+        {
+        case 0:
+        {
+            std::vector<UInt32> sparse;
+            for (UInt32 col = 0; col != ncols; ++col)
+            {
+                if (dense[col])
+                {
+                    sparse.push_back(col);
+                }
+            }
+            m.replaceSparseRow(row, sparse.begin(), sparse.end());
+            break;
+        }
+        case 1:
+            m.rowFromDense(row, dense.begin(), dense.end());
+            break;
+        default:
+            m.set(row, rng.getUInt32(ncols), dense[0]);
+            break;
+        }
+        ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    }
+
+    std::vector<UInt32> dense(ncols, 1);
+    m.appendDenseRow(dense.begin(), dense.end());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    std::vector<UInt32> rows = {0, 3, 20};
+    m.appendSparseCol(rows.begin(), rows.end());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    SBM copy(m);
+    copy.logicalNot();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(copy));
+    copy.logicalOr(m);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(copy));
+
+    m.transpose();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    m.resize(10, 12);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    m.disableColumnIndex();
+    ASSERT_FALSE(m.hasColumnIndex());
+}
+
+TEST(SparseBinaryMatrixTest, columnIndexMutators)
+{
+    SBM m(3, 8);
+    m.enableColumnIndex();
+
+    m.setRangeToOne(1, 0, 8);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.setRangeToZero(1, 2, 5);
+    EXPECT_EQ(5u, m.nNonZerosOnRow(1));
+    EXPECT_TRUE(m.getSparseCol(3).empty());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    std::vector<UInt32> cols = {1, 4, 6};
+    m.set(0, cols.begin(), cols.end(), 1);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.setForAllRows(cols.begin(), cols.begin() + 2, 0);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    m.appendSparseRow(cols.begin(), cols.end());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.appendEmptyCols(2);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.set(3, 9, 1);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    SBM other(m.nRows(), m.nCols());
+    other.setRangeToOne(0, 0, 5);
+    other.setRangeToOne(3, 5, 10);
+    SBM copy(m);
+    copy.logicalAnd(other);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(copy));
+    copy = m;
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(copy));
+    SBM slice(2, 3);
+    slice.setRangeToOne(0, 0, 3);
+    copy.setSlice(1, 2, slice);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(copy));
+    copy.compact();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(copy));
+
+    std::vector<UInt32> dense(4 * 5, 0);
+    for (UInt32 k = 6; k != 14; ++k)
+    {
+        dense[k] = 1;
+    }
+    m.fromDense(4, 5, dense.begin(), dense.end());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.inside();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.fromDense(4, 5, dense.begin(), dense.end());
+    m.edges();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    std::vector<UInt32> nz = {1, 7, 8, 15};
+    m.fromSparseVector(3, 6, nz.begin(), nz.end());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    std::vector<UInt32> nzi = {0, 2, 2};
+    std::vector<UInt32> nzj = {3, 0, 4};
+    m.setAllNonZeros(3, 5, nzi.begin(), nzi.end(), nzj.begin(), nzj.end());
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    std::stringstream buffer;
+    copy.toBinary(buffer);
+    m.fromBinary(buffer);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+
+    m.clear();
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+    m.resize(2, 3);
+    m.set(1, 2, 1);
+    ASSERT_NO_FATAL_FAILURE(checkColumnIndex(m));
+}
+
+} // namespace crucian
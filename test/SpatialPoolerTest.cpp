@@ -24,16 +24,44 @@
  * Implementation of unit tests for SpatialPooler
  */
 
+#include <atomic>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <gtest/gtest.h>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include <utility>
 
 #include <crucian/Log.hpp>
 #include <crucian/SpatialPooler.hpp>
 #include <crucian/StlIo.hpp>
+#include <crucian/Topology.hpp>
 #include <crucian/Types.hpp>
 
+// Counts the heap allocations made by the whole test program, see
+// testComputeDoesNotAllocate.
+static std::atomic<unsigned long> numAllocations(0);
+
+void *operator new(std::size_t size)
+{
+    ++numAllocations;
+    if (void *p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
 namespace crucian
 {
 
@@ -343,6 +371,48 @@ TEST(SpatialPoolerTest, testUpdateInhibitionRadius)
     ASSERT_TRUE(trueInhibitionRadius == sp.getInhibitionRadius());
 }
 
+TEST(SpatialPoolerTest, testInhibitionRadiusFollowsLearning)
+{
+    // The connected spans are kept up to date as learning connects and
+    // disconnects synapses, and give the same radius as recomputing them.
+    const std::vector<std::vector<UInt>> inputDims = {{12, 12}, {6, 5, 4}};
+    const std::vector<std::vector<UInt>> columnDims = {{8, 8}, {4, 4, 2}};
+    for (size_t c = 0; c < inputDims.size(); c++)
+    {
+        SpatialPooler sp(inputDims[c], columnDims[c], /*potentialRadius*/ 3,
+                         /*potentialPct*/ 0.5, /*globalInhibition*/ false,
+                         /*localAreaDensity*/ -1.0,
+                         /*numActiveColumnsPerInhArea*/ 5,
+                         /*stimulusThreshold*/ 1, /*synPermInactiveDec*/ 0.06,
+                         /*synPermActiveInc*/ 0.05);
+
+        Random rng(11);
+        std::vector<UInt> input(sp.getNumInputs());
+        std::vector<UInt> active(sp.getNumColumns());
+        for (UInt iter = 0; iter < 60; iter++)
+        {
+            for (auto &bit : input)
+            {
+                bit = rng.getReal64() < 0.2 ? 1 : 0;
+            }
+            sp.compute(input.data(), true, active.data());
+
+            Real span = 0;
+            for (UInt i = 0; i < sp.getNumColumns(); i++)
+            {
+                span += sp.avgConnectedSpanForColumnND_(i);
+            }
+            span /= sp.getNumColumns();
+            const Real radius = std::max(
+                (Real)1.0, (span * sp.avgColumnsPerInput_() - 1) / 2);
+
+            sp.updateInhibitionRadius_();
+            ASSERT_EQ(UInt(std::round(radius)), sp.getInhibitionRadius())
+                << "dimensions " << inputDims[c].size();
+        }
+    }
+}
+
 TEST(SpatialPoolerTest, testUpdateMinDutyCycles)
 {
     SpatialPooler sp;
@@ -553,9 +623,10 @@ TEST(SpatialPoolerTest, testUpdateDutyCycles)
     Real overlapNewVal1[] = {1, 5, 7, 0, 0};
     overlaps.assign(overlapNewVal1, overlapNewVal1 + numColumns);
     UInt active[] = {0, 0, 0, 0, 0};
+    std::vector<Real> overlapPct;
 
     sp.setIterationNum(2);
-    sp.updateDutyCycles_(overlaps, active);
+    sp.updateColumnStatistics_(overlaps, active, true, overlapPct);
 
     Real resultOverlapArr1[5];
     sp.getOverlapDutyCycles(resultOverlapArr1);
@@ -567,7 +638,7 @@ TEST(SpatialPoolerTest, testUpdateDutyCycles)
     sp.setOverlapDutyCycles(initOverlapArr1);
     sp.setIterationNum(2000);
     sp.setUpdatePeriod(1000);
-    sp.updateDutyCycles_(overlaps, active);
+    sp.updateColumnStatistics_(overlaps, active, true, overlapPct);
 
     Real resultOverlapArr2[5];
     sp.getOverlapDutyCycles(resultOverlapArr2);
@@ -1032,7 +1103,7 @@ TEST(SpatialPoolerTest, testUpdateBoostFactors)
     sp.setBoostStrength(10);
     sp.setBoostFactors(initBoostFactors1);
     sp.setActiveDutyCycles(initActiveDutyCycles1);
-    sp.updateBoostFactors_();
+    sp.updateBoostFactorsLocal_();
     sp.getBoostFactors(resultBoostFactors1.data());
     ASSERT_TRUE(check_vector_eq(trueBoostFactors1, resultBoostFactors1));
 
@@ -1045,7 +1116,7 @@ TEST(SpatialPoolerTest, testUpdateBoostFactors)
     sp.setBoostStrength(10);
     sp.setBoostFactors(initBoostFactors2);
     sp.setActiveDutyCycles(initActiveDutyCycles2);
-    sp.updateBoostFactors_();
+    sp.updateBoostFactorsLocal_();
     sp.getBoostFactors(resultBoostFactors2.data());
 
     ASSERT_TRUE(check_vector_eq(trueBoostFactors2, resultBoostFactors2));
@@ -1062,26 +1133,237 @@ TEST(SpatialPoolerTest, testUpdateBoostFactors)
     sp.setNumActiveColumnsPerInhArea(1);
     sp.setBoostFactors(initBoostFactors3);
     sp.setActiveDutyCycles(initActiveDutyCycles3);
-    sp.updateBoostFactors_();
+    sp.updateBoostFactorsLocal_();
     sp.getBoostFactors(resultBoostFactors3.data());
 
     ASSERT_TRUE(check_vector_eq(trueBoostFactors3, resultBoostFactors3));
 
+    // With global inhibition, the boost factors are updated along with the
+    // duty cycles, towards a density of 1 / 6. A period of 1 sets the active
+    // duty cycles to the activity of the step.
     Real initActiveDutyCycles4[] = {0.1, 0.3, 0.02, 0.04, 0.7, 0.12};
     Real initBoostFactors4[] = {0, 0, 0, 0, 0, 0};
-    std::vector<Real> trueBoostFactors4 = {1.94773, 0.263597,   4.33476,
-                                           3.549,   0.00482795, 1.59467};
+    std::vector<UInt> overlaps4(6, 0);
+    UInt active4[] = {1, 0, 0, 0, 0, 0};
+    std::vector<Real> trueBoostFactors4 = {0.000240369, 5.29449, 5.29449,
+                                           5.29449,     5.29449, 5.29449};
     std::vector<Real> resultBoostFactors4(6, 0);
+    std::vector<Real> overlapPct4;
     sp.setGlobalInhibition(true);
     sp.setBoostStrength(10);
     sp.setNumActiveColumnsPerInhArea(1);
     sp.setInhibitionRadius(3);
     sp.setBoostFactors(initBoostFactors4);
     sp.setActiveDutyCycles(initActiveDutyCycles4);
-    sp.updateBoostFactors_();
+    sp.setIterationNum(1);
+    sp.updateColumnStatistics_(overlaps4, active4, true, overlapPct4);
     sp.getBoostFactors(resultBoostFactors4.data());
 
-    ASSERT_TRUE(check_vector_eq(trueBoostFactors3, resultBoostFactors3));
+    ASSERT_TRUE(check_vector_eq(trueBoostFactors4, resultBoostFactors4));
+}
+
+TEST(SpatialPoolerTest, testUpdateColumnStatistics)
+{
+    // The vectorized pass must match a per-column computation exactly,
+    // including for the columns left over by the vector loops.
+    const UInt numColumns = 37;
+    for (bool globalInhibition : {true, false})
+    {
+        SpatialPooler sp({50}, {numColumns}, 16, 0.5, globalInhibition, -1.0,
+                         5);
+        sp.setBoostStrength(3);
+        Random rng(42);
+        std::vector<Real> dutyCycles(numColumns);
+        for (auto &dutyCycle : dutyCycles)
+        {
+            dutyCycle = (Real)rng.getReal64();
+        }
+        sp.setOverlapDutyCycles(dutyCycles.data());
+        sp.setActiveDutyCycles(dutyCycles.data());
+        sp.setIterationNum(20);
+
+        std::vector<UInt> overlaps(numColumns), active(numColumns);
+        for (UInt i = 0; i < numColumns; i++)
+        {
+            overlaps[i] = rng.getUInt32(2) ? rng.getUInt32(20) : 0;
+            active[i] = rng.getUInt32(4) == 0 ? 1 : 0;
+        }
+
+        for (bool learn : {false, true})
+        {
+            SpatialPooler spUpdated = sp;
+            std::vector<Real> pct;
+            spUpdated.updateColumnStatistics_(overlaps, active.data(), learn,
+                                              pct);
+
+            std::vector<Real> truePct(numColumns);
+            sp.calculateOverlapPct_(overlaps, truePct);
+            ASSERT_EQ(truePct, pct);
+
+            std::vector<Real> trueOverlapDutyCycles = dutyCycles;
+            std::vector<Real> trueActiveDutyCycles = dutyCycles;
+            std::vector<Real> trueBoostFactors(numColumns);
+            sp.getBoostFactors(trueBoostFactors.data());
+            if (learn)
+            {
+                std::vector<UInt> overlapValues(numColumns);
+                for (UInt i = 0; i < numColumns; i++)
+                {
+                    overlapValues[i] = overlaps[i] > 0 ? 1 : 0;
+                }
+                SpatialPooler::updateDutyCyclesHelper_(trueOverlapDutyCycles,
+                                                       overlapValues, 20);
+                SpatialPooler::updateDutyCyclesHelper_(trueActiveDutyCycles,
+                                                       active, 20);
+                if (globalInhibition)
+                {
+                    const Real density = sp.inhibitionDensity_();
+                    for (UInt i = 0; i < numColumns; i++)
+                    {
+                        trueBoostFactors[i] = std::exp(
+                            (density - trueActiveDutyCycles[i]) *
+                            sp.getBoostStrength());
+                    }
+                }
+            }
+
+            std::vector<Real> result(numColumns);
+            spUpdated.getOverlapDutyCycles(result.data());
+            ASSERT_EQ(trueOverlapDutyCycles, result);
+            spUpdated.getActiveDutyCycles(result.data());
+            ASSERT_EQ(trueActiveDutyCycles, result);
+            spUpdated.getBoostFactors(result.data());
+            ASSERT_EQ(trueBoostFactors, result);
+        }
+    }
+}
+
+TEST(SpatialPoolerTest, testApproximateBoost)
+{
+    // The approximate boost factors stay close to exp, and every column
+    // gets the same one whichever loop computes it.
+    const UInt numColumns = 37;
+    SpatialPooler sp({50}, {numColumns}, 16, 0.5, true, -1.0, 5);
+    sp.setBoostStrength(10);
+    sp.setApproximateBoost(true);
+    ASSERT_TRUE(sp.getApproximateBoost());
+    sp.setIterationNum(1);
+
+    std::vector<UInt> overlaps(numColumns, 0);
+    std::vector<UInt> active(numColumns, 0);
+    std::vector<Real> pct;
+    std::vector<Real> boostFactors(numColumns);
+    std::vector<Real> dutyCycles(numColumns);
+    const Real density = sp.inhibitionDensity_();
+    Random rng(7);
+    for (UInt iter = 0; iter < 20; iter++)
+    {
+        for (auto &value : active)
+        {
+            value = rng.getUInt32(2);
+        }
+        sp.setIterationNum(1 + iter);
+        sp.updateColumnStatistics_(overlaps, active.data(), true, pct);
+        sp.getActiveDutyCycles(dutyCycles.data());
+        sp.getBoostFactors(boostFactors.data());
+        for (UInt i = 0; i < numColumns; i++)
+        {
+            const Real exact =
+                std::exp((density - dutyCycles[i]) * sp.getBoostStrength());
+            ASSERT_NEAR(exact, boostFactors[i], 1e-6 * exact);
+            for (UInt j = 0; j < numColumns; j++)
+            {
+                if (dutyCycles[j] == dutyCycles[i])
+                {
+                    ASSERT_EQ(boostFactors[i], boostFactors[j]);
+                }
+            }
+        }
+    }
+}
+
+TEST(SpatialPoolerTest, testLocalWindowFilters)
+{
+    // The window sums and maxima must match a direct scan of every
+    // neighborhood, with and without wrap-around, for radii smaller than,
+    // equal to and larger than the topology.
+    const std::vector<std::vector<UInt>> topologies = {
+        {1}, {7}, {30}, {1, 9}, {6, 1}, {5, 8}, {12, 11}};
+    Random rng(11);
+    for (const auto &dimensions : topologies)
+    {
+        UInt numColumns = 1;
+        for (UInt d : dimensions)
+        {
+            numColumns *= d;
+        }
+
+        for (bool wrapAround : {false, true})
+        {
+            for (UInt radius : {0, 1, 2, 3, 5, 14})
+            {
+                SpatialPooler sp(dimensions, dimensions, radius, 0.5, false);
+                sp.setWrapAround(wrapAround);
+                sp.setInhibitionRadius(radius);
+                sp.setMinPctOverlapDutyCycles(0.25);
+                sp.setBoostStrength(3);
+
+                std::vector<Real> overlapDutyCycles(numColumns);
+                std::vector<Real> activeDutyCycles(numColumns);
+                for (UInt i = 0; i < numColumns; i++)
+                {
+                    overlapDutyCycles[i] = (Real)rng.getReal64();
+                    activeDutyCycles[i] = (Real)rng.getReal64();
+                }
+                sp.setOverlapDutyCycles(overlapDutyCycles.data());
+                sp.setActiveDutyCycles(activeDutyCycles.data());
+                sp.updateMinDutyCyclesLocal_();
+                sp.updateBoostFactorsLocal_();
+
+                std::vector<Real> minDutyCycles(numColumns);
+                std::vector<Real> boostFactors(numColumns);
+                sp.getMinOverlapDutyCycles(minDutyCycles.data());
+                sp.getBoostFactors(boostFactors.data());
+
+                for (UInt i = 0; i < numColumns; i++)
+                {
+                    std::vector<UInt> neighbors;
+                    if (wrapAround)
+                    {
+                        for (UInt neighbor :
+                             WrappingNeighborhood(i, radius, dimensions))
+                        {
+                            neighbors.push_back(neighbor);
+                        }
+                    }
+                    else
+                    {
+                        for (UInt neighbor :
+                             Neighborhood(i, radius, dimensions))
+                        {
+                            neighbors.push_back(neighbor);
+                        }
+                    }
+
+                    Real maxDuty = 0;
+                    Real64 sum = 0;
+                    for (UInt neighbor : neighbors)
+                    {
+                        maxDuty =
+                            std::max(maxDuty, overlapDutyCycles[neighbor]);
+                        sum += activeDutyCycles[neighbor];
+                    }
+                    Real targetDensity = (Real)(sum / neighbors.size());
+
+                    ASSERT_EQ(maxDuty * 0.25f, minDutyCycles[i])
+                        << "column " << i << " radius " << radius;
+                    ASSERT_NEAR(exp((targetDensity - activeDutyCycles[i]) * 3),
+                                boostFactors[i], 1e-5)
+                        << "column " << i << " radius " << radius;
+                }
+            }
+        }
+    }
 }
 
 TEST(SpatialPoolerTest, testUpdateBookeepingVars)
@@ -1138,6 +1420,53 @@ TEST(SpatialPoolerTest, testCalculateOverlap)
     }
 }
 
+TEST(SpatialPoolerTest, testCalculateOverlapSparse)
+{
+    SpatialPooler sp;
+    UInt numInputs = 10;
+    UInt numColumns = 5;
+    setup(sp, numInputs, numColumns);
+    sp.setStimulusThreshold(0);
+
+    Real permArr[5][10] = {{1, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+                           {0, 0, 1, 1, 1, 1, 1, 1, 1, 1},
+                           {0, 0, 0, 0, 1, 1, 1, 1, 1, 1},
+                           {0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
+                           {0, 0, 0, 0, 0, 0, 0, 0, 1, 1}};
+
+    std::vector<std::vector<UInt>> inputs = {{},
+                                             {0, 1, 2, 3, 4, 5, 6, 7, 8, 9},
+                                             {1, 3, 5, 7, 9},
+                                             {0, 1, 2, 3, 4},
+                                             {9}};
+
+    UInt trueOverlaps[5][5] = {{0, 0, 0, 0, 0},
+                               {10, 8, 6, 4, 2},
+                               {5, 4, 3, 2, 1},
+                               {5, 3, 1, 0, 0},
+                               {1, 1, 1, 1, 1}};
+
+    for (UInt i = 0; i < numColumns; i++)
+    {
+        sp.setPermanence(i, permArr[i]);
+    }
+
+    for (UInt i = 0; i < inputs.size(); i++)
+    {
+        std::vector<UInt> overlaps;
+        sp.calculateOverlapSparse_(inputs[i], overlaps);
+        ASSERT_TRUE(check_vector_eq(trueOverlaps[i], overlaps));
+    }
+
+    // The inverted index must follow changes to the connected synapses.
+    Real perm0[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    sp.setPermanence(0, perm0);
+    std::vector<UInt> overlaps;
+    sp.calculateOverlapSparse_(inputs[1], overlaps);
+    UInt trueOverlaps2[5] = {1, 8, 6, 4, 2};
+    ASSERT_TRUE(check_vector_eq(trueOverlaps2, overlaps));
+}
+
 TEST(SpatialPoolerTest, testCalculateOverlapPct)
 {
     SpatialPooler sp;
@@ -1434,6 +1763,71 @@ TEST(SpatialPoolerTest, testInhibitColumnsGlobal)
     ASSERT_TRUE(check_vector_eq(trueActive, active));
 }
 
+TEST(SpatialPoolerTest, testInhibitColumnsGlobalTopK)
+{
+    // The radix top-k selection must give the same winners, in the same
+    // order, as the isWinner_/addToWinners_ insertion.
+    const UInt numColumns = 500;
+    SpatialPooler sp;
+    setup(sp, 10, numColumns);
+    Random rng(42);
+
+    for (UInt iter = 0; iter < 50; iter++)
+    {
+        sp.setStimulusThreshold(iter % 3);
+        const Real density = (Real)(1 + rng.getUInt32(100)) / numColumns;
+        const UInt numDesired = (UInt)(density * numColumns);
+
+        // Few distinct values so that there are many ties, plus a few
+        // fractional ones like boosted overlaps.
+        std::vector<Real> overlaps(numColumns);
+        for (UInt i = 0; i < numColumns; i++)
+        {
+            overlaps[i] = (Real)rng.getUInt32(iter % 2 ? 8 : 40);
+            if (rng.getUInt32(10) == 0)
+            {
+                overlaps[i] *= 1.5f;
+            }
+        }
+
+        std::vector<std::pair<UInt, Real>> winners;
+        for (UInt i = 0; i < numColumns; i++)
+        {
+            if (sp.isWinner_(overlaps[i], winners, numDesired))
+            {
+                sp.addToWinners_(i, overlaps[i], winners);
+            }
+        }
+        std::vector<UInt> expected;
+        for (UInt i = 0; i < std::min(numDesired, (UInt)winners.size()); i++)
+        {
+            expected.push_back(winners[i].first);
+        }
+
+        std::vector<UInt> activeColumns;
+        sp.inhibitColumnsGlobal_(overlaps, density, activeColumns);
+        ASSERT_EQ(expected, activeColumns) << "iteration " << iter;
+
+        // Lower index first on ties, as a stable sort.
+        std::vector<UInt> sorted(numColumns);
+        for (UInt i = 0; i < numColumns; i++)
+        {
+            sorted[i] = i;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [&](UInt a, UInt b) {
+            return overlaps[a] > overlaps[b];
+        });
+        sorted.resize(numDesired);
+
+        TopKSelector selector;
+        std::vector<UInt> selected(numDesired);
+        ASSERT_EQ(numDesired,
+                  selector.select(numDesired, overlaps.begin(), overlaps.end(),
+                                  selected.begin()));
+        ASSERT_EQ(sorted, selected) << "iteration " << iter;
+    }
+}
+
 TEST(SpatialPoolerTest, testValidateGlobalInhibitionParameters)
 {
     // With 10 columns the minimum sparsity for global inhibition is 10%
@@ -1580,6 +1974,51 @@ TEST(SpatialPoolerTest, testInhibitColumnsLocal)
     }
 }
 
+TEST(SpatialPoolerTest, testInhibitColumnsLocalSweep)
+{
+    // The sweep engine must select exactly the same columns as the window
+    // engine, including the tie-breaking between equal overlaps.
+    Random rng(42);
+    const std::vector<std::vector<UInt>> topologies = {
+        {1}, {37}, {200}, {1, 30}, {12, 17}, {32, 32}, {5, 64}};
+
+    for (const auto &columnDimensions : topologies)
+    {
+        for (bool wrapAround : {false, true})
+        {
+            SpatialPooler sp(columnDimensions, columnDimensions, 16, 0.5,
+                             false, 0.1, -1, 1, 0.008, 0.05, 0.1, 0.001, 1000,
+                             10.0, 1, 0, wrapAround);
+            const UInt numColumns = sp.getNumColumns();
+
+            for (UInt inhibitionRadius : {0, 1, 2, 5, 11, 40})
+            {
+                sp.setInhibitionRadius(inhibitionRadius);
+                for (UInt iter = 0; iter < 5; iter++)
+                {
+                    const Real density = 0.02f + 0.1f * iter;
+                    std::vector<Real> overlaps(numColumns);
+                    for (UInt i = 0; i < numColumns; i++)
+                    {
+                        overlaps[i] = (Real)rng.getUInt32(iter % 2 ? 4 : 20);
+                        if (rng.getUInt32(8) == 0)
+                        {
+                            overlaps[i] += 0.5f;
+                        }
+                    }
+
+                    std::vector<UInt> expected, active;
+                    sp.inhibitColumnsLocalWindow_(overlaps, density, expected);
+                    sp.inhibitColumnsLocalSweep_(overlaps, density, active);
+                    ASSERT_EQ(expected, active)
+                        << "wrapAround " << wrapAround << " radius "
+                        << inhibitionRadius << " iteration " << iter;
+                }
+            }
+        }
+    }
+}
+
 TEST(SpatialPoolerTest, testIsUpdateRound)
 {
     SpatialPooler sp;
@@ -1721,6 +2160,104 @@ TEST(SpatialPoolerTest, testUpdatePermanencesForColumn)
     }
 }
 
+TEST(SpatialPoolerTest, testSparsePermanenceUpdates)
+{
+    // adaptSynapses_ and bumpUpWeakColumns_ update the permanences in place.
+    // Check that they give bit-identical results to the dense update.
+    const UInt numInputs = 100;
+    const UInt numColumns = 20;
+    SpatialPooler sp({numInputs}, {numColumns}, 16, 0.5, true, -1.0, 5, 3);
+    SpatialPooler spDense = sp;
+    Random rng(42);
+
+    // Permanences outside the potential pool, as setPermanence allows.
+    std::vector<Real> outside(numInputs, 0);
+    outside[0] = 0.3f;
+    outside[numInputs - 1] = 0.05f;
+    sp.setPermanence(0, outside.data());
+    spDense.setPermanence(0, outside.data());
+
+    std::vector<Real> perm(numInputs);
+    std::vector<UInt> potential(numInputs);
+    for (UInt iter = 0; iter < 50; iter++)
+    {
+        std::vector<UInt> input(numInputs);
+        for (UInt i = 0; i < numInputs; i++)
+        {
+            input[i] = rng.getUInt32(3) == 0 ? 1 : 0;
+        }
+        std::vector<UInt> activeColumns;
+        for (UInt column = 0; column < numColumns; column++)
+        {
+            if (rng.getUInt32(2) == 0)
+            {
+                activeColumns.push_back(column);
+            }
+        }
+
+        sp.adaptSynapses_(input.data(), activeColumns);
+        for (UInt column : activeColumns)
+        {
+            spDense.getPermanence(column, perm.data());
+            spDense.getPotential(column, potential.data());
+            for (UInt i = 0; i < numInputs; i++)
+            {
+                if (potential[i])
+                {
+                    perm[i] += input[i] > 0 ? spDense.getSynPermActiveInc()
+                                            : -spDense.getSynPermInactiveDec();
+                }
+            }
+            spDense.updatePermanencesForColumn_(perm, column, true);
+        }
+
+        if (iter % 5 == 0)
+        {
+            std::vector<Real> overlapDutyCycles(numColumns, 0);
+            std::vector<Real> minOverlapDutyCycles(numColumns, 0);
+            for (UInt column = 0; column < numColumns; column += 3)
+            {
+                minOverlapDutyCycles[column] = 1;
+            }
+            sp.setOverlapDutyCycles(overlapDutyCycles.data());
+            sp.setMinOverlapDutyCycles(minOverlapDutyCycles.data());
+            sp.bumpUpWeakColumns_();
+            for (UInt column = 0; column < numColumns; column += 3)
+            {
+                spDense.getPermanence(column, perm.data());
+                spDense.getPotential(column, potential.data());
+                for (UInt i = 0; i < numInputs; i++)
+                {
+                    if (potential[i])
+                    {
+                        perm[i] += spDense.getSynPermBelowStimulusInc();
+                    }
+                }
+                spDense.updatePermanencesForColumn_(perm, column, false);
+            }
+        }
+
+        for (UInt column = 0; column < numColumns; column++)
+        {
+            std::vector<Real> permDense(numInputs), permSparse(numInputs);
+            spDense.getPermanence(column, permDense.data());
+            sp.getPermanence(column, permSparse.data());
+            ASSERT_EQ(permDense, permSparse) << "column " << column;
+
+            std::vector<UInt> connectedDense(numInputs);
+            std::vector<UInt> connectedSparse(numInputs);
+            spDense.getConnectedSynapses(column, connectedDense.data());
+            sp.getConnectedSynapses(column, connectedSparse.data());
+            ASSERT_EQ(connectedDense, connectedSparse) << "column " << column;
+        }
+
+        std::vector<UInt> countsDense(numColumns), countsSparse(numColumns);
+        spDense.getConnectedCounts(countsDense.data());
+        sp.getConnectedCounts(countsSparse.data());
+        ASSERT_EQ(countsDense, countsSparse);
+    }
+}
+
 TEST(SpatialPoolerTest, testInitPermanence)
 {
     std::vector<UInt> inputDim;
@@ -1964,6 +2501,91 @@ TEST(SpatialPoolerTest, testMapPotential2D)
     ASSERT_TRUE(check_vector_eq(expectedMask4, mask));
 }
 
+TEST(SpatialPoolerTest, testInitializeIsIndependentOfThreads)
+{
+    struct Config
+    {
+        std::vector<UInt> inputDimensions;
+        std::vector<UInt> columnDimensions;
+        UInt potentialRadius;
+        bool wrapAround;
+    };
+    std::vector<Config> configs = {{{300}, {200}, 12, true},
+                                   {{300}, {200}, 300, false},
+                                   {{16, 20}, {12, 10}, 3, false},
+                                   {{16, 20}, {12, 10}, 3, true}};
+
+    for (auto &config : configs)
+    {
+        std::vector<std::unique_ptr<SpatialPooler>> sps;
+        for (UInt numThreads : {1, 4})
+        {
+            sps.emplace_back(new SpatialPooler(
+                config.inputDimensions, config.columnDimensions,
+                config.potentialRadius,
+                /*potentialPct*/ 0.5,
+                /*globalInhibition*/ true,
+                /*localAreaDensity*/ -1.0,
+                /*numActiveColumnsPerInhArea*/ 10,
+                /*stimulusThreshold*/ 2,
+                /*synPermInactiveDec*/ 0.008,
+                /*synPermActiveInc*/ 0.05,
+                /*synPermConnected*/ 0.1,
+                /*minPctOverlapDutyCycles*/ 0.001,
+                /*dutyCyclePeriod*/ 1000,
+                /*boostStrength*/ 0.0,
+                /*seed*/ 7,
+                /*spVerbosity*/ 0,
+                /*wrapAround*/ config.wrapAround,
+                /*numThreads*/ numThreads));
+        }
+        SpatialPooler &sp = *sps[0];
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, *sps[1]));
+
+        // Every column has a pool of the expected size within its
+        // neighborhood, and enough connected synapses.
+        const UInt numInputs = sp.getNumInputs();
+        std::vector<UInt> potential(numInputs);
+        std::vector<UInt> connected(numInputs);
+        for (UInt column = 0; column < sp.getNumColumns(); column++)
+        {
+            const UInt center = sp.mapColumn_(column);
+            std::vector<UInt> neighborhood;
+            if (config.wrapAround)
+            {
+                for (UInt input :
+                     WrappingNeighborhood(center, config.potentialRadius,
+                                          config.inputDimensions))
+                {
+                    neighborhood.push_back(input);
+                }
+            }
+            else
+            {
+                for (UInt input : Neighborhood(center, config.potentialRadius,
+                                               config.inputDimensions))
+                {
+                    neighborhood.push_back(input);
+                }
+            }
+
+            sp.getPotential(column, potential.data());
+            UInt numPotential = 0;
+            for (UInt input : neighborhood)
+            {
+                numPotential += potential[input];
+            }
+            ASSERT_EQ((UInt)round(neighborhood.size() * 0.5), numPotential);
+            ASSERT_EQ(numPotential, std::accumulate(potential.begin(),
+                                                    potential.end(), 0u));
+
+            sp.getConnectedSynapses(column, connected.data());
+            ASSERT_LE(2u, std::accumulate(connected.begin(), connected.end(),
+                                          0u));
+        }
+    }
+}
+
 TEST(SpatialPoolerTest, testStripUnlearnedColumns)
 {
     SpatialPooler sp;
@@ -2175,6 +2797,677 @@ TEST(SpatialPoolerTest, ZeroOverlap_StimulusThreshold_LocalInhibition)
     EXPECT_EQ(0, countNonzero(activeColumns));
 }
 
+TEST(SpatialPoolerTest, testSparseCompute)
+{
+    const UInt inputSize = 200;
+    const UInt nColumns = 100;
+
+    for (bool globalInhibition : {true, false})
+    {
+        SpatialPooler sp1({inputSize}, {nColumns},
+                          /*potentialRadius*/ 20,
+                          /*potentialPct*/ 0.5,
+                          /*globalInhibition*/ globalInhibition,
+                          /*localAreaDensity*/ -1.0,
+                          /*numActiveColumnsPerInhArea*/ 5,
+                          /*stimulusThreshold*/ 1,
+                          /*synPermInactiveDec*/ 0.008,
+                          /*synPermActiveInc*/ 0.05,
+                          /*synPermConnected*/ 0.1,
+                          /*minPctOverlapDutyCycles*/ 0.001,
+                          /*dutyCyclePeriod*/ 1000,
+                          /*boostStrength*/ 10.0,
+                          /*seed*/ 1,
+                          /*spVerbosity*/ 0,
+                          /*wrapAround*/ true);
+        SpatialPooler sp2 = sp1;
+
+        Random rng(42);
+        for (UInt i = 0; i < 120; i++)
+        {
+            std::vector<UInt> input(inputSize, 0);
+            std::vector<UInt> activeInputs;
+            for (UInt j = 0; j < inputSize; j++)
+            {
+                if (rng.getReal64() < 0.05)
+                {
+                    input[j] = 1;
+                    activeInputs.push_back(j);
+                }
+            }
+
+            bool learn = i % 3 != 2;
+            std::vector<UInt> activeArray(nColumns, 0);
+            sp1.compute(input.data(), learn, activeArray.data());
+
+            std::vector<UInt> activeColumns;
+            sp2.compute(activeInputs, learn, activeColumns);
+
+            std::vector<UInt> expected;
+            for (UInt j = 0; j < nColumns; j++)
+            {
+                if (activeArray[j] > 0)
+                {
+                    expected.push_back(j);
+                }
+            }
+            ASSERT_EQ(expected, activeColumns);
+            ASSERT_EQ(sp1.getOverlaps(), sp2.getOverlaps());
+        }
+
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
+    }
+}
+
+TEST(SpatialPoolerTest, testMultithreadedCompute)
+{
+    struct Config
+    {
+        std::vector<UInt> inputDimensions;
+        std::vector<UInt> columnDimensions;
+        bool globalInhibition;
+        bool wrapAround;
+        Real minPctOverlapDutyCycles;
+        UInt permanenceBits;
+    };
+    // The last two learn with weak columns, which are bumped, and with
+    // fixed-point permanences.
+    std::vector<Config> configs = {{{200}, {150}, true, true, 0.001, 0},
+                                   {{200}, {150}, false, true, 0.001, 0},
+                                   {{200}, {150}, false, false, 0.001, 0},
+                                   {{16, 16}, {12, 12}, false, true, 0.001, 0},
+                                   {{200}, {150}, true, true, 0.5, 0},
+                                   {{16, 16}, {12, 12}, false, true, 0.5, 8}};
+
+    for (auto &config : configs)
+    {
+        SpatialPooler sp1(config.inputDimensions, config.columnDimensions,
+                          /*potentialRadius*/ 10,
+                          /*potentialPct*/ 0.5,
+                          /*globalInhibition*/ config.globalInhibition,
+                          /*localAreaDensity*/ -1.0,
+                          /*numActiveColumnsPerInhArea*/ 5,
+                          /*stimulusThreshold*/ 1,
+                          /*synPermInactiveDec*/ 0.008,
+                          /*synPermActiveInc*/ 0.05,
+                          /*synPermConnected*/ 0.1,
+                          config.minPctOverlapDutyCycles,
+                          /*dutyCyclePeriod*/ 1000,
+                          /*boostStrength*/ 10.0,
+                          /*seed*/ 1,
+                          /*spVerbosity*/ 0,
+                          /*wrapAround*/ config.wrapAround,
+                          /*numThreads*/ 1);
+        if (config.permanenceBits > 0)
+        {
+            sp1.setPermanenceBits(config.permanenceBits);
+        }
+        SpatialPooler sp2 = sp1;
+        sp2.setNumThreads(4);
+        ASSERT_EQ(1u, sp1.getNumThreads());
+        ASSERT_EQ(4u, sp2.getNumThreads());
+
+        const UInt numInputs = sp1.getNumInputs();
+        const UInt numColumns = sp1.getNumColumns();
+        Random rng(42);
+        for (UInt i = 0; i < 120; i++)
+        {
+            std::vector<UInt> input(numInputs, 0);
+            for (UInt j = 0; j < numInputs; j++)
+            {
+                input[j] = rng.getReal64() < 0.1 ? 1 : 0;
+            }
+
+            std::vector<UInt> active1(numColumns, 0);
+            std::vector<UInt> active2(numColumns, 0);
+            sp1.compute(input.data(), true, active1.data());
+            sp2.compute(input.data(), true, active2.data());
+            ASSERT_EQ(active1, active2);
+        }
+
+        std::vector<Real> boost1(numColumns), boost2(numColumns);
+        sp1.getBoostFactors(boost1.data());
+        sp2.getBoostFactors(boost2.data());
+        ASSERT_EQ(boost1, boost2);
+        ASSERT_EQ(sp1.getInhibitionRadius(), sp2.getInhibitionRadius());
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
+    }
+}
+
+TEST(SpatialPoolerTest, testConcurrentInference)
+{
+    struct Config
+    {
+        std::vector<UInt> inputDimensions;
+        std::vector<UInt> columnDimensions;
+        bool globalInhibition;
+        UInt potentialRadius;
+    };
+    // Global, window and sweep inhibition.
+    std::vector<Config> configs = {{{200}, {150}, true, 10},
+                                   {{200}, {150}, false, 1},
+                                   {{16, 16}, {12, 12}, false, 5}};
+
+    for (auto &config : configs)
+    {
+        SpatialPooler sp(config.inputDimensions, config.columnDimensions,
+                         /*potentialRadius*/ config.potentialRadius,
+                         /*potentialPct*/ 0.5,
+                         /*globalInhibition*/ config.globalInhibition,
+                         /*localAreaDensity*/ -1.0,
+                         /*numActiveColumnsPerInhArea*/ 5,
+                         /*stimulusThreshold*/ 1,
+                         /*synPermInactiveDec*/ 0.008,
+                         /*synPermActiveInc*/ 0.05,
+                         /*synPermConnected*/ 0.1,
+                         /*minPctOverlapDutyCycles*/ 0.001,
+                         /*dutyCyclePeriod*/ 1000,
+                         /*boostStrength*/ 10.0,
+                         /*seed*/ 1,
+                         /*spVerbosity*/ 0,
+                         /*wrapAround*/ true,
+                         /*numThreads*/ 2);
+
+        const UInt numInputs = sp.getNumInputs();
+        const UInt numColumns = sp.getNumColumns();
+        const UInt nRecords = 40;
+        Random rng(42);
+        std::vector<UInt> inputs(nRecords * numInputs);
+        for (auto &input : inputs)
+        {
+            input = rng.getReal64() < 0.1 ? 1 : 0;
+        }
+        std::vector<UInt> active(numColumns);
+        for (UInt r = 0; r < nRecords; r++)
+        {
+            sp.compute(&inputs[r * numInputs], true, active.data());
+        }
+
+        // The expected results of inference, on a copy.
+        const SpatialPooler before = sp;
+        SpatialPooler reference = sp;
+        std::vector<UInt> expected(nRecords * numColumns);
+        for (UInt r = 0; r < nRecords; r++)
+        {
+            reference.compute(&inputs[r * numInputs], false,
+                              &expected[r * numColumns]);
+        }
+
+        const SpatialPooler &shared = sp;
+        const UInt numCallers = 4;
+        std::vector<std::vector<UInt>> results(numCallers);
+        std::vector<std::thread> callers;
+        for (UInt t = 0; t < numCallers; t++)
+        {
+            callers.emplace_back([&, t]() {
+                SpatialPooler::InferenceContext context;
+                std::vector<UInt> &result = results[t];
+                result.resize(nRecords * numColumns);
+                std::vector<UInt> activeInputs;
+                std::vector<UInt> activeColumns;
+                for (UInt i = 0; i < 5 * nRecords; i++)
+                {
+                    // Every caller visits the records in its own order,
+                    // alternating the dense and sparse variants by pass.
+                    const UInt steps[] = {1, 3, 7, 9};
+                    const UInt r = (i * steps[t]) % nRecords;
+                    const UInt *input = &inputs[r * numInputs];
+                    if ((i / nRecords + t) % 2 == 0)
+                    {
+                        shared.compute(input, &result[r * numColumns],
+                                       context);
+                        continue;
+                    }
+
+                    activeInputs.clear();
+                    for (UInt j = 0; j < numInputs; j++)
+                    {
+                        if (input[j])
+                        {
+                            activeInputs.push_back(j);
+                        }
+                    }
+                    shared.compute(activeInputs, activeColumns, context);
+                    std::fill(&result[r * numColumns],
+                              &result[(r + 1) * numColumns], 0);
+                    for (UInt column : activeColumns)
+                    {
+                        result[r * numColumns + column] = 1;
+                    }
+                }
+            });
+        }
+        for (auto &caller : callers)
+        {
+            caller.join();
+        }
+
+        for (UInt t = 0; t < numCallers; t++)
+        {
+            ASSERT_EQ(expected, results[t]);
+        }
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, before));
+
+        // The context keeps the last overlaps and active columns.
+        SpatialPooler::InferenceContext context;
+        sp.compute(&inputs[0], active.data(), context);
+        reference.compute(&inputs[0], false, active.data());
+        ASSERT_EQ(reference.getOverlaps(), context.getOverlaps());
+        std::vector<UInt> activeColumns;
+        for (UInt column = 0; column < numColumns; column++)
+        {
+            if (active[column])
+            {
+                activeColumns.push_back(column);
+            }
+        }
+        ASSERT_EQ(activeColumns, context.getActiveColumns());
+    }
+}
+
+TEST(SpatialPoolerTest, testComputePacked)
+{
+    // 150 inputs do not fill the last word, whose extra bits are set and
+    // must be ignored.
+    const UInt inputSize = 150;
+    const UInt nColumns = 100;
+    const UInt numWords = (inputSize + 63) / 64;
+
+    for (bool globalInhibition : {true, false})
+    {
+        for (Real density : {0.02, 0.3})
+        {
+            SpatialPooler sp1({inputSize}, {nColumns},
+                              /*potentialRadius*/ 30,
+                              /*potentialPct*/ 0.5,
+                              /*globalInhibition*/ globalInhibition,
+                              /*localAreaDensity*/ -1.0,
+                              /*numActiveColumnsPerInhArea*/ 5,
+                              /*stimulusThreshold*/ 1,
+                              /*synPermInactiveDec*/ 0.008,
+                              /*synPermActiveInc*/ 0.05,
+                              /*synPermConnected*/ 0.1,
+                              /*minPctOverlapDutyCycles*/ 0.001,
+                              /*dutyCyclePeriod*/ 1000,
+                              /*boostStrength*/ 10.0,
+                              /*seed*/ 1,
+                              /*spVerbosity*/ 0,
+                              /*wrapAround*/ true);
+            SpatialPooler sp2 = sp1;
+
+            Random rng(42);
+            for (UInt i = 0; i < 100; i++)
+            {
+                std::vector<UInt> input(inputSize, 0);
+                std::vector<UInt64> inputBits(numWords, 0);
+                for (UInt j = 0; j < inputSize; j++)
+                {
+                    if (rng.getReal64() < density)
+                    {
+                        input[j] = 1;
+                        inputBits[j / 64] |= (UInt64)1 << (j % 64);
+                    }
+                }
+                inputBits[numWords - 1] |= ~(UInt64)0 << (inputSize % 64);
+
+                std::vector<UInt> active1(nColumns, 0);
+                std::vector<UInt> active2(nColumns, 0);
+                sp1.compute(input.data(), true, active1.data());
+                sp2.compute(inputBits.data(), true, active2.data());
+                ASSERT_EQ(active1, active2);
+                ASSERT_EQ(sp1.getOverlaps(), sp2.getOverlaps());
+            }
+            ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
+        }
+    }
+
+    // The bitmap path is only taken for dense enough inputs.
+    SpatialPooler sp({inputSize}, {nColumns},
+                     /*potentialRadius*/ inputSize,
+                     /*potentialPct*/ 0.5,
+                     /*globalInhibition*/ true);
+    EXPECT_FALSE(sp.usePackedOverlap_(1));
+    EXPECT_TRUE(sp.usePackedOverlap_(inputSize / 2));
+}
+
+TEST(SpatialPoolerTest, testComputeBatch)
+{
+    const UInt inputSize = 100;
+    const UInt nColumns = 80;
+    const UInt nRecords = 37;
+
+    for (bool globalInhibition : {true, false})
+    {
+        SpatialPooler sp1({inputSize}, {nColumns},
+                          /*potentialRadius*/ 16,
+                          /*potentialPct*/ 0.5,
+                          /*globalInhibition*/ globalInhibition,
+                          /*localAreaDensity*/ -1.0,
+                          /*numActiveColumnsPerInhArea*/ 4,
+                          /*stimulusThreshold*/ 1,
+                          /*synPermInactiveDec*/ 0.008,
+                          /*synPermActiveInc*/ 0.05,
+                          /*synPermConnected*/ 0.1,
+                          /*minPctOverlapDutyCycles*/ 0.001,
+                          /*dutyCyclePeriod*/ 1000,
+                          /*boostStrength*/ 10.0,
+                          /*seed*/ 1,
+                          /*spVerbosity*/ 0,
+                          /*wrapAround*/ true);
+
+        // Train a little so that the boost factors are not all 1.
+        Random rng(42);
+        std::vector<UInt> inputs(nRecords * inputSize);
+        for (auto &input : inputs)
+        {
+            input = rng.getReal64() < 0.1 ? 1 : 0;
+        }
+        std::vector<UInt> active(nColumns);
+        for (UInt r = 0; r < nRecords; r++)
+        {
+            sp1.compute(&inputs[r * inputSize], true, active.data());
+        }
+        SpatialPooler sp2 = sp1;
+
+        std::vector<UInt> expected(nRecords * nColumns);
+        for (UInt r = 0; r < nRecords; r++)
+        {
+            sp1.compute(&inputs[r * inputSize], false, &expected[r * nColumns]);
+        }
+
+        std::vector<UInt> actual(nRecords * nColumns);
+        sp2.computeBatch(inputs.data(), nRecords, actual.data());
+
+        ASSERT_EQ(expected, actual);
+        ASSERT_EQ(sp1.getIterationNum(), sp2.getIterationNum());
+        ASSERT_EQ(sp1.getOverlaps(), sp2.getOverlaps());
+        ASSERT_EQ(sp1.getBoostedOverlaps(), sp2.getBoostedOverlaps());
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
+    }
+}
+
+TEST(SpatialPoolerTest, testAsyncLearning)
+{
+    const UInt inputSize = 150;
+    const UInt nColumns = 100;
+    const UInt numWords = (inputSize + 63) / 64;
+
+    for (bool globalInhibition : {true, false})
+    {
+        SpatialPooler sp1({inputSize}, {nColumns},
+                          /*potentialRadius*/ 30,
+                          /*potentialPct*/ 0.5,
+                          /*globalInhibition*/ globalInhibition,
+                          /*localAreaDensity*/ -1.0,
+                          /*numActiveColumnsPerInhArea*/ 5,
+                          /*stimulusThreshold*/ 1,
+                          /*synPermInactiveDec*/ 0.008,
+                          /*synPermActiveInc*/ 0.05,
+                          /*synPermConnected*/ 0.1,
+                          /*minPctOverlapDutyCycles*/ 0.001,
+                          /*dutyCyclePeriod*/ 1000,
+                          /*boostStrength*/ 10.0,
+                          /*seed*/ 1,
+                          /*spVerbosity*/ 0,
+                          /*wrapAround*/ true);
+        SpatialPooler sp2 = sp1;
+        sp2.setAsyncLearning(true);
+        ASSERT_FALSE(sp1.getAsyncLearning());
+        ASSERT_TRUE(sp2.getAsyncLearning());
+
+        // The same buffers are overwritten at every step, while the
+        // previous step may still be learning.
+        std::vector<UInt> input(inputSize);
+        std::vector<UInt64> inputBits(numWords);
+        std::vector<UInt> activeInputs;
+        std::vector<UInt> active1(nColumns), active2(nColumns);
+        std::vector<UInt> activeColumns1, activeColumns2;
+        Random rng(42);
+        for (UInt i = 0; i < 200; i++)
+        {
+            std::fill(input.begin(), input.end(), 0);
+            std::fill(inputBits.begin(), inputBits.end(), 0);
+            activeInputs.clear();
+            for (UInt j = 0; j < inputSize; j++)
+            {
+                if (rng.getReal64() < 0.1)
+                {
+                    input[j] = 1;
+                    inputBits[j / 64] |= (UInt64)1 << (j % 64);
+                    activeInputs.push_back(j);
+                }
+            }
+
+            // Learning steps of the three variants, with a step without
+            // learning now and then.
+            const bool learn = i % 7 != 6;
+            switch (i % 3)
+            {
+            case 0:
+                sp1.compute(input.data(), learn, active1.data());
+                sp2.compute(input.data(), learn, active2.data());
+                break;
+            case 1:
+                sp1.compute(inputBits.data(), learn, active1.data());
+                sp2.compute(inputBits.data(), learn, active2.data());
+                break;
+            default:
+                sp1.compute(activeInputs, learn, activeColumns1);
+                sp2.compute(activeInputs, learn, activeColumns2);
+                ASSERT_EQ(activeColumns1, activeColumns2);
+                break;
+            }
+            ASSERT_EQ(active1, active2);
+            ASSERT_EQ(sp1.getOverlaps(), sp2.getOverlaps());
+
+            // Saving waits for the pending step.
+            if (i == 100)
+            {
+                std::stringstream saved1, saved2;
+                sp1.save(saved1);
+                sp2.save(saved2);
+                ASSERT_EQ(saved1.str(), saved2.str());
+            }
+        }
+
+        sp2.waitForLearning();
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
+
+        sp2.setAsyncLearning(false);
+        ASSERT_FALSE(sp2.getAsyncLearning());
+    }
+}
+
+TEST(SpatialPoolerTest, testAsyncLearningCopyAndMove)
+{
+    const UInt inputSize = 150;
+    const UInt nColumns = 100;
+
+    SpatialPooler sp1({inputSize}, {nColumns},
+                      /*potentialRadius*/ 30,
+                      /*potentialPct*/ 0.5,
+                      /*globalInhibition*/ false,
+                      /*localAreaDensity*/ -1.0,
+                      /*numActiveColumnsPerInhArea*/ 5,
+                      /*stimulusThreshold*/ 1,
+                      /*synPermInactiveDec*/ 0.008,
+                      /*synPermActiveInc*/ 0.05,
+                      /*synPermConnected*/ 0.1,
+                      /*minPctOverlapDutyCycles*/ 0.001,
+                      /*dutyCyclePeriod*/ 1000,
+                      /*boostStrength*/ 10.0);
+    SpatialPooler sp2 = sp1;
+    sp2.setAsyncLearning(true);
+    SpatialPooler sp3 = sp2;
+    ASSERT_TRUE(sp3.getAsyncLearning());
+
+    std::vector<UInt> input(inputSize);
+    std::vector<UInt> active1(nColumns), active2(nColumns), active3(nColumns);
+    std::vector<Real> values1(nColumns), values2(nColumns);
+    std::vector<Real> perm1(inputSize), perm2(inputSize);
+    Random rng(42);
+    for (UInt i = 0; i < 80; i++)
+    {
+        for (UInt j = 0; j < inputSize; j++)
+        {
+            input[j] = rng.getReal64() < 0.1 ? 1 : 0;
+        }
+        sp1.compute(input.data(), true, active1.data());
+        sp2.compute(input.data(), true, active2.data());
+        sp3.compute(input.data(), true, active3.data());
+        ASSERT_EQ(active1, active2);
+        ASSERT_EQ(active1, active3);
+
+        // Copies and moves of spatial poolers with a pending step, which
+        // sp2 and sp3 always have here.
+        switch (i % 4)
+        {
+        case 0:
+        {
+            SpatialPooler moved(std::move(sp2));
+            sp2 = std::move(moved);
+            break;
+        }
+        case 1:
+            std::swap(sp2, sp3);
+            break;
+        case 2:
+            sp3 = sp2;
+            break;
+        default:
+        {
+            SpatialPooler copy(sp3);
+            ASSERT_TRUE(copy.getAsyncLearning());
+            sp3 = std::move(copy);
+
+            // The getters of what learning changes wait for the pending
+            // step.
+            sp1.getBoostFactors(values1.data());
+            sp2.getBoostFactors(values2.data());
+            ASSERT_EQ(values1, values2);
+            sp1.getActiveDutyCycles(values1.data());
+            sp2.getActiveDutyCycles(values2.data());
+            ASSERT_EQ(values1, values2);
+            sp1.getPermanence(i % nColumns, perm1.data());
+            sp2.getPermanence(i % nColumns, perm2.data());
+            ASSERT_EQ(perm1, perm2);
+            break;
+        }
+        }
+        ASSERT_TRUE(sp2.getAsyncLearning());
+        ASSERT_TRUE(sp3.getAsyncLearning());
+    }
+
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp3));
+}
+
+TEST(SpatialPoolerTest, testComputeDoesNotAllocate)
+{
+    const UInt inputSize = 200;
+    const UInt nColumns = 256;
+
+    for (bool globalInhibition : {true, false})
+    {
+        for (bool learn : {false, true})
+        {
+            for (UInt numThreads : {1, 3})
+            {
+                // A non-zero minPctOverlapDutyCycles makes columns weak, so
+                // that bumpUpWeakColumns_ rewrites their rows too.
+                for (Real minPctOverlapDutyCycles : {0.0, 0.5})
+                {
+                    // Learning rewrites the rows of the synapse store in place.
+                    SpatialPooler sp({inputSize}, {nColumns},
+                                     /*potentialRadius*/ 20,
+                                     /*potentialPct*/ 0.5,
+                                     /*globalInhibition*/ globalInhibition,
+                                     /*localAreaDensity*/ -1.0,
+                                     /*numActiveColumnsPerInhArea*/ 10,
+                                     /*stimulusThreshold*/ 1,
+                                     /*synPermInactiveDec*/ 0.008,
+                                     /*synPermActiveInc*/ 0.05,
+                                     /*synPermConnected*/ 0.1,
+                                     minPctOverlapDutyCycles,
+                                     /*dutyCyclePeriod*/ 1000,
+                                     /*boostStrength*/ 10.0,
+                                     /*seed*/ 1,
+                                     /*spVerbosity*/ 0,
+                                     /*wrapAround*/ true,
+                                     /*numThreads*/ numThreads);
+
+                    Random rng(42);
+                    std::vector<UInt> inputs(20 * inputSize);
+                    for (auto &input : inputs)
+                    {
+                        input = rng.getReal64() < 0.1 ? 1 : 0;
+                    }
+                    std::vector<UInt> active(nColumns);
+                    std::vector<UInt> activeInputs;
+                    std::vector<UInt> activeColumns;
+                    std::vector<UInt64> inputBits((inputSize + 63) / 64, 0);
+                    SpatialPooler::InferenceContext context;
+                    // The output of the sparse variants is the caller's.
+                    activeColumns.reserve(nColumns);
+                    for (UInt i = 0; i < inputSize; i++)
+                    {
+                        if (inputs[i])
+                        {
+                            activeInputs.push_back(i);
+                            inputBits[i / 64] |= (UInt64)1 << (i % 64);
+                        }
+                    }
+
+                    // Warm-up, which also covers a few update rounds.
+                    for (UInt iter = 0; iter < 100; iter++)
+                    {
+                        sp.compute(&inputs[(iter % 20) * inputSize], learn,
+                                   active.data());
+                        sp.compute(activeInputs, learn, activeColumns);
+                        sp.compute(inputBits.data(), learn, active.data());
+                        sp.compute(&inputs[(iter % 20) * inputSize],
+                                   active.data(), context);
+                        sp.compute(activeInputs, activeColumns, context);
+                    }
+
+                    if (learn && minPctOverlapDutyCycles > 0)
+                    {
+                        std::vector<Real> overlapDutyCycles(nColumns);
+                        std::vector<Real> minOverlapDutyCycles(nColumns);
+                        sp.getOverlapDutyCycles(overlapDutyCycles.data());
+                        sp.getMinOverlapDutyCycles(
+                            minOverlapDutyCycles.data());
+                        UInt numWeak = 0;
+                        for (UInt i = 0; i < nColumns; i++)
+                        {
+                            numWeak += overlapDutyCycles[i] <
+                                       minOverlapDutyCycles[i];
+                        }
+                        ASSERT_GT(numWeak, 0u);
+                    }
+
+                    const unsigned long before = numAllocations;
+                    for (UInt iter = 0; iter < 200; iter++)
+                    {
+                        sp.compute(&inputs[(iter % 20) * inputSize], learn,
+                                   active.data());
+                        sp.compute(activeInputs, learn, activeColumns);
+                        sp.compute(inputBits.data(), learn, active.data());
+                        sp.compute(&inputs[(iter % 20) * inputSize],
+                                   active.data(), context);
+                        sp.compute(activeInputs, activeColumns, context);
+                    }
+                    EXPECT_EQ(0ul, numAllocations - before)
+                        << "globalInhibition " << globalInhibition << " learn "
+                        << learn << " numThreads " << numThreads
+                        << " minPctOverlapDutyCycles "
+                        << minPctOverlapDutyCycles;
+                }
+            }
+        }
+    }
+}
+
 TEST(SpatialPoolerTest, testSaveLoad)
 {
     const char *filename = "SpatialPoolerSerialization.tmp";
@@ -2184,20 +3477,342 @@ TEST(SpatialPoolerTest, testSaveLoad)
     setup(sp1, numInputs, numColumns);
 
     std::ofstream outfile;
-    outfile.open(filename);
+    outfile.open(filename, std::ios::binary);
     sp1.save(outfile);
     outfile.close();
 
-    std::ifstream infile(filename);
+    std::ifstream infile(filename, std::ios::binary);
     sp2.load(infile);
     infile.close();
 
     ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp2));
 
+    SpatialPooler sp3;
+    sp3.loadMapped(filename);
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp1, sp3));
+
     int ret = ::remove(filename);
     ASSERT_TRUE(ret == 0) << "Failed to delete " << filename;
 }
 
+TEST(SpatialPoolerTest, testSaveLoadFormats)
+{
+    SpatialPooler sp({10, 12}, {8, 9}, 3, 0.5, false, -1.0, 5);
+    sp.setWrapAround(false);
+    Random rng(3);
+    std::vector<UInt> input(sp.getNumInputs());
+    std::vector<UInt> active(sp.getNumColumns());
+    for (UInt iter = 0; iter < 50; iter++)
+    {
+        for (auto &bit : input)
+        {
+            bit = rng.getReal64() < 0.2 ? 1 : 0;
+        }
+        sp.compute(input.data(), true, active.data());
+    }
+
+    // The size of the binary format is known without saving, and the data
+    // that follows it in the stream is left alone.
+    std::stringstream binary;
+    sp.save(binary);
+    binary << "next";
+    const size_t binarySize = sp.persistentSize();
+    ASSERT_EQ(binarySize + 4, binary.str().size());
+
+    SpatialPooler fromBinary;
+    fromBinary.load(binary);
+    std::string next;
+    binary >> next;
+    ASSERT_EQ("next", next);
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromBinary));
+
+    // The text format is still read.
+    std::stringstream text;
+    sp.saveText(text);
+    SpatialPooler fromText;
+    fromText.load(text);
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromText));
+    ASSERT_EQ(sp.version(), fromText.version());
+
+    // So is version 4 of the binary format, which stores the potential
+    // pools and the permanences separately.
+    std::stringstream version4;
+    sp.saveBinary_(version4, 4);
+    SpatialPooler fromVersion4;
+    fromVersion4.load(version4);
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromVersion4));
+
+    // All continue exactly like the original.
+    std::vector<UInt> activeBinary(sp.getNumColumns());
+    std::vector<UInt> activeText(sp.getNumColumns());
+    std::vector<UInt> activeVersion4(sp.getNumColumns());
+    for (UInt iter = 0; iter < 20; iter++)
+    {
+        for (auto &bit : input)
+        {
+            bit = rng.getReal64() < 0.2 ? 1 : 0;
+        }
+        sp.compute(input.data(), true, active.data());
+        fromBinary.compute(input.data(), true, activeBinary.data());
+        fromText.compute(input.data(), true, activeText.data());
+        fromVersion4.compute(input.data(), true, activeVersion4.data());
+        ASSERT_EQ(active, activeBinary);
+        ASSERT_EQ(active, activeText);
+        ASSERT_EQ(active, activeVersion4);
+    }
+
+    // Truncated or corrupted data is rejected.
+    std::string data = binary.str().substr(0, binarySize);
+    std::stringstream truncated(data.substr(0, data.size() - 1));
+    SpatialPooler rejected;
+    EXPECT_ANY_THROW(rejected.load(truncated));
+    EXPECT_ANY_THROW(rejected.loadBinary_(data.data(), 100));
+    std::string corrupted = data;
+    corrupted[4] = 'X';
+    EXPECT_ANY_THROW(
+        rejected.loadBinary_(corrupted.data(), corrupted.size()));
+
+    // So are dimensions that do not multiply to the numbers of inputs and
+    // columns.
+    for (const std::vector<UInt> &dimensions :
+         {std::vector<UInt>({10, 12}), std::vector<UInt>({8, 9})})
+    {
+        const std::string bytes(
+            reinterpret_cast<const char *>(dimensions.data()),
+            dimensions.size() * sizeof(UInt));
+        const size_t position = data.find(bytes);
+        ASSERT_NE(std::string::npos, position);
+        for (UInt dimension : {0u, dimensions[1] + 1})
+        {
+            corrupted = data;
+            std::memcpy(&corrupted[position + sizeof(UInt)], &dimension,
+                        sizeof(UInt));
+            EXPECT_ANY_THROW(
+                rejected.loadBinary_(corrupted.data(), corrupted.size()));
+        }
+    }
+}
+
+TEST(SpatialPoolerTest, testDeltaCheckpoints)
+{
+    SpatialPooler sp({10, 12}, {8, 9}, 3, 0.5, false, -1.0, 5);
+    Random rng(3);
+    std::vector<UInt> input(sp.getNumInputs());
+    std::vector<UInt> active(sp.getNumColumns());
+    auto run = [&](UInt numIterations) {
+        for (UInt iter = 0; iter < numIterations; iter++)
+        {
+            for (auto &bit : input)
+            {
+                bit = rng.getReal64() < 0.2 ? 1 : 0;
+            }
+            sp.compute(input.data(), true, active.data());
+        }
+    };
+
+    // The rows written by initialize are all dirty.
+    EXPECT_EQ(sp.getNumColumns(), sp.getNumDirtyColumns());
+    run(100);
+    std::stringstream base;
+    sp.save(base);
+    sp.markCheckpoint();
+    EXPECT_EQ(0u, sp.getNumDirtyColumns());
+
+    // A few steps only change a few columns, and the deltas go into one
+    // log. The last delta also changes the permanence format.
+    std::stringstream log;
+    std::vector<std::string> deltas;
+    for (UInt i = 0; i < 3; i++)
+    {
+        run(2);
+        if (i == 2)
+        {
+            sp.setPermanenceBits(8);
+        }
+        const UInt numDirty = sp.getNumDirtyColumns();
+        EXPECT_GT(numDirty, 0u);
+        EXPECT_TRUE(i == 2 || numDirty < sp.getNumColumns() / 2);
+
+        std::stringstream delta;
+        sp.saveDelta(delta);
+        EXPECT_EQ(0u, sp.getNumDirtyColumns());
+        EXPECT_TRUE(i == 2 || delta.str().size() < sp.persistentSize() / 2);
+        deltas.push_back(delta.str());
+        log << delta.str();
+    }
+
+    SpatialPooler restored;
+    restored.load(base);
+    for (const std::string &delta : deltas)
+    {
+        std::stringstream deltaStream(delta);
+        restored.loadDelta(deltaStream);
+    }
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, restored));
+
+    std::stringstream compacted;
+    base.seekg(0);
+    SpatialPooler::compactCheckpoint(base, log, compacted);
+    SpatialPooler fromCompacted;
+    fromCompacted.load(compacted);
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromCompacted));
+
+    // Both continue the same way.
+    std::vector<UInt> restoredActive(sp.getNumColumns());
+    for (UInt iter = 0; iter < 10; iter++)
+    {
+        for (auto &bit : input)
+        {
+            bit = rng.getReal64() < 0.2 ? 1 : 0;
+        }
+        sp.compute(input.data(), true, active.data());
+        for (SpatialPooler *other : {&restored, &fromCompacted})
+        {
+            other->compute(input.data(), true, restoredActive.data());
+            ASSERT_EQ(active, restoredActive);
+        }
+    }
+    ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, restored));
+
+    // A delta only applies to the checkpoint it follows.
+    SpatialPooler rejected;
+    base.seekg(0);
+    rejected.load(base);
+    std::stringstream second(deltas[1]);
+    EXPECT_ANY_THROW(rejected.loadDelta(second));
+    std::stringstream notDelta(base.str());
+    EXPECT_ANY_THROW(rejected.loadDelta(notDelta));
+}
+
+TEST(SpatialPoolerTest, testFixedPointPermanences)
+{
+    for (UInt bits : {8, 16})
+    {
+        SpatialPooler sp({60}, {40}, 10, 0.5, true, -1.0, 5);
+        sp.setPermanenceBits(bits);
+        ASSERT_EQ(bits, sp.getPermanenceBits());
+
+        const UInt numInputs = sp.getNumInputs();
+        const UInt numColumns = sp.getNumColumns();
+        const Real step = 1.0f / ((1 << bits) - 1);
+        auto checkPermanences = [&](const SpatialPooler &pooler) {
+            std::vector<Real> perm(numInputs);
+            std::vector<UInt> potential(numInputs), connected(numInputs);
+            for (UInt i = 0; i < numColumns; i++)
+            {
+                pooler.getPermanence(i, perm.data());
+                pooler.getPotential(i, potential.data());
+                pooler.getConnectedSynapses(i, connected.data());
+                for (UInt j = 0; j < numInputs; j++)
+                {
+                    const Real steps = perm[j] / step;
+                    ASSERT_NEAR(std::round(steps), steps, 1e-3);
+                    ASSERT_TRUE(potential[j] || perm[j] == 0);
+                    ASSERT_EQ(perm[j] >= pooler.getSynPermConnected() -
+                                             0.000001,
+                              connected[j] != 0);
+                }
+            }
+        };
+        ASSERT_NO_FATAL_FAILURE(checkPermanences(sp));
+
+        Random rng(5);
+        std::vector<UInt> input(numInputs), active(numColumns);
+        for (UInt iter = 0; iter < 30; iter++)
+        {
+            for (auto &bit : input)
+            {
+                bit = rng.getReal64() < 0.2 ? 1 : 0;
+            }
+            sp.compute(input.data(), true, active.data());
+        }
+        ASSERT_NO_FATAL_FAILURE(checkPermanences(sp));
+
+        // A learning step moves each permanence of an active column by a
+        // whole number of steps, the rounded increment or decrement.
+        const Real activeSteps = std::round(sp.getSynPermActiveInc() / step);
+        const Real inactiveSteps =
+            std::round(sp.getSynPermInactiveDec() / step);
+        SpatialPooler before = sp;
+        sp.compute(input.data(), true, active.data());
+        std::vector<Real> permBefore(numInputs), permAfter(numInputs);
+        std::vector<UInt> potential(numInputs);
+        for (UInt i = 0; i < numColumns; i++)
+        {
+            if (!active[i])
+            {
+                continue;
+            }
+            before.getPermanence(i, permBefore.data());
+            sp.getPermanence(i, permAfter.data());
+            sp.getPotential(i, potential.data());
+            for (UInt j = 0; j < numInputs; j++)
+            {
+                if (!potential[j])
+                {
+                    continue;
+                }
+                Real expected =
+                    input[j] ? std::min(1.0f, permBefore[j] +
+                                                  activeSteps * step)
+                             : std::max(0.0f, permBefore[j] -
+                                                  inactiveSteps * step);
+                expected =
+                    expected < sp.getSynPermTrimThreshold() ? 0 : expected;
+                EXPECT_NEAR(expected, permAfter[j], step / 4)
+                    << "column " << i << " input " << j;
+            }
+        }
+
+        // The binary format keeps the codes, the text format their values.
+        std::stringstream binary;
+        sp.save(binary);
+        ASSERT_EQ(sp.persistentSize(), binary.str().size());
+        SpatialPooler fromBinary;
+        fromBinary.load(binary);
+        ASSERT_EQ(bits, fromBinary.getPermanenceBits());
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromBinary));
+
+        std::stringstream version4;
+        sp.saveBinary_(version4, 4);
+        SpatialPooler fromVersion4;
+        fromVersion4.load(version4);
+        ASSERT_EQ(bits, fromVersion4.getPermanenceBits());
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromVersion4));
+
+        std::stringstream text;
+        sp.saveText(text);
+        SpatialPooler fromText;
+        fromText.load(text);
+        ASSERT_EQ(0u, fromText.getPermanenceBits());
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, fromText));
+
+        // Changing a potential pool keeps the permanences of the inputs
+        // that stay in it.
+        sp.getPermanence(0, permBefore.data());
+        sp.getPotential(0, potential.data());
+        for (UInt j = 0; j < numInputs; j += 3)
+        {
+            potential[j] = 1 - potential[j];
+        }
+        sp.setPotential(0, potential.data());
+        sp.getPermanence(0, permAfter.data());
+        for (UInt j = 0; j < numInputs; j++)
+        {
+            EXPECT_EQ(potential[j] && j % 3 ? permBefore[j] : 0,
+                      potential[j] ? permAfter[j] : 0);
+            EXPECT_TRUE(potential[j] || permAfter[j] == 0);
+        }
+        ASSERT_NO_FATAL_FAILURE(checkPermanences(sp));
+
+        // Going back to floating point keeps the values.
+        SpatialPooler floating = sp;
+        floating.setPermanenceBits(0);
+        ASSERT_EQ(0u, floating.getPermanenceBits());
+        ASSERT_NO_FATAL_FAILURE(check_spatial_eq(sp, floating));
+    }
+}
+
 TEST(SpatialPoolerTest, testConstructorVsInitialize)
 {
     // Initialize SP using the constructor
@@ -0,0 +1,418 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Unit tests for SynapseStore
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <crucian/Random.hpp>
+#include <crucian/SynapseStore.hpp>
+
+namespace crucian
+{
+
+static std::vector<UInt> connected(const SynapseStore &store, UInt row)
+{
+    std::vector<UInt> inputs;
+    store.forEachConnected(row, [&](UInt input) { inputs.push_back(input); });
+    return inputs;
+}
+
+static std::vector<UInt> connectedRows(const SynapseStore &store, UInt input)
+{
+    std::vector<UInt> rows;
+    store.forEachConnectedRow(input, [&](UInt row) { rows.push_back(row); });
+    EXPECT_EQ(rows.size(), store.getNumConnectedRows(input));
+    std::sort(rows.begin(), rows.end());
+    return rows;
+}
+
+TEST(SynapseStoreTest, rowsArePartitioned)
+{
+    SynapseStore store;
+    store.resize(2, 10);
+
+    store.beginRow(0);
+    store.append(1, 0.3, true, true);
+    store.append(2, 0.0, true, false);
+    store.append(4, 0.05, false, false);
+    store.append(5, 0.0, false, false);
+    store.append(7, 0.2, true, true);
+    EXPECT_EQ(2u, store.endRow());
+
+    // The non-potential synapse with a permanence of 0 is dropped.
+    EXPECT_EQ(4u, store.getRowSize(0));
+    EXPECT_EQ(2u, store.getNumConnected(0));
+    EXPECT_EQ(std::vector<UInt>({1, 7}), connected(store, 0));
+    EXPECT_EQ(0u, store.getRowSize(1));
+    EXPECT_EQ(3u, store.getNumPotential());
+    EXPECT_EQ(3u, store.getNumNonZeros());
+
+    std::vector<UInt> inputs;
+    std::vector<Real> perms;
+    std::vector<bool> potential;
+    store.getRow(0, inputs, perms, potential);
+    EXPECT_EQ(std::vector<UInt>({1, 2, 4, 7}), inputs);
+    EXPECT_EQ(std::vector<Real>({0.3f, 0.0f, 0.05f, 0.2f}), perms);
+    EXPECT_EQ(std::vector<bool>({true, true, false, true}), potential);
+
+    EXPECT_EQ(std::vector<UInt>({0}), connectedRows(store, 1));
+    EXPECT_EQ(std::vector<UInt>(), connectedRows(store, 2));
+    EXPECT_EQ(std::vector<UInt>({0}), connectedRows(store, 7));
+}
+
+TEST(SynapseStoreTest, connectedChanges)
+{
+    SynapseStore store;
+    store.resize(1, 10);
+
+    store.beginRow(0);
+    store.append(1, 0.3, true, true);
+    store.append(4, 0.3, true, true);
+    store.endRow();
+    EXPECT_TRUE(store.getConnectedChanged());
+    EXPECT_EQ(std::vector<UInt>({1, 4}), store.getConnectedAdded());
+    EXPECT_EQ(std::vector<UInt>(), store.getConnectedRemoved());
+
+    store.beginRow(0);
+    store.append(1, 0.0, true, false);
+    store.append(4, 0.3, true, true);
+    store.append(6, 0.3, true, true);
+    store.append(8, 0.3, true, true);
+    store.endRow();
+    EXPECT_EQ(std::vector<UInt>({6, 8}), store.getConnectedAdded());
+    EXPECT_EQ(std::vector<UInt>({1}), store.getConnectedRemoved());
+
+    // Only the permanences change.
+    store.beginRow(0);
+    store.append(1, 0.1, true, false);
+    store.append(4, 0.2, true, true);
+    store.append(6, 0.2, true, true);
+    store.append(8, 0.2, true, true);
+    store.endRow();
+    EXPECT_FALSE(store.getConnectedChanged());
+    EXPECT_EQ(std::vector<UInt>(), store.getConnectedAdded());
+    EXPECT_EQ(std::vector<UInt>(), store.getConnectedRemoved());
+}
+
+TEST(SynapseStoreTest, setPotentialKeepsPermanences)
+{
+    SynapseStore store;
+    store.resize(1, 10);
+    const UInt pool[] = {2, 3, 5};
+    store.setPotential(0, pool, pool + 3);
+    EXPECT_EQ(3u, store.getRowSize(0));
+
+    store.beginRow(0);
+    store.append(2, 0.5, true, true);
+    store.append(3, 0.0, true, false);
+    store.append(5, 0.1, true, false);
+    store.endRow();
+
+    // Input 5 leaves the pool but keeps its permanence, input 3 is dropped.
+    const UInt newPool[] = {2, 8};
+    store.setPotential(0, newPool, newPool + 2);
+
+    std::vector<UInt> inputs;
+    std::vector<Real> perms;
+    std::vector<bool> potential;
+    store.getRow(0, inputs, perms, potential);
+    EXPECT_EQ(std::vector<UInt>({2, 5, 8}), inputs);
+    EXPECT_EQ(std::vector<Real>({0.5f, 0.1f, 0.0f}), perms);
+    EXPECT_EQ(std::vector<bool>({true, false, true}), potential);
+    EXPECT_EQ(std::vector<UInt>({2}), connected(store, 0));
+}
+
+TEST(SynapseStoreTest, dirtyRows)
+{
+    SynapseStore store;
+    store.resize(3, 10);
+    EXPECT_EQ(0u, store.getNumDirty());
+
+    const UInt pool[] = {2, 3, 5};
+    for (UInt row = 0; row < 3; row++)
+    {
+        store.setPotential(row, pool, pool + 3);
+    }
+    EXPECT_EQ(3u, store.getNumDirty());
+
+    store.clearDirty();
+    EXPECT_EQ(0u, store.getNumDirty());
+
+    store.beginRow(1);
+    store.append(2, 0.5, true, true);
+    store.endRow();
+    EXPECT_FALSE(store.isDirty(0));
+    EXPECT_TRUE(store.isDirty(1));
+    EXPECT_FALSE(store.isDirty(2));
+    EXPECT_EQ(1u, store.getNumDirty());
+
+    // Setting the same permanence format changes nothing, and a new format
+    // changes every row.
+    store.setPermanenceFormat(0, 0, 0);
+    EXPECT_EQ(1u, store.getNumDirty());
+    store.setPermanenceFormat(8, 0, 1);
+    EXPECT_EQ(3u, store.getNumDirty());
+}
+
+TEST(SynapseStoreTest, indexWidths)
+{
+    // The same synapses with 16-bit and 32-bit inputs and rows.
+    SynapseStore narrow, wide;
+    narrow.resize(3, 0x10000);
+    wide.resize(0x10001, 0x10001);
+    EXPECT_EQ(16u, narrow.getInputBits());
+    EXPECT_EQ(16u, narrow.getRowBits());
+    EXPECT_EQ(32u, wide.getInputBits());
+    EXPECT_EQ(32u, wide.getRowBits());
+
+    for (SynapseStore *store : {&narrow, &wide})
+    {
+        for (UInt row = 0; row < 3; row++)
+        {
+            store->beginRow(row);
+            store->append(row, 0.5, true, true);
+            store->append(0x8000 + row, 0.0, true, false);
+            store->append(0xffff - row, 0.3, true, true);
+            store->endRow();
+        }
+    }
+    for (UInt row = 0; row < 3; row++)
+    {
+        EXPECT_EQ(std::vector<UInt>({row, 0xffff - row}),
+                  connected(narrow, row));
+        EXPECT_EQ(connected(narrow, row), connected(wide, row));
+        EXPECT_EQ(0xffff - row, narrow.getConnected(row, 1));
+        EXPECT_EQ(std::vector<UInt>({row}), connectedRows(narrow, 0xffff - row));
+        EXPECT_EQ(std::vector<UInt>({row}), connectedRows(wide, 0xffff - row));
+    }
+
+    // Inputs and rows past 16 bits.
+    wide.beginRow(0x10000);
+    wide.append(0x10000, 0.5, true, true);
+    wide.endRow();
+    EXPECT_EQ(std::vector<UInt>({0x10000}), connected(wide, 0x10000));
+    EXPECT_EQ(std::vector<UInt>({0x10000}), connectedRows(wide, 0x10000));
+
+    // 16-bit inputs take 2 bytes less per synapse. The wider store also
+    // has one more, empty, list of connected rows.
+    SynapseStore inputs16, inputs32;
+    inputs16.resize(3, 0x10000);
+    inputs32.resize(3, 0x10001);
+    std::vector<UInt> pool(1000);
+    for (UInt row = 0; row < 3; row++)
+    {
+        std::iota(pool.begin(), pool.end(), row * 1000);
+        inputs16.setPotential(row, pool.data(), pool.data() + pool.size());
+        inputs32.setPotential(row, pool.data(), pool.data() + pool.size());
+    }
+    EXPECT_EQ(2 * inputs16.getNumPotential() + sizeof(std::vector<UInt16>),
+              inputs32.getNumBytes() - inputs16.getNumBytes());
+}
+
+TEST(SynapseStoreTest, fixedPointPermanences)
+{
+    SynapseStore store;
+    store.resize(1, 4);
+    store.beginRow(0);
+    store.append(0, 0.3, true, true);
+    store.append(3, 0.71, true, false);
+    store.endRow();
+
+    store.setPermanenceFormat(8, 0, 1);
+    EXPECT_EQ(8u, store.getFixedPoint().getBits());
+    std::vector<UInt> inputs;
+    std::vector<Real> perms;
+    std::vector<bool> potential;
+    store.getRow(0, inputs, perms, potential);
+    EXPECT_EQ(store.round(0.3), perms[0]);
+    EXPECT_EQ(store.round(0.71), perms[1]);
+    EXPECT_NEAR(0.71, perms[1], 0.5 / 255);
+
+    store.setPermanenceFormat(0, 0, 0);
+    std::vector<Real> floatPerms;
+    store.getRow(0, inputs, floatPerms, potential);
+    EXPECT_EQ(perms, floatPerms);
+    EXPECT_EQ(std::vector<UInt>({0}), connected(store, 0));
+}
+
+TEST(SynapseStoreTest, writeAndLoadRows)
+{
+    for (UInt numInputs : {50u, 0x10001u})
+    {
+        for (UInt bits : {0u, 8u})
+        {
+            SynapseStore store;
+            store.resize(3, numInputs);
+            store.setPermanenceFormat(bits, 0, 1);
+            Random rng(7);
+            for (UInt row = 0; row < 2; row++)
+            {
+                store.beginRow(row);
+                for (UInt input = row; input < numInputs; input += 7 + row)
+                {
+                    const Real perm = store.round((Real)rng.getReal64());
+                    store.append(input, perm, input % 3 != 0, perm >= 0.5);
+                }
+                store.endRow();
+            }
+
+            std::ostringstream inputs, potential, perms;
+            store.writeInputs(inputs);
+            store.writePotential(potential);
+            store.writePermanences(perms);
+            std::vector<UInt> sizes, numConnected;
+            for (UInt row = 0; row < 3; row++)
+            {
+                sizes.push_back(store.getRowSize(row));
+                numConnected.push_back(store.getNumConnected(row));
+            }
+
+            SynapseStore loaded;
+            loaded.resize(3, numInputs);
+            loaded.setPermanenceFormat(bits, 0, 1);
+            loaded.loadRows(sizes.data(), numConnected.data(),
+                            store.getNumSynapses(), inputs.str().data(),
+                            potential.str().data(), perms.str().data());
+            EXPECT_EQ(3u, loaded.getNumDirty());
+            for (UInt row = 0; row < 3; row++)
+            {
+                std::vector<UInt> rowInputs, loadedInputs;
+                std::vector<Real> rowPerms, loadedPerms;
+                std::vector<bool> rowPotential, loadedPotential;
+                store.getRow(row, rowInputs, rowPerms, rowPotential);
+                loaded.getRow(row, loadedInputs, loadedPerms, loadedPotential);
+                EXPECT_EQ(rowInputs, loadedInputs);
+                EXPECT_EQ(rowPerms, loadedPerms);
+                EXPECT_EQ(rowPotential, loadedPotential);
+                EXPECT_EQ(connected(store, row), connected(loaded, row));
+            }
+            for (UInt input = 0; input < numInputs; input += 13)
+            {
+                EXPECT_EQ(connectedRows(store, input),
+                          connectedRows(loaded, input));
+            }
+
+            // Sizes that do not add up, more connected synapses than
+            // synapses, and a row holding an input twice are rejected.
+            EXPECT_ANY_THROW(loaded.loadRows(
+                sizes.data(), numConnected.data(), store.getNumSynapses() + 1,
+                inputs.str().data(), potential.str().data(),
+                perms.str().data()));
+            std::vector<UInt> badConnected = numConnected;
+            badConnected[2] = 1;
+            EXPECT_ANY_THROW(loaded.loadRows(
+                sizes.data(), badConnected.data(), store.getNumSynapses(),
+                inputs.str().data(), potential.str().data(),
+                perms.str().data()));
+            std::string badInputs = inputs.str();
+            const size_t bytes = store.getInputBits() / 8;
+            std::copy(badInputs.begin(), badInputs.begin() + bytes,
+                      badInputs.begin() + bytes);
+            EXPECT_ANY_THROW(loaded.loadRows(
+                sizes.data(), numConnected.data(), store.getNumSynapses(),
+                badInputs.data(), potential.str().data(), perms.str().data()));
+        }
+    }
+}
+
+TEST(SynapseStoreTest, matchesDenseModel)
+{
+    // Rows are rewritten with random sizes, which moves them around the
+    // arena and compacts it, and compared with a dense model.
+    const UInt numRows = 20;
+    const UInt numInputs = 50;
+    SynapseStore store;
+    store.resize(numRows, numInputs);
+    std::vector<std::vector<Real>> model(numRows,
+                                         std::vector<Real>(numInputs, 0));
+
+    Random rng(5);
+    for (UInt iter = 0; iter < 2000; iter++)
+    {
+        const UInt row = rng.getUInt32(numRows);
+        const Real density = (Real)rng.getReal64();
+        store.beginRow(row);
+        for (UInt input = 0; input < numInputs; input++)
+        {
+            Real perm = 0;
+            if (rng.getReal64() < density)
+            {
+                perm = (Real)rng.getReal64();
+            }
+            model[row][input] = perm;
+            store.append(input, perm, false, perm >= 0.5);
+        }
+        store.endRow();
+
+        if (iter % 100 != 99)
+        {
+            continue;
+        }
+        for (UInt r = 0; r < numRows; r++)
+        {
+            std::vector<UInt> expectedConnected;
+            std::vector<UInt> inputs;
+            std::vector<Real> perms;
+            for (UInt input = 0; input < numInputs; input++)
+            {
+                if (model[r][input] != 0)
+                {
+                    inputs.push_back(input);
+                    perms.push_back(model[r][input]);
+                }
+                if (model[r][input] >= 0.5)
+                {
+                    expectedConnected.push_back(input);
+                }
+            }
+            std::vector<UInt> rowInputs;
+            std::vector<Real> rowPerms;
+            std::vector<bool> potential;
+            store.getRow(r, rowInputs, rowPerms, potential);
+            ASSERT_EQ(inputs, rowInputs);
+            ASSERT_EQ(perms, rowPerms);
+            ASSERT_EQ(expectedConnected, connected(store, r));
+        }
+        for (UInt input = 0; input < numInputs; input++)
+        {
+            std::vector<UInt> rows;
+            for (UInt r = 0; r < numRows; r++)
+            {
+                if (model[r][input] >= 0.5)
+                {
+                    rows.push_back(r);
+                }
+            }
+            ASSERT_EQ(rows, connectedRows(store, input));
+        }
+    }
+}
+
+} // namespace crucian
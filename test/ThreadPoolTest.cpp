@@ -0,0 +1,94 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2016, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Unit tests for ThreadPool
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <crucian/ThreadPool.hpp>
+
+namespace crucian
+{
+
+TEST(ThreadPoolTest, parallelForCoversRange)
+{
+    for (UInt numThreads : {1, 2, 3, 8})
+    {
+        ThreadPool pool(numThreads);
+        ASSERT_EQ(numThreads, pool.getNumThreads());
+
+        for (UInt n : {0, 1, 2, 7, 1000})
+        {
+            std::vector<UInt> hits(n + 10, 0);
+            pool.parallelFor(5, 5 + n, [&](UInt begin, UInt end) {
+                for (UInt i = begin; i < end; i++)
+                {
+                    hits[i]++;
+                }
+            });
+
+            for (UInt i = 0; i < hits.size(); i++)
+            {
+                EXPECT_EQ(i >= 5 && i < 5 + n ? 1u : 0u, hits[i]);
+            }
+        }
+    }
+}
+
+TEST(ThreadPoolTest, chunksAreDeterministic)
+{
+    UInt begin, end;
+    ThreadPool::chunk(0, 10, 3, 0, begin, end);
+    EXPECT_EQ(0u, begin);
+    EXPECT_EQ(3u, end);
+    ThreadPool::chunk(0, 10, 3, 1, begin, end);
+    EXPECT_EQ(3u, begin);
+    EXPECT_EQ(6u, end);
+    ThreadPool::chunk(0, 10, 3, 2, begin, end);
+    EXPECT_EQ(6u, begin);
+    EXPECT_EQ(10u, end);
+}
+
+TEST(ThreadPoolTest, exceptionIsRethrown)
+{
+    ThreadPool pool(4);
+    EXPECT_THROW(pool.parallelFor(0, 100,
+                                  [](UInt begin, UInt end) {
+                                      if (begin <= 80 && 80 < end)
+                                      {
+                                          throw std::runtime_error("80");
+                                      }
+                                  }),
+                 std::runtime_error);
+
+    // The pool is still usable after an exception.
+    UInt sum = 0;
+    pool.parallelFor(0, 1, [&](UInt begin, UInt end) { sum += end - begin; });
+    EXPECT_EQ(1u, sum);
+}
+
+} // namespace crucian